@@ -96,6 +96,16 @@ typedef unsigned long u64;
 
 #define THRIVE_API static
 
+/* Acquire/Release accessors for the single-producer/single-consumer queues */
+#if defined(__GNUC__) || defined(__clang__)
+#define THRIVE_ATOMIC_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define THRIVE_ATOMIC_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+/* MSVC: volatile accesses have acquire/release semantics (/volatile:ms) */
+#define THRIVE_ATOMIC_LOAD_ACQUIRE(p) (*(volatile u32 *)(p))
+#define THRIVE_ATOMIC_STORE_RELEASE(p, v) (*(volatile u32 *)(p) = (v))
+#endif
+
 typedef char s8;
 typedef unsigned char u8;
 typedef unsigned short u16;
@@ -136,10 +146,12 @@ typedef enum thrive_token_kind
     THRIVE_TOKEN_KIND_SUB,         /* - */
     THRIVE_TOKEN_KIND_MUL,         /* * */
     THRIVE_TOKEN_KIND_DIV,         /* / */
+    THRIVE_TOKEN_KIND_MOD,         /* % */
     THRIVE_TOKEN_KIND_ADD_ASSIGN,  /* += */
     THRIVE_TOKEN_KIND_SUB_ASSIGN,  /* -= */
     THRIVE_TOKEN_KIND_MUL_ASSIGN,  /* *= */
     THRIVE_TOKEN_KIND_DIV_ASSIGN,  /* /= */
+    THRIVE_TOKEN_KIND_MOD_ASSIGN,  /* %= */
     THRIVE_TOKEN_KIND_INC,         /* ++ */
     THRIVE_TOKEN_KIND_DEC,         /* -- */
     THRIVE_TOKEN_KIND_EQUALS,      /* == */
@@ -193,10 +205,12 @@ s8 *thrive_token_kind_names[] = {
     "SUB",
     "MUL",
     "DIV",
+    "MOD",
     "ADD_ASSIGN",
     "SUB_ASSIGN",
     "MUL_ASSIGN",
     "DIV_ASSIGN",
+    "MOD_ASSIGN",
     "INC",
     "DEC",
     "EQUALS",
@@ -248,6 +262,7 @@ typedef struct thrive_token
 } thrive_token;
 
 typedef struct thrive_ast thrive_ast;
+typedef struct thrive_token_ring thrive_token_ring;
 
 typedef struct thrive_state
 {
@@ -264,6 +279,8 @@ typedef struct thrive_state
     u32 ast_count;
     u32 ast_capacity;
 
+    thrive_token_ring *token_ring; /* if set, tokens are consumed from a lexer thread */
+
 } thrive_state;
 
 typedef enum thrive_ast_kind
@@ -287,7 +304,8 @@ typedef enum thrive_ast_kind
     THRIVE_AST_FUNC_CALL,   /* func(a : b) */
     THRIVE_AST_EXT_DECL,    /* ext u32 func(u32 a) */
     THRIVE_AST_STRING,      /* "deadbeef" */
-    THRIVE_AST_ARRAY_ACCESS /* arr[0] */
+    THRIVE_AST_ARRAY_ACCESS, /* arr[0] */
+    THRIVE_AST_INLINE        /* func(a : b) with the body of func in place */
 
 } thrive_ast_kind;
 
@@ -324,6 +342,7 @@ struct thrive_ast
             thrive_ast *cond;
             thrive_ast *then_expr;
             thrive_ast *else_expr;
+            u8 select; /* 1 = both arms are evaluated and one is picked without a branch */
         } ternary;
 
         struct
@@ -339,6 +358,9 @@ struct thrive_ast
             thrive_ast *cond; /* i < 10 */
             thrive_ast *step; /* i ++ */
             thrive_ast *body; /* { code } */
+            u32 unroll;       /* body copies per guarded iteration in codegen, 0 = plain loop */
+            u32 reduce;       /* 1 = indexing on the counter uses pointers, 2 = and counts down, 0 = plain loop */
+            u32 accumulate;   /* accumulators per reduction in the unrolled copies, 0 = none */
         } for_loop;
 
         struct
@@ -391,6 +413,14 @@ struct thrive_ast
             u32 length;
         } string_lit;
 
+        struct
+        {
+            thrive_ast *name;   /* the inlined function */
+            thrive_ast *params; /* parameters bound to args (linked via .next) */
+            thrive_ast *args;   /* arguments, evaluated left to right (linked via .next) */
+            thrive_ast *body;   /* copy of the function body */
+        } inline_call;
+
         struct
         {
             thrive_ast *body; /* first statement in the block */
@@ -496,6 +526,26 @@ THRIVE_API void thrive_error(thrive_state *state, thrive_status_type type, s8 *m
     thrive_panic(status);
 }
 
+/* Line, column and line start of a token in the source, for errors raised after the lexer moved on */
+THRIVE_API void thrive_status_position(thrive_status *status, s8 *source_code, s8 *token)
+{
+    s8 *p;
+
+    status->line = 1;
+    status->line_start = source_code;
+
+    for (p = source_code; p < token; ++p)
+    {
+        if (*p == '\n')
+        {
+            status->line++;
+            status->line_start = p + 1;
+        }
+    }
+
+    status->column = (u32)(token - status->line_start) + 1;
+}
+
 /* #############################################################################
  * # [SECTION] Buffered Writer
  * #############################################################################
@@ -608,6 +658,114 @@ THRIVE_API THRIVE_INLINE void thrive_buffer_align(thrive_buffer *b, u32 align)
     }
 }
 
+/* #############################################################################
+ * # [SECTION] Lock-free Queues
+ * #############################################################################
+ *
+ * Single-producer/single-consumer ring buffers connecting the pipelined
+ * compilation stages (lexer -> parser -> codegen). head is only written by the
+ * producer, tail only by the consumer. Capacities have to be a power of two.
+ */
+#define THRIVE_TOKEN_RING_CAPACITY 4096
+#define THRIVE_AST_RING_CAPACITY 1024
+
+typedef struct thrive_token_ring_entry
+{
+    thrive_token token;
+    s8 *line_start; /* lexer line start at the time of the token (for errors) */
+
+} thrive_token_ring_entry;
+
+struct thrive_token_ring
+{
+    thrive_token_ring_entry entries[THRIVE_TOKEN_RING_CAPACITY];
+    u32 head;
+    u32 tail;
+    void (*yield)(void); /* called while waiting, can be NULL (busy spin) */
+};
+
+typedef struct thrive_ast_ring
+{
+    thrive_ast *entries[THRIVE_AST_RING_CAPACITY];
+    u32 head;
+    u32 tail;
+    void (*yield)(void);
+
+} thrive_ast_ring;
+
+THRIVE_API THRIVE_INLINE void thrive_token_ring_push(thrive_token_ring *r, thrive_token *token, s8 *line_start)
+{
+    u32 head = r->head;
+
+    while (head - THRIVE_ATOMIC_LOAD_ACQUIRE(&r->tail) >= THRIVE_TOKEN_RING_CAPACITY)
+    {
+        if (r->yield)
+        {
+            r->yield();
+        }
+    }
+
+    r->entries[head & (THRIVE_TOKEN_RING_CAPACITY - 1)].token = *token;
+    r->entries[head & (THRIVE_TOKEN_RING_CAPACITY - 1)].line_start = line_start;
+
+    THRIVE_ATOMIC_STORE_RELEASE(&r->head, head + 1);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_token_ring_pop(thrive_token_ring *r, thrive_token *token, s8 **line_start)
+{
+    u32 tail = r->tail;
+
+    while (THRIVE_ATOMIC_LOAD_ACQUIRE(&r->head) == tail)
+    {
+        if (r->yield)
+        {
+            r->yield();
+        }
+    }
+
+    *token = r->entries[tail & (THRIVE_TOKEN_RING_CAPACITY - 1)].token;
+    *line_start = r->entries[tail & (THRIVE_TOKEN_RING_CAPACITY - 1)].line_start;
+
+    THRIVE_ATOMIC_STORE_RELEASE(&r->tail, tail + 1);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_ast_ring_push(thrive_ast_ring *r, thrive_ast *node)
+{
+    u32 head = r->head;
+
+    while (head - THRIVE_ATOMIC_LOAD_ACQUIRE(&r->tail) >= THRIVE_AST_RING_CAPACITY)
+    {
+        if (r->yield)
+        {
+            r->yield();
+        }
+    }
+
+    r->entries[head & (THRIVE_AST_RING_CAPACITY - 1)] = node;
+
+    THRIVE_ATOMIC_STORE_RELEASE(&r->head, head + 1);
+}
+
+THRIVE_API THRIVE_INLINE thrive_ast *thrive_ast_ring_pop(thrive_ast_ring *r)
+{
+    u32 tail = r->tail;
+    thrive_ast *node;
+
+    while (THRIVE_ATOMIC_LOAD_ACQUIRE(&r->head) == tail)
+    {
+        if (r->yield)
+        {
+            r->yield();
+        }
+    }
+
+    node = r->entries[tail & (THRIVE_AST_RING_CAPACITY - 1)];
+
+    THRIVE_ATOMIC_STORE_RELEASE(&r->tail, tail + 1);
+
+    return node;
+}
+
 /* #############################################################################
  * # [SECTION] Lexer
  * #############################################################################
@@ -648,7 +806,7 @@ THRIVE_API i32 thrive_token_digit_value(s8 c)
     return 0;
 }
 
-THRIVE_API THRIVE_INLINE void thrive_token_next(thrive_state *state)
+THRIVE_API THRIVE_INLINE void thrive_token_lex(thrive_state *state)
 {
     thrive_token token = {0};
 
@@ -908,6 +1066,8 @@ repeat:
         THRIVE_TOKEN_CASE_1('}',  THRIVE_TOKEN_KIND_RBRACE  )
         THRIVE_TOKEN_CASE_1('[',  THRIVE_TOKEN_KIND_LBRACKET)
         THRIVE_TOKEN_CASE_1(']',  THRIVE_TOKEN_KIND_RBRACKET)
+        THRIVE_TOKEN_CASE_1('^',  THRIVE_TOKEN_KIND_XOR_BITWISE)
+        THRIVE_TOKEN_CASE_1('~',  THRIVE_TOKEN_KIND_NOT_BITWISE)
         THRIVE_TOKEN_CASE_1('\0', THRIVE_TOKEN_KIND_EOF     )
 
         #undef THRIVE_TOKEN_CASE_1
@@ -928,6 +1088,7 @@ repeat:
         THRIVE_TOKEN_CASE_2('!', THRIVE_TOKEN_KIND_NEGATE, '=', THRIVE_TOKEN_KIND_NOT_EQUALS)
         THRIVE_TOKEN_CASE_2('*', THRIVE_TOKEN_KIND_MUL, '=', THRIVE_TOKEN_KIND_MUL_ASSIGN)
         THRIVE_TOKEN_CASE_2('/', THRIVE_TOKEN_KIND_DIV, '=', THRIVE_TOKEN_KIND_DIV_ASSIGN)
+        THRIVE_TOKEN_CASE_2('%', THRIVE_TOKEN_KIND_MOD, '=', THRIVE_TOKEN_KIND_MOD_ASSIGN)
         THRIVE_TOKEN_CASE_2('|', THRIVE_TOKEN_KIND_OR_BITWISE, '|', THRIVE_TOKEN_KIND_OR_LOGICAL)     
         THRIVE_TOKEN_CASE_2('&', THRIVE_TOKEN_KIND_AND_BITWISE, '&', THRIVE_TOKEN_KIND_AND_LOGICAL)     
 
@@ -971,6 +1132,21 @@ repeat:
     state->current = token;
 }
 
+THRIVE_API THRIVE_INLINE void thrive_token_next(thrive_state *state)
+{
+    if (state->token_ring)
+    {
+        /* EOF is sticky (the lexer thread stops after it), a zeroed token means nothing was consumed yet */
+        if (state->current.kind != THRIVE_TOKEN_KIND_EOF || !state->current.start)
+        {
+            thrive_token_ring_pop(state->token_ring, &state->current, &state->line_start);
+        }
+        return;
+    }
+
+    thrive_token_lex(state);
+}
+
 THRIVE_API u8 thrive_token_accept(thrive_state *state, thrive_token_kind kind)
 {
     if (state->current.kind == kind)
@@ -1065,6 +1241,45 @@ THRIVE_API THRIVE_INLINE thrive_ast *thrive_ast_create(thrive_state *state, thri
     return node;
 }
 
+#define THRIVE_AST_MAX_TEMPS 1024
+
+static s8 ast_temp_chars[THRIVE_AST_MAX_TEMPS * 5]; /* "$0" ... "$1023" */
+static u32 ast_temp_count;
+
+/* Variable introduced by an optimizer pass, "$" and a number (no identifier starts with "$"), 0 once all are used */
+THRIVE_API thrive_ast *thrive_ast_create_temp(thrive_state *state)
+{
+    thrive_ast *name;
+    u32 id = ast_temp_count;
+    u32 i;
+
+    if (id == THRIVE_AST_MAX_TEMPS)
+    {
+        return 0;
+    }
+
+    ast_temp_count++;
+
+    name = thrive_ast_create(state, THRIVE_AST_NAME);
+    name->next = 0;
+    name->data.name.start = &ast_temp_chars[id * 5];
+    name->data.name.length = 2;
+
+    for (i = id; i >= 10; i /= 10)
+    {
+        name->data.name.length++;
+    }
+
+    name->data.name.start[0] = '$';
+
+    for (i = name->data.name.length - 1; i > 0; --i, id /= 10)
+    {
+        name->data.name.start[i] = (s8)('0' + id % 10);
+    }
+
+    return name;
+}
+
 THRIVE_API thrive_ast *thrive_ast_parse_expression(thrive_state *state);
 
 THRIVE_API thrive_ast *thrive_ast_parse_primary(thrive_state *state)
@@ -1133,6 +1348,7 @@ THRIVE_API THRIVE_INLINE i32 thrive_ast_prefix_bp(thrive_token_kind kind, i32 *r
     case THRIVE_TOKEN_KIND_SUB:         /* -i  */
     case THRIVE_TOKEN_KIND_ADD:         /* +i  */
     case THRIVE_TOKEN_KIND_NEGATE:      /* !i  */
+    case THRIVE_TOKEN_KIND_NOT_BITWISE: /* ~i  */
     case THRIVE_TOKEN_KIND_INC:         /* ++i */
     case THRIVE_TOKEN_KIND_DEC:         /* --i */
     case THRIVE_TOKEN_KIND_MUL:         /* *ptr */
@@ -1155,6 +1371,7 @@ THRIVE_API THRIVE_INLINE i32 thrive_ast_infix_bp(thrive_token_kind op, i32 *l_bp
     case THRIVE_TOKEN_KIND_SUB_ASSIGN:
     case THRIVE_TOKEN_KIND_MUL_ASSIGN:
     case THRIVE_TOKEN_KIND_DIV_ASSIGN:
+    case THRIVE_TOKEN_KIND_MOD_ASSIGN:
         *l_bp = 10;
         *r_bp = 9;
         return 1;
@@ -1183,6 +1400,12 @@ THRIVE_API THRIVE_INLINE i32 thrive_ast_infix_bp(thrive_token_kind op, i32 *l_bp
         *r_bp = 51;
         return 1;
 
+    /* Bitwise XOR */
+    case THRIVE_TOKEN_KIND_XOR_BITWISE:
+        *l_bp = 55;
+        *r_bp = 56;
+        return 1;
+
     /* Bitwise AND */
     case THRIVE_TOKEN_KIND_AND_BITWISE:
         *l_bp = 60;
@@ -1219,9 +1442,10 @@ THRIVE_API THRIVE_INLINE i32 thrive_ast_infix_bp(thrive_token_kind op, i32 *l_bp
         *r_bp = 91;
         return 1;
 
-    /* Multiplication / Division */
+    /* Multiplication / Division / Modulo */
     case THRIVE_TOKEN_KIND_MUL:
     case THRIVE_TOKEN_KIND_DIV:
+    case THRIVE_TOKEN_KIND_MOD:
         *l_bp = 100;
         *r_bp = 101;
         return 1;
@@ -1345,6 +1569,7 @@ THRIVE_API thrive_ast *thrive_ast_parse_expression_bp(thrive_state *state, i32 m
             node->data.ternary.cond = left;
             node->data.ternary.then_expr = then_expr;
             node->data.ternary.else_expr = else_expr;
+            node->data.ternary.select = 0;
 
             left = node;
         }
@@ -1352,7 +1577,8 @@ THRIVE_API thrive_ast *thrive_ast_parse_expression_bp(thrive_state *state, i32 m
                  op == THRIVE_TOKEN_KIND_ADD_ASSIGN ||
                  op == THRIVE_TOKEN_KIND_SUB_ASSIGN ||
                  op == THRIVE_TOKEN_KIND_MUL_ASSIGN ||
-                 op == THRIVE_TOKEN_KIND_DIV_ASSIGN)
+                 op == THRIVE_TOKEN_KIND_DIV_ASSIGN ||
+                 op == THRIVE_TOKEN_KIND_MOD_ASSIGN)
         {
             thrive_ast *right = thrive_ast_parse_expression_bp(state, r_bp);
 
@@ -1388,6 +1614,10 @@ THRIVE_API thrive_ast *thrive_ast_parse_expression_bp(thrive_state *state, i32 m
                 {
                     binary->data.binary.op = THRIVE_TOKEN_KIND_DIV;
                 }
+                else if (op == THRIVE_TOKEN_KIND_MOD_ASSIGN)
+                {
+                    binary->data.binary.op = THRIVE_TOKEN_KIND_MOD;
+                }
 
                 assign->data.assign.left = left;
                 assign->data.assign.right = binary;
@@ -1673,6 +1903,10 @@ THRIVE_API thrive_ast *thrive_ast_parse_statement(thrive_state *state)
     {
         thrive_ast *node = thrive_ast_create(state, THRIVE_AST_FOR);
 
+        node->data.for_loop.unroll = 0;
+        node->data.for_loop.reduce = 0;
+        node->data.for_loop.accumulate = 0;
+
         thrive_token_expect(state, THRIVE_TOKEN_KIND_LPAREN);
 
         /* 1. Initialization (e.g., i = 0) */
@@ -1718,6 +1952,7 @@ THRIVE_API thrive_ast *thrive_ast_parse(thrive_state *state)
     thrive_ast **tail;
 
     state->ast_count = 0;
+    ast_temp_count = 0;
 
     node = thrive_ast_create(state, THRIVE_AST_BLOCK);
     tail = &node->data.block.body;
@@ -1748,1182 +1983,8764 @@ THRIVE_API thrive_ast *thrive_ast_parse(thrive_state *state)
     return node;
 }
 
-THRIVE_API thrive_ast *thrive_ast_fold(thrive_ast *node)
+/* #############################################################################
+ * # [SECTION] Optimizer Statistics
+ * #############################################################################
+ */
+typedef struct thrive_optimizer_stats
 {
-    if (!node)
+    u32 rewrites;              /* algebraic rewrite rules applied */
+    u32 strength_reductions;   /* multiplies and divisions by constants lowered */
+    u32 propagated_constants;  /* variable loads replaced by an immediate */
+    u32 propagated_copies;     /* variable loads redirected to their copy source */
+    u32 eliminated_statements; /* statements after ret / break / continue */
+    u32 eliminated_functions;  /* functions never called */
+    u32 eliminated_imports;    /* ext declarations never called */
+    u32 eliminated_stores;     /* stores to variables never read */
+    u32 overwritten_stores;    /* stores overwritten before any read */
+    u32 forwarded_loads;       /* variable loads right behind a store of the same value */
+    u32 peephole_rewrites;     /* instruction sequences shortened while emitting */
+    u32 folded_functions;      /* functions sharing the code of an identical earlier one */
+    u32 folded_bytes;          /* code bytes saved by the folding */
+    u32 aligned_functions;     /* internal function entries padded to the alignment */
+    u32 aligned_loops;         /* loop heads padded to the alignment */
+    u32 align_padding;         /* nop bytes spent on both */
+    u32 internal_calls;        /* calls emitted in the internal convention */
+    u32 shared_globals;        /* top-level scalars used by functions turned into memory */
+    u32 inlined_calls;         /* call sites replaced by the callee body */
+    u32 specialized_params;    /* parameters replaced by the constant every call passes */
+    u32 specialized_clones;    /* function copies for constants shared by several calls */
+    u32 evaluated_calls;       /* calls replaced by their compile-time result */
+    u32 unrolled_loops;        /* loops replaced by a copy of the body per iteration */
+    u32 partially_unrolled;    /* loops running several body copies per iteration */
+    u32 promoted_arrays;       /* local arrays split into one variable per element */
+    u32 range_folds;           /* comparisons and masks decided by value ranges */
+    u32 hoisted_expressions;   /* loop-invariant expressions computed before the loop */
+    u32 if_conversions;        /* branches replaced by cmov / setcc */
+    u32 common_subexpressions; /* expressions replaced by an earlier evaluation */
+    u32 split_reductions;      /* reduction variables given several accumulators */
+    u32 reduced_loops;         /* loops indexing arrays through advancing pointers */
+    u32 counted_down_loops;    /* of which run on a hidden counter down to zero */
+
+} thrive_optimizer_stats;
+
+static thrive_optimizer_stats optimizer_stats;
+
+THRIVE_API void thrive_optimizer_stats_reset(void)
+{
+    thrive_optimizer_stats empty = {0};
+    optimizer_stats = empty;
+}
+
+/* #############################################################################
+ * # [SECTION] AST Rewrite Rules
+ * #############################################################################
+ *
+ * Algebraic simplifications are data. After folding the operands the folder
+ * evaluates constant nodes and applies the first matching rule, over and
+ * over until nothing matches. Rules are exact on u32 values and a rule that
+ * drops an operand only fires if the operand has no side effects. Every rule
+ * carries a self-test: an input expression and what it has to fold to.
+ */
+#define THRIVE_REWRITE_MAX_STEPS 64
+
+typedef enum thrive_rewrite_match
+{
+    THRIVE_REWRITE_ANY = 0,     /* anything */
+    THRIVE_REWRITE_CONST,       /* the constant rule->value */
+    THRIVE_REWRITE_INT,         /* any constant */
+    THRIVE_REWRITE_EXPR,        /* anything but a constant */
+    THRIVE_REWRITE_SAME,        /* equal to the left operand, both side effect free */
+    THRIVE_REWRITE_BOOL,        /* evaluates to 0 or 1 */
+    THRIVE_REWRITE_COMPARE,     /* a comparison */
+    THRIVE_REWRITE_NESTED,      /* rule->inner_op node of the same kind, "(y op k)" for binaries */
+    THRIVE_REWRITE_NESTED_BOOL  /* unary rule->inner_op applied to a boolean */
+
+} thrive_rewrite_match;
+
+typedef enum thrive_rewrite_result
+{
+    THRIVE_REWRITE_TO_LEFT = 0, /* the left (or only) operand */
+    THRIVE_REWRITE_TO_RIGHT,    /* the right operand */
+    THRIVE_REWRITE_TO_CONST,    /* the constant rule->result_value */
+    THRIVE_REWRITE_TO_INNER,    /* operand of the nested unary: ~~a -> a */
+    THRIVE_REWRITE_TO_SWAPPED,  /* k op a -> a op k */
+    THRIVE_REWRITE_TO_REASSOC,  /* (a op k1) op k2 -> a op (k1 op k2) */
+    THRIVE_REWRITE_TO_OFFSET,   /* (a +- k1) +- k2 -> a +- k */
+    THRIVE_REWRITE_TO_INVERTED  /* !(a < b) -> a >= b */
+
+} thrive_rewrite_result;
+
+typedef struct thrive_rewrite_rule
+{
+    thrive_ast_kind kind;  /* THRIVE_AST_BINARY or THRIVE_AST_UNARY */
+    thrive_token_kind op;  /* operator of the matched node */
+    thrive_rewrite_match left;
+    thrive_rewrite_match right;
+    u32 value;             /* constant for THRIVE_REWRITE_CONST */
+    thrive_rewrite_result result;
+    u32 result_value;      /* constant for THRIVE_REWRITE_TO_CONST */
+    thrive_token_kind inner_op;
+    s8 *test;              /* self-test input ... */
+    s8 *expected;          /* ... and what it folds to */
+    u32 hits;
+
+} thrive_rewrite_rule;
+
+/* clang-format off */
+#define THRIVE_REWRITE_BINARY(op, left, right, value, result, result_value, test, expected) \
+    {THRIVE_AST_BINARY, THRIVE_TOKEN_KIND_##op, THRIVE_REWRITE_##left, THRIVE_REWRITE_##right, value, THRIVE_REWRITE_TO_##result, result_value, THRIVE_TOKEN_KIND_INVALID, test, expected, 0}
+#define THRIVE_REWRITE_NESTED(op, inner_op, result, test, expected) \
+    {THRIVE_AST_BINARY, THRIVE_TOKEN_KIND_##op, THRIVE_REWRITE_NESTED, THRIVE_REWRITE_INT, 0, THRIVE_REWRITE_TO_##result, 0, THRIVE_TOKEN_KIND_##inner_op, test, expected, 0}
+#define THRIVE_REWRITE_UNARY(op, match, inner_op, result, test, expected) \
+    {THRIVE_AST_UNARY, THRIVE_TOKEN_KIND_##op, THRIVE_REWRITE_##match, THRIVE_REWRITE_ANY, 0, THRIVE_REWRITE_TO_##result, 0, THRIVE_TOKEN_KIND_##inner_op, test, expected, 0}
+
+static thrive_rewrite_rule thrive_rewrite_rules[] = {
+    /* Canonical form: constants go right so the rules below only look there */
+    THRIVE_REWRITE_BINARY(ADD,         INT,  EXPR,  0,          SWAPPED, 0,          "1 + a",          "a + 1"),
+    THRIVE_REWRITE_BINARY(MUL,         INT,  EXPR,  0,          SWAPPED, 0,          "2 * a",          "a * 2"),
+    THRIVE_REWRITE_BINARY(AND_BITWISE, INT,  EXPR,  0,          SWAPPED, 0,          "3 & a",          "a & 3"),
+    THRIVE_REWRITE_BINARY(OR_BITWISE,  INT,  EXPR,  0,          SWAPPED, 0,          "4 | a",          "a | 4"),
+    THRIVE_REWRITE_BINARY(XOR_BITWISE, INT,  EXPR,  0,          SWAPPED, 0,          "5 ^ a",          "a ^ 5"),
+    THRIVE_REWRITE_BINARY(EQUALS,      INT,  EXPR,  0,          SWAPPED, 0,          "6 == a",         "a == 6"),
+    THRIVE_REWRITE_BINARY(NOT_EQUALS,  INT,  EXPR,  0,          SWAPPED, 0,          "7 != a",         "a != 7"),
+
+    /* Identities */
+    THRIVE_REWRITE_BINARY(ADD,         ANY,  CONST, 0,          LEFT,    0,          "a + 0",          "a"),
+    THRIVE_REWRITE_BINARY(SUB,         ANY,  CONST, 0,          LEFT,    0,          "a - 0",          "a"),
+    THRIVE_REWRITE_BINARY(MUL,         ANY,  CONST, 1,          LEFT,    0,          "a * 1",          "a"),
+    THRIVE_REWRITE_BINARY(DIV,         ANY,  CONST, 1,          LEFT,    0,          "a / 1",          "a"),
+    THRIVE_REWRITE_BINARY(OR_BITWISE,  ANY,  CONST, 0,          LEFT,    0,          "a | 0",          "a"),
+    THRIVE_REWRITE_BINARY(XOR_BITWISE, ANY,  CONST, 0,          LEFT,    0,          "a ^ 0",          "a"),
+    THRIVE_REWRITE_BINARY(AND_BITWISE, ANY,  CONST, 0xFFFFFFFF, LEFT,    0,          "a & ~0",         "a"),
+    THRIVE_REWRITE_BINARY(LSHIFT,      ANY,  CONST, 0,          LEFT,    0,          "a << 0",         "a"),
+    THRIVE_REWRITE_BINARY(RSHIFT,      ANY,  CONST, 0,          LEFT,    0,          "a >> 0",         "a"),
+
+    /* Annihilators */
+    THRIVE_REWRITE_BINARY(MUL,         ANY,  CONST, 0,          CONST,   0,          "a * 0",          "0"),
+    THRIVE_REWRITE_BINARY(AND_BITWISE, ANY,  CONST, 0,          CONST,   0,          "a & 0",          "0"),
+    THRIVE_REWRITE_BINARY(MOD,         ANY,  CONST, 1,          CONST,   0,          "a % 1",          "0"),
+    THRIVE_REWRITE_BINARY(OR_BITWISE,  ANY,  CONST, 0xFFFFFFFF, CONST,   0xFFFFFFFF, "a | ~0",         "4294967295"),
+    THRIVE_REWRITE_BINARY(LSHIFT,      CONST, ANY,  0,          CONST,   0,          "0 << a",         "0"),
+    THRIVE_REWRITE_BINARY(RSHIFT,      CONST, ANY,  0,          CONST,   0,          "0 >> a",         "0"),
+
+    /* An operand against itself */
+    THRIVE_REWRITE_BINARY(SUB,         ANY,  SAME,  0,          CONST,   0,          "a - a",          "0"),
+    THRIVE_REWRITE_BINARY(XOR_BITWISE, ANY,  SAME,  0,          CONST,   0,          "a ^ a",          "0"),
+    THRIVE_REWRITE_BINARY(AND_BITWISE, ANY,  SAME,  0,          LEFT,    0,          "a & a",          "a"),
+    THRIVE_REWRITE_BINARY(OR_BITWISE,  ANY,  SAME,  0,          LEFT,    0,          "a | a",          "a"),
+    THRIVE_REWRITE_BINARY(EQUALS,      ANY,  SAME,  0,          CONST,   1,          "a == a",         "1"),
+    THRIVE_REWRITE_BINARY(NOT_EQUALS,  ANY,  SAME,  0,          CONST,   0,          "a != a",         "0"),
+    THRIVE_REWRITE_BINARY(LT,          ANY,  SAME,  0,          CONST,   0,          "a < a",          "0"),
+    THRIVE_REWRITE_BINARY(GT,          ANY,  SAME,  0,          CONST,   0,          "a > a",          "0"),
+    THRIVE_REWRITE_BINARY(LT_EQUALS,   ANY,  SAME,  0,          CONST,   1,          "a <= a",         "1"),
+    THRIVE_REWRITE_BINARY(GT_EQUALS,   ANY,  SAME,  0,          CONST,   1,          "a >= a",         "1"),
+
+    /* Booleans (the right side of && and || only runs if the left does not decide) */
+    THRIVE_REWRITE_BINARY(AND_LOGICAL, CONST, ANY,  0,          CONST,   0,          "0 && a",         "0"),
+    THRIVE_REWRITE_BINARY(AND_LOGICAL, ANY,  CONST, 0,          CONST,   0,          "a && 0",         "0"),
+    THRIVE_REWRITE_BINARY(AND_LOGICAL, CONST, BOOL, 1,          RIGHT,   0,          "1 && a < b",     "a < b"),
+    THRIVE_REWRITE_BINARY(AND_LOGICAL, BOOL, CONST, 1,          LEFT,    0,          "a < b && 1",     "a < b"),
+    THRIVE_REWRITE_BINARY(AND_LOGICAL, BOOL, SAME,  0,          LEFT,    0,          "a < b && a < b", "a < b"),
+    THRIVE_REWRITE_BINARY(OR_LOGICAL,  CONST, ANY,  1,          CONST,   1,          "1 || a",         "1"),
+    THRIVE_REWRITE_BINARY(OR_LOGICAL,  ANY,  CONST, 1,          CONST,   1,          "a || 1",         "1"),
+    THRIVE_REWRITE_BINARY(OR_LOGICAL,  CONST, BOOL, 0,          RIGHT,   0,          "0 || a < b",     "a < b"),
+    THRIVE_REWRITE_BINARY(OR_LOGICAL,  BOOL, CONST, 0,          LEFT,    0,          "a < b || 0",     "a < b"),
+    THRIVE_REWRITE_BINARY(OR_LOGICAL,  BOOL, SAME,  0,          LEFT,    0,          "a < b || a < b", "a < b"),
+
+    /* Reassociation of constants */
+    THRIVE_REWRITE_NESTED(ADD,         ADD,         OFFSET,  "a + 1 + 2",      "a + 3"),
+    THRIVE_REWRITE_NESTED(ADD,         SUB,         OFFSET,  "a - 5 + 2",      "a - 3"),
+    THRIVE_REWRITE_NESTED(SUB,         ADD,         OFFSET,  "a + 5 - 2",      "a + 3"),
+    THRIVE_REWRITE_NESTED(SUB,         SUB,         OFFSET,  "a - 1 - 2",      "a - 3"),
+    THRIVE_REWRITE_NESTED(MUL,         MUL,         REASSOC, "a * 2 * 3",      "a * 6"),
+    THRIVE_REWRITE_NESTED(AND_BITWISE, AND_BITWISE, REASSOC, "a & 12 & 10",    "a & 8"),
+    THRIVE_REWRITE_NESTED(OR_BITWISE,  OR_BITWISE,  REASSOC, "a | 1 | 2",      "a | 3"),
+    THRIVE_REWRITE_NESTED(XOR_BITWISE, XOR_BITWISE, REASSOC, "a ^ 3 ^ 1",      "a ^ 2"),
+
+    /* Unary */
+    THRIVE_REWRITE_UNARY(ADD,         ANY,         INVALID,     LEFT,     "+a",          "a"),
+    THRIVE_REWRITE_UNARY(SUB,         NESTED,      SUB,         INNER,    "-(-a)",       "a"),
+    THRIVE_REWRITE_UNARY(NOT_BITWISE, NESTED,      NOT_BITWISE, INNER,    "~~a",         "a"),
+    THRIVE_REWRITE_UNARY(NEGATE,      COMPARE,     INVALID,     INVERTED, "!(a < b)",    "a >= b"),
+    THRIVE_REWRITE_UNARY(NEGATE,      NESTED_BOOL, NEGATE,      INNER,    "!!(a && b)",  "a && b")
+};
+
+#undef THRIVE_REWRITE_BINARY
+#undef THRIVE_REWRITE_NESTED
+#undef THRIVE_REWRITE_UNARY
+/* clang-format on */
+
+#define THRIVE_REWRITE_RULE_COUNT (sizeof(thrive_rewrite_rules) / sizeof(thrive_rewrite_rules[0]))
+
+THRIVE_API THRIVE_INLINE u8 thrive_ast_name_equals(s8 *a, u32 a_length, s8 *b, u32 b_length)
+{
+    return (u8)(a_length == b_length && thrive_string_equals(a, b, a_length));
+}
+
+/* Structural equality of two expressions */
+THRIVE_API u8 thrive_ast_equals(thrive_ast *a, thrive_ast *b)
+{
+    if (!a || !b)
+    {
+        return (u8)(a == b);
+    }
+
+    if (a->kind != b->kind)
+    {
+        return 0;
+    }
+
+    switch (a->kind)
     {
+    case THRIVE_AST_INT:
+        return (u8)(a->data.int_value == b->data.int_value);
+    case THRIVE_AST_NAME:
+        return thrive_ast_name_equals(a->data.name.start, a->data.name.length, b->data.name.start, b->data.name.length);
+    case THRIVE_AST_STRING:
+        return thrive_ast_name_equals(a->data.string_lit.start, a->data.string_lit.length, b->data.string_lit.start, b->data.string_lit.length);
+    case THRIVE_AST_BINARY:
+        return (u8)(a->data.binary.op == b->data.binary.op &&
+                    thrive_ast_equals(a->data.binary.left, b->data.binary.left) &&
+                    thrive_ast_equals(a->data.binary.right, b->data.binary.right));
+    case THRIVE_AST_UNARY:
+        return (u8)(a->data.unary.op == b->data.unary.op && thrive_ast_equals(a->data.unary.expr, b->data.unary.expr));
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ADDR_OF:
+        return thrive_ast_equals(a->data.unary.expr, b->data.unary.expr);
+    case THRIVE_AST_ARRAY_ACCESS:
+        return (u8)(thrive_ast_equals(a->data.array_access.left, b->data.array_access.left) &&
+                    thrive_ast_equals(a->data.array_access.index, b->data.array_access.index));
+    case THRIVE_AST_TERNARY:
+        return (u8)(thrive_ast_equals(a->data.ternary.cond, b->data.ternary.cond) &&
+                    thrive_ast_equals(a->data.ternary.then_expr, b->data.ternary.then_expr) &&
+                    thrive_ast_equals(a->data.ternary.else_expr, b->data.ternary.else_expr));
+    default:
         return 0;
     }
+}
+
+/* An expression without stores or calls can be dropped or evaluated twice */
+THRIVE_API u8 thrive_ast_is_pure(thrive_ast *node)
+{
+    if (!node)
+    {
+        return 1;
+    }
 
     switch (node->kind)
     {
+    case THRIVE_AST_INT:
+    case THRIVE_AST_NAME:
+    case THRIVE_AST_STRING:
+        return 1;
     case THRIVE_AST_BINARY:
+        return (u8)(thrive_ast_is_pure(node->data.binary.left) && thrive_ast_is_pure(node->data.binary.right));
+    case THRIVE_AST_UNARY:
+        if (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)
+        {
+            return 0;
+        }
+        return thrive_ast_is_pure(node->data.unary.expr);
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ADDR_OF:
+        return thrive_ast_is_pure(node->data.unary.expr);
+    case THRIVE_AST_ARRAY_ACCESS:
+        return (u8)(thrive_ast_is_pure(node->data.array_access.left) && thrive_ast_is_pure(node->data.array_access.index));
+    case THRIVE_AST_TERNARY:
+        return (u8)(thrive_ast_is_pure(node->data.ternary.cond) &&
+                    thrive_ast_is_pure(node->data.ternary.then_expr) &&
+                    thrive_ast_is_pure(node->data.ternary.else_expr));
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API THRIVE_INLINE u8 thrive_ast_is_compare(thrive_ast *node)
+{
+    if (node->kind != THRIVE_AST_BINARY)
     {
-        thrive_ast *l;
-        thrive_ast *r;
+        return 0;
+    }
 
-        node->data.binary.left = thrive_ast_fold(node->data.binary.left);
-        node->data.binary.right = thrive_ast_fold(node->data.binary.right);
+    switch (node->data.binary.op)
+    {
+    case THRIVE_TOKEN_KIND_EQUALS:
+    case THRIVE_TOKEN_KIND_NOT_EQUALS:
+    case THRIVE_TOKEN_KIND_LT:
+    case THRIVE_TOKEN_KIND_GT:
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-        l = node->data.binary.left;
-        r = node->data.binary.right;
+/* Expressions that evaluate to 0 or 1 */
+THRIVE_API u8 thrive_ast_is_bool(thrive_ast *node)
+{
+    switch (node->kind)
+    {
+    case THRIVE_AST_INT:
+        return (u8)(node->data.int_value <= 1);
+    case THRIVE_AST_UNARY:
+        return (u8)(node->data.unary.op == THRIVE_TOKEN_KIND_NEGATE);
+    case THRIVE_AST_BINARY:
+        return (u8)(thrive_ast_is_compare(node) ||
+                    node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL ||
+                    node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL);
+    default:
+        return 0;
+    }
+}
 
-        /* Optimization: x * 0 = 0, x & 0 = 0 */
-        if ((r && r->kind == THRIVE_AST_INT && r->data.int_value == 0) ||
-            (l && l->kind == THRIVE_AST_INT && l->data.int_value == 0))
+/* Evaluates "a op b", returns 0 if it has to be left to run time. The codegen
+ * computes in 64-bit registers, a result that would not wrap to u32 there is left too */
+THRIVE_API u8 thrive_ast_eval_binary(thrive_token_kind op, u32 a, u32 b, u32 *result)
+{
+    switch (op)
+    {
+    case THRIVE_TOKEN_KIND_ADD:
+        if (a + b < a)
         {
-            if (node->data.binary.op == THRIVE_TOKEN_KIND_MUL ||
-                node->data.binary.op == THRIVE_TOKEN_KIND_AND_BITWISE)
-            {
-                node->kind = THRIVE_AST_INT;
-                node->data.int_value = 0;
-                return node;
-            }
+            return 0;
         }
-
-        /* Optimization: x + 0 = x, x - 0 = x, x * 1 = x */
-        if (r && r->kind == THRIVE_AST_INT && r->data.int_value == 0)
+        *result = a + b;
+        return 1;
+    case THRIVE_TOKEN_KIND_SUB:
+        if (a < b)
         {
-            if (node->data.binary.op == THRIVE_TOKEN_KIND_ADD ||
-                node->data.binary.op == THRIVE_TOKEN_KIND_SUB)
-            {
-                return l;
-            }
+            return 0;
         }
-
-        if (r && r->kind == THRIVE_AST_INT && r->data.int_value == 1)
+        *result = a - b;
+        return 1;
+    case THRIVE_TOKEN_KIND_MUL:
+        if (a != 0 && b > 0xFFFFFFFF / a)
         {
-            if (node->data.binary.op == THRIVE_TOKEN_KIND_MUL)
-            {
-                return l;
-            }
+            return 0;
         }
-
-        if (l && r && l->kind == THRIVE_AST_INT && r->kind == THRIVE_AST_INT)
+        *result = a * b;
+        return 1;
+    case THRIVE_TOKEN_KIND_DIV:
+        if (b == 0)
         {
-            u32 a = l->data.int_value;
-            u32 b = r->data.int_value;
-            u32 result = 0;
-
-            switch (node->data.binary.op)
-            {
-            case THRIVE_TOKEN_KIND_ADD:
-                result = a + b;
-                break;
-            case THRIVE_TOKEN_KIND_SUB:
-                result = a - b;
-                break;
-            case THRIVE_TOKEN_KIND_MUL:
-                result = a * b;
-                break;
-            case THRIVE_TOKEN_KIND_DIV:
-                if (b != 0)
-                {
-                    result = a / b;
-                }
-                else
-                {
-                    return node;
-                }
-                break;
-            case THRIVE_TOKEN_KIND_EQUALS:
-                result = (a == b);
-                break;
-            case THRIVE_TOKEN_KIND_NOT_EQUALS:
-                result = (a != b);
-                break;
-            case THRIVE_TOKEN_KIND_LT:
-                result = (a < b);
-                break;
-            case THRIVE_TOKEN_KIND_GT:
-                result = (a > b);
-                break;
-            case THRIVE_TOKEN_KIND_LT_EQUALS:
-                result = (a <= b);
-                break;
-            case THRIVE_TOKEN_KIND_GT_EQUALS:
-                result = (a >= b);
-                break;
-            case THRIVE_TOKEN_KIND_AND_BITWISE:
-                result = a & b;
-                break;
-            case THRIVE_TOKEN_KIND_OR_BITWISE:
-                result = a | b;
-                break;
-            case THRIVE_TOKEN_KIND_LSHIFT:
-                result = a << b;
-                break;
-            case THRIVE_TOKEN_KIND_RSHIFT:
-                result = a >> b;
-                break;
-            default:
-                return node;
-            }
-
-            node->kind = THRIVE_AST_INT;
-            node->data.int_value = result;
-
-            return node;
+            return 0;
         }
-
-        return node;
+        *result = a / b;
+        return 1;
+    case THRIVE_TOKEN_KIND_MOD:
+        if (b == 0)
+        {
+            return 0;
+        }
+        *result = a % b;
+        return 1;
+    case THRIVE_TOKEN_KIND_EQUALS:
+        *result = (a == b);
+        return 1;
+    case THRIVE_TOKEN_KIND_NOT_EQUALS:
+        *result = (a != b);
+        return 1;
+    case THRIVE_TOKEN_KIND_LT:
+        *result = (a < b);
+        return 1;
+    case THRIVE_TOKEN_KIND_GT:
+        *result = (a > b);
+        return 1;
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+        *result = (a <= b);
+        return 1;
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+        *result = (a >= b);
+        return 1;
+    case THRIVE_TOKEN_KIND_AND_BITWISE:
+        *result = a & b;
+        return 1;
+    case THRIVE_TOKEN_KIND_OR_BITWISE:
+        *result = a | b;
+        return 1;
+    case THRIVE_TOKEN_KIND_XOR_BITWISE:
+        *result = a ^ b;
+        return 1;
+    case THRIVE_TOKEN_KIND_AND_LOGICAL:
+        *result = (a && b);
+        return 1;
+    case THRIVE_TOKEN_KIND_OR_LOGICAL:
+        *result = (a || b);
+        return 1;
+    case THRIVE_TOKEN_KIND_LSHIFT:
+        if (b >= 32 || (a >> (31 - b)) > 1)
+        {
+            return 0;
+        }
+        *result = a << b;
+        return 1;
+    case THRIVE_TOKEN_KIND_RSHIFT:
+        if (b >= 32)
+        {
+            return 0;
+        }
+        *result = a >> b;
+        return 1;
+    default:
+        return 0;
     }
+}
 
-    case THRIVE_AST_UNARY:
-        node->data.unary.expr = thrive_ast_fold(node->data.unary.expr);
-        if (node->data.unary.expr->kind == THRIVE_AST_INT)
+/* Turns a node with constant operands into a constant */
+THRIVE_API u8 thrive_ast_eval(thrive_ast *node)
+{
+    u32 result;
+
+    if (node->kind == THRIVE_AST_BINARY)
+    {
+        thrive_ast *l = node->data.binary.left;
+        thrive_ast *r = node->data.binary.right;
+
+        if (l->kind != THRIVE_AST_INT || r->kind != THRIVE_AST_INT ||
+            !thrive_ast_eval_binary(node->data.binary.op, l->data.int_value, r->data.int_value, &result))
         {
-            u32 val = node->data.unary.expr->data.int_value;
-            if (node->data.unary.op == THRIVE_TOKEN_KIND_SUB)
-            {
-                node->kind = THRIVE_AST_INT;
-                node->data.int_value = (u32)(-(i32)val);
-                return node;
-            }
-            if (node->data.unary.op == THRIVE_TOKEN_KIND_NEGATE)
+            return 0;
+        }
+    }
+    else if (node->kind == THRIVE_AST_UNARY && node->data.unary.expr->kind == THRIVE_AST_INT)
+    {
+        u32 val = node->data.unary.expr->data.int_value;
+
+        switch (node->data.unary.op)
+        {
+        case THRIVE_TOKEN_KIND_SUB:
+            if (val != 0)
             {
-                node->kind = THRIVE_AST_INT;
-                node->data.int_value = (val == 0) ? 1 : 0;
-                return node;
+                return 0; /* the runtime negates all 64 bits */
             }
+            result = 0;
+            break;
+        case THRIVE_TOKEN_KIND_ADD:
+            result = val;
+            break;
+        case THRIVE_TOKEN_KIND_NEGATE:
+            result = (val == 0) ? 1 : 0;
+            break;
+        case THRIVE_TOKEN_KIND_NOT_BITWISE:
+            result = ~val;
+            break;
+        default:
+            return 0;
         }
-        return node;
+    }
+    else
+    {
+        return 0;
+    }
 
-    case THRIVE_AST_ASSIGN:
-        node->data.assign.right = thrive_ast_fold(node->data.assign.right);
-        return node;
+    node->kind = THRIVE_AST_INT;
+    node->data.int_value = result;
 
-    case THRIVE_AST_IF:
-    {
-        node->data.if_stmt.cond = thrive_ast_fold(node->data.if_stmt.cond);
+    return 1;
+}
 
-        if (node->data.if_stmt.cond->kind == THRIVE_AST_INT)
+THRIVE_API u8 thrive_rewrite_matches(thrive_rewrite_rule *rule, thrive_rewrite_match match, thrive_ast *operand, thrive_ast *left)
+{
+    switch (match)
+    {
+    case THRIVE_REWRITE_ANY:
+        return 1;
+    case THRIVE_REWRITE_CONST:
+        return (u8)(operand->kind == THRIVE_AST_INT && operand->data.int_value == rule->value);
+    case THRIVE_REWRITE_INT:
+        return (u8)(operand->kind == THRIVE_AST_INT);
+    case THRIVE_REWRITE_EXPR:
+        return (u8)(operand->kind != THRIVE_AST_INT);
+    case THRIVE_REWRITE_SAME:
+        return (u8)(thrive_ast_is_pure(left) && thrive_ast_is_pure(operand) && thrive_ast_equals(left, operand));
+    case THRIVE_REWRITE_BOOL:
+        return thrive_ast_is_bool(operand);
+    case THRIVE_REWRITE_COMPARE:
+        return thrive_ast_is_compare(operand);
+    case THRIVE_REWRITE_NESTED:
+        if (operand->kind != rule->kind)
         {
-            thrive_ast *selected_branch =
-                (node->data.if_stmt.cond->data.int_value != 0)
-                    ? node->data.if_stmt.then_branch
-                    : node->data.if_stmt.else_branch;
+            return 0;
+        }
+        if (operand->kind == THRIVE_AST_UNARY)
+        {
+            return (u8)(operand->data.unary.op == rule->inner_op);
+        }
+        return (u8)(operand->data.binary.op == rule->inner_op && operand->data.binary.right->kind == THRIVE_AST_INT);
+    case THRIVE_REWRITE_NESTED_BOOL:
+        return (u8)(operand->kind == THRIVE_AST_UNARY && operand->data.unary.op == rule->inner_op &&
+                    thrive_ast_is_bool(operand->data.unary.expr));
+    default:
+        return 0;
+    }
+}
 
-            if (selected_branch)
-            {
-                thrive_ast *folded = thrive_ast_fold(selected_branch);
-                thrive_ast *tail = folded;
+/* Applies a matched rule, returns the replacement or 0 if it does not apply after all */
+THRIVE_API thrive_ast *thrive_rewrite_apply(thrive_rewrite_rule *rule, thrive_ast *node, thrive_ast *l, thrive_ast *r)
+{
+    /* The right side of && and || does not run when a constant left side decides */
+    u8 logical = (u8)(node->kind == THRIVE_AST_BINARY &&
+                      (node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL));
+    u8 r_runs = (u8)(r && !(logical && l->kind == THRIVE_AST_INT));
 
-                while (tail->next)
-                {
-                    tail = tail->next;
-                }
-                tail->next = node->next;
+    switch (rule->result)
+    {
+    case THRIVE_REWRITE_TO_LEFT:
+        return (r_runs && !thrive_ast_is_pure(r)) ? 0 : l;
 
-                return folded;
-            }
+    case THRIVE_REWRITE_TO_RIGHT:
+        return thrive_ast_is_pure(l) ? r : 0;
 
-            return node->next;
+    case THRIVE_REWRITE_TO_CONST:
+        if (!thrive_ast_is_pure(l) || (r_runs && !thrive_ast_is_pure(r)))
+        {
+            return 0;
         }
+        node->kind = THRIVE_AST_INT;
+        node->data.int_value = rule->result_value;
+        return node;
 
-        node->data.if_stmt.then_branch = thrive_ast_fold(node->data.if_stmt.then_branch);
-        node->data.if_stmt.else_branch = thrive_ast_fold(node->data.if_stmt.else_branch);
+    case THRIVE_REWRITE_TO_INNER:
+        return l->data.unary.expr;
 
+    case THRIVE_REWRITE_TO_SWAPPED:
+        node->data.binary.left = r;
+        node->data.binary.right = l;
         return node;
-    }
 
-    case THRIVE_AST_TERNARY:
+    case THRIVE_REWRITE_TO_REASSOC:
     {
-        node->data.ternary.cond = thrive_ast_fold(node->data.ternary.cond);
+        u64 k1 = l->data.binary.right->data.int_value;
+        u64 k2 = r->data.int_value;
+        u64 k;
 
-        if (node->data.ternary.cond->kind == THRIVE_AST_INT)
+        switch (node->data.binary.op)
         {
-            if (node->data.ternary.cond->data.int_value != 0)
-            {
-                return thrive_ast_fold(node->data.ternary.then_expr);
-            }
-            else
-            {
-                return thrive_ast_fold(node->data.ternary.else_expr);
-            }
+        case THRIVE_TOKEN_KIND_MUL:
+            k = k1 * k2;
+            break;
+        case THRIVE_TOKEN_KIND_AND_BITWISE:
+            k = k1 & k2;
+            break;
+        case THRIVE_TOKEN_KIND_OR_BITWISE:
+            k = k1 | k2;
+            break;
+        default:
+            k = k1 ^ k2;
+            break;
         }
 
-        node->data.ternary.then_expr = thrive_ast_fold(node->data.ternary.then_expr);
-        node->data.ternary.else_expr = thrive_ast_fold(node->data.ternary.else_expr);
+        /* Wrapping would differ from the unfolded 64-bit arithmetic */
+        if (k > 0xFFFFFFFF)
+        {
+            return 0;
+        }
 
+        node->data.binary.left = l->data.binary.left;
+        r->data.int_value = (u32)k;
         return node;
     }
 
-    case THRIVE_AST_DECL:
-        if (node->data.decl.value)
+    case THRIVE_REWRITE_TO_OFFSET:
+    {
+        i64 k1 = l->data.binary.right->data.int_value;
+        i64 k2 = r->data.int_value;
+        i64 k = (l->data.binary.op == THRIVE_TOKEN_KIND_ADD ? k1 : -k1) +
+                (node->data.binary.op == THRIVE_TOKEN_KIND_ADD ? k2 : -k2);
+
+        if (k > (i64)0xFFFFFFFF || k < -(i64)0xFFFFFFFF)
         {
-            node->data.decl.value = thrive_ast_fold(node->data.decl.value);
+            return 0;
         }
-        return node;
 
-    case THRIVE_AST_RETURN:
-        node->data.ret.expr = thrive_ast_fold(node->data.ret.expr);
+        node->data.binary.left = l->data.binary.left;
+        node->data.binary.op = (k < 0) ? THRIVE_TOKEN_KIND_SUB : THRIVE_TOKEN_KIND_ADD;
+        r->data.int_value = (u32)((k < 0) ? -k : k);
         return node;
+    }
 
-    case THRIVE_AST_FOR:
-        if (node->data.for_loop.init)
+    case THRIVE_REWRITE_TO_INVERTED:
+        switch (l->data.binary.op)
         {
-            node->data.for_loop.init = thrive_ast_fold(node->data.for_loop.init);
+        case THRIVE_TOKEN_KIND_EQUALS:
+            l->data.binary.op = THRIVE_TOKEN_KIND_NOT_EQUALS;
+            break;
+        case THRIVE_TOKEN_KIND_NOT_EQUALS:
+            l->data.binary.op = THRIVE_TOKEN_KIND_EQUALS;
+            break;
+        case THRIVE_TOKEN_KIND_LT:
+            l->data.binary.op = THRIVE_TOKEN_KIND_GT_EQUALS;
+            break;
+        case THRIVE_TOKEN_KIND_GT:
+            l->data.binary.op = THRIVE_TOKEN_KIND_LT_EQUALS;
+            break;
+        case THRIVE_TOKEN_KIND_LT_EQUALS:
+            l->data.binary.op = THRIVE_TOKEN_KIND_GT;
+            break;
+        default:
+            l->data.binary.op = THRIVE_TOKEN_KIND_LT;
+            break;
         }
-        if (node->data.for_loop.cond)
+        return l;
+
+    default:
+        return 0;
+    }
+}
+
+/* Rewrites a node with folded operands until no rule matches */
+THRIVE_API thrive_ast *thrive_ast_rewrite(thrive_ast *node)
+{
+    u32 step;
+
+    for (step = 0; step < THRIVE_REWRITE_MAX_STEPS; ++step)
+    {
+        thrive_ast *l;
+        thrive_ast *r;
+        thrive_token_kind op;
+        thrive_ast *result = 0;
+        u32 i;
+
+        if (node->kind == THRIVE_AST_BINARY)
         {
-            node->data.for_loop.cond = thrive_ast_fold(node->data.for_loop.cond);
+            l = node->data.binary.left;
+            r = node->data.binary.right;
+            op = node->data.binary.op;
         }
-        if (node->data.for_loop.step)
+        else if (node->kind == THRIVE_AST_UNARY)
         {
-            node->data.for_loop.step = thrive_ast_fold(node->data.for_loop.step);
+            l = node->data.unary.expr;
+            r = 0;
+            op = node->data.unary.op;
         }
-        if (node->data.for_loop.body)
+        else
         {
-            node->data.for_loop.body = thrive_ast_fold(node->data.for_loop.body);
+            break;
         }
-        return node;
-
-    case THRIVE_AST_BLOCK:
-    {
-        thrive_ast *curr = node->data.block.body;
 
-        while (curr)
+        if (thrive_ast_eval(node))
         {
-            curr = thrive_ast_fold(curr);
-            curr = curr->next;
+            break;
         }
-        return node;
-    }
 
-    case THRIVE_AST_FUNC_DECL:
-        if (node->data.func_decl.body)
+        for (i = 0; i < THRIVE_REWRITE_RULE_COUNT && !result; ++i)
         {
-            node->data.func_decl.body = thrive_ast_fold(node->data.func_decl.body);
-        }
-        return node;
+            thrive_rewrite_rule *rule = &thrive_rewrite_rules[i];
 
-    case THRIVE_AST_FUNC_CALL:
-    {
-        thrive_ast **curr = &node->data.func_call.args;
-        while (*curr)
-        {
-            *curr = thrive_ast_fold(*curr);
-            curr = &(*curr)->next;
+            if (rule->kind != node->kind || rule->op != op ||
+                !thrive_rewrite_matches(rule, rule->left, l, l) ||
+                (r && !thrive_rewrite_matches(rule, rule->right, r, l)))
+            {
+                continue;
+            }
+
+            result = thrive_rewrite_apply(rule, node, l, r);
+
+            if (result)
+            {
+                rule->hits++;
+                optimizer_stats.rewrites++;
+            }
         }
-        return node;
-    }
 
-    case THRIVE_AST_EXT_DECL:
-    {
-        thrive_ast **curr = &node->data.ext_decl.params;
-        while (*curr)
+        if (!result)
         {
-            *curr = thrive_ast_fold(*curr);
-            curr = &(*curr)->next;
+            break;
         }
-        return node;
-    }
 
-    default:
-        return node;
+        node = result;
     }
+
+    return node;
 }
 
 /* #############################################################################
- * # [SECTION] PE32+ Generator
+ * # [SECTION] Compile-Time Evaluation
  * #############################################################################
+ *
+ * A bounded interpreter for calls to internal functions whose arguments are
+ * all constants. Thrive has no recursion and bounded loops so evaluation
+ * terminates, the step and memory limits keep it cheap.
+ *
+ * Anything the interpreter cannot reproduce exactly gives up and leaves the
+ * call alone: pointers, strings, ext calls, variables outside the callee,
+ * uninitialized reads and values the 64-bit runtime would not wrap to u32.
+ *
+ * thrive_ast_evaluate registers the functions of a program and folds it, the
+ * folder then replaces every call it can evaluate by its result.
  */
-typedef struct thrive_p32_plus_import
+#define THRIVE_EVALUATE_MAX_FUNCS 256
+#define THRIVE_EVALUATE_MAX_VARS 256
+#define THRIVE_EVALUATE_MAX_MEMORY 4096 /* u32 cells for variables and arrays */
+#define THRIVE_EVALUATE_MAX_STEPS 100000
+#define THRIVE_EVALUATE_MAX_DEPTH 32
+
+typedef enum thrive_evaluate_flow
 {
-    s8 *library;       /* e.g. "kernel32.dll" */
-    s8 **imports;      /* e.g. "ExitProcess", "Sleep" */
-    u32 imports_count; /* count of imports entries */
+    THRIVE_EVALUATE_NEXT,
+    THRIVE_EVALUATE_BREAK,
+    THRIVE_EVALUATE_CONTINUE,
+    THRIVE_EVALUATE_RETURN,
+    THRIVE_EVALUATE_FAIL
 
-} thrive_p32_plus_import;
+} thrive_evaluate_flow;
 
-u32 thrive_pe32_plus_get_iat_rva(thrive_p32_plus_import *imports, u32 num_imports, u32 text_vsize, u32 dll_index, u32 func_index)
+typedef struct thrive_evaluate_var
 {
-    u32 text_rva = 0x1000;
-    u32 rdata_rva = text_rva + thrive_align_up(text_vsize, 0x1000);
-    u32 idt_size = (num_imports + 1) * 20;
+    s8 *start;
+    u32 length;
+    u32 base; /* first cell in evaluate_memory */
+    u32 size; /* cells, 1 for scalars */
+    u8 is_array;
 
-    u32 num_funcs = 0;
-    u32 i;
+} thrive_evaluate_var;
 
-    u32 ilt_size;
-    u32 iat_base_rva;
-    u32 offset;
+static thrive_ast *evaluate_funcs[THRIVE_EVALUATE_MAX_FUNCS];
+static u32 evaluate_func_count = 0;
 
-    for (i = 0; i < num_imports; ++i)
-    {
-        num_funcs += imports[i].imports_count;
-    }
+static thrive_evaluate_var evaluate_vars[THRIVE_EVALUATE_MAX_VARS];
+static u32 evaluate_var_count;
+static u32 evaluate_frame; /* first variable visible to the running body */
+static u32 evaluate_memory[THRIVE_EVALUATE_MAX_MEMORY];
+static u8 evaluate_defined[THRIVE_EVALUATE_MAX_MEMORY];
+static u32 evaluate_memory_used;
+static u32 evaluate_steps;
+static u32 evaluate_depth;
+static u32 evaluate_result; /* value of the last ret */
 
-    ilt_size = (num_funcs + num_imports) * 8;
-    iat_base_rva = rdata_rva + idt_size + ilt_size;
+THRIVE_API u8 thrive_evaluate_expr(thrive_ast *node, u32 *value);
+THRIVE_API thrive_evaluate_flow thrive_evaluate_statement(thrive_ast *node);
+THRIVE_API thrive_ast *thrive_ast_fold(thrive_ast *node);
 
-    offset = 0;
+THRIVE_API thrive_evaluate_var *thrive_evaluate_find(thrive_ast *name)
+{
+    u32 i;
 
-    for (i = 0; i < dll_index; ++i)
+    for (i = evaluate_var_count; i > evaluate_frame; --i)
     {
-        offset += (imports[i].imports_count + 1) * 8;
-    }
+        thrive_evaluate_var *v = &evaluate_vars[i - 1];
 
-    offset += func_index * 8;
+        if (thrive_ast_name_equals(v->start, v->length, name->data.name.start, name->data.name.length))
+        {
+            return v;
+        }
+    }
 
-    return iat_base_rva + offset;
+    return 0;
 }
 
-THRIVE_API THRIVE_INLINE u32 thrive_pe32_plus_calculate_import_function_count(
-    thrive_p32_plus_import *imports,
-    u32 num_imports)
+THRIVE_API thrive_evaluate_var *thrive_evaluate_declare(thrive_ast *name, u32 size, u8 is_array)
 {
-    u32 result = 0;
-
+    thrive_evaluate_var *v;
     u32 i;
 
-    for (i = 0; i < num_imports; ++i)
+    if (evaluate_var_count == THRIVE_EVALUATE_MAX_VARS || size > THRIVE_EVALUATE_MAX_MEMORY - evaluate_memory_used)
     {
-        result += imports[i].imports_count;
+        return 0;
     }
 
-    return result;
+    v = &evaluate_vars[evaluate_var_count++];
+    v->start = name->data.name.start;
+    v->length = name->data.name.length;
+    v->base = evaluate_memory_used;
+    v->size = size;
+    v->is_array = is_array;
+
+    for (i = 0; i < size; ++i)
+    {
+        evaluate_defined[v->base + i] = 0;
+    }
+    evaluate_memory_used += size;
+
+    return v;
 }
 
-THRIVE_API THRIVE_INLINE u32 thrive_pe32_plus_calculate_import_strings_size(
-    thrive_p32_plus_import *imports,
-    u32 num_imports)
+/* The cell a store or load refers to, -1 if it is not a local the interpreter owns */
+THRIVE_API i32 thrive_evaluate_cell(thrive_ast *node)
 {
-    u32 result = 0;
-
-    u32 i;
-    u32 j;
+    thrive_evaluate_var *v;
+    u32 index;
 
-    for (i = 0; i < num_imports; ++i)
+    if (node->kind == THRIVE_AST_NAME)
     {
-        result += thrive_string_length(imports[i].library) + 1;
+        v = thrive_evaluate_find(node);
+        return (v && !v->is_array) ? (i32)v->base : -1;
+    }
 
-        for (j = 0; j < imports[i].imports_count; ++j)
-        {
-            result += 2 + thrive_string_length((s8 *)imports[i].imports[j]) + 1; /* 2 bytes for Hint */
-        }
+    if (node->kind != THRIVE_AST_ARRAY_ACCESS || node->data.array_access.left->kind != THRIVE_AST_NAME ||
+        !thrive_evaluate_expr(node->data.array_access.index, &index))
+    {
+        return -1;
     }
 
-    return result;
+    v = thrive_evaluate_find(node->data.array_access.left);
+
+    return (v && v->is_array && index < v->size) ? (i32)(v->base + index) : -1;
 }
 
-void thrive_pe32_plus_generate(
-    thrive_buffer *out,
-    thrive_buffer *code,
-    thrive_p32_plus_import *imports,
-    u32 num_imports,
-    u32 text_vsize)
+/* Runs a body in a fresh frame with the parameters bound, the value of its ret ends up in *value */
+THRIVE_API u8 thrive_evaluate_body(thrive_ast *params, u32 *args, thrive_ast *body, u32 *value)
 {
-    u32 i, j;
-    u32 num_funcs = thrive_pe32_plus_calculate_import_function_count(imports, num_imports);
-    u32 strings_size = thrive_pe32_plus_calculate_import_strings_size(imports, num_imports);
+    u32 saved_frame = evaluate_frame;
+    u32 saved_var_count = evaluate_var_count;
+    u32 saved_memory_used = evaluate_memory_used;
+    thrive_evaluate_flow flow;
+    u32 i = 0;
 
-    /* Section Layout Calculations */
-    u32 idt_size = (num_imports + 1) * 20;
-    u32 ilt_size = (num_funcs + num_imports) * 8;
-    u32 iat_size = ilt_size;
+    if (++evaluate_depth > THRIVE_EVALUATE_MAX_DEPTH)
+    {
+        return 0;
+    }
 
-    u32 text_rva = 0x1000;
-    u32 text_raw_size = thrive_align_up(code->size, 0x200);
+    evaluate_frame = evaluate_var_count;
 
-    u32 rdata_rva = text_rva + thrive_align_up(text_vsize, 0x1000);
-    u32 rdata_vsize = idt_size + ilt_size + iat_size + strings_size;
-    u32 rdata_raw_size = thrive_align_up(rdata_vsize, 0x200);
+    for (; params; params = params->next)
+    {
+        thrive_evaluate_var *v = thrive_evaluate_declare(params, 1, 0);
 
-    u32 idt_rva = rdata_rva;
-    u32 ilt_rva = idt_rva + idt_size;
-    u32 iat_rva = ilt_rva + ilt_size;
-    u32 strings_rva = iat_rva + iat_size;
-    u32 size_of_image = thrive_align_up(rdata_rva + rdata_vsize, 0x1000);
+        if (!v)
+        {
+            return 0;
+        }
+        evaluate_memory[v->base] = args[i++];
+        evaluate_defined[v->base] = 1;
+    }
 
-    u32 current_dll_name_rva = strings_rva;
-    u32 current_func_name_rva = strings_rva;
-    u32 current_ilt_rva = ilt_rva;
-    u32 current_iat_rva = iat_rva;
+    flow = thrive_evaluate_statement(body);
+    *value = evaluate_result;
 
-    /* Write DOS Header */
-    thrive_buffer_write_u16(out, 0x5A4D); /* MZ */
-    thrive_buffer_align(out, 0x3C);       /* */
-    thrive_buffer_write_u32(out, 0x40);   /* e_lfanew */
+    evaluate_frame = saved_frame;
+    evaluate_var_count = saved_var_count;
+    evaluate_memory_used = saved_memory_used;
+    evaluate_depth--;
 
-    /* Write NT Headers */
-    thrive_buffer_write_u32(out, 0x00004550); /* PE\0\0 */
-    thrive_buffer_write_u16(out, 0x8664);     /* Machine: AMD64 */
-    thrive_buffer_write_u16(out, 2);          /* NumberOfSections */
-    thrive_buffer_write_u32(out, 0);          /* TimeDateStamp */
-    thrive_buffer_write_u32(out, 0);          /* PointerToSymbolTable */
-    thrive_buffer_write_u32(out, 0);          /* NumberOfSymbols */
-    thrive_buffer_write_u16(out, 0xF0);       /* SizeOfOptionalHeader */
-    thrive_buffer_write_u16(out, 0x0022);     /* Characteristics (Exec, LargeAddr) */
+    /* Falling off the end leaves whatever rax held */
+    return (u8)(flow == THRIVE_EVALUATE_RETURN);
+}
 
-    /* Write Optional Header (PE32+) */
-    thrive_buffer_write_u16(out, 0x020B);         /* Magic */
-    thrive_buffer_write_u8(out, 1);               /* MajorLinkerVersion */
-    thrive_buffer_write_u8(out, 0);               /* MinorLinkerVersion */
-    thrive_buffer_write_u32(out, text_raw_size);  /* SizeOfCode */
-    thrive_buffer_write_u32(out, rdata_raw_size); /* SizeOfInitializedData */
-    thrive_buffer_write_u32(out, 0);              /* SizeOfUninitializedData */
-    thrive_buffer_write_u32(out, text_rva);       /* AddressOfEntryPoint */
-    thrive_buffer_write_u32(out, text_rva);       /* BaseOfCode */
+THRIVE_API u8 thrive_evaluate_args(thrive_ast *args, u32 *values, u32 *count)
+{
+    *count = 0;
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wlong-long"
-    thrive_buffer_write_u64(out, 0x0000000140000000ULL); /* ImageBase */
-#pragma GCC diagnostic pop
+    for (; args; args = args->next)
+    {
+        if (*count == 4 || !thrive_evaluate_expr(args, &values[(*count)++]))
+        {
+            return 0;
+        }
+    }
 
-    thrive_buffer_write_u32(out, 0x1000);        /* SectionAlignment */
-    thrive_buffer_write_u32(out, 0x200);         /* FileAlignment */
-    thrive_buffer_write_u16(out, 5);             /* */
-    thrive_buffer_write_u16(out, 2);             /* OSMajor / OSMinor */
-    thrive_buffer_write_u16(out, 0);             /* */
-    thrive_buffer_write_u16(out, 0);             /* ImageMajor / ImageMinor */
-    thrive_buffer_write_u16(out, 5);             /* */
-    thrive_buffer_write_u16(out, 2);             /* SubSysMajor / SubSysMinor */
-    thrive_buffer_write_u32(out, 0);             /* Win32VersionValue */
-    thrive_buffer_write_u32(out, size_of_image); /* SizeOfImage */
-    thrive_buffer_write_u32(out, 0x200);         /* SizeOfHeaders */
-    thrive_buffer_write_u32(out, 0);             /* CheckSum */
-    thrive_buffer_write_u16(out, 3);             /* Subsystem (3 = Windows CUI Console, 2 = Windows GUI, 1 = Native) */
-    thrive_buffer_write_u16(out, 0x8140);        /* DllCharacteristics (NX, DynBase, HighEnt) */
-    thrive_buffer_write_u64(out, 0x100000);      /* SizeOfStackReserve */
-    thrive_buffer_write_u64(out, 0x1000);        /* SizeOfStackCommit */
-    thrive_buffer_write_u64(out, 0x100000);      /* SizeOfHeapReserve */
-    thrive_buffer_write_u64(out, 0x1000);        /* SizeOfHeapCommit */
-    thrive_buffer_write_u32(out, 0);             /* LoaderFlags */
-    thrive_buffer_write_u32(out, 16);            /* NumberOfRvaAndSizes */
+    return 1;
+}
 
-    /* Data Directories */
-    thrive_buffer_write_u32(out, 0);
-    thrive_buffer_write_u32(out, 0); /* Export Directory */
-    thrive_buffer_write_u32(out, idt_rva);
-    thrive_buffer_write_u32(out, idt_size); /* Import Directory */
+THRIVE_API thrive_ast *thrive_evaluate_find_func(thrive_ast *name)
+{
+    u32 i;
 
-    for (i = 2; i < 16; ++i)
+    for (i = 0; i < evaluate_func_count; ++i)
     {
-        thrive_buffer_write_u32(out, 0);
-        thrive_buffer_write_u32(out, 0);
-    }
-
-    /* Section Header: .text */
-    thrive_buffer_write_bytes(out, (u8 *)".text\0\0\0", 8);
-    thrive_buffer_write_u32(out, code->size);    /* VirtualSize */
-    thrive_buffer_write_u32(out, text_rva);      /* VirtualAddress */
-    thrive_buffer_write_u32(out, text_raw_size); /* SizeOfRawData */
-    thrive_buffer_write_u32(out, 0x200);         /* PointerToRawData */
-    thrive_buffer_write_u32(out, 0);             /* */
-    thrive_buffer_write_u32(out, 0);             /* */
-    thrive_buffer_write_u16(out, 0);             /* */
-    thrive_buffer_write_u16(out, 0);             /* */
-    thrive_buffer_write_u32(out, 0x60000020);    /* Characteristics (RX) */
+        thrive_ast *decl_name = evaluate_funcs[i]->data.func_decl.name;
 
-    /* Section Header: .rdata */
-    thrive_buffer_write_bytes(out, (u8 *)".rdata\0\0", 8);
-    thrive_buffer_write_u32(out, rdata_vsize);           /* VirtualSize */
-    thrive_buffer_write_u32(out, rdata_rva);             /* VirtualAddress */
-    thrive_buffer_write_u32(out, rdata_raw_size);        /* SizeOfRawData */
-    thrive_buffer_write_u32(out, 0x200 + text_raw_size); /* PointerToRawData */
-    thrive_buffer_write_u32(out, 0);                     /* */
-    thrive_buffer_write_u32(out, 0);                     /* */
-    thrive_buffer_write_u16(out, 0);                     /* */
-    thrive_buffer_write_u16(out, 0);                     /* */
-    thrive_buffer_write_u32(out, 0x40000040);            /* Characteristics (R) */
+        if (thrive_ast_name_equals(decl_name->data.name.start, decl_name->data.name.length, name->data.name.start, name->data.name.length))
+        {
+            return evaluate_funcs[i];
+        }
+    }
 
-    thrive_buffer_align(out, 0x200); /* Pad Header to File Alignment */
+    return 0;
+}
 
-    /* Write .text Data */
-    thrive_buffer_write_bytes(out, code->data, code->size);
-    thrive_buffer_align(out, 0x200);
+THRIVE_API u8 thrive_evaluate_expr(thrive_ast *node, u32 *value)
+{
+    u32 a;
+    u32 b;
 
-    /* Write .rdata Data (Imports) */
-    for (i = 0; i < num_imports; ++i)
+    if (++evaluate_steps > THRIVE_EVALUATE_MAX_STEPS)
     {
-        current_func_name_rva += thrive_string_length(imports[i].library) + 1;
+        return 0;
     }
 
-    /* Write Import Descriptor Table (IDT) */
-    for (i = 0; i < num_imports; ++i)
+    switch (node->kind)
     {
-        thrive_buffer_write_u32(out, current_ilt_rva);
-        thrive_buffer_write_u32(out, 0);
-        thrive_buffer_write_u32(out, 0);
-        thrive_buffer_write_u32(out, current_dll_name_rva);
-        thrive_buffer_write_u32(out, current_iat_rva);
+    case THRIVE_AST_INT:
+        *value = node->data.int_value;
+        return 1;
 
-        current_dll_name_rva += thrive_string_length(imports[i].library) + 1;
-        current_ilt_rva += (imports[i].imports_count + 1) * 8;
-        current_iat_rva += (imports[i].imports_count + 1) * 8;
+    case THRIVE_AST_NAME:
+    case THRIVE_AST_ARRAY_ACCESS:
+    {
+        i32 cell = thrive_evaluate_cell(node);
+
+        if (cell < 0 || !evaluate_defined[cell])
+        {
+            return 0;
+        }
+        *value = evaluate_memory[cell];
+        return 1;
     }
 
-    thrive_buffer_write_u32(out, 0);
-    thrive_buffer_write_u32(out, 0);
-    thrive_buffer_write_u32(out, 0);
-    thrive_buffer_write_u32(out, 0);
-    thrive_buffer_write_u32(out, 0);
+    case THRIVE_AST_BINARY:
+        if (!thrive_evaluate_expr(node->data.binary.left, &a))
+        {
+            return 0;
+        }
 
-    /* Write Import Lookup Table (ILT) & Import Address Table (IAT) */
+        if (node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL)
+        {
+            if ((node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL) != (a != 0))
+            {
+                *value = (a != 0);
+                return 1;
+            }
+            if (!thrive_evaluate_expr(node->data.binary.right, &b))
+            {
+                return 0;
+            }
+            *value = (b != 0);
+            return 1;
+        }
+
+        return (u8)(thrive_evaluate_expr(node->data.binary.right, &b) &&
+                    thrive_ast_eval_binary(node->data.binary.op, a, b, value));
+
+    case THRIVE_AST_UNARY:
     {
-        i32 table;
+        thrive_token_kind op = node->data.unary.op;
 
-        for (table = 0; table < 2; ++table)
+        if (op == THRIVE_TOKEN_KIND_INC || op == THRIVE_TOKEN_KIND_DEC)
         {
-            u32 temp_name_rva = current_func_name_rva;
+            i32 cell = thrive_evaluate_cell(node->data.unary.expr);
 
-            for (i = 0; i < num_imports; ++i)
+            if (cell < 0 || !evaluate_defined[cell] ||
+                !thrive_ast_eval_binary(op == THRIVE_TOKEN_KIND_INC ? THRIVE_TOKEN_KIND_ADD : THRIVE_TOKEN_KIND_SUB, evaluate_memory[cell], 1, value))
             {
-                for (j = 0; j < imports[i].imports_count; ++j)
-                {
-                    thrive_buffer_write_u64(out, temp_name_rva);
-                    temp_name_rva += 2 + thrive_string_length((s8 *)imports[i].imports[j]) + 1;
-                }
-                thrive_buffer_write_u64(out, 0); /* Null thunk bounds the array */
+                return 0;
             }
+            evaluate_memory[cell] = *value;
+            return 1;
         }
 
-        /* Write Import Strings: DLL Names */
-        for (i = 0; i < num_imports; ++i)
+        if (!thrive_evaluate_expr(node->data.unary.expr, &a))
         {
-            thrive_buffer_write_bytes(out, (u8 *)imports[i].library, thrive_string_length(imports[i].library) + 1);
+            return 0;
         }
 
-        /* Write Import Strings: Function Names */
-        for (i = 0; i < num_imports; ++i)
+        switch (op)
         {
-            for (j = 0; j < imports[i].imports_count; ++j)
-            {
-                thrive_buffer_write_u16(out, 0); /* Ordinal Hint */
-                thrive_buffer_write_bytes(out, (u8 *)imports[i].imports[j], thrive_string_length((s8 *)imports[i].imports[j]) + 1);
-            }
+        case THRIVE_TOKEN_KIND_ADD:
+            *value = a;
+            return 1;
+        case THRIVE_TOKEN_KIND_SUB:
+            *value = 0;
+            return (u8)(a == 0); /* the runtime negates all 64 bits */
+        case THRIVE_TOKEN_KIND_NEGATE:
+            *value = (a == 0);
+            return 1;
+        case THRIVE_TOKEN_KIND_NOT_BITWISE:
+            *value = ~a;
+            return 1;
+        default:
+            return 0;
         }
     }
 
-    /* Final File Alignment Pad */
-    thrive_buffer_align(out, 0x200);
-}
+    case THRIVE_AST_TERNARY:
+        if (!thrive_evaluate_expr(node->data.ternary.cond, &a))
+        {
+            return 0;
+        }
+        return thrive_evaluate_expr(a ? node->data.ternary.then_expr : node->data.ternary.else_expr, value);
 
-/* #############################################################################
- * # [SECTION] X86_64 Machine Code Emitter
- * #############################################################################
- */
-typedef enum thrive_x64_reg
-{
-    REG_RAX = 0,
-    REG_RCX = 1,
-    REG_RDX = 2,
-    REG_RBX = 3,
-    REG_RSP = 4,
-    REG_RBP = 5,
-    REG_RSI = 6,
-    REG_RDI = 7,
-    REG_R8 = 8,
-    REG_R9 = 9,
-    REG_R10 = 10,
-    REG_R11 = 11,
-    REG_R12 = 12,
-    REG_R13 = 13,
-    REG_R14 = 14,
-    REG_R15 = 15
-} thrive_x64_reg;
+    case THRIVE_AST_ASSIGN:
+    {
+        i32 cell;
+
+        /* Right side first, like the codegen */
+        if (!thrive_evaluate_expr(node->data.assign.right, value))
+        {
+            return 0;
+        }
+
+        cell = thrive_evaluate_cell(node->data.assign.left);
+
+        if (cell < 0)
+        {
+            return 0;
+        }
+        evaluate_memory[cell] = *value;
+        evaluate_defined[cell] = 1;
+        return 1;
+    }
+
+    case THRIVE_AST_FUNC_CALL:
+    {
+        thrive_ast *decl = thrive_evaluate_find_func(node->data.func_call.name);
+        u32 args[4];
+        u32 count;
+
+        return (u8)(decl && thrive_evaluate_args(node->data.func_call.args, args, &count) &&
+                    thrive_evaluate_body(decl->data.func_decl.params, args, decl->data.func_decl.body, value));
+    }
+
+    case THRIVE_AST_INLINE:
+    {
+        u32 args[4];
+        u32 count;
+
+        return (u8)(thrive_evaluate_args(node->data.inline_call.args, args, &count) &&
+                    thrive_evaluate_body(node->data.inline_call.params, args, node->data.inline_call.body, value));
+    }
+
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API thrive_evaluate_flow thrive_evaluate_statement(thrive_ast *node)
+{
+    u32 value;
+
+    if (++evaluate_steps > THRIVE_EVALUATE_MAX_STEPS)
+    {
+        return THRIVE_EVALUATE_FAIL;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_DECL:
+    {
+        thrive_evaluate_var *v = thrive_evaluate_declare(node->data.decl.name, node->data.decl.is_array ? node->data.decl.array_size : 1, node->data.decl.is_array);
+
+        if (!v)
+        {
+            return THRIVE_EVALUATE_FAIL;
+        }
+
+        if (node->data.decl.value)
+        {
+            if (v->is_array || !thrive_evaluate_expr(node->data.decl.value, &value))
+            {
+                return THRIVE_EVALUATE_FAIL;
+            }
+            evaluate_memory[v->base] = value;
+            evaluate_defined[v->base] = 1;
+        }
+        return THRIVE_EVALUATE_NEXT;
+    }
+
+    case THRIVE_AST_BLOCK:
+    {
+        thrive_ast *curr;
+
+        for (curr = node->data.block.body; curr; curr = curr->next)
+        {
+            thrive_evaluate_flow flow = thrive_evaluate_statement(curr);
+
+            if (flow != THRIVE_EVALUATE_NEXT)
+            {
+                return flow;
+            }
+        }
+        return THRIVE_EVALUATE_NEXT;
+    }
+
+    case THRIVE_AST_IF:
+        if (!thrive_evaluate_expr(node->data.if_stmt.cond, &value))
+        {
+            return THRIVE_EVALUATE_FAIL;
+        }
+        if (value)
+        {
+            return thrive_evaluate_statement(node->data.if_stmt.then_branch);
+        }
+        return node->data.if_stmt.else_branch ? thrive_evaluate_statement(node->data.if_stmt.else_branch) : THRIVE_EVALUATE_NEXT;
+
+    case THRIVE_AST_FOR:
+        if (node->data.for_loop.init && !thrive_evaluate_expr(node->data.for_loop.init, &value))
+        {
+            return THRIVE_EVALUATE_FAIL;
+        }
+
+        for (;;)
+        {
+            thrive_evaluate_flow flow;
+
+            if (node->data.for_loop.cond)
+            {
+                if (!thrive_evaluate_expr(node->data.for_loop.cond, &value))
+                {
+                    return THRIVE_EVALUATE_FAIL;
+                }
+                if (!value)
+                {
+                    break;
+                }
+            }
+
+            flow = thrive_evaluate_statement(node->data.for_loop.body);
+
+            if (flow == THRIVE_EVALUATE_BREAK)
+            {
+                break;
+            }
+            if (flow == THRIVE_EVALUATE_RETURN || flow == THRIVE_EVALUATE_FAIL)
+            {
+                return flow;
+            }
+
+            if (node->data.for_loop.step && !thrive_evaluate_expr(node->data.for_loop.step, &value))
+            {
+                return THRIVE_EVALUATE_FAIL;
+            }
+        }
+        return THRIVE_EVALUATE_NEXT;
+
+    case THRIVE_AST_RETURN:
+        if (!node->data.ret.expr || !thrive_evaluate_expr(node->data.ret.expr, &evaluate_result))
+        {
+            return THRIVE_EVALUATE_FAIL;
+        }
+        return THRIVE_EVALUATE_RETURN;
+
+    case THRIVE_AST_BREAK:
+        return THRIVE_EVALUATE_BREAK;
+
+    case THRIVE_AST_CONTINUE:
+        return THRIVE_EVALUATE_CONTINUE;
+
+    default:
+        return thrive_evaluate_expr(node, &value) ? THRIVE_EVALUATE_NEXT : THRIVE_EVALUATE_FAIL;
+    }
+}
+
+/* Replaces a call with constant arguments by its result when the interpreter gets there */
+THRIVE_API thrive_ast *thrive_ast_evaluate_call(thrive_ast *node)
+{
+    thrive_ast *arg;
+    u32 value;
+
+    if (!evaluate_func_count)
+    {
+        return node;
+    }
+
+    for (arg = node->data.func_call.args; arg; arg = arg->next)
+    {
+        if (arg->kind != THRIVE_AST_INT)
+        {
+            return node;
+        }
+    }
+
+    evaluate_var_count = 0;
+    evaluate_frame = 0;
+    evaluate_memory_used = 0;
+    evaluate_steps = 0;
+    evaluate_depth = 0;
+
+    if (!thrive_evaluate_expr(node, &value))
+    {
+        return node;
+    }
+
+    node->kind = THRIVE_AST_INT;
+    node->data.int_value = value;
+    optimizer_stats.evaluated_calls++;
+
+    return node;
+}
+
+/* Folds the program with its functions available to the interpreter */
+THRIVE_API thrive_ast *thrive_ast_evaluate(thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    evaluate_func_count = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL && curr->data.func_decl.body && evaluate_func_count < THRIVE_EVALUATE_MAX_FUNCS)
+        {
+            evaluate_funcs[evaluate_func_count++] = curr;
+        }
+    }
+
+    program = thrive_ast_fold(program);
+    evaluate_func_count = 0;
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] AST Folding
+ * #############################################################################
+ */
+THRIVE_API thrive_ast *thrive_ast_fold(thrive_ast *node)
+{
+    if (!node)
+    {
+        return 0;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+        node->data.binary.left = thrive_ast_fold(node->data.binary.left);
+        node->data.binary.right = thrive_ast_fold(node->data.binary.right);
+        return thrive_ast_rewrite(node);
+
+    case THRIVE_AST_UNARY:
+        node->data.unary.expr = thrive_ast_fold(node->data.unary.expr);
+        return thrive_ast_rewrite(node);
+
+    case THRIVE_AST_ASSIGN:
+        node->data.assign.right = thrive_ast_fold(node->data.assign.right);
+        return node;
+
+    case THRIVE_AST_IF:
+    {
+        node->data.if_stmt.cond = thrive_ast_fold(node->data.if_stmt.cond);
+
+        if (node->data.if_stmt.cond->kind == THRIVE_AST_INT)
+        {
+            thrive_ast *selected_branch =
+                (node->data.if_stmt.cond->data.int_value != 0)
+                    ? node->data.if_stmt.then_branch
+                    : node->data.if_stmt.else_branch;
+
+            if (selected_branch)
+            {
+                thrive_ast *folded = thrive_ast_fold(selected_branch);
+                thrive_ast *tail = folded;
+
+                while (tail->next)
+                {
+                    tail = tail->next;
+                }
+                tail->next = node->next;
+
+                return folded;
+            }
+
+            return node->next;
+        }
+
+        node->data.if_stmt.then_branch = thrive_ast_fold(node->data.if_stmt.then_branch);
+        node->data.if_stmt.else_branch = thrive_ast_fold(node->data.if_stmt.else_branch);
+
+        return node;
+    }
+
+    case THRIVE_AST_TERNARY:
+    {
+        node->data.ternary.cond = thrive_ast_fold(node->data.ternary.cond);
+
+        if (node->data.ternary.cond->kind == THRIVE_AST_INT)
+        {
+            if (node->data.ternary.cond->data.int_value != 0)
+            {
+                return thrive_ast_fold(node->data.ternary.then_expr);
+            }
+            else
+            {
+                return thrive_ast_fold(node->data.ternary.else_expr);
+            }
+        }
+
+        node->data.ternary.then_expr = thrive_ast_fold(node->data.ternary.then_expr);
+        node->data.ternary.else_expr = thrive_ast_fold(node->data.ternary.else_expr);
+
+        return node;
+    }
+
+    case THRIVE_AST_DECL:
+        if (node->data.decl.value)
+        {
+            node->data.decl.value = thrive_ast_fold(node->data.decl.value);
+        }
+        return node;
+
+    case THRIVE_AST_RETURN:
+        node->data.ret.expr = thrive_ast_fold(node->data.ret.expr);
+        return node;
+
+    case THRIVE_AST_FOR:
+        if (node->data.for_loop.init)
+        {
+            node->data.for_loop.init = thrive_ast_fold(node->data.for_loop.init);
+        }
+        if (node->data.for_loop.cond)
+        {
+            node->data.for_loop.cond = thrive_ast_fold(node->data.for_loop.cond);
+        }
+        if (node->data.for_loop.step)
+        {
+            node->data.for_loop.step = thrive_ast_fold(node->data.for_loop.step);
+        }
+        if (node->data.for_loop.body)
+        {
+            node->data.for_loop.body = thrive_ast_fold(node->data.for_loop.body);
+        }
+        return node;
+
+    case THRIVE_AST_BLOCK:
+    {
+        thrive_ast **curr = &node->data.block.body;
+
+        /* A folded if can be replaced by its branch or vanish, so relink */
+        while (*curr)
+        {
+            thrive_ast *stmt = *curr;
+            *curr = thrive_ast_fold(stmt);
+
+            /* An expression statement can fold to one of its operands */
+            if (*curr && stmt->kind != THRIVE_AST_IF)
+            {
+                (*curr)->next = stmt->next;
+            }
+
+            if (*curr)
+            {
+                curr = &(*curr)->next;
+            }
+        }
+        return node;
+    }
+
+    case THRIVE_AST_FUNC_DECL:
+        if (node->data.func_decl.body)
+        {
+            node->data.func_decl.body = thrive_ast_fold(node->data.func_decl.body);
+        }
+        return node;
+
+    case THRIVE_AST_FUNC_CALL:
+    {
+        thrive_ast **curr = &node->data.func_call.args;
+        while (*curr)
+        {
+            /* The folded argument may be a different node, keep the list linked */
+            thrive_ast *next = (*curr)->next;
+            *curr = thrive_ast_fold(*curr);
+            (*curr)->next = next;
+            curr = &(*curr)->next;
+        }
+        return thrive_ast_evaluate_call(node);
+    }
+
+    case THRIVE_AST_EXT_DECL:
+    {
+        thrive_ast **curr = &node->data.ext_decl.params;
+        while (*curr)
+        {
+            *curr = thrive_ast_fold(*curr);
+            curr = &(*curr)->next;
+        }
+        return node;
+    }
+
+    case THRIVE_AST_INLINE:
+    {
+        thrive_ast **curr = &node->data.inline_call.args;
+        thrive_ast *stmt;
+
+        while (*curr)
+        {
+            thrive_ast *next = (*curr)->next;
+            *curr = thrive_ast_fold(*curr);
+            (*curr)->next = next;
+            curr = &(*curr)->next;
+        }
+
+        node->data.inline_call.body = thrive_ast_fold(node->data.inline_call.body);
+        stmt = node->data.inline_call.body->data.block.body;
+
+        /* Nothing left to bind and a body of a single "ret expr": the call is expr */
+        if (!node->data.inline_call.params && stmt && !stmt->next && stmt->kind == THRIVE_AST_RETURN && stmt->data.ret.expr)
+        {
+            return stmt->data.ret.expr;
+        }
+        return node;
+    }
+
+    default:
+        return node;
+    }
+}
+
+/* #############################################################################
+ * # [SECTION] AST Walker
+ * #############################################################################
+ */
+typedef void (*thrive_ast_visit)(thrive_ast *node, void *user);
+
+/* Visits node and everything below it in pre-order (node->next is not followed) */
+THRIVE_API void thrive_ast_walk(thrive_ast *node, thrive_ast_visit visit, void *user)
+{
+    thrive_ast *curr;
+
+    if (!node)
+    {
+        return;
+    }
+
+    visit(node, user);
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+        thrive_ast_walk(node->data.binary.left, visit, user);
+        thrive_ast_walk(node->data.binary.right, visit, user);
+        break;
+    case THRIVE_AST_UNARY:
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ADDR_OF:
+        thrive_ast_walk(node->data.unary.expr, visit, user);
+        break;
+    case THRIVE_AST_TERNARY:
+        thrive_ast_walk(node->data.ternary.cond, visit, user);
+        thrive_ast_walk(node->data.ternary.then_expr, visit, user);
+        thrive_ast_walk(node->data.ternary.else_expr, visit, user);
+        break;
+    case THRIVE_AST_IF:
+        thrive_ast_walk(node->data.if_stmt.cond, visit, user);
+        thrive_ast_walk(node->data.if_stmt.then_branch, visit, user);
+        thrive_ast_walk(node->data.if_stmt.else_branch, visit, user);
+        break;
+    case THRIVE_AST_FOR:
+        thrive_ast_walk(node->data.for_loop.init, visit, user);
+        thrive_ast_walk(node->data.for_loop.cond, visit, user);
+        thrive_ast_walk(node->data.for_loop.step, visit, user);
+        thrive_ast_walk(node->data.for_loop.body, visit, user);
+        break;
+    case THRIVE_AST_RETURN:
+        thrive_ast_walk(node->data.ret.expr, visit, user);
+        break;
+    case THRIVE_AST_ASSIGN:
+        thrive_ast_walk(node->data.assign.left, visit, user);
+        thrive_ast_walk(node->data.assign.right, visit, user);
+        break;
+    case THRIVE_AST_DECL:
+        thrive_ast_walk(node->data.decl.name, visit, user);
+        thrive_ast_walk(node->data.decl.value, visit, user);
+        break;
+    case THRIVE_AST_ARRAY_ACCESS:
+        thrive_ast_walk(node->data.array_access.left, visit, user);
+        thrive_ast_walk(node->data.array_access.index, visit, user);
+        break;
+    case THRIVE_AST_BLOCK:
+        for (curr = node->data.block.body; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        break;
+    case THRIVE_AST_FUNC_DECL:
+        thrive_ast_walk(node->data.func_decl.name, visit, user);
+        for (curr = node->data.func_decl.params; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        thrive_ast_walk(node->data.func_decl.body, visit, user);
+        break;
+    case THRIVE_AST_FUNC_CALL:
+        thrive_ast_walk(node->data.func_call.name, visit, user);
+        for (curr = node->data.func_call.args; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        break;
+    case THRIVE_AST_EXT_DECL:
+        thrive_ast_walk(node->data.ext_decl.name, visit, user);
+        for (curr = node->data.ext_decl.params; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        break;
+    case THRIVE_AST_INLINE:
+        thrive_ast_walk(node->data.inline_call.name, visit, user);
+        for (curr = node->data.inline_call.params; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        for (curr = node->data.inline_call.args; curr; curr = curr->next)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+        thrive_ast_walk(node->data.inline_call.body, visit, user);
+        break;
+    default:
+        break;
+    }
+}
+
+/* #############################################################################
+ * # [SECTION] Inlining
+ * #############################################################################
+ *
+ * Replaces calls to small internal functions with a THRIVE_AST_INLINE node
+ * holding a copy of the callee body. The inlined body runs in the caller
+ * frame: arguments are evaluated left to right and bound to fresh slots
+ * named like the parameters, a ret jumps to the end of the inlined block and
+ * leaves its value in rax.
+ *
+ * Parameters that are never written in the body and whose argument is a
+ * constant or a variable (with all arguments free of side effects) are
+ * substituted instead of bound, so "add(a : 1)" becomes "a + 1" after the
+ * fold.
+ *
+ * The cost of a call site is the node count of the callee body, sites above
+ * the budget keep the call. Functions taking more parameters than an internal
+ * call passes in registers (THRIVE_INTERNAL_ARG_REGS) are neither inlined nor
+ * specialized. Recursion is not part of the language, a function naming
+ * itself is never inlined and the number of inlined sites is capped as a
+ * sanity check.
+ */
+#ifndef THRIVE_INLINE_BUDGET
+#define THRIVE_INLINE_BUDGET 24
+#endif
+
+#define THRIVE_INLINE_MAX_FUNCS 256
+#define THRIVE_INLINE_MAX_PARAMS 6 /* THRIVE_INTERNAL_ARG_REGS */
+#define THRIVE_INLINE_MAX_SITES 4096
+
+typedef struct thrive_inline_func
+{
+    thrive_ast *decl;
+    u32 param_count;
+    u8 eligible;
+
+} thrive_inline_func;
+
+typedef struct thrive_inline_scan
+{
+    thrive_ast *name; /* name looked for in the body */
+    u8 used;
+    u8 written;       /* stored to, declared or address taken */
+
+} thrive_inline_scan;
+
+static thrive_inline_func inline_funcs[THRIVE_INLINE_MAX_FUNCS];
+static u32 inline_func_count;
+static u32 inline_budget;
+static u32 inline_sites;
+
+/* Parameters replaced by their argument while copying a body */
+static thrive_ast *inline_substitute_params[THRIVE_INLINE_MAX_PARAMS];
+static thrive_ast *inline_substitute_args[THRIVE_INLINE_MAX_PARAMS];
+static u32 inline_substitute_count;
+
+THRIVE_API void thrive_inline_count_visitor(thrive_ast *node, void *user)
+{
+    (void)node;
+    (*(u32 *)user)++;
+}
+
+THRIVE_API u32 thrive_inline_cost(thrive_ast *body)
+{
+    u32 count = 0;
+    thrive_ast_walk(body, thrive_inline_count_visitor, &count);
+    return count;
+}
+
+THRIVE_API u8 thrive_inline_is_name(thrive_ast *node, thrive_ast *name)
+{
+    return (u8)(node && node->kind == THRIVE_AST_NAME &&
+                thrive_ast_name_equals(node->data.name.start, node->data.name.length, name->data.name.start, name->data.name.length));
+}
+
+THRIVE_API void thrive_inline_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_inline_scan *scan = (thrive_inline_scan *)user;
+    thrive_ast *target = 0;
+
+    if (thrive_inline_is_name(node, scan->name))
+    {
+        scan->used = 1;
+    }
+
+    if (node->kind == THRIVE_AST_ASSIGN)
+    {
+        target = node->data.assign.left;
+    }
+    else if (node->kind == THRIVE_AST_DECL)
+    {
+        target = node->data.decl.name;
+    }
+    else if (node->kind == THRIVE_AST_ADDR_OF ||
+             (node->kind == THRIVE_AST_UNARY && (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)))
+    {
+        target = node->data.unary.expr;
+    }
+
+    if (thrive_inline_is_name(target, scan->name))
+    {
+        scan->written = 1;
+    }
+}
+
+THRIVE_API thrive_inline_scan thrive_inline_scan_body(thrive_ast *body, thrive_ast *name)
+{
+    thrive_inline_scan scan;
+
+    scan.name = name;
+    scan.used = 0;
+    scan.written = 0;
+    thrive_ast_walk(body, thrive_inline_scan_visitor, &scan);
+
+    return scan;
+}
+
+THRIVE_API thrive_inline_func *thrive_inline_find(thrive_ast *name)
+{
+    u32 i;
+
+    for (i = 0; i < inline_func_count; ++i)
+    {
+        if (thrive_inline_is_name(inline_funcs[i].decl->data.func_decl.name, name))
+        {
+            return &inline_funcs[i];
+        }
+    }
+
+    return 0;
+}
+
+THRIVE_API thrive_ast *thrive_inline_clone(thrive_state *state, thrive_ast *node);
+
+THRIVE_API thrive_ast *thrive_inline_clone_list(thrive_state *state, thrive_ast *list)
+{
+    thrive_ast *head = 0;
+    thrive_ast **tail = &head;
+
+    for (; list; list = list->next)
+    {
+        *tail = thrive_inline_clone(state, list);
+        tail = &(*tail)->next;
+    }
+
+    return head;
+}
+
+/* Deep copy of a callee body with the substituted parameters replaced */
+THRIVE_API thrive_ast *thrive_inline_clone(thrive_state *state, thrive_ast *node)
+{
+    thrive_ast *copy;
+    u32 i;
+
+    if (!node)
+    {
+        return 0;
+    }
+
+    if (node->kind == THRIVE_AST_NAME)
+    {
+        for (i = 0; i < inline_substitute_count; ++i)
+        {
+            if (thrive_inline_is_name(node, inline_substitute_params[i]))
+            {
+                node = inline_substitute_args[i];
+                break;
+            }
+        }
+    }
+
+    copy = thrive_ast_create(state, node->kind);
+    *copy = *node;
+    copy->next = 0;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+        copy->data.binary.left = thrive_inline_clone(state, node->data.binary.left);
+        copy->data.binary.right = thrive_inline_clone(state, node->data.binary.right);
+        break;
+    case THRIVE_AST_UNARY:
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ADDR_OF:
+        copy->data.unary.expr = thrive_inline_clone(state, node->data.unary.expr);
+        break;
+    case THRIVE_AST_TERNARY:
+        copy->data.ternary.cond = thrive_inline_clone(state, node->data.ternary.cond);
+        copy->data.ternary.then_expr = thrive_inline_clone(state, node->data.ternary.then_expr);
+        copy->data.ternary.else_expr = thrive_inline_clone(state, node->data.ternary.else_expr);
+        break;
+    case THRIVE_AST_IF:
+        copy->data.if_stmt.cond = thrive_inline_clone(state, node->data.if_stmt.cond);
+        copy->data.if_stmt.then_branch = thrive_inline_clone(state, node->data.if_stmt.then_branch);
+        copy->data.if_stmt.else_branch = thrive_inline_clone(state, node->data.if_stmt.else_branch);
+        break;
+    case THRIVE_AST_FOR:
+        copy->data.for_loop.init = thrive_inline_clone(state, node->data.for_loop.init);
+        copy->data.for_loop.cond = thrive_inline_clone(state, node->data.for_loop.cond);
+        copy->data.for_loop.step = thrive_inline_clone(state, node->data.for_loop.step);
+        copy->data.for_loop.body = thrive_inline_clone(state, node->data.for_loop.body);
+        break;
+    case THRIVE_AST_RETURN:
+        copy->data.ret.expr = thrive_inline_clone(state, node->data.ret.expr);
+        break;
+    case THRIVE_AST_ASSIGN:
+        copy->data.assign.left = thrive_inline_clone(state, node->data.assign.left);
+        copy->data.assign.right = thrive_inline_clone(state, node->data.assign.right);
+        break;
+    case THRIVE_AST_DECL:
+        copy->data.decl.name = thrive_inline_clone(state, node->data.decl.name);
+        copy->data.decl.value = thrive_inline_clone(state, node->data.decl.value);
+        break;
+    case THRIVE_AST_ARRAY_ACCESS:
+        copy->data.array_access.left = thrive_inline_clone(state, node->data.array_access.left);
+        copy->data.array_access.index = thrive_inline_clone(state, node->data.array_access.index);
+        break;
+    case THRIVE_AST_BLOCK:
+        copy->data.block.body = thrive_inline_clone_list(state, node->data.block.body);
+        break;
+    case THRIVE_AST_FUNC_CALL:
+        copy->data.func_call.args = thrive_inline_clone_list(state, node->data.func_call.args);
+        break;
+    case THRIVE_AST_INLINE:
+    {
+        /*
+         * Names of the scope being copied reach the nested body only as
+         * substituted arguments, which are never written there. Its bound
+         * parameters and its own locals shadow them.
+         */
+        thrive_ast *saved_params[THRIVE_INLINE_MAX_PARAMS];
+        thrive_ast *saved_args[THRIVE_INLINE_MAX_PARAMS];
+        u32 saved_count = inline_substitute_count;
+        u32 kept = 0;
+
+        copy->data.inline_call.args = thrive_inline_clone_list(state, node->data.inline_call.args);
+
+        for (i = 0; i < saved_count; ++i)
+        {
+            thrive_ast *param;
+            u8 shadowed = thrive_inline_scan_body(node->data.inline_call.body, inline_substitute_params[i]).written;
+
+            for (param = node->data.inline_call.params; param; param = param->next)
+            {
+                shadowed = (u8)(shadowed || thrive_inline_is_name(param, inline_substitute_params[i]));
+            }
+
+            saved_params[i] = inline_substitute_params[i];
+            saved_args[i] = inline_substitute_args[i];
+
+            if (!shadowed)
+            {
+                inline_substitute_params[kept] = saved_params[i];
+                inline_substitute_args[kept++] = saved_args[i];
+            }
+        }
+
+        inline_substitute_count = 0;
+        copy->data.inline_call.params = thrive_inline_clone_list(state, node->data.inline_call.params);
+
+        inline_substitute_count = kept;
+        copy->data.inline_call.body = thrive_inline_clone(state, node->data.inline_call.body);
+
+        for (i = 0; i < saved_count; ++i)
+        {
+            inline_substitute_params[i] = saved_params[i];
+            inline_substitute_args[i] = saved_args[i];
+        }
+
+        inline_substitute_count = saved_count;
+        break;
+    }
+    default:
+        break;
+    }
+
+    return copy;
+}
+
+/* Turns the call node into an inline node in place, so every reference to it stays valid */
+THRIVE_API void thrive_inline_expand(thrive_state *state, thrive_ast *call, thrive_inline_func *f)
+{
+    thrive_ast *body = f->decl->data.func_decl.body;
+    thrive_ast *param = f->decl->data.func_decl.params;
+    thrive_ast *arg = call->data.func_call.args;
+    thrive_ast **params_tail = &call->data.inline_call.params;
+    thrive_ast **args_tail = &call->data.inline_call.args;
+    u8 pure_args = 1;
+
+    for (; arg; arg = arg->next)
+    {
+        pure_args = (u8)(pure_args && thrive_ast_is_pure(arg));
+    }
+
+    arg = call->data.func_call.args;
+    call->kind = THRIVE_AST_INLINE;
+    *params_tail = 0;
+    inline_substitute_count = 0;
+
+    while (param)
+    {
+        thrive_ast *next_arg = arg->next;
+        thrive_inline_scan scan = thrive_inline_scan_body(body, param);
+        u8 substitute = (u8)(!scan.written && arg->kind == THRIVE_AST_INT);
+
+        /* A variable argument must not collide with any name the body uses */
+        if (!scan.written && pure_args && arg->kind == THRIVE_AST_NAME)
+        {
+            thrive_ast *other;
+
+            substitute = (u8)!thrive_inline_scan_body(body, arg).used;
+
+            for (other = f->decl->data.func_decl.params; other; other = other->next)
+            {
+                if (other != param && thrive_inline_is_name(other, arg))
+                {
+                    substitute = 0;
+                }
+            }
+        }
+
+        if (substitute)
+        {
+            inline_substitute_params[inline_substitute_count] = param;
+            inline_substitute_args[inline_substitute_count++] = arg;
+        }
+        else
+        {
+            *params_tail = thrive_ast_create(state, THRIVE_AST_NAME);
+            **params_tail = *param;
+            (*params_tail)->next = 0;
+            params_tail = &(*params_tail)->next;
+
+            arg->next = 0;
+            *args_tail = arg;
+            args_tail = &arg->next;
+        }
+
+        param = param->next;
+        arg = next_arg;
+    }
+
+    *args_tail = 0;
+    call->data.inline_call.body = thrive_inline_clone(state, body);
+    inline_substitute_count = 0;
+
+    inline_sites++;
+    optimizer_stats.inlined_calls++;
+}
+
+THRIVE_API void thrive_inline_visitor(thrive_ast *node, void *user)
+{
+    thrive_state *state = (thrive_state *)user;
+    thrive_inline_func *f;
+    thrive_ast *arg;
+    u32 arg_count = 0;
+    u32 cost;
+
+    if (node->kind != THRIVE_AST_FUNC_CALL || inline_sites >= THRIVE_INLINE_MAX_SITES)
+    {
+        return;
+    }
+
+    f = thrive_inline_find(node->data.func_call.name);
+
+    if (!f || !f->eligible)
+    {
+        return;
+    }
+
+    for (arg = node->data.func_call.args; arg; arg = arg->next)
+    {
+        arg_count++;
+    }
+
+    cost = thrive_inline_cost(f->decl->data.func_decl.body);
+
+    /* The copy (at most cost nodes) and the bound parameters must fit the pool */
+    if (arg_count != f->param_count || cost > inline_budget ||
+        state->ast_count + cost + arg_count > state->ast_capacity)
+    {
+        return;
+    }
+
+    thrive_inline_expand(state, node, f);
+}
+
+/* Inlines calls to functions whose body costs at most budget nodes, 0 disables inlining */
+THRIVE_API thrive_ast *thrive_ast_inline(thrive_state *state, thrive_ast *program, u32 budget)
+{
+    thrive_ast *curr;
+
+    inline_func_count = 0;
+    inline_budget = budget;
+    inline_sites = 0;
+
+    if (!budget)
+    {
+        return program;
+    }
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_inline_func *f;
+        thrive_ast *param;
+
+        if (curr->kind != THRIVE_AST_FUNC_DECL || inline_func_count == THRIVE_INLINE_MAX_FUNCS)
+        {
+            continue;
+        }
+
+        f = &inline_funcs[inline_func_count++];
+        f->decl = curr;
+        f->param_count = 0;
+
+        for (param = curr->data.func_decl.params; param; param = param->next)
+        {
+            f->param_count++;
+        }
+
+        f->eligible = (u8)(f->param_count <= THRIVE_INLINE_MAX_PARAMS &&
+                           curr->data.func_decl.body &&
+                           !thrive_inline_scan_body(curr->data.func_decl.body, curr->data.func_decl.name).used);
+    }
+
+    thrive_ast_walk(program, thrive_inline_visitor, state);
+
+    return thrive_ast_fold(program);
+}
+
+/* #############################################################################
+ * # [SECTION] Shared Globals
+ * #############################################################################
+ *
+ * Top-level variables live in .data / .bss, so functions can read and write
+ * them. The passes follow a scalar only through its own scope, a top-level
+ * scalar that some function uses becomes a one element array instead: array
+ * elements are memory, which the passes already expect to change across
+ * calls and stores.
+ *
+ *   u32 g = 1                  u32 $0[1] = 1
+ *   u32 bump() { ++g }    =>   u32 bump() { $0[0] = $0[0] + 1 }
+ *   print(g + bump())          print($0[0] + bump())
+ *
+ * Top-level arrays are memory already and keep their name. Functions
+ * declaring a parameter or a local of the same name keep theirs.
+ */
+#define THRIVE_SHARED_NODES 8 /* nodes created per rewritten use at most */
+
+typedef struct thrive_shared_scan
+{
+    thrive_state *state;
+    thrive_ast *name; /* the top-level scalar */
+    thrive_ast *temp; /* the array replacing it */
+    u32 uses;
+    u32 decls;
+
+} thrive_shared_scan;
+
+THRIVE_API void thrive_shared_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_shared_scan *scan = (thrive_shared_scan *)user;
+    thrive_ast *param = 0;
+
+    if (thrive_inline_is_name(node, scan->name))
+    {
+        scan->uses++;
+    }
+    else if (node->kind == THRIVE_AST_DECL && thrive_inline_is_name(node->data.decl.name, scan->name))
+    {
+        scan->decls++;
+    }
+    else if (node->kind == THRIVE_AST_FUNC_DECL || node->kind == THRIVE_AST_EXT_DECL)
+    {
+        param = node->kind == THRIVE_AST_FUNC_DECL ? node->data.func_decl.params : node->data.ext_decl.params;
+    }
+
+    for (; param; param = param->next)
+    {
+        scan->decls += (u32)thrive_inline_is_name(param, scan->name);
+    }
+}
+
+/* Walks the top-level code of program, or the bodies of the functions using name without declaring it */
+THRIVE_API void thrive_shared_walk(thrive_ast *program, u8 functions, thrive_ast_visit visit, thrive_shared_scan *scan)
+{
+    thrive_ast *curr;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL && functions)
+        {
+            thrive_shared_scan local = *scan;
+
+            local.uses = 0;
+            local.decls = 0;
+            thrive_ast_walk(curr, thrive_shared_scan_visitor, &local);
+
+            if (local.uses && !local.decls)
+            {
+                thrive_ast_walk(curr->data.func_decl.body, visit, scan);
+            }
+        }
+        else if (curr->kind != THRIVE_AST_FUNC_DECL && curr->kind != THRIVE_AST_EXT_DECL && !functions)
+        {
+            thrive_ast_walk(curr, visit, scan);
+        }
+    }
+}
+
+/* 1 if a function of program uses the top-level variable name */
+THRIVE_API u8 thrive_shared_is_used(thrive_ast *program, thrive_ast *name)
+{
+    thrive_shared_scan scan;
+
+    scan.state = 0;
+    scan.name = name;
+    scan.temp = 0;
+    scan.uses = 0;
+    scan.decls = 0;
+    thrive_shared_walk(program, 1, thrive_shared_scan_visitor, &scan);
+
+    return (u8)(scan.uses > 0);
+}
+
+/* temp[0] */
+THRIVE_API thrive_ast *thrive_shared_element(thrive_shared_scan *scan)
+{
+    thrive_ast *node = thrive_ast_create(scan->state, THRIVE_AST_ARRAY_ACCESS);
+    thrive_ast *name = thrive_ast_create(scan->state, THRIVE_AST_NAME);
+    thrive_ast *index = thrive_ast_create(scan->state, THRIVE_AST_INT);
+
+    *name = *scan->temp;
+    index->next = 0;
+    index->data.int_value = 0;
+    node->next = 0;
+    node->data.array_access.left = name;
+    node->data.array_access.index = index;
+
+    return node;
+}
+
+THRIVE_API void thrive_shared_rewrite_visitor(thrive_ast *node, void *user)
+{
+    thrive_shared_scan *scan = (thrive_shared_scan *)user;
+    thrive_ast *next = node->next;
+
+    if (node->kind == THRIVE_AST_DECL && thrive_inline_is_name(node->data.decl.name, scan->name))
+    {
+        node->data.decl.name = scan->temp;
+        node->data.decl.is_array = 1;
+        node->data.decl.array_size = 1;
+    }
+    else if (node->kind == THRIVE_AST_ADDR_OF && thrive_inline_is_name(node->data.unary.expr, scan->name))
+    {
+        *node = *scan->temp;
+        node->next = next;
+    }
+    else if (node->kind == THRIVE_AST_UNARY && thrive_inline_is_name(node->data.unary.expr, scan->name) &&
+             (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC))
+    {
+        thrive_ast *value = thrive_ast_create(scan->state, THRIVE_AST_BINARY);
+        thrive_ast *one = thrive_ast_create(scan->state, THRIVE_AST_INT);
+
+        one->next = 0;
+        one->data.int_value = 1;
+        value->next = 0;
+        value->data.binary.op = node->data.unary.op == THRIVE_TOKEN_KIND_INC ? THRIVE_TOKEN_KIND_ADD : THRIVE_TOKEN_KIND_SUB;
+        value->data.binary.left = thrive_shared_element(scan);
+        value->data.binary.right = one;
+
+        node->kind = THRIVE_AST_ASSIGN;
+        node->data.assign.left = thrive_shared_element(scan);
+        node->data.assign.right = value;
+    }
+    else if (thrive_inline_is_name(node, scan->name))
+    {
+        *node = *thrive_shared_element(scan);
+        node->next = next;
+    }
+}
+
+/* Turns the top-level scalars used by functions into one element arrays */
+THRIVE_API thrive_ast *thrive_ast_share(thrive_state *state, thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_shared_scan scan;
+        thrive_ast *other;
+
+        if (curr->kind != THRIVE_AST_DECL || curr->data.decl.is_array)
+        {
+            continue;
+        }
+
+        scan.state = state;
+        scan.name = curr->data.decl.name;
+        scan.temp = 0;
+        scan.uses = 0;
+        scan.decls = 0;
+        thrive_shared_walk(program, 0, thrive_shared_scan_visitor, &scan);
+
+        /* Declared once, and not also the name of a function */
+        for (other = program->data.block.body; other; other = other->next)
+        {
+            scan.decls += (u32)((other->kind == THRIVE_AST_FUNC_DECL && thrive_inline_is_name(other->data.func_decl.name, scan.name)) ||
+                                (other->kind == THRIVE_AST_EXT_DECL && thrive_inline_is_name(other->data.ext_decl.name, scan.name)));
+        }
+
+        if (scan.decls != 1 || !thrive_shared_is_used(program, scan.name))
+        {
+            continue;
+        }
+
+        thrive_shared_walk(program, 1, thrive_shared_scan_visitor, &scan);
+
+        if (state->ast_count + THRIVE_SHARED_NODES * scan.uses > state->ast_capacity)
+        {
+            continue;
+        }
+
+        scan.temp = thrive_ast_create_temp(state);
+
+        if (!scan.temp)
+        {
+            break;
+        }
+
+        /* The functions first, the top-level walk renames the declaration */
+        thrive_shared_walk(program, 1, thrive_shared_rewrite_visitor, &scan);
+        thrive_shared_walk(program, 0, thrive_shared_rewrite_visitor, &scan);
+
+        optimizer_stats.shared_globals++;
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Function Specialization
+ * #############################################################################
+ *
+ * Interprocedural constant propagation over the call graph, which has no
+ * cycles since the language has no recursion. Functions are visited callers
+ * first, so the calls in a body are final by the time its callees are
+ * looked at. Only calls from the top-level code and from functions that are
+ * still called count.
+ *
+ *   - a parameter that every call passes the same constant is replaced by
+ *     that constant in the body and dropped from the function and the calls
+ *   - calls that share the same constants for some parameters from at least
+ *     THRIVE_SPECIALIZE_MIN_SITES sites are redirected to a clone of the
+ *     function with those parameters substituted and dropped
+ *
+ * Both bodies are folded afterwards so branches on the constants vanish.
+ * Clones are named like temporaries ("$n") and their total node count is
+ * bounded by the budget. A parameter written in the body (or whose address
+ * is taken) is never substituted. The original is removed by the dead code
+ * elimination once every call went to a clone.
+ */
+#ifndef THRIVE_SPECIALIZE_BUDGET
+#define THRIVE_SPECIALIZE_BUDGET 256
+#endif
+
+#define THRIVE_SPECIALIZE_MAX_FUNCS 256
+#define THRIVE_SPECIALIZE_MAX_SITES 1024
+#define THRIVE_SPECIALIZE_MAX_CLONES 64
+#define THRIVE_SPECIALIZE_MIN_SITES 2
+
+typedef struct thrive_specialize_func
+{
+    thrive_ast *decl;
+    u32 param_count;
+    u8 done; /* its calls are final */
+    u8 live; /* called from the top-level code or a live function */
+
+} thrive_specialize_func;
+
+static thrive_specialize_func specialize_funcs[THRIVE_SPECIALIZE_MAX_FUNCS];
+static u32 specialize_func_count;
+static u32 specialize_budget;
+static u32 specialize_clones;
+
+/* Calls to the function being specialized */
+static thrive_ast *specialize_sites[THRIVE_SPECIALIZE_MAX_SITES];
+static u32 specialize_masks[THRIVE_SPECIALIZE_MAX_SITES]; /* bit per constant parameter */
+static u32 specialize_site_count;
+static u8 specialize_site_overflow;
+static thrive_ast *specialize_target;
+
+THRIVE_API void thrive_specialize_site_visitor(thrive_ast *node, void *user)
+{
+    (void)user;
+
+    if (node->kind != THRIVE_AST_FUNC_CALL || !thrive_inline_is_name(node->data.func_call.name, specialize_target))
+    {
+        return;
+    }
+
+    if (specialize_site_count == THRIVE_SPECIALIZE_MAX_SITES)
+    {
+        specialize_site_overflow = 1;
+        return;
+    }
+
+    specialize_sites[specialize_site_count++] = node;
+}
+
+/* Collects the calls to f from the top-level code and the live functions already done */
+THRIVE_API void thrive_specialize_collect(thrive_ast *program, thrive_specialize_func *f)
+{
+    thrive_ast *curr;
+    u32 i;
+
+    specialize_target = f->decl->data.func_decl.name;
+    specialize_site_count = 0;
+    specialize_site_overflow = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind != THRIVE_AST_FUNC_DECL && curr->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_ast_walk(curr, thrive_specialize_site_visitor, 0);
+        }
+    }
+
+    for (i = 0; i < specialize_func_count; ++i)
+    {
+        if (specialize_funcs[i].done && specialize_funcs[i].live)
+        {
+            thrive_ast_walk(specialize_funcs[i].decl->data.func_decl.body, thrive_specialize_site_visitor, 0);
+        }
+    }
+}
+
+THRIVE_API thrive_ast *thrive_specialize_arg(thrive_ast *call, u32 index)
+{
+    thrive_ast *arg = call->data.func_call.args;
+
+    for (; arg && index; --index)
+    {
+        arg = arg->next;
+    }
+
+    return arg;
+}
+
+/* Parameters of decl the call passes a constant for */
+THRIVE_API u32 thrive_specialize_mask(thrive_ast *decl, thrive_ast *call)
+{
+    thrive_ast *param = decl->data.func_decl.params;
+    thrive_ast *arg = call->data.func_call.args;
+    u32 mask = 0;
+    u32 i;
+
+    for (i = 0; param && arg; ++i, param = param->next, arg = arg->next)
+    {
+        if (arg->kind == THRIVE_AST_INT && !thrive_inline_scan_body(decl->data.func_decl.body, param).written)
+        {
+            mask |= 1u << i;
+        }
+    }
+
+    return (param || arg) ? 0 : mask;
+}
+
+/* 1 if both calls pass the same constants for the parameters in mask */
+THRIVE_API u8 thrive_specialize_same(thrive_ast *a, thrive_ast *b, u32 mask)
+{
+    u32 i;
+
+    for (i = 0; i < THRIVE_INLINE_MAX_PARAMS; ++i)
+    {
+        if ((mask & (1u << i)) && thrive_specialize_arg(a, i)->data.int_value != thrive_specialize_arg(b, i)->data.int_value)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* 1 if site j passes the constants of site i for the parameters in mask */
+THRIVE_API u8 thrive_specialize_matches(u32 i, u32 j, u32 mask)
+{
+    return (u8)((specialize_masks[j] & mask) == mask && thrive_specialize_same(specialize_sites[i], specialize_sites[j], mask));
+}
+
+THRIVE_API u32 thrive_specialize_last(u32 mask)
+{
+    u32 bit = 1u << (THRIVE_INLINE_MAX_PARAMS - 1);
+
+    while (!(mask & bit))
+    {
+        bit >>= 1;
+    }
+
+    return bit;
+}
+
+/* Copies decl with the parameters in mask replaced by the constants of call and folds the copy */
+THRIVE_API thrive_ast *thrive_specialize_copy(thrive_state *state, thrive_ast *decl, thrive_ast *call, u32 mask)
+{
+    thrive_ast *copy = thrive_ast_create(state, THRIVE_AST_FUNC_DECL);
+    thrive_ast **params_tail = &copy->data.func_decl.params;
+    thrive_ast *param;
+    u32 i;
+
+    *copy = *decl;
+    copy->next = 0;
+    inline_substitute_count = 0;
+
+    for (i = 0, param = decl->data.func_decl.params; param; ++i, param = param->next)
+    {
+        if (mask & (1u << i))
+        {
+            inline_substitute_params[inline_substitute_count] = param;
+            inline_substitute_args[inline_substitute_count++] = thrive_specialize_arg(call, i);
+            continue;
+        }
+
+        *params_tail = thrive_ast_create(state, THRIVE_AST_NAME);
+        **params_tail = *param;
+        (*params_tail)->next = 0;
+        params_tail = &(*params_tail)->next;
+    }
+
+    *params_tail = 0;
+    copy->data.func_decl.body = thrive_inline_clone(state, decl->data.func_decl.body);
+    inline_substitute_count = 0;
+
+    return thrive_ast_fold(copy);
+}
+
+/* Drops the arguments in mask from the call and makes it call name */
+THRIVE_API void thrive_specialize_redirect(thrive_state *state, thrive_ast *call, u32 mask, thrive_ast *name)
+{
+    thrive_ast **arg = &call->data.func_call.args;
+    u32 i;
+
+    for (i = 0; *arg; ++i)
+    {
+        if (mask & (1u << i))
+        {
+            *arg = (*arg)->next;
+        }
+        else
+        {
+            arg = &(*arg)->next;
+        }
+    }
+
+    call->data.func_call.name = thrive_ast_create(state, THRIVE_AST_NAME);
+    *call->data.func_call.name = *name;
+    call->data.func_call.name->next = 0;
+}
+
+THRIVE_API void thrive_specialize_function(thrive_state *state, thrive_ast *program, thrive_specialize_func *f)
+{
+    u32 cost;
+    u32 mask;
+    u32 i;
+    u32 j;
+
+    thrive_specialize_collect(program, f);
+    f->live = (u8)(specialize_site_count > 0 || specialize_site_overflow);
+
+    if (!f->live || specialize_site_overflow || !f->decl->data.func_decl.body || f->param_count > THRIVE_INLINE_MAX_PARAMS)
+    {
+        return;
+    }
+
+    /* The calls collected above miss the ones of f to itself, which may pass anything */
+    if (thrive_inline_scan_body(f->decl->data.func_decl.body, f->decl->data.func_decl.name).used)
+    {
+        return;
+    }
+
+    cost = thrive_inline_cost(f->decl->data.func_decl.body);
+    mask = (1u << f->param_count) - 1;
+
+    /* Constants every call agrees on go into the function itself */
+    for (i = 0; i < specialize_site_count; ++i)
+    {
+        mask &= thrive_specialize_mask(f->decl, specialize_sites[i]);
+
+        for (j = 0; j < f->param_count; ++j)
+        {
+            mask &= thrive_specialize_same(specialize_sites[0], specialize_sites[i], mask & (1u << j)) ? ~0u : ~(1u << j);
+        }
+    }
+
+    if (mask && state->ast_count + cost + f->param_count + 1 <= state->ast_capacity)
+    {
+        thrive_ast *copy = thrive_specialize_copy(state, f->decl, specialize_sites[0], mask);
+
+        f->decl->data.func_decl.params = copy->data.func_decl.params;
+        f->decl->data.func_decl.body = copy->data.func_decl.body;
+
+        for (i = 0; i < THRIVE_INLINE_MAX_PARAMS; ++i)
+        {
+            if (mask & (1u << i))
+            {
+                f->param_count--;
+                optimizer_stats.specialized_params++;
+            }
+        }
+
+        for (i = 0; i < specialize_site_count; ++i)
+        {
+            thrive_specialize_redirect(state, specialize_sites[i], mask, f->decl->data.func_decl.name);
+        }
+
+        cost = thrive_inline_cost(f->decl->data.func_decl.body);
+    }
+
+    /* Constants shared by several calls get a clone */
+    for (i = 0; i < specialize_site_count; ++i)
+    {
+        specialize_masks[i] = thrive_specialize_mask(f->decl, specialize_sites[i]);
+    }
+
+    for (i = 0; i < specialize_site_count; ++i)
+    {
+        thrive_specialize_func *clone;
+        thrive_ast *name;
+        u32 count;
+
+        /* Fewer constants are shared by more calls, drop the last ones until enough calls agree */
+        for (mask = specialize_masks[i]; mask; mask &= ~thrive_specialize_last(mask))
+        {
+            for (count = 0, j = i; j < specialize_site_count; ++j)
+            {
+                count += thrive_specialize_matches(i, j, mask);
+            }
+
+            if (count >= THRIVE_SPECIALIZE_MIN_SITES)
+            {
+                break;
+            }
+        }
+
+        if (!mask || cost > specialize_budget ||
+            specialize_clones == THRIVE_SPECIALIZE_MAX_CLONES || specialize_func_count == THRIVE_SPECIALIZE_MAX_FUNCS ||
+            state->ast_count + cost + f->param_count + 2 > state->ast_capacity)
+        {
+            continue;
+        }
+
+        name = thrive_ast_create_temp(state);
+
+        if (!name)
+        {
+            return;
+        }
+
+        clone = &specialize_funcs[specialize_func_count++];
+        clone->decl = thrive_specialize_copy(state, f->decl, specialize_sites[i], mask);
+        clone->decl->data.func_decl.name = name;
+        clone->decl->next = f->decl->next;
+        f->decl->next = clone->decl;
+        clone->param_count = f->param_count;
+        clone->done = 1;
+        clone->live = 1;
+
+        for (j = 0; j < THRIVE_INLINE_MAX_PARAMS; ++j)
+        {
+            clone->param_count -= (u32)((mask >> j) & 1);
+        }
+
+        /* Sites are compared against the first one, redirect it last */
+        for (j = specialize_site_count; j-- > i;)
+        {
+            if (thrive_specialize_matches(i, j, mask))
+            {
+                thrive_specialize_redirect(state, specialize_sites[j], mask, name);
+                specialize_masks[j] = 0;
+            }
+        }
+
+        specialize_budget -= cost;
+        specialize_clones++;
+        optimizer_stats.specialized_clones++;
+    }
+}
+
+/* Propagates constant arguments into functions and clones functions per shared constants, 0 disables cloning */
+THRIVE_API thrive_ast *thrive_ast_specialize(thrive_state *state, thrive_ast *program, u32 budget)
+{
+    thrive_ast *curr;
+    u32 i;
+    u32 j;
+
+    specialize_func_count = 0;
+    specialize_budget = budget;
+    specialize_clones = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_specialize_func *f;
+        thrive_ast *param;
+
+        if (curr->kind != THRIVE_AST_FUNC_DECL)
+        {
+            continue;
+        }
+
+        /* Every function takes part in the ordering, give up on programs with more */
+        if (specialize_func_count == THRIVE_SPECIALIZE_MAX_FUNCS)
+        {
+            return program;
+        }
+
+        f = &specialize_funcs[specialize_func_count++];
+        f->decl = curr;
+        f->param_count = 0;
+        f->done = 0;
+        f->live = 0;
+
+        for (param = curr->data.func_decl.params; param; param = param->next)
+        {
+            f->param_count++;
+        }
+    }
+
+    /* Next is a function no pending function calls, none left means a cycle */
+    for (;;)
+    {
+        thrive_specialize_func *next = 0;
+
+        for (i = 0; i < specialize_func_count && !next; ++i)
+        {
+            next = specialize_funcs[i].done ? 0 : &specialize_funcs[i];
+
+            for (j = 0; j < specialize_func_count && next; ++j)
+            {
+                if (j != i && !specialize_funcs[j].done &&
+                    thrive_inline_scan_body(specialize_funcs[j].decl->data.func_decl.body, next->decl->data.func_decl.name).used)
+                {
+                    next = 0;
+                }
+            }
+        }
+
+        if (!next)
+        {
+            break;
+        }
+
+        thrive_specialize_function(state, program, next);
+        next->done = 1;
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Loop Unrolling
+ * #############################################################################
+ *
+ * Recognizes counted loops of the form
+ *
+ *   for (i = c0 : i < limit : ++i)    (also <=, > and >= with --i, i += c, i -= c)
+ *
+ * where the body never writes i or the names of limit and neither has its
+ * address taken in the enclosing function.
+ *
+ * If c0 and limit are constants and all copies of the body cost at most the
+ * budget, the loop is replaced by one copy of the body per iteration with i
+ * substituted by its value, followed by the final store to i. Bodies with a
+ * break or continue of their own are not fully unrolled.
+ *
+ * Other innermost loops are marked to run 8, 4 or 2 copies of the body per
+ * guarded iteration. The codegen checks "i + (n - 1) * c < limit" once, runs
+ * the n copies each followed by the step and lets the plain loop execute the
+ * remaining iterations. Every copy has its own continue label and break
+ * leaves the whole loop, so both keep their meaning.
+ *
+ * Bodies that declare variables or hold string literals are left alone,
+ * every copy would get its own stack slot or string.
+ */
+#ifndef THRIVE_UNROLL_BUDGET
+#define THRIVE_UNROLL_BUDGET 128
+#endif
+
+#define THRIVE_UNROLL_MAX_LOOPS 1024
+#define THRIVE_UNROLL_MAX_STEP 0xFFFF
+
+typedef struct thrive_unroll_loop
+{
+    thrive_ast *var;   /* induction variable */
+    thrive_ast *limit; /* bound the variable is compared against */
+    u32 step;          /* added (or subtracted) per iteration */
+    u8 down;           /* 1 if the variable counts down */
+
+} thrive_unroll_loop;
+
+typedef struct thrive_unroll_scan
+{
+    thrive_ast *name; /* name looked for in the scope */
+    u8 address_taken;
+
+} thrive_unroll_scan;
+
+static thrive_ast *unroll_loops[THRIVE_UNROLL_MAX_LOOPS];
+static thrive_ast *unroll_scopes[THRIVE_UNROLL_MAX_LOOPS];
+static u32 unroll_loop_count;
+static u32 unroll_budget;
+
+/* An expression that yields the same value on every iteration of body */
+THRIVE_API u8 thrive_unroll_invariant(thrive_ast *node, thrive_ast *body)
+{
+    switch (node->kind)
+    {
+    case THRIVE_AST_INT:
+        return 1;
+    case THRIVE_AST_NAME:
+        return (u8)!thrive_inline_scan_body(body, node).written;
+    case THRIVE_AST_BINARY:
+        return (u8)(thrive_unroll_invariant(node->data.binary.left, body) && thrive_unroll_invariant(node->data.binary.right, body));
+    case THRIVE_AST_UNARY:
+        return (u8)(node->data.unary.op != THRIVE_TOKEN_KIND_INC && node->data.unary.op != THRIVE_TOKEN_KIND_DEC &&
+                    thrive_unroll_invariant(node->data.unary.expr, body));
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API void thrive_unroll_blocker_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_DECL || node->kind == THRIVE_AST_STRING)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+/* A break or continue that belongs to the loop itself (not to a nested one) */
+THRIVE_API u8 thrive_unroll_has_jump(thrive_ast *node)
+{
+    thrive_ast *curr;
+
+    if (!node)
+    {
+        return 0;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BREAK:
+    case THRIVE_AST_CONTINUE:
+        return 1;
+    case THRIVE_AST_IF:
+        return (u8)(thrive_unroll_has_jump(node->data.if_stmt.then_branch) || thrive_unroll_has_jump(node->data.if_stmt.else_branch));
+    case THRIVE_AST_BLOCK:
+        for (curr = node->data.block.body; curr; curr = curr->next)
+        {
+            if (thrive_unroll_has_jump(curr))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+/* Matches the condition and step of a counted loop, the body is not checked */
+THRIVE_API u8 thrive_unroll_match(thrive_ast *node, thrive_unroll_loop *loop)
+{
+    thrive_ast *cond = node->data.for_loop.cond;
+    thrive_ast *step = node->data.for_loop.step;
+    thrive_ast *body = node->data.for_loop.body;
+    u8 step_down;
+
+    if (!cond || !step || !body || cond->kind != THRIVE_AST_BINARY || cond->data.binary.left->kind != THRIVE_AST_NAME)
+    {
+        return 0;
+    }
+
+    loop->var = cond->data.binary.left;
+    loop->limit = cond->data.binary.right;
+
+    switch (cond->data.binary.op)
+    {
+    case THRIVE_TOKEN_KIND_LT:
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+        loop->down = 0;
+        break;
+    case THRIVE_TOKEN_KIND_GT:
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+        loop->down = 1;
+        break;
+    default:
+        return 0;
+    }
+
+    /* ++i, --i or i = i + c, i = i - c (the form of i += c) */
+    if (step->kind == THRIVE_AST_UNARY &&
+        (step->data.unary.op == THRIVE_TOKEN_KIND_INC || step->data.unary.op == THRIVE_TOKEN_KIND_DEC) &&
+        thrive_inline_is_name(step->data.unary.expr, loop->var))
+    {
+        loop->step = 1;
+        step_down = (u8)(step->data.unary.op == THRIVE_TOKEN_KIND_DEC);
+    }
+    else if (step->kind == THRIVE_AST_ASSIGN &&
+             thrive_inline_is_name(step->data.assign.left, loop->var) &&
+             step->data.assign.right->kind == THRIVE_AST_BINARY &&
+             (step->data.assign.right->data.binary.op == THRIVE_TOKEN_KIND_ADD || step->data.assign.right->data.binary.op == THRIVE_TOKEN_KIND_SUB) &&
+             thrive_inline_is_name(step->data.assign.right->data.binary.left, loop->var) &&
+             step->data.assign.right->data.binary.right->kind == THRIVE_AST_INT)
+    {
+        loop->step = step->data.assign.right->data.binary.right->data.int_value;
+        step_down = (u8)(step->data.assign.right->data.binary.op == THRIVE_TOKEN_KIND_SUB);
+    }
+    else
+    {
+        return 0;
+    }
+
+    return (u8)(step_down == loop->down && loop->step != 0 && loop->step <= THRIVE_UNROLL_MAX_STEP);
+}
+
+/* Matches the counted loop shape, used by the pass and again by the codegen */
+THRIVE_API u8 thrive_unroll_analyze(thrive_ast *node, thrive_unroll_loop *loop)
+{
+    thrive_ast *body = node->data.for_loop.body;
+    u8 blocked = 0;
+
+    if (!thrive_unroll_match(node, loop))
+    {
+        return 0;
+    }
+
+    thrive_ast_walk(body, thrive_unroll_blocker_visitor, &blocked);
+
+    return (u8)(!blocked &&
+                !thrive_inline_scan_body(body, loop->var).written &&
+                !thrive_inline_scan_body(loop->limit, loop->var).used &&
+                thrive_unroll_invariant(loop->limit, body));
+}
+
+THRIVE_API void thrive_unroll_address_visitor(thrive_ast *node, void *user)
+{
+    thrive_unroll_scan *scan = (thrive_unroll_scan *)user;
+
+    if (node->kind == THRIVE_AST_ADDR_OF && thrive_inline_is_name(node->data.unary.expr, scan->name))
+    {
+        scan->address_taken = 1;
+    }
+}
+
+/* Whether &name is taken in scope for any name of expr (a pointer could then write it) */
+THRIVE_API u8 thrive_unroll_address_taken(thrive_ast *scope, thrive_ast *expr)
+{
+    thrive_unroll_scan scan;
+
+    switch (expr->kind)
+    {
+    case THRIVE_AST_NAME:
+        scan.name = expr;
+        scan.address_taken = 0;
+        thrive_ast_walk(scope, thrive_unroll_address_visitor, &scan);
+        return scan.address_taken;
+    case THRIVE_AST_BINARY:
+        return (u8)(thrive_unroll_address_taken(scope, expr->data.binary.left) || thrive_unroll_address_taken(scope, expr->data.binary.right));
+    case THRIVE_AST_UNARY:
+        return thrive_unroll_address_taken(scope, expr->data.unary.expr);
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API void thrive_unroll_has_loop_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_FOR)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+THRIVE_API void thrive_unroll_collect_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_FOR && unroll_loop_count < THRIVE_UNROLL_MAX_LOOPS)
+    {
+        unroll_scopes[unroll_loop_count] = (thrive_ast *)user;
+        unroll_loops[unroll_loop_count++] = node;
+    }
+}
+
+/* The loop condition as the codegen evaluates it (signed 64-bit) */
+THRIVE_API u8 thrive_unroll_compare(thrive_token_kind op, i64 a, i64 b)
+{
+    switch (op)
+    {
+    case THRIVE_TOKEN_KIND_LT:
+        return (u8)(a < b);
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+        return (u8)(a <= b);
+    case THRIVE_TOKEN_KIND_GT:
+        return (u8)(a > b);
+    default:
+        return (u8)(a >= b);
+    }
+}
+
+/* Turns the loop into a block with one copy of the body per iteration in place */
+THRIVE_API u8 thrive_unroll_full(thrive_state *state, thrive_ast *node, thrive_unroll_loop *loop, u32 cost)
+{
+    thrive_ast *init = node->data.for_loop.init;
+    thrive_ast *body = node->data.for_loop.body;
+    thrive_ast *head = 0;
+    thrive_ast **tail = &head;
+    thrive_token_kind op = node->data.for_loop.cond->data.binary.op;
+    i64 delta = loop->down ? -(i64)loop->step : (i64)loop->step;
+    i64 start;
+    i64 current;
+    u32 trips = 0;
+
+    if (!init || init->kind != THRIVE_AST_ASSIGN || !thrive_inline_is_name(init->data.assign.left, loop->var) ||
+        init->data.assign.right->kind != THRIVE_AST_INT || loop->limit->kind != THRIVE_AST_INT ||
+        thrive_unroll_has_jump(body))
+    {
+        return 0;
+    }
+
+    start = (i64)init->data.assign.right->data.int_value;
+
+    for (current = start; thrive_unroll_compare(op, current, (i64)loop->limit->data.int_value); current += delta)
+    {
+        if (++trips * cost > unroll_budget)
+        {
+            return 0;
+        }
+    }
+
+    /* The value i is left with must fit an immediate, the copies must fit the pool */
+    if (current < 0 || current > 0xFFFFFFFF || state->ast_count + trips * (cost + 1) > state->ast_capacity)
+    {
+        return 0;
+    }
+
+    inline_substitute_params[0] = loop->var;
+    inline_substitute_count = 1;
+
+    for (current = start; trips > 0; --trips, current += delta)
+    {
+        thrive_ast *value = thrive_ast_create(state, THRIVE_AST_INT);
+        value->next = 0;
+        value->data.int_value = (u32)current;
+
+        inline_substitute_args[0] = value;
+        *tail = thrive_inline_clone(state, body);
+        tail = &(*tail)->next;
+    }
+
+    inline_substitute_count = 0;
+
+    /* The init becomes the final store "i = c" */
+    init->data.assign.right->data.int_value = (u32)current;
+    init->next = 0;
+    *tail = init;
+
+    node->kind = THRIVE_AST_BLOCK;
+    node->data.block.body = head;
+
+    return 1;
+}
+
+/* Unrolls counted loops whose copies cost at most budget AST nodes, 0 disables unrolling */
+THRIVE_API thrive_ast *thrive_ast_unroll(thrive_state *state, thrive_ast *program, u32 budget)
+{
+    thrive_ast *curr;
+    u32 i;
+
+    unroll_loop_count = 0;
+    unroll_budget = budget;
+
+    if (!budget)
+    {
+        return program;
+    }
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_ast_walk(curr, thrive_unroll_collect_visitor, curr->kind == THRIVE_AST_FUNC_DECL ? curr : program);
+    }
+
+    /* Collected in pre-order, going backwards handles nested loops first */
+    for (i = unroll_loop_count; i > 0; --i)
+    {
+        thrive_ast *node = unroll_loops[i - 1];
+        thrive_ast *scope = unroll_scopes[i - 1];
+        thrive_unroll_loop loop;
+        u32 factor = 8;
+        u8 nested = 0;
+        u32 cost;
+
+        if (!thrive_unroll_analyze(node, &loop) ||
+            thrive_unroll_address_taken(scope, loop.var) || thrive_unroll_address_taken(scope, loop.limit))
+        {
+            continue;
+        }
+
+        cost = thrive_inline_cost(node->data.for_loop.body);
+
+        if (thrive_unroll_full(state, node, &loop, cost))
+        {
+            optimizer_stats.unrolled_loops++;
+            continue;
+        }
+
+        thrive_ast_walk(node->data.for_loop.body, thrive_unroll_has_loop_visitor, &nested);
+
+        while (factor > 1 && factor * cost > budget)
+        {
+            factor >>= 1;
+        }
+
+        if (!nested && factor > 1)
+        {
+            node->data.for_loop.unroll = factor;
+            optimizer_stats.partially_unrolled++;
+        }
+    }
+
+    return thrive_ast_fold(program);
+}
+
+/* #############################################################################
+ * # [SECTION] Scalar Replacement
+ * #############################################################################
+ *
+ * Splits small local arrays whose address never escapes into one variable
+ * per element. An array qualifies when every use of its name in the scope
+ * (a function or the top-level code) indexes it with a constant in bounds:
+ * it is not assigned, passed, dereferenced or has an element address taken.
+ * Runs after the unrolling, which turns "a[i]" in counted loops into
+ * constant indices.
+ *
+ * Elements become plain slots named like temporaries ("$n"), addressed
+ * directly instead of through base + index * 8, and the propagation can track
+ * them like any other variable.
+ */
+#define THRIVE_PROMOTE_MAX_ELEMENTS 8
+#define THRIVE_PROMOTE_MAX_ARRAYS 256
+
+typedef struct thrive_promote_scan
+{
+    thrive_ast *name; /* array looked for */
+    u32 size;
+    u32 decls;     /* declarations (and parameters) of the name */
+    u32 uses;      /* NAME nodes with the name, declarations included */
+    u32 constants; /* of which index the array in bounds with a constant */
+
+} thrive_promote_scan;
+
+static thrive_ast *promote_decls[THRIVE_PROMOTE_MAX_ARRAYS];
+static u32 promote_decl_count;
+
+/* Element variables of the array being replaced */
+static thrive_ast *promote_name;
+static thrive_ast *promote_elements[THRIVE_PROMOTE_MAX_ELEMENTS];
+
+/* Walks a function or, for the program, the top-level code only */
+THRIVE_API void thrive_promote_walk(thrive_ast *scope, thrive_ast_visit visit, void *user)
+{
+    thrive_ast *curr;
+
+    if (scope->kind != THRIVE_AST_BLOCK)
+    {
+        thrive_ast_walk(scope, visit, user);
+        return;
+    }
+
+    for (curr = scope->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind != THRIVE_AST_FUNC_DECL && curr->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_ast_walk(curr, visit, user);
+        }
+    }
+}
+
+THRIVE_API void thrive_promote_collect_visitor(thrive_ast *node, void *user)
+{
+    (void)user;
+
+    if (node->kind == THRIVE_AST_DECL && node->data.decl.is_array && node->data.decl.array_size > 0 &&
+        node->data.decl.array_size <= THRIVE_PROMOTE_MAX_ELEMENTS && promote_decl_count < THRIVE_PROMOTE_MAX_ARRAYS)
+    {
+        promote_decls[promote_decl_count++] = node;
+    }
+}
+
+THRIVE_API void thrive_promote_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_promote_scan *scan = (thrive_promote_scan *)user;
+    thrive_ast *param = 0;
+
+    if (thrive_inline_is_name(node, scan->name))
+    {
+        scan->uses++;
+    }
+    else if (node->kind == THRIVE_AST_DECL && thrive_inline_is_name(node->data.decl.name, scan->name))
+    {
+        scan->decls++;
+    }
+    else if (node->kind == THRIVE_AST_FUNC_DECL)
+    {
+        param = node->data.func_decl.params;
+    }
+    else if (node->kind == THRIVE_AST_INLINE)
+    {
+        param = node->data.inline_call.params;
+    }
+    else if (node->kind == THRIVE_AST_ARRAY_ACCESS && thrive_inline_is_name(node->data.array_access.left, scan->name) &&
+             node->data.array_access.index->kind == THRIVE_AST_INT && node->data.array_access.index->data.int_value < scan->size)
+    {
+        scan->constants++;
+    }
+    else if (node->kind == THRIVE_AST_ADDR_OF && node->data.unary.expr->kind == THRIVE_AST_ARRAY_ACCESS &&
+             thrive_inline_is_name(node->data.unary.expr->data.array_access.left, scan->name))
+    {
+        /* &a[k] points into the array, it escapes like the bare name */
+        scan->uses++;
+    }
+
+    for (; param; param = param->next)
+    {
+        scan->decls += (u32)thrive_inline_is_name(param, scan->name);
+    }
+}
+
+THRIVE_API void thrive_promote_rewrite_visitor(thrive_ast *node, void *user)
+{
+    thrive_ast *next = node->next;
+
+    (void)user;
+
+    if (node->kind == THRIVE_AST_ARRAY_ACCESS && thrive_inline_is_name(node->data.array_access.left, promote_name))
+    {
+        *node = *promote_elements[node->data.array_access.index->data.int_value];
+        node->next = next;
+    }
+}
+
+/* Replaces the arrays of scope that never escape by their elements */
+THRIVE_API void thrive_promote_scope(thrive_state *state, thrive_ast *scope)
+{
+    u32 i;
+    u32 k;
+
+    promote_decl_count = 0;
+    thrive_promote_walk(scope, thrive_promote_collect_visitor, 0);
+
+    for (i = 0; i < promote_decl_count; ++i)
+    {
+        thrive_ast *decl = promote_decls[i];
+        thrive_promote_scan scan;
+
+        scan.name = decl->data.decl.name;
+        scan.size = decl->data.decl.array_size;
+        scan.decls = 0;
+        scan.uses = 0;
+        scan.constants = 0;
+        thrive_promote_walk(scope, thrive_promote_scan_visitor, &scan);
+
+        /* Arrays of the top-level code that functions use are memory shared with them */
+        if (scan.decls != 1 || scan.uses != 1 + scan.constants || state->ast_count + 2 * scan.size > state->ast_capacity ||
+            (scope->kind == THRIVE_AST_BLOCK && thrive_shared_is_used(scope, scan.name)))
+        {
+            continue;
+        }
+
+        for (k = 0; k < scan.size; ++k)
+        {
+            promote_elements[k] = thrive_ast_create_temp(state);
+
+            if (!promote_elements[k])
+            {
+                return;
+            }
+        }
+
+        promote_name = decl->data.decl.name;
+        thrive_promote_walk(scope, thrive_promote_rewrite_visitor, 0);
+
+        /* The declaration becomes the first element, the others follow it */
+        decl->data.decl.name = promote_elements[0];
+        decl->data.decl.is_array = 0;
+        decl->data.decl.array_size = 0;
+
+        for (k = scan.size - 1; k > 0; --k)
+        {
+            thrive_ast *element = thrive_ast_create(state, THRIVE_AST_DECL);
+
+            *element = *decl;
+            element->data.decl.name = promote_elements[k];
+            decl->next = element;
+        }
+
+        optimizer_stats.promoted_arrays++;
+    }
+}
+
+/* Splits local arrays indexed only with constants into scalars */
+THRIVE_API thrive_ast *thrive_ast_promote(thrive_state *state, thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL)
+        {
+            thrive_promote_scope(state, curr);
+        }
+    }
+
+    thrive_promote_scope(state, program);
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Value Range Analysis
+ * #############################################################################
+ *
+ * Integer intervals for the variables of one scope (a function or the
+ * top-level code), known in two cases:
+ *
+ *   - the counter of a counted loop inside the body, when the body never
+ *     writes it and its address is never taken: "for (i = a : i < n : ++i)"
+ *     keeps i in [a, n - 1]
+ *   - a scalar whose declaration is its only store, up to the end of the
+ *     enclosing block
+ *
+ * Expression ranges follow the 64-bit arithmetic of the codegen (division and
+ * remainder are unsigned 32-bit). Comparisons the ranges decide become 0 or 1,
+ * which lets the folding drop the branch they guard, and masks or remainders
+ * that keep every value of their operand ("i & 255", "i % 16" with i in
+ * [0, 9]) are removed.
+ */
+#define THRIVE_RANGE_MAX_VARS 64
+#define THRIVE_RANGE_MAX_REPORT 64
+#define THRIVE_RANGE_LIMIT 0xFFFFFFFF /* bounds further from zero are treated as unknown */
+
+typedef struct thrive_range
+{
+    i64 lo;
+    i64 hi;
+    u8 known;
+
+} thrive_range;
+
+typedef struct thrive_range_var
+{
+    thrive_ast *scope; /* name of the function, 0 for the top-level code */
+    thrive_ast *name;
+    thrive_range range;
+
+} thrive_range_var;
+
+typedef struct thrive_range_scan
+{
+    thrive_ast *name; /* variable looked for */
+    u32 writes;       /* declarations, parameters, stores and ++ / -- */
+    u8 address_taken;
+
+} thrive_range_scan;
+
+static thrive_range_var range_vars[THRIVE_RANGE_MAX_VARS];
+static u32 range_var_count;
+static thrive_ast *range_scope; /* function or program being analyzed */
+static thrive_ast *range_scope_name;
+
+/* Every range pushed by the last run, for the debug dump */
+static thrive_range_var range_reports[THRIVE_RANGE_MAX_REPORT];
+static u32 range_report_count;
+
+THRIVE_API thrive_range thrive_range_make(i64 lo, i64 hi)
+{
+    thrive_range r;
+
+    r.lo = lo;
+    r.hi = hi;
+    r.known = (u8)(lo <= hi && lo >= -(i64)THRIVE_RANGE_LIMIT && hi <= (i64)THRIVE_RANGE_LIMIT);
+
+    return r;
+}
+
+THRIVE_API thrive_range thrive_range_binary(thrive_token_kind op, thrive_range l, thrive_range r)
+{
+    thrive_range none = thrive_range_make(1, 0);
+    i64 p[4];
+    i64 lo;
+    i64 hi;
+    u32 i;
+
+    switch (op)
+    {
+    case THRIVE_TOKEN_KIND_LT:
+    case THRIVE_TOKEN_KIND_GT:
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+    case THRIVE_TOKEN_KIND_EQUALS:
+    case THRIVE_TOKEN_KIND_NOT_EQUALS:
+    case THRIVE_TOKEN_KIND_AND_LOGICAL:
+    case THRIVE_TOKEN_KIND_OR_LOGICAL:
+        return thrive_range_make(0, 1);
+    case THRIVE_TOKEN_KIND_AND_BITWISE:
+        /* Either operand that cannot be negative bounds the result */
+        hi = (i64)THRIVE_RANGE_LIMIT + 1;
+        hi = (l.known && l.lo >= 0 && l.hi < hi) ? l.hi : hi;
+        hi = (r.known && r.lo >= 0 && r.hi < hi) ? r.hi : hi;
+        return thrive_range_make(0, hi);
+    default:
+        break;
+    }
+
+    if (!l.known || !r.known)
+    {
+        return none;
+    }
+
+    switch (op)
+    {
+    case THRIVE_TOKEN_KIND_ADD:
+        return thrive_range_make(l.lo + r.lo, l.hi + r.hi);
+    case THRIVE_TOKEN_KIND_SUB:
+        return thrive_range_make(l.lo - r.hi, l.hi - r.lo);
+    case THRIVE_TOKEN_KIND_MUL:
+        /* Bounds below 2^31 cannot overflow the products */
+        if (l.lo < -0x7FFFFFFF || l.hi > 0x7FFFFFFF || r.lo < -0x7FFFFFFF || r.hi > 0x7FFFFFFF)
+        {
+            return none;
+        }
+
+        p[0] = l.lo * r.lo;
+        p[1] = l.lo * r.hi;
+        p[2] = l.hi * r.lo;
+        p[3] = l.hi * r.hi;
+        lo = p[0];
+        hi = p[0];
+
+        for (i = 1; i < 4; ++i)
+        {
+            lo = p[i] < lo ? p[i] : lo;
+            hi = p[i] > hi ? p[i] : hi;
+        }
+        return thrive_range_make(lo, hi);
+    case THRIVE_TOKEN_KIND_DIV:
+        return (l.lo >= 0 && r.lo > 0) ? thrive_range_make(l.lo / r.hi, l.hi / r.lo) : none;
+    case THRIVE_TOKEN_KIND_MOD:
+        if (r.lo <= 0)
+        {
+            return none;
+        }
+        return thrive_range_make(0, (l.lo >= 0 && l.hi < r.hi) ? l.hi : r.hi - 1);
+    case THRIVE_TOKEN_KIND_RSHIFT:
+        return (l.lo >= 0 && r.lo == r.hi && r.lo < 64) ? thrive_range_make(l.lo >> r.lo, l.hi >> r.lo) : none;
+    case THRIVE_TOKEN_KIND_LSHIFT:
+        return (l.lo >= 0 && r.lo == r.hi && r.lo < 32 && l.hi <= ((i64)THRIVE_RANGE_LIMIT >> r.lo)) ? thrive_range_make(l.lo << r.lo, l.hi << r.lo) : none;
+    default:
+        return none;
+    }
+}
+
+THRIVE_API thrive_range thrive_range_of(thrive_ast *node)
+{
+    thrive_range none = thrive_range_make(1, 0);
+    thrive_range a;
+    thrive_range b;
+    u32 i;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_INT:
+        return thrive_range_make(node->data.int_value, node->data.int_value);
+    case THRIVE_AST_NAME:
+        for (i = range_var_count; i-- > 0;)
+        {
+            if (thrive_inline_is_name(node, range_vars[i].name))
+            {
+                return range_vars[i].range;
+            }
+        }
+        return none;
+    case THRIVE_AST_BINARY:
+        return thrive_range_binary(node->data.binary.op, thrive_range_of(node->data.binary.left), thrive_range_of(node->data.binary.right));
+    case THRIVE_AST_UNARY:
+        a = thrive_range_of(node->data.unary.expr);
+
+        switch (node->data.unary.op)
+        {
+        case THRIVE_TOKEN_KIND_SUB:
+            return a.known ? thrive_range_make(-a.hi, -a.lo) : none;
+        case THRIVE_TOKEN_KIND_NOT_BITWISE:
+            return thrive_range_make(0, THRIVE_RANGE_LIMIT); /* 32-bit not */
+        case THRIVE_TOKEN_KIND_NEGATE:
+            return thrive_range_make(0, 1);
+        default:
+            return none;
+        }
+    case THRIVE_AST_TERNARY:
+        a = thrive_range_of(node->data.ternary.then_expr);
+        b = thrive_range_of(node->data.ternary.else_expr);
+
+        if (!a.known || !b.known)
+        {
+            return none;
+        }
+        return thrive_range_make(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi);
+    default:
+        return none;
+    }
+}
+
+/* 1 or 0 when the operand ranges decide the comparison, -1 otherwise */
+THRIVE_API i32 thrive_range_decide(thrive_token_kind op, thrive_range l, thrive_range r)
+{
+    if (!l.known || !r.known)
+    {
+        return -1;
+    }
+
+    switch (op)
+    {
+    case THRIVE_TOKEN_KIND_LT:
+        return l.hi < r.lo ? 1 : (l.lo >= r.hi ? 0 : -1);
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+        return l.hi <= r.lo ? 1 : (l.lo > r.hi ? 0 : -1);
+    case THRIVE_TOKEN_KIND_GT:
+        return l.lo > r.hi ? 1 : (l.hi <= r.lo ? 0 : -1);
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+        return l.lo >= r.hi ? 1 : (l.hi < r.lo ? 0 : -1);
+    case THRIVE_TOKEN_KIND_EQUALS:
+    case THRIVE_TOKEN_KIND_NOT_EQUALS:
+        if (l.hi < r.lo || l.lo > r.hi)
+        {
+            return op == THRIVE_TOKEN_KIND_NOT_EQUALS;
+        }
+        if (l.lo == l.hi && r.lo == r.hi)
+        {
+            return op == THRIVE_TOKEN_KIND_EQUALS;
+        }
+        return -1;
+    default:
+        return -1;
+    }
+}
+
+/* Whether "value & mask" is value for every value in r */
+THRIVE_API u8 thrive_range_mask_keeps(thrive_range r, u32 mask)
+{
+    u64 bits = (u64)r.hi;
+
+    if (!r.known || r.lo < 0)
+    {
+        return 0;
+    }
+
+    /* Every bit below the highest one of r.hi must survive */
+    bits |= bits >> 1;
+    bits |= bits >> 2;
+    bits |= bits >> 4;
+    bits |= bits >> 8;
+    bits |= bits >> 16;
+    bits |= bits >> 32;
+
+    return (u8)((bits & (u64)mask) == bits);
+}
+
+/* Folds decided comparisons and redundant masks below node, bottom-up */
+THRIVE_API void thrive_range_expr(thrive_ast *node)
+{
+    thrive_ast *curr;
+    thrive_ast *left;
+    thrive_ast *right;
+    thrive_ast *next;
+    thrive_range l;
+    i32 decided;
+
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+        thrive_range_expr(node->data.binary.left);
+        thrive_range_expr(node->data.binary.right);
+        break;
+    case THRIVE_AST_UNARY:
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ADDR_OF:
+        thrive_range_expr(node->data.unary.expr);
+        return;
+    case THRIVE_AST_TERNARY:
+        thrive_range_expr(node->data.ternary.cond);
+        thrive_range_expr(node->data.ternary.then_expr);
+        thrive_range_expr(node->data.ternary.else_expr);
+        return;
+    case THRIVE_AST_ASSIGN:
+        thrive_range_expr(node->data.assign.left);
+        thrive_range_expr(node->data.assign.right);
+        return;
+    case THRIVE_AST_ARRAY_ACCESS:
+        thrive_range_expr(node->data.array_access.left);
+        thrive_range_expr(node->data.array_access.index);
+        return;
+    case THRIVE_AST_FUNC_CALL:
+        for (curr = node->data.func_call.args; curr; curr = curr->next)
+        {
+            thrive_range_expr(curr);
+        }
+        return;
+    default:
+        /* The body of an inlined call has names of its own */
+        return;
+    }
+
+    left = node->data.binary.left;
+    right = node->data.binary.right;
+    l = thrive_range_of(left);
+    decided = thrive_range_decide(node->data.binary.op, l, thrive_range_of(right));
+
+    if (decided >= 0 && thrive_ast_is_pure(node))
+    {
+        node->kind = THRIVE_AST_INT;
+        node->data.int_value = (u32)decided;
+        optimizer_stats.range_folds++;
+        return;
+    }
+
+    if (right->kind == THRIVE_AST_INT &&
+        ((node->data.binary.op == THRIVE_TOKEN_KIND_AND_BITWISE && thrive_range_mask_keeps(l, right->data.int_value)) ||
+         (node->data.binary.op == THRIVE_TOKEN_KIND_MOD && l.known && l.lo >= 0 && l.hi < (i64)right->data.int_value)))
+    {
+        next = node->next;
+        *node = *left;
+        node->next = next;
+        optimizer_stats.range_folds++;
+    }
+}
+
+THRIVE_API void thrive_range_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_range_scan *scan = (thrive_range_scan *)user;
+    thrive_ast *target = 0;
+    thrive_ast *param = 0;
+
+    if (node->kind == THRIVE_AST_ASSIGN)
+    {
+        target = node->data.assign.left;
+    }
+    else if (node->kind == THRIVE_AST_DECL)
+    {
+        target = node->data.decl.name;
+    }
+    else if (node->kind == THRIVE_AST_UNARY && (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC))
+    {
+        target = node->data.unary.expr;
+    }
+    else if (node->kind == THRIVE_AST_ADDR_OF && thrive_inline_is_name(node->data.unary.expr, scan->name))
+    {
+        scan->address_taken = 1;
+    }
+    else if (node->kind == THRIVE_AST_FUNC_DECL)
+    {
+        param = node->data.func_decl.params;
+    }
+    else if (node->kind == THRIVE_AST_INLINE)
+    {
+        param = node->data.inline_call.params;
+    }
+
+    scan->writes += (u32)thrive_inline_is_name(target, scan->name);
+
+    for (; param; param = param->next)
+    {
+        scan->writes += (u32)thrive_inline_is_name(param, scan->name);
+    }
+}
+
+THRIVE_API thrive_range_scan thrive_range_scan_scope(thrive_ast *name)
+{
+    thrive_range_scan scan;
+
+    scan.name = name;
+    scan.writes = 0;
+    scan.address_taken = 0;
+    thrive_promote_walk(range_scope, thrive_range_scan_visitor, &scan);
+
+    return scan;
+}
+
+THRIVE_API void thrive_range_push(thrive_ast *name, thrive_range range)
+{
+    thrive_range_var *v;
+
+    if (!range.known || range_var_count >= THRIVE_RANGE_MAX_VARS)
+    {
+        return;
+    }
+
+    v = &range_vars[range_var_count++];
+    v->scope = range_scope_name;
+    v->name = name;
+    v->range = range;
+
+    if (range_report_count < THRIVE_RANGE_MAX_REPORT)
+    {
+        range_reports[range_report_count++] = *v;
+    }
+}
+
+THRIVE_API void thrive_range_statement(thrive_ast *stmt);
+
+THRIVE_API void thrive_range_loop(thrive_ast *node)
+{
+    thrive_ast *init = node->data.for_loop.init;
+    thrive_unroll_loop loop;
+    thrive_range_scan scan;
+    thrive_range start;
+    thrive_range limit;
+    u8 inclusive;
+
+    thrive_range_expr(init);
+    thrive_range_expr(node->data.for_loop.cond);
+    thrive_range_expr(node->data.for_loop.step);
+
+    if (!thrive_unroll_match(node, &loop) || !init || init->kind != THRIVE_AST_ASSIGN || !thrive_inline_is_name(init->data.assign.left, loop.var))
+    {
+        thrive_range_statement(node->data.for_loop.body);
+        return;
+    }
+
+    scan = thrive_range_scan_scope(loop.var);
+    start = thrive_range_of(init->data.assign.right);
+    limit = thrive_range_of(loop.limit);
+    inclusive = (u8)(node->data.for_loop.cond->data.binary.op == THRIVE_TOKEN_KIND_LT_EQUALS ||
+                     node->data.for_loop.cond->data.binary.op == THRIVE_TOKEN_KIND_GT_EQUALS);
+
+    if (!scan.address_taken && start.known && limit.known && !thrive_inline_scan_body(node->data.for_loop.body, loop.var).written)
+    {
+        if (loop.down)
+        {
+            thrive_range_push(loop.var, thrive_range_make(inclusive ? limit.lo : limit.lo + 1, start.hi));
+        }
+        else
+        {
+            thrive_range_push(loop.var, thrive_range_make(start.lo, inclusive ? limit.hi : limit.hi - 1));
+        }
+    }
+
+    thrive_range_statement(node->data.for_loop.body);
+}
+
+THRIVE_API void thrive_range_statement(thrive_ast *stmt)
+{
+    u32 count = range_var_count;
+    thrive_ast *curr;
+    thrive_range_scan scan;
+
+    if (!stmt)
+    {
+        return;
+    }
+
+    switch (stmt->kind)
+    {
+    case THRIVE_AST_BLOCK:
+        for (curr = stmt->data.block.body; curr; curr = curr->next)
+        {
+            thrive_range_statement(curr);
+        }
+        break;
+    case THRIVE_AST_DECL:
+        thrive_range_expr(stmt->data.decl.value);
+
+        if (stmt->data.decl.value && !stmt->data.decl.is_array)
+        {
+            scan = thrive_range_scan_scope(stmt->data.decl.name);
+
+            if (scan.writes == 1 && !scan.address_taken)
+            {
+                thrive_range_push(stmt->data.decl.name, thrive_range_of(stmt->data.decl.value));
+            }
+        }
+        /* Lives to the end of the enclosing block */
+        return;
+    case THRIVE_AST_IF:
+        thrive_range_expr(stmt->data.if_stmt.cond);
+        thrive_range_statement(stmt->data.if_stmt.then_branch);
+        range_var_count = count;
+        thrive_range_statement(stmt->data.if_stmt.else_branch);
+        break;
+    case THRIVE_AST_FOR:
+        thrive_range_loop(stmt);
+        break;
+    case THRIVE_AST_RETURN:
+        thrive_range_expr(stmt->data.ret.expr);
+        break;
+    case THRIVE_AST_FUNC_DECL:
+    case THRIVE_AST_EXT_DECL:
+        break;
+    default:
+        thrive_range_expr(stmt);
+        break;
+    }
+
+    range_var_count = count;
+}
+
+/* Folds comparisons and masks decided by the ranges of loop counters and constants */
+THRIVE_API thrive_ast *thrive_ast_range(thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    range_report_count = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL)
+        {
+            range_scope = curr;
+            range_scope_name = curr->data.func_decl.name;
+            range_var_count = 0;
+            thrive_range_statement(curr->data.func_decl.body);
+        }
+    }
+
+    range_scope = program;
+    range_scope_name = 0;
+    range_var_count = 0;
+    thrive_range_statement(program);
+
+    return thrive_ast_fold(program);
+}
+
+/* #############################################################################
+ * # [SECTION] Loop-Invariant Code Motion
+ * #############################################################################
+ *
+ * Moves expressions of a loop whose value cannot change between iterations
+ * into fresh variables computed once before the loop:
+ *
+ *   for (i = 0 : i < n : ++i) { s += p[k] * (n * w) }
+ *
+ * becomes
+ *
+ *   i = 0
+ *   if (i < n) { u32 $0 = p[k]  u32 $1 = n * w  for ( : i < n : ++i) { s += $0 * $1 } }
+ *
+ * An expression is invariant if it is free of side effects and reads no
+ * variable written in the loop. Variables whose address is taken count as
+ * written when the loop stores through a pointer or array or calls a
+ * function, and loads (p[k], *p) are only invariant if it does neither.
+ *
+ * Expressions that can fault (loads, division by a non-constant) are only
+ * moved if every iteration evaluates them and the loop condition can be
+ * repeated as the guard, so a loop that never runs still never evaluates
+ * them. Others are moved unguarded. Names, constants and string or variable
+ * addresses are a single instruction already and stay in place, and so do
+ * the bodies of inlined calls, whose parameters are bound per call.
+ */
+#define THRIVE_LICM_MAX_LOOPS 1024
+#define THRIVE_LICM_MAX_LOOP_HOISTS 16
+
+typedef struct thrive_licm_loop
+{
+    thrive_ast *node;  /* the loop being optimized */
+    thrive_ast *scope; /* function (or program) it belongs to */
+    u8 writes_memory;  /* stores through a pointer or array, or calls */
+    u8 guarded;        /* the condition can be repeated as the guard */
+
+    /* Hoisted expressions and the variables now holding them */
+    thrive_ast *exprs[THRIVE_LICM_MAX_LOOP_HOISTS];
+    thrive_ast *names[THRIVE_LICM_MAX_LOOP_HOISTS];
+    u32 count;
+    u8 faults; /* a hoisted expression needs the guard */
+
+} thrive_licm_loop;
+
+static thrive_ast *licm_loops[THRIVE_LICM_MAX_LOOPS];
+static thrive_ast *licm_scopes[THRIVE_LICM_MAX_LOOPS];
+static u32 licm_loop_count;
+
+THRIVE_API void thrive_licm_collect_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_FOR && licm_loop_count < THRIVE_LICM_MAX_LOOPS)
+    {
+        licm_scopes[licm_loop_count] = (thrive_ast *)user;
+        licm_loops[licm_loop_count++] = node;
+    }
+}
+
+THRIVE_API void thrive_licm_memory_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_FUNC_CALL ||
+        (node->kind == THRIVE_AST_ASSIGN &&
+         (node->data.assign.left->kind == THRIVE_AST_ARRAY_ACCESS || node->data.assign.left->kind == THRIVE_AST_DEREF)))
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+THRIVE_API void thrive_licm_jump_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_BREAK || node->kind == THRIVE_AST_CONTINUE || node->kind == THRIVE_AST_RETURN)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+THRIVE_API u8 thrive_licm_written(thrive_licm_loop *loop, thrive_ast *name)
+{
+    thrive_ast *node = loop->node;
+
+    return (u8)(thrive_inline_scan_body(node->data.for_loop.cond, name).written ||
+                thrive_inline_scan_body(node->data.for_loop.step, name).written ||
+                thrive_inline_scan_body(node->data.for_loop.body, name).written ||
+                (loop->writes_memory && thrive_unroll_address_taken(loop->scope, name)));
+}
+
+THRIVE_API u8 thrive_licm_invariant(thrive_licm_loop *loop, thrive_ast *node)
+{
+    switch (node->kind)
+    {
+    case THRIVE_AST_INT:
+    case THRIVE_AST_STRING:
+        return 1;
+    case THRIVE_AST_NAME:
+        return (u8)!thrive_licm_written(loop, node);
+    case THRIVE_AST_ADDR_OF:
+        return (u8)(node->data.unary.expr->kind == THRIVE_AST_NAME);
+    case THRIVE_AST_BINARY:
+        return (u8)(thrive_licm_invariant(loop, node->data.binary.left) && thrive_licm_invariant(loop, node->data.binary.right));
+    case THRIVE_AST_UNARY:
+        return (u8)(node->data.unary.op != THRIVE_TOKEN_KIND_INC && node->data.unary.op != THRIVE_TOKEN_KIND_DEC &&
+                    thrive_licm_invariant(loop, node->data.unary.expr));
+    case THRIVE_AST_TERNARY:
+        return (u8)(thrive_licm_invariant(loop, node->data.ternary.cond) &&
+                    thrive_licm_invariant(loop, node->data.ternary.then_expr) &&
+                    thrive_licm_invariant(loop, node->data.ternary.else_expr));
+    case THRIVE_AST_DEREF:
+        return (u8)(!loop->writes_memory && thrive_licm_invariant(loop, node->data.unary.expr));
+    case THRIVE_AST_ARRAY_ACCESS:
+        return (u8)(!loop->writes_memory &&
+                    thrive_licm_invariant(loop, node->data.array_access.left) &&
+                    thrive_licm_invariant(loop, node->data.array_access.index));
+    default:
+        return 0;
+    }
+}
+
+/* Whether evaluating node can fault (loads, division by zero) */
+THRIVE_API u8 thrive_licm_faults(thrive_ast *node)
+{
+    switch (node->kind)
+    {
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ARRAY_ACCESS:
+        return 1;
+    case THRIVE_AST_BINARY:
+        if ((node->data.binary.op == THRIVE_TOKEN_KIND_DIV || node->data.binary.op == THRIVE_TOKEN_KIND_MOD) &&
+            (node->data.binary.right->kind != THRIVE_AST_INT || !node->data.binary.right->data.int_value))
+        {
+            return 1;
+        }
+        return (u8)(thrive_licm_faults(node->data.binary.left) || thrive_licm_faults(node->data.binary.right));
+    case THRIVE_AST_UNARY:
+        return thrive_licm_faults(node->data.unary.expr);
+    case THRIVE_AST_TERNARY:
+        return (u8)(thrive_licm_faults(node->data.ternary.cond) ||
+                    thrive_licm_faults(node->data.ternary.then_expr) ||
+                    thrive_licm_faults(node->data.ternary.else_expr));
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API thrive_ast *thrive_licm_name(thrive_state *state, thrive_ast *name)
+{
+    thrive_ast *copy = thrive_ast_create(state, THRIVE_AST_NAME);
+    *copy = *name;
+    copy->next = 0;
+    return copy;
+}
+
+/* Replaces node by the variable holding its value, 0 if it cannot be hoisted */
+THRIVE_API thrive_ast *thrive_licm_hoist(thrive_state *state, thrive_licm_loop *loop, thrive_ast *node, u8 conditional)
+{
+    thrive_ast *name;
+    u32 i;
+    u8 faults;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+    case THRIVE_AST_UNARY:
+    case THRIVE_AST_TERNARY:
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ARRAY_ACCESS:
+        break;
+    default:
+        return 0;
+    }
+
+    if (!thrive_ast_is_pure(node) || !thrive_licm_invariant(loop, node))
+    {
+        return 0;
+    }
+
+    faults = thrive_licm_faults(node);
+
+    if (faults && (conditional || !loop->guarded))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < loop->count; ++i)
+    {
+        if (thrive_ast_equals(loop->exprs[i], node))
+        {
+            return thrive_licm_name(state, loop->names[i]);
+        }
+    }
+
+    if (loop->count == THRIVE_LICM_MAX_LOOP_HOISTS || state->ast_count + 8 > state->ast_capacity)
+    {
+        return 0;
+    }
+
+    name = thrive_ast_create_temp(state);
+
+    if (!name)
+    {
+        return 0;
+    }
+
+    loop->exprs[loop->count] = node;
+    loop->names[loop->count++] = name;
+    loop->faults = (u8)(loop->faults || faults);
+
+    optimizer_stats.hoisted_expressions++;
+
+    return thrive_licm_name(state, name);
+}
+
+THRIVE_API void thrive_licm_expr(thrive_state *state, thrive_licm_loop *loop, thrive_ast **slot, u8 conditional);
+
+THRIVE_API void thrive_licm_list(thrive_state *state, thrive_licm_loop *loop, thrive_ast **slot, u8 conditional)
+{
+    for (; *slot; slot = &(*slot)->next)
+    {
+        thrive_licm_expr(state, loop, slot, conditional);
+    }
+}
+
+/* Hoists the largest invariant sub-expressions of *slot, conditional if it may not run on every iteration */
+THRIVE_API void thrive_licm_expr(thrive_state *state, thrive_licm_loop *loop, thrive_ast **slot, u8 conditional)
+{
+    thrive_ast *node = *slot;
+    thrive_ast *name;
+
+    if (!node)
+    {
+        return;
+    }
+
+    name = thrive_licm_hoist(state, loop, node, conditional);
+
+    if (name)
+    {
+        name->next = node->next;
+        *slot = name;
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+    {
+        u8 short_circuit = (u8)(node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL);
+        thrive_licm_expr(state, loop, &node->data.binary.left, conditional);
+        thrive_licm_expr(state, loop, &node->data.binary.right, (u8)(conditional || short_circuit));
+        break;
+    }
+    case THRIVE_AST_UNARY:
+        if (node->data.unary.op != THRIVE_TOKEN_KIND_INC && node->data.unary.op != THRIVE_TOKEN_KIND_DEC)
+        {
+            thrive_licm_expr(state, loop, &node->data.unary.expr, conditional);
+        }
+        break;
+    case THRIVE_AST_DEREF:
+        thrive_licm_expr(state, loop, &node->data.unary.expr, conditional);
+        break;
+    case THRIVE_AST_TERNARY:
+        thrive_licm_expr(state, loop, &node->data.ternary.cond, conditional);
+        thrive_licm_expr(state, loop, &node->data.ternary.then_expr, 1);
+        thrive_licm_expr(state, loop, &node->data.ternary.else_expr, 1);
+        break;
+    case THRIVE_AST_ARRAY_ACCESS:
+        thrive_licm_expr(state, loop, &node->data.array_access.left, conditional);
+        thrive_licm_expr(state, loop, &node->data.array_access.index, conditional);
+        break;
+    case THRIVE_AST_ASSIGN:
+    {
+        thrive_ast *target = node->data.assign.left;
+
+        /* The stored-to location stays, only its address computation is a candidate */
+        if (target->kind == THRIVE_AST_ARRAY_ACCESS)
+        {
+            thrive_licm_expr(state, loop, &target->data.array_access.left, conditional);
+            thrive_licm_expr(state, loop, &target->data.array_access.index, conditional);
+        }
+        else if (target->kind == THRIVE_AST_DEREF)
+        {
+            thrive_licm_expr(state, loop, &target->data.unary.expr, conditional);
+        }
+
+        thrive_licm_expr(state, loop, &node->data.assign.right, conditional);
+        break;
+    }
+    case THRIVE_AST_DECL:
+        thrive_licm_expr(state, loop, &node->data.decl.value, conditional);
+        break;
+    case THRIVE_AST_RETURN:
+        thrive_licm_expr(state, loop, &node->data.ret.expr, conditional);
+        break;
+    case THRIVE_AST_FUNC_CALL:
+        thrive_licm_list(state, loop, &node->data.func_call.args, conditional);
+        break;
+    case THRIVE_AST_INLINE:
+        thrive_licm_list(state, loop, &node->data.inline_call.args, conditional);
+        break;
+    case THRIVE_AST_IF:
+        thrive_licm_expr(state, loop, &node->data.if_stmt.cond, conditional);
+        thrive_licm_expr(state, loop, &node->data.if_stmt.then_branch, 1);
+        thrive_licm_expr(state, loop, &node->data.if_stmt.else_branch, 1);
+        break;
+    case THRIVE_AST_FOR:
+        thrive_licm_expr(state, loop, &node->data.for_loop.init, conditional);
+        thrive_licm_expr(state, loop, &node->data.for_loop.cond, conditional);
+        thrive_licm_expr(state, loop, &node->data.for_loop.step, 1);
+        thrive_licm_expr(state, loop, &node->data.for_loop.body, 1);
+        break;
+    case THRIVE_AST_BLOCK:
+    {
+        thrive_ast **curr;
+
+        /* Statements after one that may leave the iteration do not always run */
+        for (curr = &node->data.block.body; *curr; curr = &(*curr)->next)
+        {
+            u8 jumps = 0;
+
+            thrive_licm_expr(state, loop, curr, conditional);
+            thrive_ast_walk(*curr, thrive_licm_jump_visitor, &jumps);
+            conditional = (u8)(conditional || jumps);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+THRIVE_API thrive_ast *thrive_licm_decl(thrive_state *state, thrive_ast *name, thrive_ast *value)
+{
+    thrive_ast *decl = thrive_ast_create(state, THRIVE_AST_DECL);
+    decl->next = 0;
+    decl->data.decl.name = name;
+    decl->data.decl.value = value;
+    decl->data.decl.is_array = 0;
+    decl->data.decl.array_size = 0;
+    return decl;
+}
+
+THRIVE_API thrive_ast *thrive_licm_block(thrive_state *state, thrive_ast *body)
+{
+    thrive_ast *block = thrive_ast_create(state, THRIVE_AST_BLOCK);
+    block->next = 0;
+    block->data.block.body = body;
+    return block;
+}
+
+THRIVE_API void thrive_licm_loop_optimize(thrive_state *state, thrive_ast *node, thrive_ast *scope)
+{
+    thrive_licm_loop loop;
+    thrive_ast *guard = 0;
+    thrive_ast *copy;
+    thrive_ast *head = 0;
+    thrive_ast **tail = &head;
+    u32 i;
+
+    loop.node = node;
+    loop.scope = scope;
+    loop.writes_memory = 0;
+    loop.guarded = (u8)(node->data.for_loop.cond && thrive_ast_is_pure(node->data.for_loop.cond));
+    loop.count = 0;
+    loop.faults = 0;
+
+    thrive_ast_walk(node->data.for_loop.cond, thrive_licm_memory_visitor, &loop.writes_memory);
+    thrive_ast_walk(node->data.for_loop.step, thrive_licm_memory_visitor, &loop.writes_memory);
+    thrive_ast_walk(node->data.for_loop.body, thrive_licm_memory_visitor, &loop.writes_memory);
+
+    /* The guard is the condition as it was, before its own invariant parts move */
+    if (loop.guarded && state->ast_count + thrive_inline_cost(node->data.for_loop.cond) + 16 <= state->ast_capacity)
+    {
+        inline_substitute_count = 0;
+        guard = thrive_inline_clone(state, node->data.for_loop.cond);
+    }
+    else
+    {
+        loop.guarded = 0;
+    }
+
+    /* The condition runs before every iteration, the step only after a complete one */
+    thrive_licm_expr(state, &loop, &node->data.for_loop.cond, 0);
+    thrive_licm_expr(state, &loop, &node->data.for_loop.step, 1);
+    thrive_licm_expr(state, &loop, &node->data.for_loop.body, 0);
+
+    if (!loop.count)
+    {
+        return;
+    }
+
+    /* init, the hoisted variables and the loop without its init replace the loop in place */
+    copy = thrive_ast_create(state, THRIVE_AST_FOR);
+    *copy = *node;
+    copy->next = 0;
+    copy->data.for_loop.init = 0;
+
+    for (i = 0; i < loop.count; ++i)
+    {
+        *tail = thrive_licm_decl(state, thrive_licm_name(state, loop.names[i]), loop.exprs[i]);
+        tail = &(*tail)->next;
+    }
+
+    *tail = copy;
+
+    if (loop.faults)
+    {
+        thrive_ast *branch = thrive_ast_create(state, THRIVE_AST_IF);
+        branch->next = 0;
+        branch->data.if_stmt.cond = guard;
+        branch->data.if_stmt.then_branch = thrive_licm_block(state, head);
+        branch->data.if_stmt.else_branch = 0;
+        head = branch;
+    }
+
+    if (node->data.for_loop.init)
+    {
+        node->data.for_loop.init->next = head;
+        head = node->data.for_loop.init;
+    }
+
+    node->kind = THRIVE_AST_BLOCK;
+    node->data.block.body = head;
+}
+
+/* Hoists loop-invariant expressions in front of their loops, outer loops first */
+THRIVE_API thrive_ast *thrive_ast_hoist(thrive_state *state, thrive_ast *program)
+{
+    thrive_ast *curr;
+    u32 i;
+
+    licm_loop_count = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_ast_walk(curr, thrive_licm_collect_visitor, curr->kind == THRIVE_AST_FUNC_DECL ? curr : program);
+    }
+
+    for (i = 0; i < licm_loop_count; ++i)
+    {
+        thrive_licm_loop_optimize(state, licm_loops[i], licm_scopes[i]);
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] If-Conversion
+ * #############################################################################
+ *
+ * Marks ternaries whose arms are cheap enough to evaluate both and pick the
+ * result without a branch, and turns
+ *
+ *   if (c) { x = a } else { x = b }    into    x = c ? a : b
+ *   if (c) { x = a }                   into    x = c ? a : x
+ *
+ * The codegen emits cmovcc for marked ternaries (setcc and arithmetic when
+ * both arms are constants). The condition must be free of side effects and
+ * the arms must not jump themselves (&&, ||, ternaries) or fault where the
+ * branch would have guarded them: a division needs a non-zero constant
+ * divisor and a load must also appear in the condition.
+ *
+ * The budget bounds the node count of both arms together. Larger arms keep
+ * the branch, a well predicted branch beats computing both of them.
+ */
+#ifndef THRIVE_SELECT_BUDGET
+#define THRIVE_SELECT_BUDGET 8
+#endif
+
+typedef struct thrive_select_scan
+{
+    thrive_ast *expr; /* expression looked for */
+    u8 found;
+
+} thrive_select_scan;
+
+static u32 select_budget;
+
+THRIVE_API void thrive_select_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_select_scan *scan = (thrive_select_scan *)user;
+
+    if (thrive_ast_equals(node, scan->expr))
+    {
+        scan->found = 1;
+    }
+}
+
+/* An arm that runs unconditionally once converted */
+THRIVE_API u8 thrive_select_cheap(thrive_ast *node, thrive_ast *cond)
+{
+    thrive_select_scan scan;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_INT:
+    case THRIVE_AST_NAME:
+    case THRIVE_AST_STRING:
+        return 1;
+    case THRIVE_AST_BINARY:
+        if (node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL)
+        {
+            return 0;
+        }
+        if ((node->data.binary.op == THRIVE_TOKEN_KIND_DIV || node->data.binary.op == THRIVE_TOKEN_KIND_MOD) &&
+            (node->data.binary.right->kind != THRIVE_AST_INT || node->data.binary.right->data.int_value == 0))
+        {
+            return 0;
+        }
+        return (u8)(thrive_select_cheap(node->data.binary.left, cond) && thrive_select_cheap(node->data.binary.right, cond));
+    case THRIVE_AST_UNARY:
+        if (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)
+        {
+            return 0;
+        }
+        return thrive_select_cheap(node->data.unary.expr, cond);
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ARRAY_ACCESS:
+        /* The condition performs the same load either way */
+        scan.expr = node;
+        scan.found = 0;
+        thrive_ast_walk(cond, thrive_select_scan_visitor, &scan);
+        return scan.found;
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API u8 thrive_select_convertible(thrive_ast *cond, thrive_ast *then_expr, thrive_ast *else_expr)
+{
+    return (u8)(thrive_ast_is_pure(cond) &&
+                thrive_select_cheap(then_expr, cond) && thrive_select_cheap(else_expr, cond) &&
+                thrive_inline_cost(then_expr) + thrive_inline_cost(else_expr) <= select_budget);
+}
+
+/* The single "x = value" of a branch, 0 for anything else */
+THRIVE_API thrive_ast *thrive_select_store(thrive_ast *branch)
+{
+    if (branch && branch->kind == THRIVE_AST_BLOCK && branch->data.block.body && !branch->data.block.body->next)
+    {
+        branch = branch->data.block.body;
+    }
+
+    return (branch && branch->kind == THRIVE_AST_ASSIGN && branch->data.assign.left->kind == THRIVE_AST_NAME) ? branch : 0;
+}
+
+THRIVE_API void thrive_select_visitor(thrive_ast *node, void *user)
+{
+    thrive_state *state = (thrive_state *)user;
+    thrive_ast *then_store;
+    thrive_ast *else_store;
+    thrive_ast *else_expr;
+    thrive_ast *select;
+
+    if (node->kind == THRIVE_AST_TERNARY)
+    {
+        if (!node->data.ternary.select &&
+            thrive_select_convertible(node->data.ternary.cond, node->data.ternary.then_expr, node->data.ternary.else_expr))
+        {
+            node->data.ternary.select = 1;
+            optimizer_stats.if_conversions++;
+        }
+        return;
+    }
+
+    if (node->kind != THRIVE_AST_IF || state->ast_count + 2 > state->ast_capacity)
+    {
+        return;
+    }
+
+    then_store = thrive_select_store(node->data.if_stmt.then_branch);
+    else_store = thrive_select_store(node->data.if_stmt.else_branch);
+
+    if (!then_store || (node->data.if_stmt.else_branch && !else_store) ||
+        (else_store && !thrive_ast_equals(then_store->data.assign.left, else_store->data.assign.left)))
+    {
+        return;
+    }
+
+    else_expr = else_store ? else_store->data.assign.right : then_store->data.assign.left;
+
+    if (!thrive_select_convertible(node->data.if_stmt.cond, then_store->data.assign.right, else_expr))
+    {
+        return;
+    }
+
+    /* Without an else the variable keeps its value, reading it needs its own node */
+    if (!else_store)
+    {
+        else_expr = thrive_ast_create(state, THRIVE_AST_NAME);
+        *else_expr = *then_store->data.assign.left;
+        else_expr->next = 0;
+    }
+
+    select = thrive_ast_create(state, THRIVE_AST_TERNARY);
+    select->next = 0;
+    select->data.ternary.cond = node->data.if_stmt.cond;
+    select->data.ternary.then_expr = then_store->data.assign.right;
+    select->data.ternary.else_expr = else_expr;
+    select->data.ternary.select = 1;
+
+    node->kind = THRIVE_AST_ASSIGN;
+    node->data.assign.left = then_store->data.assign.left;
+    node->data.assign.right = select;
+    optimizer_stats.if_conversions++;
+}
+
+/* Replaces branches whose arms cost at most budget AST nodes by a select, 0 disables the conversion */
+THRIVE_API thrive_ast *thrive_ast_select(thrive_state *state, thrive_ast *program, u32 budget)
+{
+    select_budget = budget;
+
+    if (budget)
+    {
+        thrive_ast_walk(program, thrive_select_visitor, state);
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Common Subexpression Elimination
+ * #############################################################################
+ *
+ * Local value numbering over one function body (or the top-level statements,
+ * or the body of an inlined call). Expressions are visited in the order the
+ * code generator evaluates them, and a pure expression equal to one already
+ * evaluated reuses its result:
+ *
+ *   if (p[i] == 10 && p[i] > 0) { s += a * b  t = a * b }
+ *
+ * becomes
+ *
+ *   u32 $0  u32 $1
+ *   if (($0 = p[i]) == 10 && $0 > 0) { s += ($1 = a * b)  t = $1 }
+ *
+ * A remembered value is forgotten when a variable it reads is written.
+ * Loads (p[i], *p) and reads of variables whose address is taken are also
+ * forgotten at every store through a pointer or array and at every call.
+ * Values computed where the code may not run (the right side of && and ||,
+ * ternary and if branches, loops) are only reused within that region.
+ */
+#define THRIVE_CSE_MAX_ENTRIES 256
+#define THRIVE_CSE_MAX_REWRITES 256
+#define THRIVE_CSE_MAX_EXPOSED 64
+#define THRIVE_CSE_MAX_ROOTS 256
+#define THRIVE_WIN64_ARG_REGS 4    /* register arguments of an ext call */
+#define THRIVE_INTERNAL_ARG_REGS 6 /* register arguments of a call between Thrive functions */
+
+typedef struct thrive_cse_entry
+{
+    thrive_ast *expr;  /* first evaluation */
+    thrive_ast **slot; /* where it sits */
+    thrive_ast *temp;  /* variable holding its value, 0 until reused */
+    u8 loads;          /* reads memory */
+    u8 exposed;        /* reads a variable whose address is taken */
+    u8 valid;
+
+} thrive_cse_entry;
+
+typedef struct thrive_cse_rewrite
+{
+    thrive_ast **slot;
+    thrive_ast *temp;
+    u8 store; /* *slot becomes "temp = *slot" instead of "temp" */
+
+} thrive_cse_rewrite;
+
+static thrive_cse_entry cse_entries[THRIVE_CSE_MAX_ENTRIES];
+static u32 cse_entry_count;
+
+static thrive_cse_rewrite cse_rewrites[THRIVE_CSE_MAX_REWRITES];
+static u32 cse_rewrite_count;
+
+/* Variables whose address is taken in the current function */
+static thrive_ast *cse_exposed[THRIVE_CSE_MAX_EXPOSED];
+static u32 cse_exposed_count;
+static u8 cse_exposed_overflow;
+
+/* Bodies of inlined calls, optimized on their own */
+static thrive_ast *cse_roots[THRIVE_CSE_MAX_ROOTS];
+static u32 cse_root_count;
+
+static thrive_ast *cse_program; /* the ext declarations decide the calling convention */
+
+/* Arguments the call passes in registers, the code generator evaluates the others first, last to first */
+THRIVE_API u32 thrive_cse_register_args(thrive_ast *call)
+{
+    thrive_ast *decl;
+
+    for (decl = cse_program->data.block.body; decl; decl = decl->next)
+    {
+        if (decl->kind == THRIVE_AST_EXT_DECL && thrive_inline_is_name(decl->data.ext_decl.name, call->data.func_call.name))
+        {
+            return THRIVE_WIN64_ARG_REGS;
+        }
+    }
+
+    return THRIVE_INTERNAL_ARG_REGS;
+}
+
+THRIVE_API u8 thrive_cse_is_exposed(thrive_ast *name)
+{
+    u32 i;
+
+    if (cse_exposed_overflow)
+    {
+        return 1;
+    }
+
+    for (i = 0; i < cse_exposed_count; ++i)
+    {
+        if (thrive_inline_is_name(cse_exposed[i], name))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+THRIVE_API void thrive_cse_scope_visitor(thrive_ast *node, void *user)
+{
+    (void)user;
+
+    if (node->kind == THRIVE_AST_ADDR_OF && node->data.unary.expr->kind == THRIVE_AST_NAME &&
+        !thrive_cse_is_exposed(node->data.unary.expr))
+    {
+        if (cse_exposed_count == THRIVE_CSE_MAX_EXPOSED)
+        {
+            cse_exposed_overflow = 1;
+            return;
+        }
+        cse_exposed[cse_exposed_count++] = node->data.unary.expr;
+    }
+    else if (node->kind == THRIVE_AST_INLINE && node->data.inline_call.body->kind == THRIVE_AST_BLOCK &&
+             cse_root_count < THRIVE_CSE_MAX_ROOTS)
+    {
+        cse_roots[cse_root_count++] = node->data.inline_call.body;
+    }
+}
+
+THRIVE_API void thrive_cse_entry_visitor(thrive_ast *node, void *user)
+{
+    thrive_cse_entry *entry = (thrive_cse_entry *)user;
+
+    if (node->kind == THRIVE_AST_DEREF || node->kind == THRIVE_AST_ARRAY_ACCESS)
+    {
+        entry->loads = 1;
+    }
+    else if (node->kind == THRIVE_AST_NAME && thrive_cse_is_exposed(node))
+    {
+        entry->exposed = 1;
+    }
+}
+
+/* Forgets the values that a store through a pointer or array, or a call, can change */
+THRIVE_API void thrive_cse_kill_memory(void)
+{
+    u32 i;
+
+    for (i = 0; i < cse_entry_count; ++i)
+    {
+        if (cse_entries[i].loads || cse_entries[i].exposed)
+        {
+            cse_entries[i].valid = 0;
+        }
+    }
+}
+
+/* Forgets the values that read name */
+THRIVE_API void thrive_cse_kill(thrive_ast *name)
+{
+    u32 i;
+
+    if (thrive_cse_is_exposed(name))
+    {
+        thrive_cse_kill_memory();
+    }
+
+    for (i = 0; i < cse_entry_count; ++i)
+    {
+        if (cse_entries[i].valid && thrive_inline_scan_body(cse_entries[i].expr, name).used)
+        {
+            cse_entries[i].valid = 0;
+        }
+    }
+}
+
+/* Everything a loop writes is forgotten before its first iteration */
+THRIVE_API void thrive_cse_kill_visitor(thrive_ast *node, void *user)
+{
+    (void)user;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_ASSIGN:
+        if (node->data.assign.left->kind == THRIVE_AST_NAME)
+        {
+            thrive_cse_kill(node->data.assign.left);
+        }
+        else
+        {
+            thrive_cse_kill_memory();
+        }
+        break;
+    case THRIVE_AST_DECL:
+        thrive_cse_kill(node->data.decl.name);
+        break;
+    case THRIVE_AST_UNARY:
+        if (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)
+        {
+            thrive_cse_kill(node->data.unary.expr);
+        }
+        break;
+    case THRIVE_AST_FUNC_CALL:
+    case THRIVE_AST_INLINE:
+        thrive_cse_kill_memory();
+        break;
+    default:
+        break;
+    }
+}
+
+/* Records a rewrite of *slot, 0 if the slot has one already (a node reached twice would get two) */
+THRIVE_API u8 thrive_cse_rewrite_add(thrive_ast **slot, thrive_ast *temp, u8 store)
+{
+    u32 i;
+
+    for (i = 0; i < cse_rewrite_count; ++i)
+    {
+        if (cse_rewrites[i].slot == slot)
+        {
+            return 0;
+        }
+    }
+
+    cse_rewrites[cse_rewrite_count].slot = slot;
+    cse_rewrites[cse_rewrite_count].temp = temp;
+    cse_rewrites[cse_rewrite_count++].store = store;
+
+    return 1;
+}
+
+/* Clears the node the user pointer points to once the walk reaches it */
+THRIVE_API void thrive_cse_find_visitor(thrive_ast *node, void *user)
+{
+    thrive_ast **find = (thrive_ast **)user;
+
+    if (node == *find)
+    {
+        *find = 0;
+    }
+}
+
+/* 1 if node is part of the tree at root */
+THRIVE_API u8 thrive_cse_reaches(thrive_ast *root, thrive_ast *node)
+{
+    thrive_ast *find = node;
+
+    thrive_ast_walk(root, thrive_cse_find_visitor, &find);
+
+    return (u8)(find == 0);
+}
+
+/* Replaces *slot by an earlier evaluation of the same value if there is one, or remembers it */
+THRIVE_API u8 thrive_cse_reuse(thrive_state *state, thrive_ast **slot)
+{
+    thrive_ast *node = *slot;
+    thrive_cse_entry *entry;
+    u32 i;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+    case THRIVE_AST_UNARY:
+    case THRIVE_AST_TERNARY:
+    case THRIVE_AST_DEREF:
+    case THRIVE_AST_ARRAY_ACCESS:
+        break;
+    default:
+        return 0;
+    }
+
+    if (!thrive_ast_is_pure(node))
+    {
+        return 0;
+    }
+
+    for (i = 0; i < cse_entry_count; ++i)
+    {
+        entry = &cse_entries[i];
+
+        if (!entry->valid || !thrive_ast_equals(entry->expr, node))
+        {
+            continue;
+        }
+
+        if (cse_rewrite_count + 2 > THRIVE_CSE_MAX_REWRITES || state->ast_count + 8 > state->ast_capacity)
+        {
+            return 0;
+        }
+
+        /* The first reuse stores the first evaluation, a temp nobody stores to is never read */
+        if (!entry->temp)
+        {
+            thrive_ast *temp = thrive_ast_create_temp(state);
+
+            if (!temp || !thrive_cse_rewrite_add(entry->slot, temp, 1))
+            {
+                entry->valid = 0;
+                return 0;
+            }
+
+            entry->temp = temp;
+        }
+
+        if (!thrive_cse_rewrite_add(slot, entry->temp, 0))
+        {
+            return 0;
+        }
+
+        optimizer_stats.common_subexpressions++;
+        return 1;
+    }
+
+    if (cse_entry_count < THRIVE_CSE_MAX_ENTRIES)
+    {
+        entry = &cse_entries[cse_entry_count++];
+        entry->expr = node;
+        entry->slot = slot;
+        entry->temp = 0;
+        entry->loads = 0;
+        entry->exposed = 0;
+        entry->valid = 1;
+        thrive_ast_walk(node, thrive_cse_entry_visitor, entry);
+    }
+
+    return 0;
+}
+
+THRIVE_API void thrive_cse_expr(thrive_state *state, thrive_ast **slot);
+
+/* Visits *slot in a region that may not run, its values are forgotten afterwards */
+THRIVE_API void thrive_cse_region(thrive_state *state, thrive_ast **slot)
+{
+    u32 mark = cse_entry_count;
+    thrive_cse_expr(state, slot);
+    cse_entry_count = mark;
+}
+
+/* Visits *slot and everything below it in evaluation order */
+THRIVE_API void thrive_cse_expr(thrive_state *state, thrive_ast **slot)
+{
+    thrive_ast *node = *slot;
+    thrive_ast **arg;
+    u32 mark;
+    u32 count;
+    u32 registers;
+    u32 i;
+
+    if (!node || thrive_cse_reuse(state, slot))
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BINARY:
+        thrive_cse_expr(state, &node->data.binary.left);
+        if (node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL)
+        {
+            thrive_cse_region(state, &node->data.binary.right);
+        }
+        else
+        {
+            thrive_cse_expr(state, &node->data.binary.right);
+        }
+        break;
+    case THRIVE_AST_UNARY:
+        if (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)
+        {
+            thrive_cse_kill(node->data.unary.expr);
+        }
+        else
+        {
+            thrive_cse_expr(state, &node->data.unary.expr);
+        }
+        break;
+    case THRIVE_AST_DEREF:
+        thrive_cse_expr(state, &node->data.unary.expr);
+        break;
+    case THRIVE_AST_TERNARY:
+        thrive_cse_expr(state, &node->data.ternary.cond);
+        thrive_cse_region(state, &node->data.ternary.then_expr);
+        thrive_cse_region(state, &node->data.ternary.else_expr);
+        break;
+    case THRIVE_AST_ARRAY_ACCESS:
+        thrive_cse_expr(state, &node->data.array_access.index);
+        thrive_cse_expr(state, &node->data.array_access.left);
+        break;
+    case THRIVE_AST_ASSIGN:
+    {
+        thrive_ast *target = node->data.assign.left;
+        thrive_ast *right = node->data.assign.right;
+
+        thrive_cse_expr(state, &node->data.assign.right);
+
+        if (target->kind == THRIVE_AST_NAME)
+        {
+            thrive_cse_kill(target);
+            break;
+        }
+
+        /* "p[i] += x" shares p[i] with its right side, which was visited already (all of it once
+         * "p[i] + 0" folds to p[i]) */
+        if (!thrive_cse_reaches(right, target))
+        {
+            if (target->kind == THRIVE_AST_ARRAY_ACCESS)
+            {
+                thrive_cse_expr(state, &target->data.array_access.index);
+                thrive_cse_expr(state, &target->data.array_access.left);
+            }
+            else if (target->kind == THRIVE_AST_DEREF)
+            {
+                thrive_cse_expr(state, &target->data.unary.expr);
+            }
+        }
+
+        thrive_cse_kill_memory();
+        break;
+    }
+    case THRIVE_AST_DECL:
+        thrive_cse_expr(state, &node->data.decl.value);
+        thrive_cse_kill(node->data.decl.name);
+        break;
+    case THRIVE_AST_RETURN:
+        thrive_cse_expr(state, &node->data.ret.expr);
+        break;
+    case THRIVE_AST_FUNC_CALL:
+        /* Arguments past the register ones are evaluated first, last to first */
+        registers = thrive_cse_register_args(node);
+
+        for (count = 0, arg = &node->data.func_call.args; *arg; arg = &(*arg)->next)
+        {
+            count++;
+        }
+
+        for (; count > registers; --count)
+        {
+            for (i = 1, arg = &node->data.func_call.args; i < count; ++i)
+            {
+                arg = &(*arg)->next;
+            }
+
+            thrive_cse_expr(state, arg);
+        }
+
+        for (i = 0, arg = &node->data.func_call.args; *arg && i < registers; ++i, arg = &(*arg)->next)
+        {
+            thrive_cse_expr(state, arg);
+        }
+
+        thrive_cse_kill_memory();
+        break;
+    case THRIVE_AST_INLINE:
+        for (arg = &node->data.inline_call.args; *arg; arg = &(*arg)->next)
+        {
+            thrive_cse_expr(state, arg);
+        }
+
+        thrive_cse_kill_memory();
+        break;
+    case THRIVE_AST_IF:
+        thrive_cse_expr(state, &node->data.if_stmt.cond);
+        thrive_cse_region(state, &node->data.if_stmt.then_branch);
+        thrive_cse_region(state, &node->data.if_stmt.else_branch);
+        break;
+    case THRIVE_AST_FOR:
+        thrive_cse_expr(state, &node->data.for_loop.init);
+
+        mark = cse_entry_count;
+
+        thrive_ast_walk(node->data.for_loop.cond, thrive_cse_kill_visitor, 0);
+        thrive_ast_walk(node->data.for_loop.step, thrive_cse_kill_visitor, 0);
+        thrive_ast_walk(node->data.for_loop.body, thrive_cse_kill_visitor, 0);
+
+        /* The condition runs before the body and the step on every iteration */
+        thrive_cse_expr(state, &node->data.for_loop.cond);
+        thrive_cse_region(state, &node->data.for_loop.body);
+        thrive_cse_region(state, &node->data.for_loop.step);
+
+        cse_entry_count = mark;
+        break;
+    case THRIVE_AST_BLOCK:
+        mark = cse_entry_count;
+
+        for (arg = &node->data.block.body; *arg; arg = &(*arg)->next)
+        {
+            thrive_cse_expr(state, arg);
+        }
+
+        cse_entry_count = mark;
+        break;
+    default:
+        break;
+    }
+}
+
+/* Optimizes a statement list on its own and declares the variables it introduced at its head */
+THRIVE_API void thrive_cse_list(thrive_state *state, thrive_ast **list)
+{
+    thrive_ast **slot;
+    thrive_ast *decls = 0;
+    thrive_ast **tail = &decls;
+    u32 i;
+    u32 j;
+
+    cse_entry_count = 0;
+    cse_rewrite_count = 0;
+
+    for (slot = list; *slot; slot = &(*slot)->next)
+    {
+        if ((*slot)->kind != THRIVE_AST_FUNC_DECL && (*slot)->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_cse_expr(state, slot);
+        }
+    }
+
+    for (i = 0; i < cse_rewrite_count; ++i)
+    {
+        thrive_cse_rewrite *rewrite = &cse_rewrites[i];
+        thrive_ast *node = *rewrite->slot;
+        thrive_ast *replacement;
+
+        if (rewrite->store)
+        {
+            thrive_ast *decl = thrive_licm_decl(state, thrive_licm_name(state, rewrite->temp), 0);
+
+            replacement = thrive_ast_create(state, THRIVE_AST_ASSIGN);
+            replacement->data.assign.left = thrive_licm_name(state, rewrite->temp);
+            replacement->data.assign.right = node;
+
+            *tail = decl;
+            tail = &decl->next;
+        }
+        else
+        {
+            replacement = thrive_licm_name(state, rewrite->temp);
+        }
+
+        replacement->next = node->next;
+        *rewrite->slot = replacement;
+
+        /* A later rewrite of the next call argument now starts from the replacement */
+        for (j = i + 1; j < cse_rewrite_count; ++j)
+        {
+            if (cse_rewrites[j].slot == &node->next)
+            {
+                cse_rewrites[j].slot = &replacement->next;
+            }
+        }
+
+        if (rewrite->store)
+        {
+            node->next = 0;
+        }
+    }
+
+    *tail = *list;
+    *list = decls;
+}
+
+/* Optimizes a function body or the top-level statements, then the inlined calls in them */
+THRIVE_API void thrive_cse_unit(thrive_state *state, thrive_ast **list)
+{
+    thrive_ast *stmt;
+    u32 i;
+
+    cse_exposed_count = 0;
+    cse_exposed_overflow = 0;
+    cse_root_count = 0;
+
+    for (stmt = *list; stmt; stmt = stmt->next)
+    {
+        if (stmt->kind != THRIVE_AST_FUNC_DECL && stmt->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_ast_walk(stmt, thrive_cse_scope_visitor, 0);
+        }
+    }
+
+    thrive_cse_list(state, list);
+
+    for (i = 0; i < cse_root_count; ++i)
+    {
+        thrive_cse_list(state, &cse_roots[i]->data.block.body);
+    }
+}
+
+/* Reuses the values of repeated pure expressions within each function */
+THRIVE_API thrive_ast *thrive_ast_reuse(thrive_state *state, thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    cse_program = program;
+    thrive_cse_unit(state, &program->data.block.body);
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL && curr->data.func_decl.body->kind == THRIVE_AST_BLOCK)
+        {
+            thrive_cse_unit(state, &curr->data.func_decl.body->data.block.body);
+        }
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Reduction Splitting
+ * #############################################################################
+ *
+ * In a loop marked for unrolling, a variable the body only updates with
+ *
+ *   s = s + e              (also ^, & and |, s on either side)
+ *   s = e < s ? e : s      (min / max with <, <=, > or >=, any operand order)
+ *
+ * where e does not read s chains every copy of the body to the one before.
+ * These operations are associative and commutative on the 64-bit values
+ * the codegen works with, so copy k of the unrolled part can update its own
+ * accumulator k % n instead. The extra accumulators start at 0 for + and ^
+ * and at the value of s for the others, and are folded back into s behind
+ * the unrolled part, before the plain loop runs the remaining iterations.
+ *
+ * The reductions must be statements of the body itself, not nested in an if.
+ * Bodies with a break or ret are left alone, either would leave the unrolled
+ * part with the accumulators not folded back. The address of s must not be
+ * taken in the scope.
+ */
+#define THRIVE_ACCUMULATE_MAX 4             /* accumulators per reduction */
+#define THRIVE_ACCUMULATE_MAX_REDUCTIONS 8 /* per loop */
+
+typedef struct thrive_accumulate_reduction
+{
+    thrive_ast *statement; /* s = s op e */
+    thrive_ast *name;      /* s */
+
+} thrive_accumulate_reduction;
+
+typedef struct thrive_accumulate_uses
+{
+    thrive_ast *name;
+    u32 count;
+
+} thrive_accumulate_uses;
+
+THRIVE_API void thrive_accumulate_uses_visitor(thrive_ast *node, void *user)
+{
+    thrive_accumulate_uses *uses = (thrive_accumulate_uses *)user;
+
+    if (thrive_inline_is_name(node, uses->name))
+    {
+        uses->count++;
+    }
+}
+
+/* NAME nodes of name in node, reads and writes */
+THRIVE_API u32 thrive_accumulate_count(thrive_ast *node, thrive_ast *name)
+{
+    thrive_accumulate_uses uses;
+
+    uses.name = name;
+    uses.count = 0;
+    thrive_ast_walk(node, thrive_accumulate_uses_visitor, &uses);
+
+    return uses.count;
+}
+
+/* The compared operand has the value of the picked one: equal, or "$t = x" compared and $t picked */
+THRIVE_API u8 thrive_accumulate_same(thrive_ast *compared, thrive_ast *picked)
+{
+    if (compared->kind == THRIVE_AST_ASSIGN && compared->data.assign.left->kind == THRIVE_AST_NAME)
+    {
+        return thrive_inline_is_name(picked, compared->data.assign.left);
+    }
+
+    return thrive_ast_equals(compared, picked);
+}
+
+/* s of "s = s op e" / "s = e < s ? e : s", the NAME nodes of s it must hold in uses */
+THRIVE_API thrive_ast *thrive_accumulate_match(thrive_ast *statement, u32 *uses)
+{
+    thrive_ast *name;
+    thrive_ast *right;
+
+    if (statement->kind != THRIVE_AST_ASSIGN || statement->data.assign.left->kind != THRIVE_AST_NAME)
+    {
+        return 0;
+    }
+
+    name = statement->data.assign.left;
+    right = statement->data.assign.right;
+
+    if (right->kind == THRIVE_AST_BINARY)
+    {
+        switch (right->data.binary.op)
+        {
+        case THRIVE_TOKEN_KIND_ADD:
+        case THRIVE_TOKEN_KIND_XOR_BITWISE:
+        case THRIVE_TOKEN_KIND_AND_BITWISE:
+        case THRIVE_TOKEN_KIND_OR_BITWISE:
+            *uses = 2;
+            return (thrive_inline_is_name(right->data.binary.left, name) || thrive_inline_is_name(right->data.binary.right, name)) ? name : 0;
+        default:
+            return 0;
+        }
+    }
+
+    if (right->kind == THRIVE_AST_TERNARY && right->data.ternary.cond->kind == THRIVE_AST_BINARY)
+    {
+        thrive_ast *cond = right->data.ternary.cond;
+        u8 left_is_s = thrive_inline_is_name(cond->data.binary.left, name);
+        u8 then_is_s = thrive_inline_is_name(right->data.ternary.then_expr, name);
+
+        switch (cond->data.binary.op)
+        {
+        case THRIVE_TOKEN_KIND_LT:
+        case THRIVE_TOKEN_KIND_LT_EQUALS:
+        case THRIVE_TOKEN_KIND_GT:
+        case THRIVE_TOKEN_KIND_GT_EQUALS:
+            break;
+        default:
+            return 0;
+        }
+
+        /* The uses count rules out s on both sides */
+        if ((left_is_s || thrive_inline_is_name(cond->data.binary.right, name)) &&
+            (then_is_s || thrive_inline_is_name(right->data.ternary.else_expr, name)) &&
+            thrive_accumulate_same(left_is_s ? cond->data.binary.right : cond->data.binary.left,
+                                   then_is_s ? right->data.ternary.else_expr : right->data.ternary.then_expr))
+        {
+            *uses = 3;
+            return name;
+        }
+    }
+
+    return 0;
+}
+
+/* Reductions among the statements of body, their variables used nowhere else in it */
+THRIVE_API u32 thrive_accumulate_scan(thrive_ast *body, thrive_accumulate_reduction *reductions)
+{
+    thrive_ast *curr = body->kind == THRIVE_AST_BLOCK ? body->data.block.body : body;
+    u32 count = 0;
+
+    for (; curr && count < THRIVE_ACCUMULATE_MAX_REDUCTIONS; curr = curr->next)
+    {
+        u32 uses = 0;
+        thrive_ast *name = thrive_accumulate_match(curr, &uses);
+
+        if (name && thrive_accumulate_count(curr, name) == uses && thrive_accumulate_count(body, name) == uses)
+        {
+            reductions[count].statement = curr;
+            reductions[count].name = name;
+            count++;
+        }
+
+        if (body->kind != THRIVE_AST_BLOCK)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+THRIVE_API void thrive_accumulate_exit_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_BREAK || node->kind == THRIVE_AST_RETURN)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+/* Marks unrolled loops whose reductions can be split over 2 or 4 accumulators */
+THRIVE_API thrive_ast *thrive_ast_accumulate(thrive_ast *program)
+{
+    thrive_accumulate_reduction reductions[THRIVE_ACCUMULATE_MAX_REDUCTIONS];
+    thrive_ast *curr;
+    u32 i;
+    u32 j;
+
+    unroll_loop_count = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_ast_walk(curr, thrive_unroll_collect_visitor, curr->kind == THRIVE_AST_FUNC_DECL ? curr : program);
+    }
+
+    for (i = 0; i < unroll_loop_count; ++i)
+    {
+        thrive_ast *node = unroll_loops[i];
+        u32 count;
+        u8 exits = 0;
+
+        node->data.for_loop.accumulate = 0;
+
+        if (node->data.for_loop.unroll < 2)
+        {
+            continue;
+        }
+
+        thrive_ast_walk(node->data.for_loop.body, thrive_accumulate_exit_visitor, &exits);
+        count = exits ? 0 : thrive_accumulate_scan(node->data.for_loop.body, reductions);
+
+        for (j = 0; j < count; ++j)
+        {
+            if (thrive_unroll_address_taken(unroll_scopes[i], reductions[j].name))
+            {
+                count = 0;
+            }
+        }
+
+        if (count)
+        {
+            node->data.for_loop.accumulate = node->data.for_loop.unroll < THRIVE_ACCUMULATE_MAX ? node->data.for_loop.unroll : THRIVE_ACCUMULATE_MAX;
+            optimizer_stats.split_reductions += count;
+        }
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Loop Strength Reduction
+ * #############################################################################
+ *
+ * Marks innermost counted loops (see Loop Unrolling) whose body indexes
+ * arrays or pointers with the loop counter:
+ *
+ *   for (i = 0 : i < n : ++i) { s += a[i] }
+ *
+ * The codegen keeps a pointer to a[i] per indexed name, set up once after
+ * the init and advanced by the element size with every step, so a[i] is a
+ * single load through it instead of recomputing a + i * 8.
+ *
+ * If the counter is read nowhere else, the loop steps by one with < or > and
+ * has no break, the codegen also counts down: it stores the final value of
+ * the counter up front and runs "n - i" iterations on a hidden counter whose
+ * decrement sets the flags for the exit jump.
+ *
+ * The indexed names must not be written in the loop, and neither they, the
+ * counter nor the names of the limit may have their address taken. Loops
+ * with nested loops or inlined calls are left alone.
+ */
+#define THRIVE_REDUCE_MAX_LOOPS 1024
+#define THRIVE_REDUCE_MAX_POINTERS 8
+
+typedef struct thrive_reduce_scan
+{
+    thrive_ast *var; /* loop counter */
+
+    /* Names indexed by the counter */
+    thrive_ast *bases[THRIVE_REDUCE_MAX_POINTERS];
+    u32 base_count;
+
+    u32 indexed; /* base[var] accesses */
+    u32 uses;    /* reads of var, those accesses included */
+    u8 breaks;
+    u8 blocked; /* nested loop, inlined call or too many indexed names */
+
+} thrive_reduce_scan;
+
+static thrive_ast *reduce_loops[THRIVE_REDUCE_MAX_LOOPS];
+static thrive_ast *reduce_scopes[THRIVE_REDUCE_MAX_LOOPS];
+static u32 reduce_loop_count;
+
+THRIVE_API void thrive_reduce_collect_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_FOR && reduce_loop_count < THRIVE_REDUCE_MAX_LOOPS)
+    {
+        reduce_scopes[reduce_loop_count] = (thrive_ast *)user;
+        reduce_loops[reduce_loop_count++] = node;
+    }
+}
+
+/* Collects the names indexed by the counter, also used by the codegen */
+THRIVE_API void thrive_reduce_scan_visitor(thrive_ast *node, void *user)
+{
+    thrive_reduce_scan *scan = (thrive_reduce_scan *)user;
+    thrive_ast *base;
+    u32 i;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_BREAK:
+        scan->breaks = 1;
+        break;
+    case THRIVE_AST_FOR:
+    case THRIVE_AST_INLINE:
+        scan->blocked = 1;
+        break;
+    case THRIVE_AST_NAME:
+        if (thrive_inline_is_name(node, scan->var))
+        {
+            scan->uses++;
+        }
+        break;
+    case THRIVE_AST_ARRAY_ACCESS:
+        base = node->data.array_access.left;
+
+        if (base->kind != THRIVE_AST_NAME || !thrive_inline_is_name(node->data.array_access.index, scan->var))
+        {
+            break;
+        }
+
+        scan->indexed++;
+
+        for (i = 0; i < scan->base_count; ++i)
+        {
+            if (thrive_inline_is_name(scan->bases[i], base))
+            {
+                return;
+            }
+        }
+
+        if (scan->base_count == THRIVE_REDUCE_MAX_POINTERS)
+        {
+            scan->blocked = 1;
+            return;
+        }
+
+        scan->bases[scan->base_count++] = base;
+        break;
+    default:
+        break;
+    }
+}
+
+THRIVE_API thrive_reduce_scan thrive_reduce_scan_body(thrive_ast *body, thrive_ast *var)
+{
+    thrive_reduce_scan scan;
+
+    scan.var = var;
+    scan.base_count = 0;
+    scan.indexed = 0;
+    scan.uses = 0;
+    scan.breaks = 0;
+    scan.blocked = 0;
+    thrive_ast_walk(body, thrive_reduce_scan_visitor, &scan);
+
+    return scan;
+}
+
+THRIVE_API void thrive_reduce_loop(thrive_ast *node, thrive_ast *scope)
+{
+    thrive_unroll_loop loop;
+    thrive_reduce_scan scan;
+    thrive_ast *base;
+    u32 i;
+    u8 strict;
+
+    if (!thrive_unroll_analyze(node, &loop) ||
+        thrive_unroll_address_taken(scope, loop.var) || thrive_unroll_address_taken(scope, loop.limit))
+    {
+        return;
+    }
+
+    scan = thrive_reduce_scan_body(node->data.for_loop.body, loop.var);
+
+    if (scan.blocked || !scan.indexed)
+    {
+        return;
+    }
+
+    for (i = 0; i < scan.base_count; ++i)
+    {
+        base = scan.bases[i];
+
+        if (thrive_inline_scan_body(node->data.for_loop.cond, base).written ||
+            thrive_inline_scan_body(node->data.for_loop.step, base).written ||
+            thrive_inline_scan_body(node->data.for_loop.body, base).written ||
+            thrive_unroll_address_taken(scope, base))
+        {
+            return;
+        }
+    }
+
+    node->data.for_loop.reduce = 1;
+    optimizer_stats.reduced_loops++;
+
+    strict = (u8)(node->data.for_loop.cond->data.binary.op == THRIVE_TOKEN_KIND_LT ||
+                  node->data.for_loop.cond->data.binary.op == THRIVE_TOKEN_KIND_GT);
+
+    if (strict && loop.step == 1 && !scan.breaks && scan.uses == scan.indexed)
+    {
+        node->data.for_loop.reduce = 2;
+        optimizer_stats.counted_down_loops++;
+    }
+}
+
+/* Marks the loops whose indexing on the counter becomes pointer increments */
+THRIVE_API thrive_ast *thrive_ast_reduce(thrive_ast *program)
+{
+    thrive_ast *curr;
+    u32 i;
+
+    reduce_loop_count = 0;
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        thrive_ast_walk(curr, thrive_reduce_collect_visitor, curr->kind == THRIVE_AST_FUNC_DECL ? curr : program);
+    }
+
+    for (i = 0; i < reduce_loop_count; ++i)
+    {
+        thrive_reduce_loop(reduce_loops[i], reduce_scopes[i]);
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Constant and Copy Propagation
+ * #############################################################################
+ *
+ * Forward dataflow over one scope (the top-level statements or a function
+ * body). A fact records that a variable holds a known constant or the same
+ * value as another variable. Facts flow through statement lists and blocks,
+ * are intersected where if/else branches merge and are dropped for every
+ * variable a loop writes.
+ *
+ * Only scalar variables whose address is never taken are tracked. Stores
+ * through pointers, array writes and calls can therefore never change a
+ * tracked variable and leave the facts intact. Top-level scalars that
+ * functions use are arrays after thrive_ast_share, so calls never
+ * invalidate a tracked one either.
+ */
+#define THRIVE_PROPAGATE_MAX_FACTS 64
+#define THRIVE_PROPAGATE_MAX_UNTRACKED 128
+
+typedef struct thrive_propagate_fact
+{
+    s8 *start; /* variable the fact is about */
+    u32 length;
+    s8 *source_start; /* copy source, 0 if the fact is a constant */
+    u32 source_length;
+    u32 value;
+
+} thrive_propagate_fact;
+
+typedef struct thrive_propagate_env
+{
+    thrive_propagate_fact facts[THRIVE_PROPAGATE_MAX_FACTS];
+    u32 fact_count;
+    u8 unreachable; /* after ret, break or continue */
+
+} thrive_propagate_env;
+
+static thrive_ast *propagate_untracked[THRIVE_PROPAGATE_MAX_UNTRACKED];
+static u32 propagate_untracked_count = 0;
+static u8 propagate_untracked_overflow = 0;
+static u32 propagate_conditional = 0; /* > 0 while code may not execute (no new facts) */
+
+THRIVE_API void thrive_ast_propagate_untrack(thrive_ast *node, void *user)
+{
+    (void)user;
+
+    if (node->kind != THRIVE_AST_NAME)
+    {
+        return;
+    }
+
+    if (propagate_untracked_count >= THRIVE_PROPAGATE_MAX_UNTRACKED)
+    {
+        propagate_untracked_overflow = 1;
+        return;
+    }
+
+    propagate_untracked[propagate_untracked_count++] = node;
+}
+
+/* Arrays and address-taken variables live in memory others can write */
+THRIVE_API void thrive_ast_propagate_collect(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_ADDR_OF)
+    {
+        thrive_ast_walk(node->data.unary.expr, thrive_ast_propagate_untrack, user);
+    }
+    else if (node->kind == THRIVE_AST_DECL && node->data.decl.is_array)
+    {
+        thrive_ast_propagate_untrack(node->data.decl.name, user);
+    }
+}
+
+THRIVE_API u8 thrive_ast_propagate_is_tracked(s8 *start, u32 length)
+{
+    u32 i;
+
+    if (propagate_untracked_overflow)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < propagate_untracked_count; ++i)
+    {
+        thrive_ast *n = propagate_untracked[i];
+
+        if (thrive_ast_name_equals(n->data.name.start, n->data.name.length, start, length))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+THRIVE_API thrive_propagate_fact *thrive_ast_propagate_find(thrive_propagate_env *env, s8 *start, u32 length)
+{
+    u32 i;
+
+    for (i = 0; i < env->fact_count; ++i)
+    {
+        if (thrive_ast_name_equals(env->facts[i].start, env->facts[i].length, start, length))
+        {
+            return &env->facts[i];
+        }
+    }
+
+    return 0;
+}
+
+/* Forgets everything known about a variable, including copies of it */
+THRIVE_API void thrive_ast_propagate_kill(thrive_propagate_env *env, s8 *start, u32 length)
+{
+    u32 i = 0;
+
+    while (i < env->fact_count)
+    {
+        thrive_propagate_fact *f = &env->facts[i];
+
+        if (thrive_ast_name_equals(f->start, f->length, start, length) ||
+            (f->source_start && thrive_ast_name_equals(f->source_start, f->source_length, start, length)))
+        {
+            *f = env->facts[--env->fact_count];
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+/* Records "name = value" after a store, value being the already rewritten right side */
+THRIVE_API void thrive_ast_propagate_store(thrive_propagate_env *env, thrive_ast *name, thrive_ast *value)
+{
+    thrive_propagate_fact *f;
+
+    thrive_ast_propagate_kill(env, name->data.name.start, name->data.name.length);
+
+    if (propagate_conditional || !value || env->fact_count >= THRIVE_PROPAGATE_MAX_FACTS ||
+        !thrive_ast_propagate_is_tracked(name->data.name.start, name->data.name.length))
+    {
+        return;
+    }
+
+    if (value->kind == THRIVE_AST_INT)
+    {
+        f = &env->facts[env->fact_count++];
+        f->start = name->data.name.start;
+        f->length = name->data.name.length;
+        f->source_start = 0;
+        f->source_length = 0;
+        f->value = value->data.int_value;
+    }
+    else if (value->kind == THRIVE_AST_NAME &&
+             thrive_ast_propagate_is_tracked(value->data.name.start, value->data.name.length) &&
+             !thrive_ast_name_equals(name->data.name.start, name->data.name.length, value->data.name.start, value->data.name.length))
+    {
+        f = &env->facts[env->fact_count++];
+        f->start = name->data.name.start;
+        f->length = name->data.name.length;
+        f->source_start = value->data.name.start;
+        f->source_length = value->data.name.length;
+        f->value = 0;
+    }
+}
+
+THRIVE_API void thrive_ast_propagate_kill_stores(thrive_ast *node, void *user)
+{
+    thrive_propagate_env *env = (thrive_propagate_env *)user;
+    thrive_ast *target = 0;
+
+    if (node->kind == THRIVE_AST_ASSIGN)
+    {
+        target = node->data.assign.left;
+    }
+    else if (node->kind == THRIVE_AST_UNARY &&
+             (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC))
+    {
+        target = node->data.unary.expr;
+    }
+    else if (node->kind == THRIVE_AST_DECL)
+    {
+        target = node->data.decl.name;
+    }
+
+    if (target && target->kind == THRIVE_AST_NAME)
+    {
+        thrive_ast_propagate_kill(env, target->data.name.start, target->data.name.length);
+    }
+}
+
+/* Keeps only the facts both paths agree on */
+THRIVE_API void thrive_ast_propagate_meet(thrive_propagate_env *env, thrive_propagate_env *other)
+{
+    u32 i = 0;
+
+    if (other->unreachable)
+    {
+        return;
+    }
+
+    if (env->unreachable)
+    {
+        *env = *other;
+        return;
+    }
+
+    while (i < env->fact_count)
+    {
+        thrive_propagate_fact *f = &env->facts[i];
+        thrive_propagate_fact *g = thrive_ast_propagate_find(other, f->start, f->length);
+
+        if (!g || f->value != g->value || (f->source_start == 0) != (g->source_start == 0) ||
+            (f->source_start && !thrive_ast_name_equals(f->source_start, f->source_length, g->source_start, g->source_length)))
+        {
+            *f = env->facts[--env->fact_count];
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+THRIVE_API thrive_ast *thrive_ast_propagate_expr(thrive_state *state, thrive_ast *node, thrive_propagate_env *env);
+THRIVE_API void thrive_ast_propagate_statement(thrive_state *state, thrive_ast **stmt, thrive_propagate_env *env);
+
+/* Rewrites sub-expressions that may or may not run: they only invalidate facts */
+THRIVE_API thrive_ast *thrive_ast_propagate_conditional(thrive_state *state, thrive_ast *node, thrive_propagate_env *env)
+{
+    thrive_ast_walk(node, thrive_ast_propagate_kill_stores, env);
+
+    propagate_conditional++;
+    node = thrive_ast_propagate_expr(state, node, env);
+    propagate_conditional--;
+
+    return node;
+}
+
+/* Rewrites variable loads in evaluation order, returns the folded expression */
+THRIVE_API thrive_ast *thrive_ast_propagate_expr(thrive_state *state, thrive_ast *node, thrive_propagate_env *env)
+{
+    if (!node)
+    {
+        return 0;
+    }
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_NAME:
+    {
+        thrive_propagate_fact *f = thrive_ast_propagate_find(env, node->data.name.start, node->data.name.length);
+
+        if (!f)
+        {
+            return node;
+        }
+
+        if (f->source_start)
+        {
+            node->data.name.start = f->source_start;
+            node->data.name.length = f->source_length;
+            optimizer_stats.propagated_copies++;
+        }
+        else
+        {
+            node->kind = THRIVE_AST_INT;
+            node->data.int_value = f->value;
+            optimizer_stats.propagated_constants++;
+        }
+        return node;
+    }
+
+    case THRIVE_AST_BINARY:
+        node->data.binary.left = thrive_ast_propagate_expr(state, node->data.binary.left, env);
+
+        if (node->data.binary.op == THRIVE_TOKEN_KIND_AND_LOGICAL || node->data.binary.op == THRIVE_TOKEN_KIND_OR_LOGICAL)
+        {
+            node->data.binary.right = thrive_ast_propagate_conditional(state, node->data.binary.right, env);
+        }
+        else
+        {
+            node->data.binary.right = thrive_ast_propagate_expr(state, node->data.binary.right, env);
+        }
+        return thrive_ast_fold(node);
+
+    case THRIVE_AST_UNARY:
+    {
+        thrive_ast *target = node->data.unary.expr;
+
+        if (node->data.unary.op != THRIVE_TOKEN_KIND_INC && node->data.unary.op != THRIVE_TOKEN_KIND_DEC)
+        {
+            node->data.unary.expr = thrive_ast_propagate_expr(state, target, env);
+            return thrive_ast_fold(node);
+        }
+
+        if (target->kind == THRIVE_AST_NAME)
+        {
+            thrive_propagate_fact *f = thrive_ast_propagate_find(env, target->data.name.start, target->data.name.length);
+
+            if (f && !f->source_start && !propagate_conditional)
+            {
+                f->value += (node->data.unary.op == THRIVE_TOKEN_KIND_INC) ? 1 : (u32)-1;
+            }
+            else
+            {
+                thrive_ast_propagate_kill(env, target->data.name.start, target->data.name.length);
+            }
+        }
+        return node;
+    }
+
+    case THRIVE_AST_DEREF:
+        node->data.unary.expr = thrive_ast_propagate_expr(state, node->data.unary.expr, env);
+        return node;
+
+    case THRIVE_AST_TERNARY:
+        node->data.ternary.cond = thrive_ast_propagate_expr(state, node->data.ternary.cond, env);
+        node->data.ternary.then_expr = thrive_ast_propagate_conditional(state, node->data.ternary.then_expr, env);
+        node->data.ternary.else_expr = thrive_ast_propagate_conditional(state, node->data.ternary.else_expr, env);
+        return thrive_ast_fold(node);
+
+    case THRIVE_AST_ARRAY_ACCESS:
+        node->data.array_access.index = thrive_ast_propagate_expr(state, node->data.array_access.index, env);
+        node->data.array_access.left = thrive_ast_propagate_expr(state, node->data.array_access.left, env);
+        return node;
+
+    case THRIVE_AST_ASSIGN:
+    {
+        thrive_ast *left = node->data.assign.left;
+        thrive_ast *right = node->data.assign.right;
+
+        if (left->kind == THRIVE_AST_NAME)
+        {
+            /* "a += b" shares the target node with the operand, give the load its own node */
+            if (right == left || (right->kind == THRIVE_AST_BINARY && right->data.binary.left == left))
+            {
+                thrive_ast *load = thrive_ast_create(state, THRIVE_AST_NAME);
+                *load = *left;
+                load->next = 0;
+
+                if (right == left)
+                {
+                    right = load;
+                }
+                else
+                {
+                    right->data.binary.left = load;
+                }
+            }
+
+            node->data.assign.right = thrive_ast_propagate_expr(state, right, env);
+            thrive_ast_propagate_store(env, left, node->data.assign.right);
+            return node;
+        }
+
+        /* Stores through memory: right side first, then the address */
+        node->data.assign.right = thrive_ast_propagate_expr(state, right, env);
+
+        if (left->kind == THRIVE_AST_DEREF)
+        {
+            left->data.unary.expr = thrive_ast_propagate_expr(state, left->data.unary.expr, env);
+        }
+        else if (left->kind == THRIVE_AST_ARRAY_ACCESS)
+        {
+            left->data.array_access.index = thrive_ast_propagate_expr(state, left->data.array_access.index, env);
+            left->data.array_access.left = thrive_ast_propagate_expr(state, left->data.array_access.left, env);
+        }
+        return node;
+    }
+
+    case THRIVE_AST_INLINE:
+    {
+        thrive_ast **curr = &node->data.inline_call.args;
+        thrive_ast *param = node->data.inline_call.params;
+        u32 saved_conditional = propagate_conditional;
+        thrive_propagate_env inner;
+
+        inner.fact_count = 0;
+        inner.unreachable = 0;
+
+        /* The body only sees its parameters, constant arguments become its first facts */
+        while (*curr)
+        {
+            thrive_ast *next = (*curr)->next;
+            *curr = thrive_ast_propagate_expr(state, *curr, env);
+            (*curr)->next = next;
+
+            if ((*curr)->kind == THRIVE_AST_INT)
+            {
+                propagate_conditional = 0;
+                thrive_ast_propagate_store(&inner, param, *curr);
+                propagate_conditional = saved_conditional;
+            }
+
+            param = param->next;
+            curr = &(*curr)->next;
+        }
+
+        thrive_ast_walk(node->data.inline_call.body, thrive_ast_propagate_kill_stores, env);
+
+        propagate_conditional = 0;
+        thrive_ast_propagate_statement(state, &node->data.inline_call.body, &inner);
+        propagate_conditional = saved_conditional;
+
+        return thrive_ast_fold(node);
+    }
+
+    case THRIVE_AST_FUNC_CALL:
+    {
+        thrive_ast **curr = &node->data.func_call.args;
+
+        /* Arguments past the register ones are evaluated first, so do not rely on their order */
+        while (*curr)
+        {
+            thrive_ast *next = (*curr)->next;
+            *curr = thrive_ast_propagate_conditional(state, *curr, env);
+            (*curr)->next = next;
+            curr = &(*curr)->next;
+        }
+        return node;
+    }
+
+    default:
+        return node;
+    }
+}
+
+THRIVE_API void thrive_ast_propagate_list(thrive_state *state, thrive_ast **curr, thrive_propagate_env *env)
+{
+    while (*curr)
+    {
+        if ((*curr)->kind != THRIVE_AST_FUNC_DECL && (*curr)->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_ast_propagate_statement(state, curr, env);
+        }
+        curr = &(*curr)->next;
+    }
+}
+
+THRIVE_API void thrive_ast_propagate_statement(thrive_state *state, thrive_ast **stmt, thrive_propagate_env *env)
+{
+    thrive_ast *node = *stmt;
+
+    switch (node->kind)
+    {
+    case THRIVE_AST_DECL:
+        if (!node->data.decl.is_array)
+        {
+            node->data.decl.value = thrive_ast_propagate_expr(state, node->data.decl.value, env);
+            thrive_ast_propagate_store(env, node->data.decl.name, node->data.decl.value);
+        }
+        break;
+
+    case THRIVE_AST_BLOCK:
+        thrive_ast_propagate_list(state, &node->data.block.body, env);
+        break;
+
+    case THRIVE_AST_IF:
+    {
+        thrive_ast *cond = thrive_ast_propagate_expr(state, node->data.if_stmt.cond, env);
+        node->data.if_stmt.cond = cond;
+
+        /* Only the taken branch runs, the fold removes the other one afterwards */
+        if (cond->kind == THRIVE_AST_INT)
+        {
+            thrive_ast **taken = cond->data.int_value ? &node->data.if_stmt.then_branch : &node->data.if_stmt.else_branch;
+
+            if (*taken)
+            {
+                thrive_ast_propagate_statement(state, taken, env);
+            }
+        }
+        else
+        {
+            thrive_propagate_env else_env = *env;
+
+            thrive_ast_propagate_statement(state, &node->data.if_stmt.then_branch, env);
+
+            if (node->data.if_stmt.else_branch)
+            {
+                thrive_ast_propagate_statement(state, &node->data.if_stmt.else_branch, &else_env);
+            }
+
+            thrive_ast_propagate_meet(env, &else_env);
+        }
+        break;
+    }
+
+    case THRIVE_AST_FOR:
+    {
+        thrive_propagate_env body_env;
+
+        node->data.for_loop.init = thrive_ast_propagate_expr(state, node->data.for_loop.init, env);
+
+        /* What holds on every iteration: facts about variables the loop never writes */
+        thrive_ast_walk(node, thrive_ast_propagate_kill_stores, env);
+
+        node->data.for_loop.cond = thrive_ast_propagate_conditional(state, node->data.for_loop.cond, env);
+
+        body_env = *env;
+        thrive_ast_propagate_statement(state, &node->data.for_loop.body, &body_env);
+
+        node->data.for_loop.step = thrive_ast_propagate_conditional(state, node->data.for_loop.step, env);
+        break;
+    }
+
+    case THRIVE_AST_RETURN:
+        node->data.ret.expr = thrive_ast_propagate_expr(state, node->data.ret.expr, env);
+        env->unreachable = 1;
+        break;
+
+    case THRIVE_AST_BREAK:
+    case THRIVE_AST_CONTINUE:
+        env->unreachable = 1;
+        break;
+
+    default:
+    {
+        thrive_ast *next = node->next;
+        *stmt = thrive_ast_propagate_expr(state, node, env);
+        (*stmt)->next = next;
+        break;
+    }
+    }
+}
+
+/* Propagates one scope, either the top-level statements or a function body */
+THRIVE_API void thrive_ast_propagate_scope(thrive_state *state, thrive_ast *scope)
+{
+    thrive_propagate_env env;
+    thrive_ast *curr;
+
+    env.fact_count = 0;
+    env.unreachable = 0;
+
+    propagate_untracked_count = 0;
+    propagate_untracked_overflow = 0;
+    propagate_conditional = 0;
+
+    for (curr = scope->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind != THRIVE_AST_FUNC_DECL)
+        {
+            thrive_ast_walk(curr, thrive_ast_propagate_collect, 0);
+        }
+    }
+
+    thrive_ast_propagate_list(state, &scope->data.block.body, &env);
+}
+
+/* Runs on a folded program block, folds again what became constant */
+THRIVE_API thrive_ast *thrive_ast_propagate(thrive_state *state, thrive_ast *program)
+{
+    thrive_ast *curr;
+
+    thrive_ast_propagate_scope(state, program);
+
+    for (curr = program->data.block.body; curr; curr = curr->next)
+    {
+        if (curr->kind == THRIVE_AST_FUNC_DECL)
+        {
+            thrive_ast_propagate_scope(state, curr->data.func_decl.body);
+        }
+    }
+
+    return thrive_ast_fold(program);
+}
+
+/* #############################################################################
+ * # [SECTION] Dead Code Elimination
+ * #############################################################################
+ *
+ * Whole-program pass over the optimized AST, in this order:
+ *
+ *   - statements after ret / break / continue are dropped (functions and ext
+ *     declarations following a top-level ret are kept, variable declarations
+ *     lose their initializer)
+ *   - functions and ext declarations not reachable from the top-level code
+ *     are dropped, so they are neither emitted nor imported
+ *   - stores to variables that are never read are dropped, the stored value
+ *     is kept as a statement when it has side effects
+ *   - stores overwritten by a later statement of the same list before any
+ *     read are dropped the same way, unless the address of the variable is
+ *     taken or a ret / break / continue in between can skip the overwrite
+ *
+ * Variables are matched by name over the whole program, so a store is only
+ * dead when no scope reads a variable of that name.
+ */
+#define THRIVE_ELIMINATE_MAX_NAMES 256
+#define THRIVE_ELIMINATE_MAX_DECLS 256
+#define THRIVE_ELIMINATE_MAX_REPORT 64
+#define THRIVE_ELIMINATE_MAX_DISTANCE 16 /* statements searched for the overwrite of a store */
+
+typedef struct thrive_eliminate_name
+{
+    s8 *start;
+    u32 length;
+    u32 uses;   /* NAME nodes with this name */
+    u32 stores; /* of which are targets of statement-level stores */
+    u8 address_taken;
+
+} thrive_eliminate_name;
+
+static thrive_eliminate_name eliminate_names[THRIVE_ELIMINATE_MAX_NAMES];
+static u32 eliminate_name_count;
+static u8 eliminate_name_overflow;
+
+static thrive_ast *eliminate_decls[THRIVE_ELIMINATE_MAX_DECLS];
+static u8 eliminate_reached[THRIVE_ELIMINATE_MAX_DECLS];
+static u8 eliminate_scanned[THRIVE_ELIMINATE_MAX_DECLS];
+static u32 eliminate_decl_count;
+
+/* Dropped functions and ext declarations, for the size report */
+static thrive_ast *eliminated_decls[THRIVE_ELIMINATE_MAX_REPORT];
+static u32 eliminated_decl_count;
+
+/* A statement after which control never reaches the next one in its list */
+THRIVE_API u8 thrive_eliminate_terminates(thrive_ast *stmt)
+{
+    thrive_ast *curr;
+
+    switch (stmt->kind)
+    {
+    case THRIVE_AST_RETURN:
+    case THRIVE_AST_BREAK:
+    case THRIVE_AST_CONTINUE:
+        return 1;
+    case THRIVE_AST_BLOCK:
+        curr = stmt->data.block.body;
+        while (curr && curr->next)
+        {
+            curr = curr->next;
+        }
+        return (u8)(curr && thrive_eliminate_terminates(curr));
+    case THRIVE_AST_IF:
+        return (u8)(stmt->data.if_stmt.else_branch &&
+                    thrive_eliminate_terminates(stmt->data.if_stmt.then_branch) &&
+                    thrive_eliminate_terminates(stmt->data.if_stmt.else_branch));
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API void thrive_eliminate_unreachable_list(thrive_ast **list, u8 top_level);
+
+THRIVE_API void thrive_eliminate_unreachable(thrive_ast *stmt)
+{
+    switch (stmt->kind)
+    {
+    case THRIVE_AST_BLOCK:
+        thrive_eliminate_unreachable_list(&stmt->data.block.body, 0);
+        break;
+    case THRIVE_AST_IF:
+        thrive_eliminate_unreachable(stmt->data.if_stmt.then_branch);
+        if (stmt->data.if_stmt.else_branch)
+        {
+            thrive_eliminate_unreachable(stmt->data.if_stmt.else_branch);
+        }
+        break;
+    case THRIVE_AST_FOR:
+        thrive_eliminate_unreachable(stmt->data.for_loop.body);
+        break;
+    case THRIVE_AST_FUNC_DECL:
+        thrive_eliminate_unreachable(stmt->data.func_decl.body);
+        break;
+    default:
+        break;
+    }
+}
+
+THRIVE_API void thrive_eliminate_unreachable_list(thrive_ast **list, u8 top_level)
+{
+    thrive_ast **curr = list;
+    u8 dead = 0;
+
+    while (*curr)
+    {
+        u8 is_decl = (u8)((*curr)->kind == THRIVE_AST_FUNC_DECL || (*curr)->kind == THRIVE_AST_EXT_DECL);
+
+        if (dead && (*curr)->kind == THRIVE_AST_DECL)
+        {
+            /* Later code may still name the variable, keep its slot */
+            if ((*curr)->data.decl.value)
+            {
+                (*curr)->data.decl.value = 0;
+                optimizer_stats.eliminated_statements++;
+            }
+        }
+        else if (dead && !(top_level && is_decl))
+        {
+            *curr = (*curr)->next;
+            optimizer_stats.eliminated_statements++;
+            continue;
+        }
+
+        thrive_eliminate_unreachable(*curr);
+
+        if (!is_decl && thrive_eliminate_terminates(*curr))
+        {
+            dead = 1;
+        }
+
+        curr = &(*curr)->next;
+    }
+}
+
+THRIVE_API i32 thrive_eliminate_find_decl(thrive_ast *name)
+{
+    u32 i;
+
+    for (i = 0; i < eliminate_decl_count; ++i)
+    {
+        thrive_ast *decl = eliminate_decls[i];
+        thrive_ast *decl_name = decl->kind == THRIVE_AST_FUNC_DECL ? decl->data.func_decl.name : decl->data.ext_decl.name;
+
+        if (thrive_ast_name_equals(decl_name->data.name.start, decl_name->data.name.length, name->data.name.start, name->data.name.length))
+        {
+            return (i32)i;
+        }
+    }
+
+    return -1;
+}
+
+/* Marks every declaration named in reachable code, notes top-level rets (they call ExitProcess) */
+THRIVE_API void thrive_eliminate_reach_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_NAME)
+    {
+        i32 i = thrive_eliminate_find_decl(node);
+
+        if (i >= 0)
+        {
+            eliminate_reached[i] = 1;
+        }
+    }
+    else if (node->kind == THRIVE_AST_RETURN && user)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+THRIVE_API void thrive_eliminate_unreached(thrive_ast *program)
+{
+    thrive_ast **curr;
+    u8 top_level_ret = 0;
+    u8 changed = 1;
+    u32 i;
+
+    eliminate_decl_count = 0;
+
+    for (curr = &program->data.block.body; *curr; curr = &(*curr)->next)
+    {
+        if ((*curr)->kind == THRIVE_AST_FUNC_DECL || (*curr)->kind == THRIVE_AST_EXT_DECL)
+        {
+            if (eliminate_decl_count == THRIVE_ELIMINATE_MAX_DECLS)
+            {
+                return;
+            }
+            eliminate_reached[eliminate_decl_count] = 0;
+            eliminate_scanned[eliminate_decl_count] = 0;
+            eliminate_decls[eliminate_decl_count++] = *curr;
+        }
+    }
+
+    /* Roots: the top-level statements */
+    for (curr = &program->data.block.body; *curr; curr = &(*curr)->next)
+    {
+        if ((*curr)->kind != THRIVE_AST_FUNC_DECL && (*curr)->kind != THRIVE_AST_EXT_DECL)
+        {
+            thrive_ast_walk(*curr, thrive_eliminate_reach_visitor, &top_level_ret);
+        }
+    }
+
+    if (top_level_ret)
+    {
+        for (i = 0; i < eliminate_decl_count; ++i)
+        {
+            thrive_ast *decl = eliminate_decls[i];
+
+            if (decl->kind == THRIVE_AST_EXT_DECL && thrive_ast_name_equals(decl->data.ext_decl.name->data.name.start, decl->data.ext_decl.name->data.name.length, (s8 *)"ExitProcess", 11))
+            {
+                eliminate_reached[i] = 1;
+            }
+        }
+    }
+
+    /* Functions reached so far reach everything their bodies name */
+    while (changed)
+    {
+        changed = 0;
+
+        for (i = 0; i < eliminate_decl_count; ++i)
+        {
+            if (eliminate_reached[i] && !eliminate_scanned[i] && eliminate_decls[i]->kind == THRIVE_AST_FUNC_DECL)
+            {
+                eliminate_scanned[i] = 1;
+                thrive_ast_walk(eliminate_decls[i]->data.func_decl.body, thrive_eliminate_reach_visitor, 0);
+                changed = 1;
+            }
+        }
+    }
+
+    i = 0;
+    curr = &program->data.block.body;
+
+    while (*curr)
+    {
+        if ((*curr)->kind == THRIVE_AST_FUNC_DECL || (*curr)->kind == THRIVE_AST_EXT_DECL)
+        {
+            if (!eliminate_reached[i++])
+            {
+                if ((*curr)->kind == THRIVE_AST_FUNC_DECL)
+                {
+                    optimizer_stats.eliminated_functions++;
+                }
+                else
+                {
+                    optimizer_stats.eliminated_imports++;
+                }
+
+                if (eliminated_decl_count < THRIVE_ELIMINATE_MAX_REPORT)
+                {
+                    eliminated_decls[eliminated_decl_count++] = *curr;
+                }
+
+                *curr = (*curr)->next;
+                continue;
+            }
+        }
+
+        curr = &(*curr)->next;
+    }
+}
+
+THRIVE_API thrive_eliminate_name *thrive_eliminate_find_name(thrive_ast *name)
+{
+    u32 i;
+
+    for (i = 0; i < eliminate_name_count; ++i)
+    {
+        if (thrive_ast_name_equals(eliminate_names[i].start, eliminate_names[i].length, name->data.name.start, name->data.name.length))
+        {
+            return &eliminate_names[i];
+        }
+    }
+
+    return 0;
+}
+
+THRIVE_API void thrive_eliminate_use_visitor(thrive_ast *node, void *user)
+{
+    thrive_eliminate_name *entry;
+    u8 address_taken = 0;
+
+    (void)user;
+
+    /* &name is visited before name itself */
+    if (node->kind == THRIVE_AST_ADDR_OF && node->data.unary.expr->kind == THRIVE_AST_NAME)
+    {
+        node = node->data.unary.expr;
+        address_taken = 1;
+    }
+    else if (node->kind != THRIVE_AST_NAME)
+    {
+        return;
+    }
+
+    entry = thrive_eliminate_find_name(node);
+
+    if (!entry)
+    {
+        if (eliminate_name_count == THRIVE_ELIMINATE_MAX_NAMES)
+        {
+            eliminate_name_overflow = 1;
+            return;
+        }
+        entry = &eliminate_names[eliminate_name_count++];
+        entry->start = node->data.name.start;
+        entry->length = node->data.name.length;
+        entry->uses = 0;
+        entry->stores = 0;
+        entry->address_taken = 0;
+    }
+
+    if (address_taken)
+    {
+        entry->address_taken = 1;
+        return;
+    }
+
+    entry->uses++;
+}
+
+/* The variable a statement stores to, 0 for anything else (array declarations keep their storage) */
+THRIVE_API thrive_ast *thrive_eliminate_store_target(thrive_ast *stmt)
+{
+    if (stmt->kind == THRIVE_AST_DECL && !stmt->data.decl.is_array)
+    {
+        return stmt->data.decl.name;
+    }
+
+    if (stmt->kind == THRIVE_AST_ASSIGN && stmt->data.assign.left->kind == THRIVE_AST_NAME)
+    {
+        return stmt->data.assign.left;
+    }
+
+    return 0;
+}
+
+/* Counts (remove == 0) or drops (remove == 1) the statement-level stores in a list */
+THRIVE_API u32 thrive_eliminate_stores_list(thrive_ast **list, u8 remove);
+
+THRIVE_API u32 thrive_eliminate_stores(thrive_ast *stmt, u8 remove)
+{
+    switch (stmt->kind)
+    {
+    case THRIVE_AST_BLOCK:
+        return thrive_eliminate_stores_list(&stmt->data.block.body, remove);
+    case THRIVE_AST_IF:
+        return thrive_eliminate_stores(stmt->data.if_stmt.then_branch, remove) +
+               (stmt->data.if_stmt.else_branch ? thrive_eliminate_stores(stmt->data.if_stmt.else_branch, remove) : 0);
+    case THRIVE_AST_FOR:
+        return thrive_eliminate_stores(stmt->data.for_loop.body, remove);
+    case THRIVE_AST_FUNC_DECL:
+        return thrive_eliminate_stores(stmt->data.func_decl.body, remove);
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API u32 thrive_eliminate_stores_list(thrive_ast **list, u8 remove)
+{
+    thrive_ast **curr = list;
+    u32 removed = 0;
+
+    while (*curr)
+    {
+        thrive_ast *target = thrive_eliminate_store_target(*curr);
+        thrive_eliminate_name *entry = target ? thrive_eliminate_find_name(target) : 0;
+
+        if (entry && !remove)
+        {
+            entry->stores++;
+        }
+        else if (entry && entry->uses == entry->stores)
+        {
+            thrive_ast *value = (*curr)->kind == THRIVE_AST_DECL ? (*curr)->data.decl.value : (*curr)->data.assign.right;
+
+            optimizer_stats.eliminated_stores++;
+            removed++;
+
+            if (value && !thrive_ast_is_pure(value))
+            {
+                value->next = (*curr)->next;
+                *curr = value;
+            }
+            else
+            {
+                *curr = (*curr)->next;
+                continue;
+            }
+        }
+        else
+        {
+            removed += thrive_eliminate_stores(*curr, remove);
+        }
+
+        curr = &(*curr)->next;
+    }
+
+    return removed;
+}
+
+THRIVE_API void thrive_eliminate_jump_visitor(thrive_ast *node, void *user)
+{
+    if (node->kind == THRIVE_AST_RETURN || node->kind == THRIVE_AST_BREAK || node->kind == THRIVE_AST_CONTINUE)
+    {
+        *(u8 *)user = 1;
+    }
+}
+
+/* Whether a later statement of the list stores to the target of store before anything reads it */
+THRIVE_API u8 thrive_eliminate_overwritten(thrive_ast *store, thrive_ast *target)
+{
+    thrive_ast *curr = store->next;
+    u32 distance;
+
+    for (distance = 0; curr && distance < THRIVE_ELIMINATE_MAX_DISTANCE; curr = curr->next, ++distance)
+    {
+        u8 jumps = 0;
+
+        if (curr->kind == THRIVE_AST_ASSIGN && thrive_inline_is_name(curr->data.assign.left, target))
+        {
+            return (u8)!thrive_inline_scan_body(curr->data.assign.right, target).used;
+        }
+
+        thrive_ast_walk(curr, thrive_eliminate_jump_visitor, &jumps);
+
+        if (jumps || thrive_inline_scan_body(curr, target).used)
+        {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Drops the stores of a list (and the lists below it) that a later statement overwrites */
+THRIVE_API u32 thrive_eliminate_overwrites_list(thrive_ast **list);
+
+THRIVE_API u32 thrive_eliminate_overwrites(thrive_ast *stmt)
+{
+    switch (stmt->kind)
+    {
+    case THRIVE_AST_BLOCK:
+        return thrive_eliminate_overwrites_list(&stmt->data.block.body);
+    case THRIVE_AST_IF:
+        return thrive_eliminate_overwrites(stmt->data.if_stmt.then_branch) +
+               (stmt->data.if_stmt.else_branch ? thrive_eliminate_overwrites(stmt->data.if_stmt.else_branch) : 0);
+    case THRIVE_AST_FOR:
+        return thrive_eliminate_overwrites(stmt->data.for_loop.body);
+    case THRIVE_AST_FUNC_DECL:
+        return thrive_eliminate_overwrites(stmt->data.func_decl.body);
+    default:
+        return 0;
+    }
+}
+
+THRIVE_API u32 thrive_eliminate_overwrites_list(thrive_ast **list)
+{
+    thrive_ast **curr = list;
+    u32 removed = 0;
+
+    while (*curr)
+    {
+        thrive_ast *target = thrive_eliminate_store_target(*curr);
+        thrive_eliminate_name *entry = target ? thrive_eliminate_find_name(target) : 0;
+        thrive_ast *value = 0;
+
+        if (entry && !entry->address_taken && thrive_eliminate_overwritten(*curr, target))
+        {
+            value = (*curr)->kind == THRIVE_AST_DECL ? (*curr)->data.decl.value : (*curr)->data.assign.right;
+        }
+
+        if (value && (*curr)->kind == THRIVE_AST_DECL)
+        {
+            /* The declaration keeps the slot, an initializer with side effects stays */
+            if (thrive_ast_is_pure(value))
+            {
+                (*curr)->data.decl.value = 0;
+                optimizer_stats.overwritten_stores++;
+                removed++;
+            }
+        }
+        else if (value)
+        {
+            optimizer_stats.overwritten_stores++;
+            removed++;
+
+            if (!thrive_ast_is_pure(value))
+            {
+                value->next = (*curr)->next;
+                *curr = value;
+            }
+            else
+            {
+                *curr = (*curr)->next;
+                continue;
+            }
+        }
+        else
+        {
+            removed += thrive_eliminate_overwrites(*curr);
+        }
+
+        curr = &(*curr)->next;
+    }
+
+    return removed;
+}
+
+THRIVE_API thrive_ast *thrive_ast_eliminate(thrive_ast *program)
+{
+    u32 removed = 1;
+
+    eliminated_decl_count = 0;
+
+    thrive_eliminate_unreachable_list(&program->data.block.body, 1);
+    thrive_eliminate_unreached(program);
+
+    /* Dropping a store can leave the variables it read without readers */
+    while (removed)
+    {
+        eliminate_name_count = 0;
+        eliminate_name_overflow = 0;
+
+        thrive_ast_walk(program, thrive_eliminate_use_visitor, 0);
+
+        if (eliminate_name_overflow)
+        {
+            break;
+        }
+
+        /* Use counts stay high for what a dropped overwritten store read, the next round drops it */
+        removed = thrive_eliminate_overwrites_list(&program->data.block.body);
+        thrive_eliminate_stores_list(&program->data.block.body, 0);
+        removed += thrive_eliminate_stores_list(&program->data.block.body, 1);
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] Pass Manager
+ * #############################################################################
+ *
+ * The optimizer passes in pipeline order, each with the lowest level that
+ * runs it:
+ *
+ *   -O0  none, the parsed AST goes straight to the codegen (fastest compile)
+ *   -O1  cheap passes over expressions and statement lists: folding,
+ *        constant / copy propagation and dead code elimination
+ *   -O2  the full pipeline, the codegen adds its peephole rewrites
+ *
+ * thrive_ast_optimize runs a whole level and calls the options' hook around
+ * every pass it runs, which is how a frontend times the passes one by one.
+ */
+typedef enum thrive_opt_level
+{
+    THRIVE_OPT_O0 = 0,
+    THRIVE_OPT_O1,
+    THRIVE_OPT_O2
+
+} thrive_opt_level;
+
+typedef enum thrive_pass_kind
+{
+    THRIVE_PASS_FOLD = 0,
+    THRIVE_PASS_SHARE,
+    THRIVE_PASS_INLINE,
+    THRIVE_PASS_SPECIALIZE,
+    THRIVE_PASS_PROPAGATE,
+    THRIVE_PASS_UNROLL,
+    THRIVE_PASS_PROMOTE,
+    THRIVE_PASS_RANGE,
+    THRIVE_PASS_HOIST,
+    THRIVE_PASS_EVALUATE,
+    THRIVE_PASS_SELECT,
+    THRIVE_PASS_REUSE,
+    THRIVE_PASS_ACCUMULATE,
+    THRIVE_PASS_REDUCE,
+    THRIVE_PASS_ELIMINATE
+
+} thrive_pass_kind;
+
+typedef struct thrive_pass
+{
+    s8 *name;
+    thrive_pass_kind kind;
+    thrive_opt_level level; /* lowest level running the pass */
+
+} thrive_pass;
+
+static thrive_pass thrive_passes[] = {
+    {"fold", THRIVE_PASS_FOLD, THRIVE_OPT_O1},
+    {"share", THRIVE_PASS_SHARE, THRIVE_OPT_O1}, /* before any pass follows a top-level scalar */
+    {"inline", THRIVE_PASS_INLINE, THRIVE_OPT_O2},
+    {"specialize", THRIVE_PASS_SPECIALIZE, THRIVE_OPT_O2},
+    {"propagate", THRIVE_PASS_PROPAGATE, THRIVE_OPT_O1},
+    {"unroll", THRIVE_PASS_UNROLL, THRIVE_OPT_O2},
+    {"promote", THRIVE_PASS_PROMOTE, THRIVE_OPT_O2},
+    {"propagate2", THRIVE_PASS_PROPAGATE, THRIVE_OPT_O2}, /* over the unrolled bodies and promoted scalars */
+    {"range", THRIVE_PASS_RANGE, THRIVE_OPT_O2},
+    {"hoist", THRIVE_PASS_HOIST, THRIVE_OPT_O2},
+    {"evaluate", THRIVE_PASS_EVALUATE, THRIVE_OPT_O2},
+    {"select", THRIVE_PASS_SELECT, THRIVE_OPT_O2},
+    {"reuse", THRIVE_PASS_REUSE, THRIVE_OPT_O2},
+    {"accumulate", THRIVE_PASS_ACCUMULATE, THRIVE_OPT_O2},
+    {"reduce", THRIVE_PASS_REDUCE, THRIVE_OPT_O2},
+    {"eliminate", THRIVE_PASS_ELIMINATE, THRIVE_OPT_O1},
+};
+
+#define THRIVE_PASS_COUNT (sizeof(thrive_passes) / sizeof(thrive_passes[0]))
+
+/* Called before (done = 0) and after (done = 1) a pass, index is its entry of thrive_passes */
+typedef void (*thrive_pass_hook)(void *user, u32 index, u8 done);
+
+typedef struct thrive_pass_options
+{
+    thrive_opt_level level;
+    u32 inline_budget;
+    u32 clone_budget;
+    u32 unroll_budget;
+    u32 select_budget;
+    thrive_pass_hook hook; /* 0 = none */
+    void *hook_user;
+
+} thrive_pass_options;
+
+THRIVE_API thrive_pass_options thrive_pass_defaults(thrive_opt_level level)
+{
+    thrive_pass_options options;
+
+    options.level = level;
+    options.inline_budget = THRIVE_INLINE_BUDGET;
+    options.clone_budget = THRIVE_SPECIALIZE_BUDGET;
+    options.unroll_budget = THRIVE_UNROLL_BUDGET;
+    options.select_budget = THRIVE_SELECT_BUDGET;
+    options.hook = 0;
+    options.hook_user = 0;
+
+    return options;
+}
+
+/* Runs entry index of thrive_passes regardless of the level */
+THRIVE_API thrive_ast *thrive_pass_run(thrive_state *state, thrive_ast *program, u32 index, thrive_pass_options *options)
+{
+    switch (thrive_passes[index].kind)
+    {
+    case THRIVE_PASS_FOLD:
+        return thrive_ast_fold(program);
+    case THRIVE_PASS_SHARE:
+        return thrive_ast_share(state, program);
+    case THRIVE_PASS_INLINE:
+        return thrive_ast_inline(state, program, options->inline_budget);
+    case THRIVE_PASS_SPECIALIZE:
+        return thrive_ast_specialize(state, program, options->clone_budget);
+    case THRIVE_PASS_PROPAGATE:
+        return thrive_ast_propagate(state, program);
+    case THRIVE_PASS_UNROLL:
+        return thrive_ast_unroll(state, program, options->unroll_budget);
+    case THRIVE_PASS_PROMOTE:
+        return thrive_ast_promote(state, program);
+    case THRIVE_PASS_RANGE:
+        return thrive_ast_range(program);
+    case THRIVE_PASS_HOIST:
+        return thrive_ast_hoist(state, program);
+    case THRIVE_PASS_EVALUATE:
+        return thrive_ast_evaluate(program);
+    case THRIVE_PASS_SELECT:
+        return thrive_ast_select(state, program, options->select_budget);
+    case THRIVE_PASS_REUSE:
+        return thrive_ast_reuse(state, program);
+    case THRIVE_PASS_ACCUMULATE:
+        return thrive_ast_accumulate(program);
+    case THRIVE_PASS_REDUCE:
+        return thrive_ast_reduce(program);
+    default:
+        return thrive_ast_eliminate(program);
+    }
+}
+
+/* Runs every pass of the options' level in pipeline order */
+THRIVE_API thrive_ast *thrive_ast_optimize(thrive_state *state, thrive_ast *program, thrive_pass_options *options)
+{
+    u32 i;
+
+    for (i = 0; i < THRIVE_PASS_COUNT; ++i)
+    {
+        if (thrive_passes[i].level > options->level)
+        {
+            continue;
+        }
+
+        if (options->hook)
+        {
+            options->hook(options->hook_user, i, 0);
+        }
+
+        program = thrive_pass_run(state, program, i, options);
+
+        if (options->hook)
+        {
+            options->hook(options->hook_user, i, 1);
+        }
+    }
+
+    return program;
+}
+
+/* #############################################################################
+ * # [SECTION] PE32+ Generator
+ * #############################################################################
+ */
+typedef struct thrive_p32_plus_import
+{
+    s8 *library;       /* e.g. "kernel32.dll" */
+    s8 **imports;      /* e.g. "ExitProcess", "Sleep" */
+    u32 imports_count; /* count of imports entries */
+
+} thrive_p32_plus_import;
+
+u32 thrive_pe32_plus_get_iat_rva(thrive_p32_plus_import *imports, u32 num_imports, u32 text_vsize, u32 dll_index, u32 func_index)
+{
+    u32 text_rva = 0x1000;
+    u32 rdata_rva = text_rva + thrive_align_up(text_vsize, 0x1000);
+    u32 idt_size = (num_imports + 1) * 20;
+
+    u32 num_funcs = 0;
+    u32 i;
+
+    u32 ilt_size;
+    u32 iat_base_rva;
+    u32 offset;
+
+    for (i = 0; i < num_imports; ++i)
+    {
+        num_funcs += imports[i].imports_count;
+    }
+
+    ilt_size = (num_funcs + num_imports) * 8;
+    iat_base_rva = rdata_rva + idt_size + ilt_size;
+
+    offset = 0;
+
+    for (i = 0; i < dll_index; ++i)
+    {
+        offset += (imports[i].imports_count + 1) * 8;
+    }
+
+    offset += func_index * 8;
+
+    return iat_base_rva + offset;
+}
+
+THRIVE_API THRIVE_INLINE u32 thrive_pe32_plus_calculate_import_function_count(
+    thrive_p32_plus_import *imports,
+    u32 num_imports)
+{
+    u32 result = 0;
+
+    u32 i;
+
+    for (i = 0; i < num_imports; ++i)
+    {
+        result += imports[i].imports_count;
+    }
+
+    return result;
+}
+
+THRIVE_API THRIVE_INLINE u32 thrive_pe32_plus_calculate_import_strings_size(
+    thrive_p32_plus_import *imports,
+    u32 num_imports)
+{
+    u32 result = 0;
+
+    u32 i;
+    u32 j;
+
+    for (i = 0; i < num_imports; ++i)
+    {
+        result += thrive_string_length(imports[i].library) + 1;
+
+        for (j = 0; j < imports[i].imports_count; ++j)
+        {
+            result += 2 + thrive_string_length((s8 *)imports[i].imports[j]) + 1; /* 2 bytes for Hint */
+        }
+    }
+
+    return result;
+}
+
+/* String literals follow the import tables in .rdata */
+u32 thrive_pe32_plus_get_strings_rva(thrive_p32_plus_import *imports, u32 num_imports, u32 text_vsize)
+{
+    u32 num_funcs = thrive_pe32_plus_calculate_import_function_count(imports, num_imports);
+    u32 rdata_rva = 0x1000 + thrive_align_up(text_vsize, 0x1000);
+
+    return rdata_rva + (num_imports + 1) * 20 + (num_funcs + num_imports) * 8 * 2 + thrive_pe32_plus_calculate_import_strings_size(imports, num_imports);
+}
+
+/* .data follows .rdata, .bss follows .data (at data_rva when .data is empty) */
+u32 thrive_pe32_plus_get_data_rva(thrive_p32_plus_import *imports, u32 num_imports, u32 text_vsize, u32 strings_size)
+{
+    u32 rdata_rva = 0x1000 + thrive_align_up(text_vsize, 0x1000);
+    u32 rdata_end = thrive_pe32_plus_get_strings_rva(imports, num_imports, text_vsize) + strings_size;
+
+    return rdata_rva + thrive_align_up(rdata_end - rdata_rva, 0x1000);
+}
+
+void thrive_pe32_plus_generate(
+    thrive_buffer *out,
+    thrive_buffer *code,
+    thrive_buffer *strings, /* string literals for .rdata, 0 for none */
+    thrive_buffer *data,    /* initialized globals, 0 for none */
+    u32 bss_size,           /* zero-filled globals */
+    thrive_p32_plus_import *imports,
+    u32 num_imports,
+    u32 text_vsize)
+{
+    u32 i, j;
+    u32 num_funcs = thrive_pe32_plus_calculate_import_function_count(imports, num_imports);
+    u32 strings_size = thrive_pe32_plus_calculate_import_strings_size(imports, num_imports);
+
+    /* Section Layout Calculations */
+    u32 idt_size = (num_imports + 1) * 20;
+    u32 ilt_size = (num_funcs + num_imports) * 8;
+    u32 iat_size = ilt_size;
+
+    u32 text_rva = 0x1000;
+    u32 text_raw_size = thrive_align_up(code->size, 0x200);
+
+    u32 literals_size = strings ? strings->size : 0;
+    u32 rdata_rva = text_rva + thrive_align_up(text_vsize, 0x1000);
+    u32 rdata_vsize = idt_size + ilt_size + iat_size + strings_size + literals_size;
+    u32 rdata_raw_size = thrive_align_up(rdata_vsize, 0x200);
+
+    u32 idt_rva = rdata_rva;
+    u32 ilt_rva = idt_rva + idt_size;
+    u32 iat_rva = ilt_rva + ilt_size;
+    u32 strings_rva = iat_rva + iat_size;
+
+    u32 data_vsize = data ? data->size : 0;
+    u32 data_rva = rdata_rva + thrive_align_up(rdata_vsize, 0x1000);
+    u32 data_raw_size = thrive_align_up(data_vsize, 0x200);
+
+    u32 bss_rva = data_rva + thrive_align_up(data_vsize, 0x1000);
+    u32 size_of_image = thrive_align_up(bss_rva + bss_size, 0x1000);
+    u16 num_sections = (u16)(2 + (data_vsize ? 1 : 0) + (bss_size ? 1 : 0));
+
+    u32 current_dll_name_rva = strings_rva;
+    u32 current_func_name_rva = strings_rva;
+    u32 current_ilt_rva = ilt_rva;
+    u32 current_iat_rva = iat_rva;
+
+    /* Write DOS Header */
+    thrive_buffer_write_u16(out, 0x5A4D); /* MZ */
+    thrive_buffer_align(out, 0x3C);       /* */
+    thrive_buffer_write_u32(out, 0x40);   /* e_lfanew */
+
+    /* Write NT Headers */
+    thrive_buffer_write_u32(out, 0x00004550);   /* PE\0\0 */
+    thrive_buffer_write_u16(out, 0x8664);       /* Machine: AMD64 */
+    thrive_buffer_write_u16(out, num_sections); /* NumberOfSections */
+    thrive_buffer_write_u32(out, 0);            /* TimeDateStamp */
+    thrive_buffer_write_u32(out, 0);            /* PointerToSymbolTable */
+    thrive_buffer_write_u32(out, 0);            /* NumberOfSymbols */
+    thrive_buffer_write_u16(out, 0xF0);         /* SizeOfOptionalHeader */
+    thrive_buffer_write_u16(out, 0x0022);       /* Characteristics (Exec, LargeAddr) */
+
+    /* Write Optional Header (PE32+) */
+    thrive_buffer_write_u16(out, 0x020B);                           /* Magic */
+    thrive_buffer_write_u8(out, 1);                                 /* MajorLinkerVersion */
+    thrive_buffer_write_u8(out, 0);                                 /* MinorLinkerVersion */
+    thrive_buffer_write_u32(out, text_raw_size);                    /* SizeOfCode */
+    thrive_buffer_write_u32(out, rdata_raw_size + data_raw_size);   /* SizeOfInitializedData */
+    thrive_buffer_write_u32(out, thrive_align_up(bss_size, 0x200)); /* SizeOfUninitializedData */
+    thrive_buffer_write_u32(out, text_rva);                         /* AddressOfEntryPoint */
+    thrive_buffer_write_u32(out, text_rva);                         /* BaseOfCode */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wlong-long"
+    thrive_buffer_write_u64(out, 0x0000000140000000ULL); /* ImageBase */
+#pragma GCC diagnostic pop
+
+    thrive_buffer_write_u32(out, 0x1000);        /* SectionAlignment */
+    thrive_buffer_write_u32(out, 0x200);         /* FileAlignment */
+    thrive_buffer_write_u16(out, 5);             /* */
+    thrive_buffer_write_u16(out, 2);             /* OSMajor / OSMinor */
+    thrive_buffer_write_u16(out, 0);             /* */
+    thrive_buffer_write_u16(out, 0);             /* ImageMajor / ImageMinor */
+    thrive_buffer_write_u16(out, 5);             /* */
+    thrive_buffer_write_u16(out, 2);             /* SubSysMajor / SubSysMinor */
+    thrive_buffer_write_u32(out, 0);             /* Win32VersionValue */
+    thrive_buffer_write_u32(out, size_of_image); /* SizeOfImage */
+    thrive_buffer_write_u32(out, 0x200);         /* SizeOfHeaders */
+    thrive_buffer_write_u32(out, 0);             /* CheckSum */
+    thrive_buffer_write_u16(out, 3);             /* Subsystem (3 = Windows CUI Console, 2 = Windows GUI, 1 = Native) */
+    thrive_buffer_write_u16(out, 0x8140);        /* DllCharacteristics (NX, DynBase, HighEnt) */
+    thrive_buffer_write_u64(out, 0x100000);      /* SizeOfStackReserve */
+    thrive_buffer_write_u64(out, 0x1000);        /* SizeOfStackCommit */
+    thrive_buffer_write_u64(out, 0x100000);      /* SizeOfHeapReserve */
+    thrive_buffer_write_u64(out, 0x1000);        /* SizeOfHeapCommit */
+    thrive_buffer_write_u32(out, 0);             /* LoaderFlags */
+    thrive_buffer_write_u32(out, 16);            /* NumberOfRvaAndSizes */
+
+    /* Data Directories */
+    thrive_buffer_write_u32(out, 0);
+    thrive_buffer_write_u32(out, 0); /* Export Directory */
+    thrive_buffer_write_u32(out, idt_rva);
+    thrive_buffer_write_u32(out, idt_size); /* Import Directory */
+
+    for (i = 2; i < 16; ++i)
+    {
+        thrive_buffer_write_u32(out, 0);
+        thrive_buffer_write_u32(out, 0);
+    }
+
+    /* Section Header: .text */
+    thrive_buffer_write_bytes(out, (u8 *)".text\0\0\0", 8);
+    thrive_buffer_write_u32(out, code->size);    /* VirtualSize */
+    thrive_buffer_write_u32(out, text_rva);      /* VirtualAddress */
+    thrive_buffer_write_u32(out, text_raw_size); /* SizeOfRawData */
+    thrive_buffer_write_u32(out, 0x200);         /* PointerToRawData */
+    thrive_buffer_write_u32(out, 0);             /* */
+    thrive_buffer_write_u32(out, 0);             /* */
+    thrive_buffer_write_u16(out, 0);             /* */
+    thrive_buffer_write_u16(out, 0);             /* */
+    thrive_buffer_write_u32(out, 0x60000020);    /* Characteristics (RX) */
+
+    /* Section Header: .rdata */
+    thrive_buffer_write_bytes(out, (u8 *)".rdata\0\0", 8);
+    thrive_buffer_write_u32(out, rdata_vsize);           /* VirtualSize */
+    thrive_buffer_write_u32(out, rdata_rva);             /* VirtualAddress */
+    thrive_buffer_write_u32(out, rdata_raw_size);        /* SizeOfRawData */
+    thrive_buffer_write_u32(out, 0x200 + text_raw_size); /* PointerToRawData */
+    thrive_buffer_write_u32(out, 0);                     /* */
+    thrive_buffer_write_u32(out, 0);                     /* */
+    thrive_buffer_write_u16(out, 0);                     /* */
+    thrive_buffer_write_u16(out, 0);                     /* */
+    thrive_buffer_write_u32(out, 0x40000040);            /* Characteristics (R) */
+
+    /* Section Header: .data */
+    if (data_vsize)
+    {
+        thrive_buffer_write_bytes(out, (u8 *)".data\0\0\0", 8);
+        thrive_buffer_write_u32(out, data_vsize);                             /* VirtualSize */
+        thrive_buffer_write_u32(out, data_rva);                               /* VirtualAddress */
+        thrive_buffer_write_u32(out, data_raw_size);                          /* SizeOfRawData */
+        thrive_buffer_write_u32(out, 0x200 + text_raw_size + rdata_raw_size); /* PointerToRawData */
+        thrive_buffer_write_u32(out, 0);                                      /* */
+        thrive_buffer_write_u32(out, 0);                                      /* */
+        thrive_buffer_write_u16(out, 0);                                      /* */
+        thrive_buffer_write_u16(out, 0);                                      /* */
+        thrive_buffer_write_u32(out, 0xC0000040);                             /* Characteristics (RW) */
+    }
+
+    /* Section Header: .bss, no raw data, the loader zero-fills it */
+    if (bss_size)
+    {
+        thrive_buffer_write_bytes(out, (u8 *)".bss\0\0\0\0", 8);
+        thrive_buffer_write_u32(out, bss_size);   /* VirtualSize */
+        thrive_buffer_write_u32(out, bss_rva);    /* VirtualAddress */
+        thrive_buffer_write_u32(out, 0);          /* SizeOfRawData */
+        thrive_buffer_write_u32(out, 0);          /* PointerToRawData */
+        thrive_buffer_write_u32(out, 0);          /* */
+        thrive_buffer_write_u32(out, 0);          /* */
+        thrive_buffer_write_u16(out, 0);          /* */
+        thrive_buffer_write_u16(out, 0);          /* */
+        thrive_buffer_write_u32(out, 0xC0000080); /* Characteristics (RW, uninitialized) */
+    }
+
+    thrive_buffer_align(out, 0x200); /* Pad Header to File Alignment */
+
+    /* Write .text Data */
+    thrive_buffer_write_bytes(out, code->data, code->size);
+    thrive_buffer_align(out, 0x200);
+
+    /* Write .rdata Data (Imports) */
+    for (i = 0; i < num_imports; ++i)
+    {
+        current_func_name_rva += thrive_string_length(imports[i].library) + 1;
+    }
+
+    /* Write Import Descriptor Table (IDT) */
+    for (i = 0; i < num_imports; ++i)
+    {
+        thrive_buffer_write_u32(out, current_ilt_rva);
+        thrive_buffer_write_u32(out, 0);
+        thrive_buffer_write_u32(out, 0);
+        thrive_buffer_write_u32(out, current_dll_name_rva);
+        thrive_buffer_write_u32(out, current_iat_rva);
+
+        current_dll_name_rva += thrive_string_length(imports[i].library) + 1;
+        current_ilt_rva += (imports[i].imports_count + 1) * 8;
+        current_iat_rva += (imports[i].imports_count + 1) * 8;
+    }
+
+    thrive_buffer_write_u32(out, 0);
+    thrive_buffer_write_u32(out, 0);
+    thrive_buffer_write_u32(out, 0);
+    thrive_buffer_write_u32(out, 0);
+    thrive_buffer_write_u32(out, 0);
+
+    /* Write Import Lookup Table (ILT) & Import Address Table (IAT) */
+    {
+        i32 table;
+
+        for (table = 0; table < 2; ++table)
+        {
+            u32 temp_name_rva = current_func_name_rva;
+
+            for (i = 0; i < num_imports; ++i)
+            {
+                for (j = 0; j < imports[i].imports_count; ++j)
+                {
+                    thrive_buffer_write_u64(out, temp_name_rva);
+                    temp_name_rva += 2 + thrive_string_length((s8 *)imports[i].imports[j]) + 1;
+                }
+                thrive_buffer_write_u64(out, 0); /* Null thunk bounds the array */
+            }
+        }
+
+        /* Write Import Strings: DLL Names */
+        for (i = 0; i < num_imports; ++i)
+        {
+            thrive_buffer_write_bytes(out, (u8 *)imports[i].library, thrive_string_length(imports[i].library) + 1);
+        }
+
+        /* Write Import Strings: Function Names */
+        for (i = 0; i < num_imports; ++i)
+        {
+            for (j = 0; j < imports[i].imports_count; ++j)
+            {
+                thrive_buffer_write_u16(out, 0); /* Ordinal Hint */
+                thrive_buffer_write_bytes(out, (u8 *)imports[i].imports[j], thrive_string_length((s8 *)imports[i].imports[j]) + 1);
+            }
+        }
+    }
+
+    /* Write String Literals */
+    if (literals_size)
+    {
+        thrive_buffer_write_bytes(out, strings->data, literals_size);
+    }
+
+    thrive_buffer_align(out, 0x200);
+
+    /* Write .data */
+    if (data_vsize)
+    {
+        thrive_buffer_write_bytes(out, data->data, data_vsize);
+    }
+
+    /* Final File Alignment Pad */
+    thrive_buffer_align(out, 0x200);
+}
+
+/* #############################################################################
+ * # [SECTION] X86_64 Machine Code Emitter
+ * #############################################################################
+ */
+typedef enum thrive_x64_reg
+{
+    REG_RAX = 0,
+    REG_RCX = 1,
+    REG_RDX = 2,
+    REG_RBX = 3,
+    REG_RSP = 4,
+    REG_RBP = 5,
+    REG_RSI = 6,
+    REG_RDI = 7,
+    REG_R8 = 8,
+    REG_R9 = 9,
+    REG_R10 = 10,
+    REG_R11 = 11,
+    REG_R12 = 12,
+    REG_R13 = 13,
+    REG_R14 = 14,
+    REG_R15 = 15
+} thrive_x64_reg;
 
 typedef enum thrive_x64_op_ext
 {
-    OP_EXT_ADD = 0,
-    OP_EXT_OR = 1,
-    OP_EXT_ADC = 2,
-    OP_EXT_SBB = 3,
-    OP_EXT_AND = 4,
-    OP_EXT_SUB = 5,
-    OP_EXT_XOR = 6,
-    OP_EXT_CMP = 7,
-    OP_EXT_MOV = 0
-} thrive_x64_op_ext;
+    OP_EXT_ADD = 0,
+    OP_EXT_OR = 1,
+    OP_EXT_ADC = 2,
+    OP_EXT_SBB = 3,
+    OP_EXT_AND = 4,
+    OP_EXT_SUB = 5,
+    OP_EXT_XOR = 6,
+    OP_EXT_CMP = 7,
+    OP_EXT_MOV = 0
+} thrive_x64_op_ext;
+
+typedef enum thrive_x64_cc
+{
+    CC_O = 0x0,
+    CC_NO = 0x1,
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_S = 0x8,
+    CC_NS = 0x9,
+    CC_P = 0xA,
+    CC_NP = 0xB,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF
+} thrive_x64_cc;
+
+THRIVE_API THRIVE_INLINE void thrive_x64_modrm_reg(thrive_buffer *b, thrive_x64_reg reg, thrive_x64_reg rm)
+{
+    /* Mod = 11 (register-direct addressing) */
+    u8 modrm = 0xC0 | ((reg & 7) << 3) | (rm & 7);
+    thrive_buffer_write_u8(b, modrm);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_rex(thrive_buffer *b, u8 w, thrive_x64_reg reg, thrive_x64_reg rm)
+{
+    u8 rex = 0x40;
+
+    if (w)
+    {
+        rex |= 0x08; /* W: 64-bit operand size */
+    }
+
+    if (reg >= 8)
+    {
+        rex |= 0x04; /* R: Extension for 'reg' field */
+    }
+
+    if (rm >= 8)
+    {
+        rex |= 0x01; /* B: Extension for 'rm' field */
+    }
+
+    thrive_buffer_write_u8(b, rex);
+}
+
+/* REX for 32-bit operands, only emitted when an extended register needs it */
+THRIVE_API THRIVE_INLINE void thrive_x64_rex32(thrive_buffer *b, thrive_x64_reg reg, thrive_x64_reg rm)
+{
+    if (reg >= 8 || rm >= 8)
+    {
+        thrive_x64_rex(b, 0, reg, rm);
+    }
+}
+
+/* SUB reg, imm8 or ADD reg, imm8 */
+THRIVE_API THRIVE_INLINE void thrive_x64_alu_ri8(thrive_buffer *b, thrive_x64_op_ext op_ext, thrive_x64_reg dst, u8 imm)
+{
+    thrive_x64_rex(b, 1, 0, dst);
+    thrive_buffer_write_u8(b, 0x83);
+    thrive_buffer_write_u8(b, (u8)(0xC0 | (op_ext << 3) | (dst & 7)));
+    thrive_buffer_write_u8(b, imm);
+}
+
+/* [rbp + disp32] */
+THRIVE_API THRIVE_INLINE void thrive_x64_modrm_disp32(thrive_buffer *b, thrive_x64_reg reg, thrive_x64_reg base, i32 disp)
+{
+    thrive_buffer_write_u8(b, 0x80 | ((reg & 7) << 3) | (base & 7)); /* mod=10 */
+    thrive_buffer_write_u32(b, (u32)disp);
+}
+
+/* MOV reg, imm32 */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_ri32(thrive_buffer *b, thrive_x64_reg dst, u32 imm)
+{
+    thrive_x64_rex(b, 1, 0, dst);
+    thrive_buffer_write_u8(b, 0xC7);
+    thrive_buffer_write_u8(b, 0xC0 | (OP_EXT_MOV << 3) | (dst & 7));
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* MOV reg, imm64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_ri64(thrive_buffer *b, thrive_x64_reg dst, u64 imm)
+{
+    thrive_x64_rex(b, 1, 0, dst);
+    thrive_buffer_write_u8(b, 0xB8 | (dst & 7));
+    thrive_buffer_write_u64(b, imm);
+}
+
+/* mov r64, [rbp+disp] */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_r_mrbp(thrive_buffer *b, thrive_x64_reg dst, i32 disp)
+{
+    thrive_x64_rex(b, 1, dst, REG_RBP);
+    thrive_buffer_write_u8(b, 0x8B);
+    thrive_x64_modrm_disp32(b, dst, REG_RBP, disp);
+}
+
+/* mov [rbp+disp], r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_mrbp_r(thrive_buffer *b, i32 disp, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, REG_RBP);
+    thrive_buffer_write_u8(b, 0x89);
+    thrive_x64_modrm_disp32(b, src, REG_RBP, disp);
+}
+
+/* lea r64, [rbp+disp] */
+THRIVE_API THRIVE_INLINE void thrive_x64_lea_r_mrbp(thrive_buffer *b, thrive_x64_reg dst, i32 disp)
+{
+    thrive_x64_rex(b, 1, dst, REG_RBP);
+    thrive_buffer_write_u8(b, 0x8D);
+    thrive_x64_modrm_disp32(b, dst, REG_RBP, disp);
+}
+
+/* add / sub / cmp qword [rbp+disp], imm32 */
+THRIVE_API THRIVE_INLINE void thrive_x64_alu_mrbp_i32(thrive_buffer *b, thrive_x64_op_ext op_ext, i32 disp, u32 imm)
+{
+    thrive_x64_rex(b, 1, 0, REG_RBP);
+    thrive_buffer_write_u8(b, 0x81);
+    thrive_x64_modrm_disp32(b, (thrive_x64_reg)op_ext, REG_RBP, disp);
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* MOV reg, reg */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, dst, src);
+    thrive_buffer_write_u8(b, 0x8B);
+    thrive_x64_modrm_reg(b, dst, src);
+}
+
+/* mov rax, [rax] */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_r_mr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg base)
+{
+    thrive_x64_rex(b, 1, dst, base);
+    thrive_buffer_write_u8(b, 0x8B);
+    /* Mod=00 (memory indirect). No displacement. */
+    thrive_buffer_write_u8(b, 0x00 | ((dst & 7) << 3) | (base & 7));
+}
+
+/* mov [rax], rbx */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_mr_r(thrive_buffer *b, thrive_x64_reg base, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, base);
+    thrive_buffer_write_u8(b, 0x89);
+    /* Mod=00 (memory indirect). No displacement. */
+    thrive_buffer_write_u8(b, 0x00 | ((src & 7) << 3) | (base & 7));
+}
+
+/* movzx rax, al */
+THRIVE_API THRIVE_INLINE void thrive_x64_movzx_rax_al(thrive_buffer *b)
+{
+    thrive_buffer_write_u8(b, 0x48);
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, 0xB6);
+    thrive_buffer_write_u8(b, 0xC0);
+}
+
+/* PUSH reg */
+THRIVE_API THRIVE_INLINE void thrive_x64_push_r(thrive_buffer *b, thrive_x64_reg reg)
+{
+    if (reg >= 8)
+    {
+        thrive_buffer_write_u8(b, 0x41); /* REX.B for high registers */
+    }
+    thrive_buffer_write_u8(b, 0x50 | (reg & 7));
+}
+
+/* POP reg */
+THRIVE_API THRIVE_INLINE void thrive_x64_pop_r(thrive_buffer *b, thrive_x64_reg reg)
+{
+    if (reg >= 8)
+    {
+        thrive_buffer_write_u8(b, 0x41);
+    }
+    thrive_buffer_write_u8(b, 0x58 | (reg & 7));
+}
+
+/* XOR reg, reg */
+THRIVE_API THRIVE_INLINE void thrive_x64_xor_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, dst);
+    thrive_buffer_write_u8(b, 0x31);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+/* add r64, r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_add_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, dst);
+    thrive_buffer_write_u8(b, 0x01);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+/* sub r64, r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_sub_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, dst);
+    thrive_buffer_write_u8(b, 0x29);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_sub_rsp_imm32(thrive_buffer *b, u32 imm)
+{
+    thrive_buffer_write_u8(b, 0x48);
+    thrive_buffer_write_u8(b, 0x81);
+    thrive_buffer_write_u8(b, 0xEC);
+    thrive_buffer_write_u32(b, imm);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_add_rsp_imm32(thrive_buffer *b, u32 imm)
+{
+    thrive_buffer_write_u8(b, 0x48);
+    thrive_buffer_write_u8(b, 0x81);
+    thrive_buffer_write_u8(b, 0xC4);
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* imul r64, r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_imul_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, dst, src);
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, 0xAF);
+    thrive_x64_modrm_reg(b, dst, src);
+}
+
+/* cmp r64, r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_cmp_rr(thrive_buffer *b, thrive_x64_reg a, thrive_x64_reg rb)
+{
+    thrive_x64_rex(b, 1, rb, a);
+    thrive_buffer_write_u8(b, 0x39);
+    thrive_x64_modrm_reg(b, rb, a);
+}
+
+/* setcc */
+THRIVE_API THRIVE_INLINE void thrive_x64_setcc(thrive_buffer *b, thrive_x64_cc cc)
+{
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, (u8)(0x90 | cc)); /* cc = condition */
+    thrive_buffer_write_u8(b, 0xC0);            /* AL */
+}
+
+/* cmovcc r64, r64 */
+THRIVE_API THRIVE_INLINE void thrive_x64_cmovcc_rr(thrive_buffer *b, thrive_x64_cc cc, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, dst, src);
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, (u8)(0x40 | cc));
+    thrive_x64_modrm_reg(b, dst, src);
+}
+
+/* jmp rel32 */
+THRIVE_API THRIVE_INLINE void thrive_x64_jmp(thrive_buffer *b, i32 rel)
+{
+    thrive_buffer_write_u8(b, 0xE9);
+    thrive_buffer_write_u32(b, (u32)rel);
+}
+
+/* je / jne / etc */
+THRIVE_API THRIVE_INLINE void thrive_x64_jcc(thrive_buffer *b, thrive_x64_cc cc, i32 rel)
+{
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, (u8)(0x80 | cc));
+    thrive_buffer_write_u32(b, (u32)rel);
+}
+
+/* NEG */
+THRIVE_API THRIVE_INLINE void thrive_x64_neg_r(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xF7);
+    thrive_buffer_write_u8(b, 0xD8 | (reg & 7));
+}
+
+/* NOT r32 (clears the upper half, ~ works on u32 like the folder) */
+THRIVE_API THRIVE_INLINE void thrive_x64_not_r32(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex32(b, 0, reg);
+    thrive_buffer_write_u8(b, 0xF7);
+    thrive_buffer_write_u8(b, 0xD0 | (reg & 7));
+}
+
+/* TEST rax, rax */
+THRIVE_API THRIVE_INLINE void thrive_x64_test_rr(thrive_buffer *b, thrive_x64_reg a, thrive_x64_reg breg)
+{
+    thrive_x64_rex(b, 1, breg, a);
+    thrive_buffer_write_u8(b, 0x85);
+    thrive_x64_modrm_reg(b, breg, a);
+}
+
+/* CMP rax, imm32 */
+THRIVE_API THRIVE_INLINE void thrive_x64_cmp_ri32(thrive_buffer *b, thrive_x64_reg reg, u32 imm)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0x81);
+    thrive_buffer_write_u8(b, 0xF8 | (reg & 7));
+    thrive_buffer_write_u32(b, imm);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_and_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, dst);
+    thrive_buffer_write_u8(b, 0x21);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_or_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex(b, 1, src, dst);
+    thrive_buffer_write_u8(b, 0x09);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_shl_cl(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xD3);
+    thrive_buffer_write_u8(b, 0xE0 | (reg & 7));
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_shr_cl(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xD3);
+    thrive_buffer_write_u8(b, 0xE8 | (reg & 7));
+}
+
+/* SHL r64, imm8 */
+THRIVE_API THRIVE_INLINE void thrive_x64_shl_ri8(thrive_buffer *b, thrive_x64_reg reg, u8 imm)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xC1);
+    thrive_buffer_write_u8(b, 0xE0 | (reg & 7));
+    thrive_buffer_write_u8(b, imm);
+}
+
+/* SHR r32, imm8 */
+THRIVE_API THRIVE_INLINE void thrive_x64_shr_r32_i8(thrive_buffer *b, thrive_x64_reg reg, u8 imm)
+{
+    thrive_x64_rex32(b, 0, reg);
+    thrive_buffer_write_u8(b, 0xC1);
+    thrive_buffer_write_u8(b, 0xE8 | (reg & 7));
+    thrive_buffer_write_u8(b, imm);
+}
+
+/* AND r32, imm32 */
+THRIVE_API THRIVE_INLINE void thrive_x64_and_r32_i32(thrive_buffer *b, thrive_x64_reg reg, u32 imm)
+{
+    thrive_x64_rex32(b, 0, reg);
+    thrive_buffer_write_u8(b, 0x81);
+    thrive_buffer_write_u8(b, 0xE0 | (reg & 7));
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* MOV r32, r32 (clears the upper half) */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_r32_r32(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+{
+    thrive_x64_rex32(b, src, dst);
+    thrive_buffer_write_u8(b, 0x89);
+    thrive_x64_modrm_reg(b, src, dst);
+}
+
+/* MOV r32, imm32 (zero-extended) */
+THRIVE_API THRIVE_INLINE void thrive_x64_mov_r32_i32(thrive_buffer *b, thrive_x64_reg dst, u32 imm)
+{
+    thrive_x64_rex32(b, 0, dst);
+    thrive_buffer_write_u8(b, 0xB8 | (dst & 7));
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* LEA r64, [base + index * scale] (base must not be rbp/r13, index below r8) */
+THRIVE_API THRIVE_INLINE void thrive_x64_lea_r_sib(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg base, thrive_x64_reg index, u32 scale)
+{
+    u8 ss = (u8)(scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0);
+
+    thrive_x64_rex(b, 1, dst, base);
+    thrive_buffer_write_u8(b, 0x8D);
+    thrive_buffer_write_u8(b, 0x04 | ((dst & 7) << 3));
+    thrive_buffer_write_u8(b, (u8)((ss << 6) | ((index & 7) << 3) | (base & 7)));
+}
+
+/* IMUL r64, r64, imm32 (sign-extended) */
+THRIVE_API THRIVE_INLINE void thrive_x64_imul_rri32(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src, u32 imm)
+{
+    thrive_x64_rex(b, 1, dst, src);
+    thrive_buffer_write_u8(b, 0x69);
+    thrive_x64_modrm_reg(b, dst, src);
+    thrive_buffer_write_u32(b, imm);
+}
+
+/* MUL r64 (rdx:rax = rax * reg) */
+THRIVE_API THRIVE_INLINE void thrive_x64_mul_r(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xF7);
+    thrive_buffer_write_u8(b, 0xE0 | (reg & 7));
+}
+
+/* DIV r32 (eax = edx:eax / reg, edx = remainder) */
+THRIVE_API THRIVE_INLINE void thrive_x64_div_r32(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex32(b, 0, reg);
+    thrive_buffer_write_u8(b, 0xF7);
+    thrive_buffer_write_u8(b, 0xF0 | (reg & 7));
+}
+
+/* IDIV */
+THRIVE_API THRIVE_INLINE void thrive_x64_idiv_r(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_x64_rex(b, 1, 0, reg);
+    thrive_buffer_write_u8(b, 0xF7);
+    thrive_buffer_write_u8(b, 0xF8 | (reg & 7));
+}
+
+/* CQO */
+THRIVE_API THRIVE_INLINE void thrive_x64_cqo(thrive_buffer *b)
+{
+    thrive_buffer_write_u8(b, 0x48);
+    thrive_buffer_write_u8(b, 0x99);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_leave(thrive_buffer *b)
+{
+    thrive_buffer_write_u8(b, 0xC9);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_ret(thrive_buffer *b)
+{
+    thrive_buffer_write_u8(b, 0xC3);
+}
+
+/* size bytes of padding as the recommended multi-byte nops (0F 1F /0), 9 bytes per instruction at most */
+THRIVE_API void thrive_x64_nop(thrive_buffer *b, u32 size)
+{
+    static u8 nops[9][9] = {
+        {0x90},
+        {0x66, 0x90},
+        {0x0F, 0x1F, 0x00},
+        {0x0F, 0x1F, 0x40, 0x00},
+        {0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+        {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+    while (size > 0)
+    {
+        u32 n = size > 9 ? 9 : size;
+
+        thrive_buffer_write_bytes(b, nops[n - 1], n);
+        size -= n;
+    }
+}
+
+/* lea rax, [rel STR_0] */
+THRIVE_API THRIVE_INLINE void thrive_x64_lea_rip_rel32(thrive_buffer *b, thrive_x64_reg dst, u32 rel)
+{
+    thrive_x64_rex(b, 1, dst, 0);
+    thrive_buffer_write_u8(b, 0x8D);
+    thrive_buffer_write_u8(b, 0x05 | ((dst & 7) << 3));
+    thrive_buffer_write_u32(b, rel);
+}
+
+/* direct call */
+THRIVE_API THRIVE_INLINE void thrive_x64_call_rel32(thrive_buffer *b, u32 curr_rva, u32 target_rva)
+{
+    u32 rel = target_rva - (curr_rva + 5);
+    thrive_buffer_write_u8(b, 0xE8);
+    thrive_buffer_write_u32(b, rel);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_inst_call_rel32(thrive_buffer *b, u32 curr_rva, u32 target_rva)
+{
+    u32 rel = target_rva - (curr_rva + 6);
+    thrive_buffer_write_u8(b, 0xFF); /* CALL */
+    thrive_buffer_write_u8(b, 0x15); /* ModR/M: rel32 */
+    thrive_buffer_write_u32(b, rel);
+}
+
+/* #############################################################################
+ * # [SECTION] X86_64 PE32+ Codegen
+ * #############################################################################
+ */
+#define THRIVE_MAX_VARS (THRIVE_MAX_GLOBALS + 256) /* the globals and the locals in scope */
+#define THRIVE_MAX_LABELS 4096 /* entries of the default label table, see thrive_x64_codegen_tables */
+#define THRIVE_MAX_FIXUPS 4096 /* entries of the default fixup table, and the most string literals */
+#define THRIVE_MAX_FUNCS 256
+#define THRIVE_MAX_GLOBALS 4096
+#define THRIVE_MAX_STRING_BYTES 65536 /* decoded string literals, each distinct one once */
+#define THRIVE_STRING_HASH_SIZE 8192  /* power of two, twice THRIVE_MAX_FIXUPS */
+#define THRIVE_GLOBAL_SLOT 0x40000000 /* slots from here on are globals, slot - THRIVE_GLOBAL_SLOT indexes globals[] */
+
+typedef struct thrive_var
+{
+    s8 *start;
+    u32 length;
+    i32 offset;
+    u8 is_array;
+} thrive_var;
+
+typedef enum fixup_type
+{
+    FIXUP_JMP,
+    FIXUP_CALL_REL,
+    FIXUP_CALL_IAT,
+    FIXUP_STRING,
+    FIXUP_DATA /* rip-relative access to a global */
+} fixup_type;
+
+typedef struct thrive_fixup
+{
+    fixup_type type;
+    u32 buffer_offset;
+    u32 instr_end_offset;
+    i32 target_id;
+} thrive_fixup;
+
+typedef struct thrive_string_data
+{
+    u32 start;  /* decoded bytes in string_b, with the null terminator */
+    u32 length; /* including the null terminator */
+    u32 offset; /* in the .rdata literals, assigned by thrive_x64_codegen_strings */
+} thrive_string_data;
+
+typedef struct thrive_global
+{
+    u32 size;   /* bytes, 8 per element like a stack slot */
+    u32 offset; /* into .data or .bss, assigned by thrive_x64_codegen_end */
+    u64 value;  /* initial value of a .data global */
+    u8 in_data; /* 0 puts it into the zero-filled .bss */
+
+} thrive_global;
+
+typedef struct thrive_func
+{
+    s8 *start;
+    u32 length;
+    u32 rva;
+    u8 is_external;
+    u32 ext_dll_index;
+    u32 ext_func_index;
+} thrive_func;
 
-typedef enum thrive_x64_cc
+static thrive_var vars[THRIVE_MAX_VARS];
+static u32 var_count = 0;
+static i32 stack_offset = 0;
+static i32 in_function = 0;
+static i32 label_id = 0;
+static i32 current_break_label = -1;
+static i32 current_return_label = -1; /* end of the inlined body a ret jumps to */
+static i32 stack_lowest = 0;          /* deepest local slot of the current frame */
+static u32 frame_size_offset = 0;     /* imm32 of the prologue's "sub rsp" */
+static i32 current_continue_label = -1;
+static thrive_fixup fixup_table[THRIVE_MAX_FIXUPS];
+static thrive_fixup *fixups = fixup_table;
+static u32 fixup_capacity = THRIVE_MAX_FIXUPS;
+static u32 fixup_count = 0;
+static u32 label_table[THRIVE_MAX_LABELS];
+static u32 *label_offsets = label_table;
+static u32 label_capacity = THRIVE_MAX_LABELS;
+static thrive_string_data string_pool[THRIVE_MAX_FIXUPS]; /* a literal is referenced by at least one fixup */
+static u32 string_count = 0;
+static u32 string_hash[THRIVE_STRING_HASH_SIZE]; /* string_pool index + 1, 0 = free */
+static u8 string_bytes[THRIVE_MAX_STRING_BYTES];
+static thrive_buffer string_b = {string_bytes, 0, THRIVE_MAX_STRING_BYTES};
+static u8 rdata_string_bytes[THRIVE_MAX_STRING_BYTES];
+static thrive_buffer rdata_string_b = {rdata_string_bytes, 0, THRIVE_MAX_STRING_BYTES}; /* the literals after tail merging */
+static u32 string_order[THRIVE_MAX_FIXUPS];
+static thrive_func funcs[THRIVE_MAX_FUNCS];
+static u32 func_count = 0;
+static thrive_global globals[THRIVE_MAX_GLOBALS];
+static u32 global_count = 0;
+static u8 global_data[THRIVE_MAX_GLOBALS * 8]; /* .data, only scalars have an initial value */
+
+/*
+ * Internal calling convention. Thrive functions are only reached through
+ * FIXUP_CALL_REL calls, so they skip the Win64 ABI that ext calls and the
+ * entry point keep: the first THRIVE_INTERNAL_ARG_REGS arguments go in the
+ * registers below, the rest are pushed right to left so the callee finds
+ * the first of them at [rbp + 16], and there is no shadow space.
+ * A call clobbers rax (the result), rbx, rcx, rdx, r8 - r11 and the flags.
+ * rsi, rdi and r12 - r15 are never touched, rbp and rsp are preserved.
+ */
+static thrive_x64_reg internal_arg_regs[THRIVE_INTERNAL_ARG_REGS] = {REG_RCX, REG_RDX, REG_R8, REG_R9, REG_R10, REG_R11};
+
+/* Hardcoded mapping for demonstration */
+static s8 *kUser32 = "user32.dll";
+static s8 *kKernel32 = "kernel32.dll";
+static s8 *user32_funcs[32];
+static s8 *kernel32_funcs[32];
+static u32 u32_fc = 0, k32_fc = 0;
+static s8 import_name_pool[1024];
+static u32 import_name_pool_offset = 0;
+
+/* Pointers of the strength-reduced loop being generated (see thrive_ast_reduce) */
+static thrive_ast *reduced_var; /* counter they follow */
+static thrive_ast *reduced_bases[THRIVE_REDUCE_MAX_POINTERS];
+static i32 reduced_offsets[THRIVE_REDUCE_MAX_POINTERS]; /* slot holding &base[counter] */
+static u32 reduced_count;
+static u32 reduced_bump; /* bytes per step */
+static u8 reduced_down;
+
+/* Reductions of the unrolled loop being generated (see thrive_ast_accumulate) */
+static thrive_accumulate_reduction accumulate_reductions[THRIVE_ACCUMULATE_MAX_REDUCTIONS];
+static thrive_var *accumulate_vars[THRIVE_ACCUMULATE_MAX_REDUCTIONS];
+static i32 accumulate_offsets[THRIVE_ACCUMULATE_MAX_REDUCTIONS][THRIVE_ACCUMULATE_MAX]; /* [0] is the variable's own slot */
+static u32 accumulate_count;
+static u32 accumulate_width;
+
+/* Slot the last variable store wrote rax to, a load of it emitted right behind the store keeps rax */
+static thrive_buffer *stored_buffer;
+static u32 stored_end;
+static i32 stored_slot;
+
+/*
+ * Peephole window: the last instructions emitted through the codegen wrappers
+ * below. A pattern is only rewritten while it still ends the buffer, before
+ * any label is bound behind it or a later fixup points past it, so label and
+ * fixup offsets never have to move.
+ */
+#define THRIVE_PEEPHOLE_WINDOW 4
+
+typedef enum thrive_peephole_kind
 {
-    CC_O = 0x0,
-    CC_NO = 0x1,
-    CC_B = 0x2,
-    CC_AE = 0x3,
-    CC_E = 0x4,
-    CC_NE = 0x5,
-    CC_BE = 0x6,
-    CC_A = 0x7,
-    CC_S = 0x8,
-    CC_NS = 0x9,
-    CC_P = 0xA,
-    CC_NP = 0xB,
-    CC_L = 0xC,
-    CC_GE = 0xD,
-    CC_LE = 0xE,
-    CC_G = 0xF
-} thrive_x64_cc;
+    PEEP_PUSH,  /* push rax */
+    PEEP_RAX,   /* only writes rax: mov rax, imm / mov rax, [rbp+disp] */
+    PEEP_FLAGS, /* ALU op, ZF is set from the result in rax */
+    PEEP_BOOL,  /* setcc al; movzx rax, al */
+    PEEP_TEST,  /* test rax, rax */
+    PEEP_JMP    /* jmp rel32 to a label */
 
-THRIVE_API THRIVE_INLINE void thrive_x64_modrm_reg(thrive_buffer *b, thrive_x64_reg reg, thrive_x64_reg rm)
+} thrive_peephole_kind;
+
+typedef struct thrive_peephole_op
 {
-    /* Mod = 11 (register-direct addressing) */
-    u8 modrm = 0xC0 | ((reg & 7) << 3) | (rm & 7);
-    thrive_buffer_write_u8(b, modrm);
+    thrive_peephole_kind kind;
+    thrive_x64_cc cc; /* condition of a PEEP_BOOL */
+    u32 start;
+    u32 end;
+
+} thrive_peephole_op;
+
+static u8 peephole_enabled;
+static thrive_buffer *peephole_buffer;
+static thrive_peephole_op peephole_ops[THRIVE_PEEPHOLE_WINDOW];
+static u32 peephole_count;
+
+/* Code of an emitted internal function, kept for the identical code folding */
+typedef struct thrive_icf_func
+{
+    i32 func;
+    u32 start;
+    u32 size;
+    u32 fixup_first; /* the body's fixups are [fixup_first, fixup_end) */
+    u32 fixup_end;
+    u32 hash;
+
+} thrive_icf_func;
+
+static u8 icf_enabled;
+static thrive_icf_func icf_funcs[THRIVE_MAX_FUNCS];
+static u32 icf_count;
+
+static u32 align_functions; /* entry alignment of internal functions, 0 = none */
+static u32 align_loops;     /* alignment of the label a loop branches back to, 0 = none */
+
+/* Turns the rewrites on or off, the wrappers emit the plain instructions when off */
+THRIVE_API void thrive_x64_codegen_peephole(u8 enabled)
+{
+    peephole_enabled = enabled;
+    peephole_count = 0;
+}
+
+/* The instruction depth places from the end, 0 unless it and all behind it still end the buffer */
+THRIVE_API thrive_peephole_op *thrive_x64_peephole_tail(thrive_buffer *b, u32 depth)
+{
+    u32 end = b->size;
+    u32 i;
+
+    if (!peephole_enabled || peephole_buffer != b || depth >= peephole_count)
+    {
+        return 0;
+    }
+
+    for (i = 0; i <= depth; ++i)
+    {
+        thrive_peephole_op *op = &peephole_ops[peephole_count - 1 - i];
+
+        if (op->end != end)
+        {
+            return 0;
+        }
+
+        end = op->start;
+    }
+
+    return &peephole_ops[peephole_count - 1 - depth];
+}
+
+/* Records the instruction emitted from start up to the buffer end */
+THRIVE_API void thrive_x64_peephole_note(thrive_buffer *b, thrive_peephole_kind kind, thrive_x64_cc cc, u32 start)
+{
+    thrive_peephole_op *op;
+    u32 i;
+
+    if (!peephole_enabled)
+    {
+        return;
+    }
+
+    if (peephole_buffer != b)
+    {
+        peephole_buffer = b;
+        peephole_count = 0;
+    }
+
+    if (peephole_count == THRIVE_PEEPHOLE_WINDOW)
+    {
+        for (i = 1; i < THRIVE_PEEPHOLE_WINDOW; ++i)
+        {
+            peephole_ops[i - 1] = peephole_ops[i];
+        }
+
+        peephole_count--;
+    }
+
+    op = &peephole_ops[peephole_count++];
+    op->kind = kind;
+    op->cc = cc;
+    op->start = start;
+    op->end = b->size;
+}
+
+/* Drops everything emitted from start on */
+THRIVE_API void thrive_x64_peephole_rewind(thrive_buffer *b, u32 start)
+{
+    b->size = start;
+
+    while (peephole_count > 0 && peephole_ops[peephole_count - 1].start >= start)
+    {
+        peephole_count--;
+    }
+
+    optimizer_stats.peephole_rewrites++;
+}
+
+/* A table of the codegen is full */
+THRIVE_API void thrive_x64_codegen_overflow(s8 *message)
+{
+    thrive_status status = {0};
+
+    status.type = THRIVE_STATUS_ERROR_MEMORY;
+    status.message = message;
+
+    thrive_panic(status);
+}
+
+THRIVE_API THRIVE_INLINE void thrive_x64_codegen_reset_locals(void)
+{
+    var_count = 0;
+    stack_offset = 0;
+}
+
+THRIVE_API THRIVE_INLINE i32 thrive_x64_codegen_new_label(void)
+{
+    if ((u32)label_id == label_capacity)
+    {
+        thrive_x64_codegen_overflow("Too many labels");
+    }
+
+    return label_id++;
+}
+
+THRIVE_API void thrive_x64_codegen_bind_label(thrive_buffer *b, i32 label)
+{
+    thrive_peephole_op *jmp = thrive_x64_peephole_tail(b, 0);
+
+    /* jmp to the very next instruction */
+    while (jmp && jmp->kind == PEEP_JMP && fixup_count > 0 && fixups[fixup_count - 1].buffer_offset == jmp->start + 1 && fixups[fixup_count - 1].target_id == label)
+    {
+        fixup_count--;
+        thrive_x64_peephole_rewind(b, jmp->start);
+        jmp = thrive_x64_peephole_tail(b, 0);
+    }
+
+    label_offsets[label] = b->size;
+    stored_buffer = 0;  /* a jump here may arrive with anything in rax */
+    peephole_count = 0; /* or with other flags */
+}
+
+THRIVE_API void thrive_x64_codegen_record_fixup(thrive_buffer *b, fixup_type type, i32 target_id)
+{
+    /* A dropped fixup would leave a rel32 of 0 behind */
+    if (fixup_count == fixup_capacity)
+    {
+        thrive_x64_codegen_overflow("Too many fixups");
+    }
+
+    fixups[fixup_count].type = type;
+    fixups[fixup_count].buffer_offset = b->size;
+    fixups[fixup_count].instr_end_offset = b->size + 4;
+    fixups[fixup_count].target_id = target_id;
+    fixup_count++;
+
+    thrive_buffer_write_u32(b, 0); /* Dummy bytes to patch later */
+}
+
+/* op reg, [rip+global] with opcode 0x8B (mov reg, m), 0x89 (mov m, reg) or 0x8D (lea) */
+THRIVE_API void thrive_x64_codegen_global(thrive_buffer *b, u8 opcode, thrive_x64_reg reg, i32 slot)
+{
+    thrive_x64_rex(b, 1, reg, REG_RAX);
+    thrive_buffer_write_u8(b, opcode);
+    thrive_buffer_write_u8(b, (u8)(((reg & 7) << 3) | 5)); /* mod 00, rm 101: [rip+disp32] */
+    thrive_x64_codegen_record_fixup(b, FIXUP_DATA, slot - THRIVE_GLOBAL_SLOT);
+}
+
+/* mov [rbp+offset], rax for a variable (mov [rip+global], rax for a global slot), remembered for thrive_x64_codegen_load */
+THRIVE_API void thrive_x64_codegen_store(thrive_buffer *b, i32 offset)
+{
+    if (offset >= THRIVE_GLOBAL_SLOT)
+    {
+        thrive_x64_codegen_global(b, 0x89, REG_RAX, offset);
+    }
+    else
+    {
+        thrive_x64_mov_mrbp_r(b, offset, REG_RAX);
+    }
+
+    stored_buffer = b;
+    stored_end = b->size;
+    stored_slot = offset;
+}
+
+/* mov rax, [rbp+offset], dropped when the previous instruction stored rax there */
+THRIVE_API void thrive_x64_codegen_load(thrive_buffer *b, i32 offset)
+{
+    u32 start = b->size;
+
+    if (stored_buffer == b && stored_end == b->size && stored_slot == offset)
+    {
+        optimizer_stats.forwarded_loads++;
+        return;
+    }
+
+    if (offset >= THRIVE_GLOBAL_SLOT)
+    {
+        thrive_x64_codegen_global(b, 0x8B, REG_RAX, offset);
+    }
+    else
+    {
+        thrive_x64_mov_r_mrbp(b, REG_RAX, offset);
+    }
+
+    thrive_x64_peephole_note(b, PEEP_RAX, CC_E, start);
+}
+
+/* lea rax, [rbp+offset] or [rip+global] for the address of a variable */
+THRIVE_API void thrive_x64_codegen_address(thrive_buffer *b, i32 offset)
+{
+    if (offset >= THRIVE_GLOBAL_SLOT)
+    {
+        thrive_x64_codegen_global(b, 0x8D, REG_RAX, offset);
+    }
+    else
+    {
+        thrive_x64_lea_r_mrbp(b, REG_RAX, offset);
+    }
+}
+
+/* mov reg, imm, as the 5 byte mov r32, imm32 when the value has no upper half */
+THRIVE_API void thrive_x64_codegen_imm(thrive_buffer *b, thrive_x64_reg reg, u64 imm)
+{
+    u32 start = b->size;
+
+    if (peephole_enabled && imm <= 0xFFFFFFFF)
+    {
+        thrive_x64_mov_r32_i32(b, reg, (u32)imm);
+    }
+    else
+    {
+        thrive_x64_mov_ri64(b, reg, imm);
+    }
+
+    if (reg == REG_RAX)
+    {
+        thrive_x64_peephole_note(b, PEEP_RAX, CC_E, start);
+    }
+}
+
+/* push rax */
+THRIVE_API void thrive_x64_codegen_push(thrive_buffer *b)
+{
+    u32 start = b->size;
+
+    thrive_x64_push_r(b, REG_RAX);
+    thrive_x64_peephole_note(b, PEEP_PUSH, CC_E, start);
+}
+
+/* pop reg, becomes a mov when the push rax is right before it or only an instruction writing rax is in between */
+THRIVE_API void thrive_x64_codegen_pop(thrive_buffer *b, thrive_x64_reg reg)
+{
+    thrive_peephole_op *push = thrive_x64_peephole_tail(b, 0);
+    thrive_peephole_op *load = push;
+    u8 moved[16];
+    u32 length;
+    u32 i;
+
+    if (push && push->kind == PEEP_PUSH)
+    {
+        thrive_x64_peephole_rewind(b, push->start);
+
+        if (reg != REG_RAX)
+        {
+            thrive_x64_mov_rr(b, reg, REG_RAX);
+        }
+        return;
+    }
+
+    push = thrive_x64_peephole_tail(b, 1);
+
+    if (push && push->kind == PEEP_PUSH && load->kind == PEEP_RAX)
+    {
+        /* The rip-relative load of a global carries the last fixup, it moves (or goes) with the load */
+        thrive_fixup *fixup = fixup_count > 0 && fixups[fixup_count - 1].buffer_offset >= load->start ? &fixups[fixup_count - 1] : 0;
+        u32 moved_start = load->start;
+
+        length = load->end - load->start;
+
+        for (i = 0; i < length; ++i)
+        {
+            moved[i] = b->data[load->start + i];
+        }
+
+        /* "pop rax" restores what the load overwrote, the load is dead */
+        thrive_x64_peephole_rewind(b, push->start);
+
+        if (reg != REG_RAX)
+        {
+            u32 start;
+
+            thrive_x64_mov_rr(b, reg, REG_RAX);
+            start = b->size;
+
+            for (i = 0; i < length; ++i)
+            {
+                thrive_buffer_write_u8(b, moved[i]);
+            }
+
+            thrive_x64_peephole_note(b, PEEP_RAX, CC_E, start);
+
+            if (fixup)
+            {
+                fixup->buffer_offset = fixup->buffer_offset - moved_start + start;
+                fixup->instr_end_offset = fixup->buffer_offset + 4;
+            }
+        }
+        else if (fixup)
+        {
+            fixup_count--;
+        }
+        return;
+    }
+
+    thrive_x64_pop_r(b, reg);
+}
+
+/* Drops "setcc al; movzx rax, al; test rax, rax" in front of a consumer of ZF, which then uses the setcc condition */
+THRIVE_API void thrive_x64_codegen_fuse(thrive_buffer *b, thrive_x64_cc *cc)
+{
+    thrive_peephole_op *test = thrive_x64_peephole_tail(b, 0);
+    thrive_peephole_op *flag = thrive_x64_peephole_tail(b, 1);
+
+    if ((*cc == CC_E || *cc == CC_NE) && flag && flag->kind == PEEP_BOOL && test->kind == PEEP_TEST)
+    {
+        *cc = *cc == CC_E ? (thrive_x64_cc)(flag->cc ^ 1) : flag->cc; /* the x64 conditions come in pairs cc / cc ^ 1 */
+        thrive_x64_peephole_rewind(b, flag->start);
+    }
+}
+
+/* setcc al; movzx rax, al */
+THRIVE_API void thrive_x64_codegen_bool(thrive_buffer *b, thrive_x64_cc cc)
+{
+    u32 start;
+
+    thrive_x64_codegen_fuse(b, &cc);
+    start = b->size;
+    thrive_x64_setcc(b, cc);
+    thrive_x64_movzx_rax_al(b);
+    thrive_x64_peephole_note(b, PEEP_BOOL, cc, start);
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_rex(thrive_buffer *b, u8 w, thrive_x64_reg reg, thrive_x64_reg rm)
+/* test rax, rax for a je / jne / sete / setne, skipped when the last ALU op already set ZF from rax */
+THRIVE_API void thrive_x64_codegen_test(thrive_buffer *b)
 {
-    u8 rex = 0x40;
+    thrive_peephole_op *op = thrive_x64_peephole_tail(b, 0);
+    u32 start = b->size;
 
-    if (w)
+    if (op && op->kind == PEEP_FLAGS)
     {
-        rex |= 0x08; /* W: 64-bit operand size */
+        optimizer_stats.peephole_rewrites++;
+        return;
     }
 
-    if (reg >= 8)
+    thrive_x64_test_rr(b, REG_RAX, REG_RAX);
+    thrive_x64_peephole_note(b, PEEP_TEST, CC_E, start);
+}
+
+/* jcc rel32 to label */
+THRIVE_API void thrive_x64_codegen_jcc(thrive_buffer *b, thrive_x64_cc cc, i32 label)
+{
+    thrive_x64_codegen_fuse(b, &cc);
+    thrive_buffer_write_u8(b, 0x0F);
+    thrive_buffer_write_u8(b, (u8)(0x80 | cc));
+    thrive_x64_codegen_record_fixup(b, FIXUP_JMP, label);
+}
+
+/* jmp rel32 to label, dropped by thrive_x64_codegen_bind_label when the label follows right behind */
+THRIVE_API void thrive_x64_codegen_jmp(thrive_buffer *b, i32 label)
+{
+    u32 start = b->size;
+
+    thrive_buffer_write_u8(b, 0xE9);
+    thrive_x64_codegen_record_fixup(b, FIXUP_JMP, label);
+    thrive_x64_peephole_note(b, PEEP_JMP, CC_E, start);
+}
+
+THRIVE_API i32 thrive_x64_codegen_find_or_add_func(s8 *start, u32 length)
+{
+    u32 i;
+
+    for (i = 0; i < func_count; ++i)
     {
-        rex |= 0x04; /* R: Extension for 'reg' field */
+        if (funcs[i].length == length && thrive_string_equals(funcs[i].start, start, length))
+        {
+            return (i32)i;
+        }
     }
 
-    if (rm >= 8)
+    funcs[func_count].start = start;
+    funcs[func_count].length = length;
+    funcs[func_count].rva = 0;
+    funcs[func_count].is_external = 0; /* picks the calling convention, must not survive an earlier program */
+
+    return (i32)func_count++;
+}
+
+THRIVE_API thrive_var *thrive_x64_codegen_find_var(s8 *start, u32 length)
+{
+    u32 i;
+
+    /* Newest first, so parameters of inlined bodies shadow the caller */
+    for (i = var_count; i > 0; --i)
     {
-        rex |= 0x01; /* B: Extension for 'rm' field */
+        if (vars[i - 1].length == length && thrive_string_equals(vars[i - 1].start, start, length))
+        {
+            return &vars[i - 1];
+        }
     }
 
-    thrive_buffer_write_u8(b, rex);
+    return 0;
 }
 
-/* SUB reg, imm8 or ADD reg, imm8 */
-THRIVE_API THRIVE_INLINE void thrive_x64_alu_ri8(thrive_buffer *b, thrive_x64_op_ext op_ext, thrive_x64_reg dst, u8 imm)
+THRIVE_API thrive_var *thrive_x64_codegen_add_var(s8 *start, u32 length, u8 is_array, u32 array_size)
 {
-    thrive_x64_rex(b, 1, 0, dst);
-    thrive_buffer_write_u8(b, 0x83);
-    thrive_buffer_write_u8(b, (u8)(0xC0 | (op_ext << 3) | (dst & 7)));
-    thrive_buffer_write_u8(b, imm);
+    thrive_var *v;
+    u32 size = is_array ? array_size : 1;
+
+    if (var_count == THRIVE_MAX_VARS)
+    {
+        thrive_x64_codegen_overflow("Too many variables in scope");
+    }
+
+    v = &vars[var_count++];
+    stack_offset -= (i32)(8 * size);
+    if (stack_offset < stack_lowest)
+    {
+        stack_lowest = stack_offset;
+    }
+    v->start = start;
+    v->length = length;
+    v->offset = stack_offset;
+    v->is_array = is_array;
+    return v;
 }
 
-/* [rbp + disp32] */
-THRIVE_API THRIVE_INLINE void thrive_x64_modrm_disp32(thrive_buffer *b, thrive_x64_reg reg, thrive_x64_reg base, i32 disp)
+/* A top-level variable in .bss instead of the top-level frame, functions read it from there */
+THRIVE_API thrive_var *thrive_x64_codegen_add_global(s8 *start, u32 length, u8 is_array, u32 array_size)
 {
-    thrive_buffer_write_u8(b, 0x80 | ((reg & 7) << 3) | (base & 7)); /* mod=10 */
-    thrive_buffer_write_u32(b, (u32)disp);
+    thrive_var *v;
+    thrive_global *g;
+
+    /* Never a stack slot: functions have no access to the top-level frame */
+    if (global_count == THRIVE_MAX_GLOBALS || var_count == THRIVE_MAX_VARS)
+    {
+        thrive_x64_codegen_overflow("Too many top-level variables");
+    }
+
+    g = &globals[global_count];
+    g->size = 8 * (is_array ? array_size : 1);
+    g->offset = 0;
+    g->value = 0;
+    g->in_data = 0;
+
+    v = &vars[var_count++];
+    v->start = start;
+    v->length = length;
+    v->offset = THRIVE_GLOBAL_SLOT + (i32)global_count++;
+    v->is_array = is_array;
+    return v;
 }
 
-/* MOV reg, imm32 */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_ri32(thrive_buffer *b, thrive_x64_reg dst, u32 imm)
+THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node);
+THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node);
+
+/* push rbp; mov rbp, rsp; sub rsp, 256 (patched by thrive_x64_codegen_frame_end) */
+THRIVE_API void thrive_x64_codegen_frame_begin(thrive_buffer *b)
 {
-    thrive_x64_rex(b, 1, 0, dst);
-    thrive_buffer_write_u8(b, 0xC7);
-    thrive_buffer_write_u8(b, 0xC0 | (OP_EXT_MOV << 3) | (dst & 7));
-    thrive_buffer_write_u32(b, imm);
+    thrive_x64_push_r(b, REG_RBP);
+    thrive_x64_mov_rr(b, REG_RBP, REG_RSP);
+    frame_size_offset = b->size + 3;
+    thrive_x64_sub_rsp_imm32(b, 256);
+    stack_lowest = 0;
 }
 
-/* MOV reg, imm64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_ri64(thrive_buffer *b, thrive_x64_reg dst, u64 imm)
+/* Grows the frame when the locals, inlined ones included, need more than 256 bytes */
+THRIVE_API void thrive_x64_codegen_frame_end(thrive_buffer *b)
 {
-    thrive_x64_rex(b, 1, 0, dst);
-    thrive_buffer_write_u8(b, 0xB8 | (dst & 7));
-    thrive_buffer_write_u64(b, imm);
+    u32 size = thrive_align_up((u32)-stack_lowest, 16);
+
+    if (size > 256)
+    {
+        u32 *patch_ptr = (u32 *)(b->data + frame_size_offset);
+        *patch_ptr = size;
+    }
 }
 
-/* mov r64, [rbp+disp] */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_r_mrbp(thrive_buffer *b, thrive_x64_reg dst, i32 disp)
+/* Aligns internal function entries and loop heads (powers of two like 16 or 32, 0 = off).
+ * .text starts on a page, so buffer offsets align like addresses. */
+THRIVE_API void thrive_x64_codegen_align(u32 functions, u32 loops)
 {
-    thrive_x64_rex(b, 1, dst, REG_RBP);
-    thrive_buffer_write_u8(b, 0x8B);
-    thrive_x64_modrm_disp32(b, dst, REG_RBP, disp);
+    align_functions = functions;
+    align_loops = loops;
 }
 
-/* mov [rbp+disp], r64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_mrbp_r(thrive_buffer *b, i32 disp, thrive_x64_reg src)
+/* Label and fixup tables sized for the input by the platform layer, 0 keeps the default ones */
+THRIVE_API void thrive_x64_codegen_tables(u32 *labels, u32 labels_capacity, thrive_fixup *fixup_entries, u32 fixup_entries_capacity)
 {
-    thrive_x64_rex(b, 1, src, REG_RBP);
-    thrive_buffer_write_u8(b, 0x89);
-    thrive_x64_modrm_disp32(b, src, REG_RBP, disp);
+    label_offsets = labels ? labels : label_table;
+    label_capacity = labels ? labels_capacity : THRIVE_MAX_LABELS;
+    fixups = fixup_entries ? fixup_entries : fixup_table;
+    fixup_capacity = fixup_entries ? fixup_entries_capacity : THRIVE_MAX_FIXUPS;
 }
 
-/* lea r64, [rbp+disp] */
-THRIVE_API THRIVE_INLINE void thrive_x64_lea_r_mrbp(thrive_buffer *b, thrive_x64_reg dst, i32 disp)
+/* Nops up to the next multiple of alignment, returns their size */
+THRIVE_API u32 thrive_x64_codegen_pad(thrive_buffer *b, u32 alignment)
 {
-    thrive_x64_rex(b, 1, dst, REG_RBP);
-    thrive_buffer_write_u8(b, 0x8D);
-    thrive_x64_modrm_disp32(b, dst, REG_RBP, disp);
+    u32 size = alignment ? (alignment - b->size % alignment) % alignment : 0;
+
+    thrive_x64_nop(b, size);
+    optimizer_stats.align_padding += size;
+
+    return size;
 }
 
-/* MOV reg, reg */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+/* Binds the label a loop branches back to, the nops in front run once on entry */
+THRIVE_API void thrive_x64_codegen_bind_loop(thrive_buffer *b, i32 label)
 {
-    thrive_x64_rex(b, 1, dst, src);
-    thrive_buffer_write_u8(b, 0x8B);
-    thrive_x64_modrm_reg(b, dst, src);
+    if (align_loops)
+    {
+        thrive_x64_codegen_pad(b, align_loops);
+        optimizer_stats.aligned_loops++;
+    }
+
+    thrive_x64_codegen_bind_label(b, label);
 }
 
-/* mov rax, [rax] */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_r_mr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg base)
+/* Turns the identical code folding of internal functions on or off */
+THRIVE_API void thrive_x64_codegen_icf(u8 enabled)
 {
-    thrive_x64_rex(b, 1, dst, base);
-    thrive_buffer_write_u8(b, 0x8B);
-    /* Mod=00 (memory indirect). No displacement. */
-    thrive_buffer_write_u8(b, 0x00 | ((dst & 7) << 3) | (base & 7));
+    icf_enabled = enabled;
+    icf_count = 0;
 }
 
-/* mov [rax], rbx */
-THRIVE_API THRIVE_INLINE void thrive_x64_mov_mr_r(thrive_buffer *b, thrive_x64_reg base, thrive_x64_reg src)
+/* FNV-1a of the code, the rel32 fields of the fixups are still the zeroes record_fixup wrote */
+THRIVE_API u32 thrive_x64_icf_hash(thrive_buffer *b, u32 start, u32 size)
 {
-    thrive_x64_rex(b, 1, src, base);
-    thrive_buffer_write_u8(b, 0x89);
-    /* Mod=00 (memory indirect). No displacement. */
-    thrive_buffer_write_u8(b, 0x00 | ((src & 7) << 3) | (base & 7));
+    u32 hash = 2166136261u;
+    u32 i;
+
+    for (i = 0; i < size; ++i)
+    {
+        hash = (hash ^ b->data[start + i]) * 16777619u;
+    }
+
+    return hash;
 }
 
-/* movzx rax, al */
-THRIVE_API THRIVE_INLINE void thrive_x64_movzx_rax_al(thrive_buffer *b)
+/* Whether fixup a of body f and fixup c of body g patch the same place with the same target */
+THRIVE_API u8 thrive_x64_icf_same_fixup(thrive_icf_func *f, thrive_fixup *a, thrive_icf_func *g, thrive_fixup *c)
 {
-    thrive_buffer_write_u8(b, 0x48);
-    thrive_buffer_write_u8(b, 0x0F);
-    thrive_buffer_write_u8(b, 0xB6);
-    thrive_buffer_write_u8(b, 0xC0);
+    if (a->type != c->type || a->buffer_offset - f->start != c->buffer_offset - g->start)
+    {
+        return 0;
+    }
+
+    switch (a->type)
+    {
+    case FIXUP_JMP:
+        return label_offsets[a->target_id] - f->start == label_offsets[c->target_id] - g->start;
+    case FIXUP_CALL_REL:
+        /* A recursive call of each body to itself counts as the same call */
+        return a->target_id == c->target_id || (a->target_id == f->func && c->target_id == g->func);
+    default:
+        /* CALL_IAT, STRING and DATA: equal targets have equal indices (into funcs, string_pool, globals) */
+        return a->target_id == c->target_id;
+    }
 }
 
-/* PUSH reg */
-THRIVE_API THRIVE_INLINE void thrive_x64_push_r(thrive_buffer *b, thrive_x64_reg reg)
+/* Byte by byte and fixup by fixup comparison of two bodies with the same hash */
+THRIVE_API u8 thrive_x64_icf_equals(thrive_buffer *b, thrive_icf_func *f, thrive_icf_func *g)
 {
-    if (reg >= 8)
+    u32 i;
+
+    if (f->hash != g->hash || f->size != g->size || f->fixup_end - f->fixup_first != g->fixup_end - g->fixup_first)
     {
-        thrive_buffer_write_u8(b, 0x41); /* REX.B for high registers */
+        return 0;
     }
-    thrive_buffer_write_u8(b, 0x50 | (reg & 7));
+
+    for (i = 0; i < f->size; ++i)
+    {
+        if (b->data[f->start + i] != b->data[g->start + i])
+        {
+            return 0;
+        }
+    }
+
+    for (i = 0; i < f->fixup_end - f->fixup_first; ++i)
+    {
+        if (!thrive_x64_icf_same_fixup(f, &fixups[f->fixup_first + i], g, &fixups[g->fixup_first + i]))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
-/* POP reg */
-THRIVE_API THRIVE_INLINE void thrive_x64_pop_r(thrive_buffer *b, thrive_x64_reg reg)
+/*
+ * Called behind the code of an internal function. If an earlier function has
+ * the same code the new body and its fixups are dropped again and the function
+ * takes the rva of the earlier one, so every call fixup, already recorded or
+ * not, lands on the shared body.
+ */
+THRIVE_API void thrive_x64_codegen_icf_fold(thrive_buffer *b, i32 f_idx, u32 start, u32 fixup_first)
 {
-    if (reg >= 8)
+    thrive_icf_func *g;
+    u32 i;
+
+    if (!icf_enabled || icf_count >= THRIVE_MAX_FUNCS)
     {
-        thrive_buffer_write_u8(b, 0x41);
+        return;
     }
-    thrive_buffer_write_u8(b, 0x58 | (reg & 7));
+
+    g = &icf_funcs[icf_count];
+    g->func = f_idx;
+    g->start = start;
+    g->size = b->size - start;
+    g->fixup_first = fixup_first;
+    g->fixup_end = fixup_count;
+    g->hash = thrive_x64_icf_hash(b, start, g->size);
+
+    for (i = 0; i < icf_count; ++i)
+    {
+        if (thrive_x64_icf_equals(b, &icf_funcs[i], g))
+        {
+            funcs[f_idx].rva = funcs[icf_funcs[i].func].rva;
+            optimizer_stats.folded_functions++;
+            optimizer_stats.folded_bytes += g->size;
+
+            b->size = start;
+            fixup_count = fixup_first;
+            peephole_count = 0;
+            stored_buffer = 0;
+            return;
+        }
+    }
+
+    icf_count++;
 }
 
-/* XOR reg, reg */
-THRIVE_API THRIVE_INLINE void thrive_x64_xor_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+/* string_pool index of a literal, decoded (escapes) and added unless an equal one exists */
+THRIVE_API u32 thrive_x64_codegen_string(s8 *start, u32 length)
 {
-    thrive_x64_rex(b, 1, src, dst);
-    thrive_buffer_write_u8(b, 0x31);
-    thrive_x64_modrm_reg(b, src, dst);
+    u32 begin = string_b.size;
+    u32 hash;
+    u32 slot;
+    u32 i;
+
+    for (i = 0; i < length; ++i)
+    {
+        u8 c = (u8)start[i];
+
+        if (c == '\\' && i + 1 < length)
+        {
+            c = (u8)start[++i];
+            c = c == 'n' ? 10 : c == 'r' ? 13 : c == 't' ? 9 : c == '0' ? 0 : c;
+        }
+
+        thrive_buffer_write_u8(&string_b, c);
+    }
+
+    thrive_buffer_write_u8(&string_b, 0); /* Null Terminator */
+    hash = thrive_x64_icf_hash(&string_b, begin, string_b.size - begin);
+
+    for (slot = hash & (THRIVE_STRING_HASH_SIZE - 1); string_hash[slot]; slot = (slot + 1) & (THRIVE_STRING_HASH_SIZE - 1))
+    {
+        thrive_string_data *other = &string_pool[string_hash[slot] - 1];
+
+        if (other->length == string_b.size - begin &&
+            thrive_string_equals((s8 *)string_bytes + other->start, (s8 *)string_bytes + begin, other->length))
+        {
+            string_b.size = begin;
+            return string_hash[slot] - 1;
+        }
+    }
+
+    if (string_count == THRIVE_MAX_FIXUPS)
+    {
+        /* Only once the fixups ran out, the reference is not patched anyway */
+        string_b.size = begin;
+        return 0;
+    }
+
+    string_pool[string_count].start = begin;
+    string_pool[string_count].length = string_b.size - begin;
+    string_hash[slot] = ++string_count;
+
+    return string_count - 1;
 }
 
-/* add r64, r64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_add_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+/* Compares two literals from their ends, < 0 if a sorts first, a longer literal before its own tail */
+THRIVE_API i32 thrive_x64_codegen_string_compare(thrive_string_data *a, thrive_string_data *b)
 {
-    thrive_x64_rex(b, 1, src, dst);
-    thrive_buffer_write_u8(b, 0x01);
-    thrive_x64_modrm_reg(b, src, dst);
+    u32 i;
+
+    for (i = 1; i <= a->length && i <= b->length; ++i)
+    {
+        u8 x = string_bytes[a->start + a->length - i];
+        u8 y = string_bytes[b->start + b->length - i];
+
+        if (x != y)
+        {
+            return (i32)y - (i32)x;
+        }
+    }
+
+    return (i32)b->length - (i32)a->length;
 }
 
-/* sub r64, r64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_sub_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+/* Lays out the literals of .rdata: sorted by their reversed bytes every literal
+ * follows the literals ending with it, so a tail of the last one written is
+ * found right there and shares its bytes ("world" inside "hello world") */
+THRIVE_API void thrive_x64_codegen_strings(void)
 {
-    thrive_x64_rex(b, 1, src, dst);
-    thrive_buffer_write_u8(b, 0x29);
-    thrive_x64_modrm_reg(b, src, dst);
-}
+    thrive_string_data *last = 0;
+    u32 gap;
+    u32 i;
+    u32 j;
+
+    for (i = 0; i < string_count; ++i)
+    {
+        string_order[i] = i;
+    }
+
+    /* Shell sort, the order of string_pool stays */
+    for (gap = string_count / 2; gap > 0; gap /= 2)
+    {
+        for (i = gap; i < string_count; ++i)
+        {
+            u32 id = string_order[i];
+
+            for (j = i; j >= gap && thrive_x64_codegen_string_compare(&string_pool[string_order[j - gap]], &string_pool[id]) > 0; j -= gap)
+            {
+                string_order[j] = string_order[j - gap];
+            }
+
+            string_order[j] = id;
+        }
+    }
+
+    for (i = 0; i < string_count; ++i)
+    {
+        thrive_string_data *str = &string_pool[string_order[i]];
+
+        if (last && last->length >= str->length &&
+            thrive_string_equals((s8 *)string_bytes + last->start + last->length - str->length, (s8 *)string_bytes + str->start, str->length))
+        {
+            str->offset = last->offset + last->length - str->length;
+            continue;
+        }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_sub_rsp_imm32(thrive_buffer *b, u32 imm)
-{
-    thrive_buffer_write_u8(b, 0x48);
-    thrive_buffer_write_u8(b, 0x81);
-    thrive_buffer_write_u8(b, 0xEC);
-    thrive_buffer_write_u32(b, imm);
+        str->offset = rdata_string_b.size;
+        thrive_buffer_write_bytes(&rdata_string_b, string_bytes + str->start, str->length);
+        last = str;
+    }
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_add_rsp_imm32(thrive_buffer *b, u32 imm)
+/* Multiplier for division by a constant: n / d == mulhi64(n, M) for every 32-bit n (Lemire et al.) */
+THRIVE_API THRIVE_INLINE u64 thrive_x64_div_magic(u32 d)
 {
-    thrive_buffer_write_u8(b, 0x48);
-    thrive_buffer_write_u8(b, 0x81);
-    thrive_buffer_write_u8(b, 0xC4);
-    thrive_buffer_write_u32(b, imm);
+    return ~(u64)0 / d + 1;
 }
 
-/* imul r64, r64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_imul_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
+/* rax = rax * c using shl, lea or an immediate imul (c below 2^31) */
+THRIVE_API void thrive_x64_mul_const(thrive_buffer *b, u32 c)
 {
-    thrive_x64_rex(b, 1, dst, src);
-    thrive_buffer_write_u8(b, 0x0F);
-    thrive_buffer_write_u8(b, 0xAF);
-    thrive_x64_modrm_reg(b, dst, src);
-}
+    u32 odd = c;
+    u8 shift = 0;
 
-/* cmp r64, r64 */
-THRIVE_API THRIVE_INLINE void thrive_x64_cmp_rr(thrive_buffer *b, thrive_x64_reg a, thrive_x64_reg rb)
-{
-    thrive_x64_rex(b, 1, rb, a);
-    thrive_buffer_write_u8(b, 0x39);
-    thrive_x64_modrm_reg(b, rb, a);
-}
+    if (c == 0)
+    {
+        thrive_x64_xor_rr(b, REG_RAX, REG_RAX);
+        return;
+    }
 
-/* setcc */
-THRIVE_API THRIVE_INLINE void thrive_x64_setcc(thrive_buffer *b, thrive_x64_cc cc)
-{
-    thrive_buffer_write_u8(b, 0x0F);
-    thrive_buffer_write_u8(b, (u8)(0x90 | cc)); /* cc = condition */
-    thrive_buffer_write_u8(b, 0xC0);            /* AL */
-}
+    while (!(odd & 1))
+    {
+        odd >>= 1;
+        shift++;
+    }
 
-/* jmp rel32 */
-THRIVE_API THRIVE_INLINE void thrive_x64_jmp(thrive_buffer *b, i32 rel)
-{
-    thrive_buffer_write_u8(b, 0xE9);
-    thrive_buffer_write_u32(b, (u32)rel);
-}
+    if (odd == 3 || odd == 5 || odd == 9)
+    {
+        thrive_x64_lea_r_sib(b, REG_RAX, REG_RAX, REG_RAX, odd - 1);
+    }
+    else if (odd != 1)
+    {
+        thrive_x64_imul_rri32(b, REG_RAX, REG_RAX, c);
+        return;
+    }
 
-/* je / jne / etc */
-THRIVE_API THRIVE_INLINE void thrive_x64_jcc(thrive_buffer *b, thrive_x64_cc cc, i32 rel)
-{
-    thrive_buffer_write_u8(b, 0x0F);
-    thrive_buffer_write_u8(b, (u8)(0x80 | cc));
-    thrive_buffer_write_u32(b, (u32)rel);
+    if (shift)
+    {
+        thrive_x64_shl_ri8(b, REG_RAX, shift);
+    }
 }
 
-/* NEG */
-THRIVE_API THRIVE_INLINE void thrive_x64_neg_r(thrive_buffer *b, thrive_x64_reg reg)
+/* rax = (u32)rax / d (or % d) for d != 0, clobbers rcx and rdx */
+THRIVE_API void thrive_x64_div_const(thrive_buffer *b, u32 d, u8 remainder)
 {
-    thrive_x64_rex(b, 1, 0, reg);
-    thrive_buffer_write_u8(b, 0xF7);
-    thrive_buffer_write_u8(b, 0xD8 | (reg & 7));
-}
+    if ((d & (d - 1)) == 0)
+    {
+        u8 shift = 0;
 
-/* TEST rax, rax */
-THRIVE_API THRIVE_INLINE void thrive_x64_test_rr(thrive_buffer *b, thrive_x64_reg a, thrive_x64_reg breg)
-{
-    thrive_x64_rex(b, 1, breg, a);
-    thrive_buffer_write_u8(b, 0x85);
-    thrive_x64_modrm_reg(b, breg, a);
-}
+        while ((1u << shift) != d)
+        {
+            shift++;
+        }
 
-/* CMP rax, imm32 */
-THRIVE_API THRIVE_INLINE void thrive_x64_cmp_ri32(thrive_buffer *b, thrive_x64_reg reg, u32 imm)
-{
-    thrive_x64_rex(b, 1, 0, reg);
-    thrive_buffer_write_u8(b, 0x81);
-    thrive_buffer_write_u8(b, 0xF8 | (reg & 7));
-    thrive_buffer_write_u32(b, imm);
-}
+        if (remainder)
+        {
+            thrive_x64_and_r32_i32(b, REG_RAX, d - 1);
+        }
+        else if (shift)
+        {
+            thrive_x64_shr_r32_i8(b, REG_RAX, shift);
+        }
+        else
+        {
+            thrive_x64_mov_r32_r32(b, REG_RAX, REG_RAX);
+        }
+        return;
+    }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_and_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
-{
-    thrive_x64_rex(b, 1, src, dst);
-    thrive_buffer_write_u8(b, 0x21);
-    thrive_x64_modrm_reg(b, src, dst);
-}
+    /* q = high half of n * M, the remainder is the high half of (low half) * d */
+    thrive_x64_mov_r32_r32(b, REG_RAX, REG_RAX);
+    thrive_x64_mov_ri64(b, REG_RCX, thrive_x64_div_magic(d));
 
-THRIVE_API THRIVE_INLINE void thrive_x64_or_rr(thrive_buffer *b, thrive_x64_reg dst, thrive_x64_reg src)
-{
-    thrive_x64_rex(b, 1, src, dst);
-    thrive_buffer_write_u8(b, 0x09);
-    thrive_x64_modrm_reg(b, src, dst);
-}
+    if (remainder)
+    {
+        thrive_x64_imul_rr(b, REG_RAX, REG_RCX);
+        thrive_x64_mov_r32_i32(b, REG_RCX, d);
+    }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_shl_cl(thrive_buffer *b, thrive_x64_reg reg)
-{
-    thrive_x64_rex(b, 1, 0, reg);
-    thrive_buffer_write_u8(b, 0xD3);
-    thrive_buffer_write_u8(b, 0xE0 | (reg & 7));
+    thrive_x64_mul_r(b, REG_RCX);
+    thrive_x64_mov_rr(b, REG_RAX, REG_RDX);
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_shr_cl(thrive_buffer *b, thrive_x64_reg reg)
+/* Multiply, divide and modulo by a constant without the second operand register or idiv */
+THRIVE_API u8 thrive_x64_codegen_strength_reduce(thrive_buffer *b, thrive_ast *node)
 {
-    thrive_x64_rex(b, 1, 0, reg);
-    thrive_buffer_write_u8(b, 0xD3);
-    thrive_buffer_write_u8(b, 0xE8 | (reg & 7));
-}
+    u32 c = node->data.binary.right->data.int_value;
 
-/* IDIV */
-THRIVE_API THRIVE_INLINE void thrive_x64_idiv_r(thrive_buffer *b, thrive_x64_reg reg)
-{
-    thrive_x64_rex(b, 1, 0, reg);
-    thrive_buffer_write_u8(b, 0xF7);
-    thrive_buffer_write_u8(b, 0xF8 | (reg & 7));
-}
+    switch (node->data.binary.op)
+    {
+    case THRIVE_TOKEN_KIND_MUL:
+        if (c >= 0x80000000)
+        {
+            return 0;
+        }
+        thrive_x64_codegen_expression(b, node->data.binary.left);
+        thrive_x64_mul_const(b, c);
+        break;
+    case THRIVE_TOKEN_KIND_DIV:
+    case THRIVE_TOKEN_KIND_MOD:
+        if (c == 0)
+        {
+            return 0;
+        }
+        thrive_x64_codegen_expression(b, node->data.binary.left);
+        thrive_x64_div_const(b, c, (u8)(node->data.binary.op == THRIVE_TOKEN_KIND_MOD));
+        break;
+    default:
+        return 0;
+    }
 
-/* CQO */
-THRIVE_API THRIVE_INLINE void thrive_x64_cqo(thrive_buffer *b)
-{
-    thrive_buffer_write_u8(b, 0x48);
-    thrive_buffer_write_u8(b, 0x99);
+    optimizer_stats.strength_reductions++;
+    return 1;
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_leave(thrive_buffer *b)
+/* Slot of the pointer to node's element if node is base[counter] in the reduced loop being generated, 0 if not */
+THRIVE_API i32 thrive_x64_codegen_find_pointer(thrive_ast *node)
 {
-    thrive_buffer_write_u8(b, 0xC9);
-}
+    u32 i;
 
-THRIVE_API THRIVE_INLINE void thrive_x64_ret(thrive_buffer *b)
-{
-    thrive_buffer_write_u8(b, 0xC3);
-}
+    if (!reduced_count || !thrive_inline_is_name(node->data.array_access.index, reduced_var))
+    {
+        return 0;
+    }
 
-/* lea rax, [rel STR_0] */
-THRIVE_API THRIVE_INLINE void thrive_x64_lea_rip_rel32(thrive_buffer *b, thrive_x64_reg dst, u32 rel)
-{
-    thrive_x64_rex(b, 1, dst, 0);
-    thrive_buffer_write_u8(b, 0x8D);
-    thrive_buffer_write_u8(b, 0x05 | ((dst & 7) << 3));
-    thrive_buffer_write_u32(b, rel);
-}
+    for (i = 0; i < reduced_count; ++i)
+    {
+        if (thrive_inline_is_name(node->data.array_access.left, reduced_bases[i]))
+        {
+            return reduced_offsets[i];
+        }
+    }
 
-/* direct call */
-THRIVE_API THRIVE_INLINE void thrive_x64_call_rel32(thrive_buffer *b, u32 curr_rva, u32 target_rva)
-{
-    u32 rel = target_rva - (curr_rva + 5);
-    thrive_buffer_write_u8(b, 0xE8);
-    thrive_buffer_write_u32(b, rel);
+    return 0;
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_inst_call_rel32(thrive_buffer *b, u32 curr_rva, u32 target_rva)
+/* The slot of name[k] for a constant k, 0 when the element needs the address computed (a global has no addend, only element 0) */
+THRIVE_API i32 thrive_x64_codegen_element_slot(thrive_ast *node)
 {
-    u32 rel = target_rva - (curr_rva + 6);
-    thrive_buffer_write_u8(b, 0xFF); /* CALL */
-    thrive_buffer_write_u8(b, 0x15); /* ModR/M: rel32 */
-    thrive_buffer_write_u32(b, rel);
-}
+    thrive_ast *left = node->data.array_access.left;
+    thrive_ast *index = node->data.array_access.index;
+    thrive_var *v;
 
-/* #############################################################################
- * # [SECTION] X86_64 PE32+ Codegen
- * #############################################################################
- */
-#define THRIVE_MAX_VARS 256
-#define THRIVE_MAX_LABELS 1024
-#define THRIVE_MAX_FIXUPS 1024
-#define THRIVE_MAX_FUNCS 256
+    if (left->kind != THRIVE_AST_NAME || index->kind != THRIVE_AST_INT || index->data.int_value >= 0x100000)
+    {
+        return 0;
+    }
 
-typedef struct thrive_var
-{
-    s8 *start;
-    u32 length;
-    i32 offset;
-    u8 is_array;
-} thrive_var;
+    v = thrive_x64_codegen_find_var(left->data.name.start, left->data.name.length);
 
-typedef enum fixup_type
-{
-    FIXUP_JMP,
-    FIXUP_CALL_REL,
-    FIXUP_CALL_IAT,
-    FIXUP_STRING
-} fixup_type;
+    if (!v || !v->is_array)
+    {
+        return 0;
+    }
 
-typedef struct thrive_fixup
-{
-    fixup_type type;
-    u32 buffer_offset;
-    u32 instr_end_offset;
-    i32 target_id;
-} thrive_fixup;
+    if (v->offset >= THRIVE_GLOBAL_SLOT)
+    {
+        return index->data.int_value == 0 ? v->offset : 0;
+    }
 
-typedef struct thrive_string_data
-{
-    s8 *start;
-    u32 length;
-    u32 offset; /* Buffer offset where string is stored */
-} thrive_string_data;
+    return v->offset + 8 * (i32)index->data.int_value;
+}
 
-typedef struct thrive_func
+/* Points a new slot per name indexed by the counter at its current element */
+THRIVE_API void thrive_x64_codegen_pointers(thrive_buffer *b, thrive_ast *node, thrive_unroll_loop *loop)
 {
-    s8 *start;
-    u32 length;
-    u32 rva;
-    u8 is_external;
-    u32 ext_dll_index;
-    u32 ext_func_index;
-} thrive_func;
-
-static thrive_var vars[THRIVE_MAX_VARS];
-static u32 var_count = 0;
-static i32 stack_offset = 0;
-static i32 in_function = 0;
-static i32 label_id = 0;
-static i32 current_break_label = -1;
-static i32 current_continue_label = -1;
-static thrive_fixup fixups[THRIVE_MAX_FIXUPS];
-static u32 fixup_count = 0;
-static u32 label_offsets[THRIVE_MAX_LABELS];
-static thrive_string_data string_pool[256];
-static u32 string_count = 0;
-static thrive_func funcs[THRIVE_MAX_FUNCS];
-static u32 func_count = 0;
+    thrive_reduce_scan scan = thrive_reduce_scan_body(node->data.for_loop.body, loop->var);
+    u32 i;
 
-/* Hardcoded mapping for demonstration */
-static s8 *kUser32 = "user32.dll";
-static s8 *kKernel32 = "kernel32.dll";
-static s8 *user32_funcs[32];
-static s8 *kernel32_funcs[32];
-static u32 u32_fc = 0, k32_fc = 0;
-static s8 import_name_pool[1024];
-static u32 import_name_pool_offset = 0;
+    reduced_count = 0;
 
-THRIVE_API THRIVE_INLINE void thrive_x64_codegen_reset_locals(void)
-{
-    var_count = 0;
-    stack_offset = 0;
-}
+    for (i = 0; i < scan.base_count; ++i)
+    {
+        thrive_var *v = thrive_x64_codegen_add_var((s8 *)"$p", 2, 0, 0);
+
+        thrive_x64_codegen_expression(b, loop->var);
+        thrive_x64_shl_ri8(b, REG_RAX, 3); /* rax = counter * 8 */
+        thrive_x64_codegen_push(b);
+        thrive_x64_codegen_expression(b, scan.bases[i]);
+        thrive_x64_codegen_pop(b, REG_RBX);
+        thrive_x64_add_rr(b, REG_RAX, REG_RBX);
+        thrive_x64_codegen_store(b, v->offset);
+
+        reduced_bases[i] = scan.bases[i];
+        reduced_offsets[i] = v->offset;
+    }
 
-THRIVE_API THRIVE_INLINE i32 thrive_x64_codegen_new_label(void)
-{
-    return label_id++;
+    reduced_var = loop->var;
+    reduced_bump = loop->step * 8;
+    reduced_down = loop->down;
+    reduced_count = scan.base_count;
 }
 
-THRIVE_API THRIVE_INLINE void thrive_x64_codegen_bind_label(thrive_buffer *b, i32 label)
+/* Moves the pointers of the reduced loop to the next element, after each step */
+THRIVE_API void thrive_x64_codegen_advance(thrive_buffer *b)
 {
-    label_offsets[label] = b->size;
+    u32 i;
+
+    for (i = 0; i < reduced_count; ++i)
+    {
+        thrive_x64_alu_mrbp_i32(b, reduced_down ? OP_EXT_SUB : OP_EXT_ADD, reduced_offsets[i], reduced_bump);
+    }
 }
 
-THRIVE_API void thrive_x64_codegen_record_fixup(thrive_buffer *b, fixup_type type, i32 target_id)
+/* Condition code that holds when the comparison op is true, after "cmp left, right" */
+THRIVE_API thrive_x64_cc thrive_x64_codegen_cc(thrive_token_kind op)
 {
-    if (fixup_count < THRIVE_MAX_FIXUPS)
+    switch (op)
     {
-        fixups[fixup_count].type = type;
-        fixups[fixup_count].buffer_offset = b->size;
-        fixups[fixup_count].instr_end_offset = b->size + 4;
-        fixups[fixup_count].target_id = target_id;
-        fixup_count++;
+    case THRIVE_TOKEN_KIND_LT:
+        return CC_L;
+    case THRIVE_TOKEN_KIND_GT:
+        return CC_G;
+    case THRIVE_TOKEN_KIND_LT_EQUALS:
+        return CC_LE;
+    case THRIVE_TOKEN_KIND_GT_EQUALS:
+        return CC_GE;
+    case THRIVE_TOKEN_KIND_EQUALS:
+        return CC_E;
+    default:
+        return CC_NE;
     }
-    thrive_buffer_write_u32(b, 0); /* Dummy bytes to patch later */
 }
 
-THRIVE_API i32 thrive_x64_codegen_find_or_add_func(s8 *start, u32 length)
+/*
+ * Ternary marked by the if-conversion: both arms are evaluated, no branch.
+ * Evaluation order stays cond, then, else (the CSE stores temporaries in the
+ * condition that the arms read), the flags are set at the end from the saved
+ * operands.
+ */
+THRIVE_API void thrive_x64_codegen_select(thrive_buffer *b, thrive_ast *node)
 {
-    u32 i;
+    thrive_ast *cond = node->data.ternary.cond;
+    thrive_ast *then_expr = node->data.ternary.then_expr;
+    thrive_ast *else_expr = node->data.ternary.else_expr;
+    u8 compare = thrive_ast_is_compare(cond);
+    thrive_x64_cc cc = compare ? thrive_x64_codegen_cc(cond->data.binary.op) : CC_NE;
 
-    for (i = 0; i < func_count; ++i)
+    if (compare)
     {
-        if (funcs[i].length == length && thrive_string_equals(funcs[i].start, start, length))
-        {
-            return (i32)i;
-        }
+        thrive_x64_codegen_expression(b, cond->data.binary.left);
+        thrive_x64_codegen_push(b);
+        thrive_x64_codegen_expression(b, cond->data.binary.right);
+    }
+    else
+    {
+        thrive_x64_codegen_expression(b, cond);
     }
 
-    funcs[func_count].start = start;
-    funcs[func_count].length = length;
+    /* c ? k1 : k0 = k0 + (-c & (k1 - k0)) */
+    if (then_expr->kind == THRIVE_AST_INT && else_expr->kind == THRIVE_AST_INT)
+    {
+        u64 delta = (u64)then_expr->data.int_value - (u64)else_expr->data.int_value;
 
-    return (i32)func_count++;
-}
+        if (compare)
+        {
+            thrive_x64_codegen_pop(b, REG_RBX);
+            thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
+        }
+        else
+        {
+            thrive_x64_codegen_test(b);
+        }
 
-THRIVE_API thrive_var *thrive_x64_codegen_find_var(s8 *start, u32 length)
-{
-    u32 i;
+        thrive_x64_codegen_bool(b, cc);
 
-    for (i = 0; i < var_count; ++i)
-    {
-        if (vars[i].length == length && thrive_string_equals(vars[i].start, start, length))
+        if (delta != 1)
+        {
+            thrive_x64_neg_r(b, REG_RAX);
+            thrive_x64_codegen_imm(b, REG_RBX, delta);
+            thrive_x64_and_rr(b, REG_RAX, REG_RBX);
+        }
+
+        if (else_expr->data.int_value)
         {
-            return &vars[i];
+            thrive_x64_codegen_imm(b, REG_RBX, else_expr->data.int_value);
+            thrive_x64_add_rr(b, REG_RAX, REG_RBX);
         }
+        return;
     }
 
-    return 0;
-}
+    thrive_x64_codegen_push(b);
+    thrive_x64_codegen_expression(b, then_expr);
+    thrive_x64_codegen_push(b);
+    thrive_x64_codegen_expression(b, else_expr);
+    thrive_x64_codegen_pop(b, REG_RBX); /* then */
 
-THRIVE_API thrive_var *thrive_x64_codegen_add_var(s8 *start, u32 length, u8 is_array, u32 array_size)
-{
-    thrive_var *v = &vars[var_count++];
-    u32 size = is_array ? array_size : 1;
-    stack_offset -= (i32)(8 * size);
-    v->start = start;
-    v->length = length;
-    v->offset = stack_offset;
-    v->is_array = is_array;
-    return v;
-}
+    if (compare)
+    {
+        thrive_x64_codegen_pop(b, REG_RCX); /* right */
+        thrive_x64_codegen_pop(b, REG_RDX); /* left */
+        thrive_x64_cmp_rr(b, REG_RDX, REG_RCX);
+    }
+    else
+    {
+        thrive_x64_codegen_pop(b, REG_RCX);
+        thrive_x64_test_rr(b, REG_RCX, REG_RCX);
+    }
 
-THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node);
-THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node);
+    thrive_x64_cmovcc_rr(b, cc, REG_RAX, REG_RBX);
+}
 
 THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node)
 {
     switch (node->kind)
     {
     case THRIVE_AST_INT:
-        thrive_x64_mov_ri64(b, REG_RAX, node->data.int_value);
+        thrive_x64_codegen_imm(b, REG_RAX, node->data.int_value);
         break;
     case THRIVE_AST_NAME:
     {
         thrive_var *v = thrive_x64_codegen_find_var(node->data.name.start, node->data.name.length);
         if (v->is_array)
         {
-            thrive_x64_lea_r_mrbp(b, REG_RAX, v->offset);
+            thrive_x64_codegen_address(b, v->offset);
         }
         else
         {
-            thrive_x64_mov_r_mrbp(b, REG_RAX, v->offset);
+            thrive_x64_codegen_load(b, v->offset);
         }
         break;
     }
     case THRIVE_AST_ARRAY_ACCESS:
+    {
+        i32 pointer = thrive_x64_codegen_find_pointer(node);
+
+        if (pointer)
+        {
+            thrive_x64_codegen_load(b, pointer);
+            thrive_x64_mov_r_mr(b, REG_RAX, REG_RAX);
+            break;
+        }
+
+        if (thrive_x64_codegen_element_slot(node))
+        {
+            thrive_x64_codegen_load(b, thrive_x64_codegen_element_slot(node));
+            break;
+        }
+
         thrive_x64_codegen_expression(b, node->data.array_access.index);
         thrive_x64_mov_ri32(b, REG_RBX, 8);
         thrive_x64_imul_rr(b, REG_RAX, REG_RBX); /* rax = index * 8 */
-        thrive_x64_push_r(b, REG_RAX);
+        thrive_x64_codegen_push(b);
 
         thrive_x64_codegen_expression(b, node->data.array_access.left);
-        thrive_x64_pop_r(b, REG_RBX);
+        thrive_x64_codegen_pop(b, REG_RBX);
         thrive_x64_add_rr(b, REG_RAX, REG_RBX);   /* rax = base + offset */
         thrive_x64_mov_r_mr(b, REG_RAX, REG_RAX); /* rax = [rax] */
         break;
+    }
     case THRIVE_AST_BINARY:
     {
-        thrive_x64_codegen_expression(b, node->data.binary.left);
-        thrive_x64_push_r(b, REG_RAX);
-        thrive_x64_codegen_expression(b, node->data.binary.right);
-        thrive_x64_pop_r(b, REG_RBX); /* RBX=left, RAX=right */
+        u32 start;
+
+        if (node->data.binary.right->kind == THRIVE_AST_INT && thrive_x64_codegen_strength_reduce(b, node))
+        {
+            break;
+        }
+
+        /* && and || evaluate their operands themselves so the right one only runs when needed */
+        if (node->data.binary.op != THRIVE_TOKEN_KIND_AND_LOGICAL && node->data.binary.op != THRIVE_TOKEN_KIND_OR_LOGICAL)
+        {
+            thrive_x64_codegen_expression(b, node->data.binary.left);
+            thrive_x64_codegen_push(b);
+            thrive_x64_codegen_expression(b, node->data.binary.right);
+            thrive_x64_codegen_pop(b, REG_RBX); /* RBX=left, RAX=right */
+        }
+
+        start = b->size;
 
         switch (node->data.binary.op)
         {
         case THRIVE_TOKEN_KIND_ADD:
             thrive_x64_add_rr(b, REG_RAX, REG_RBX);
+            thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
             break;
         case THRIVE_TOKEN_KIND_SUB:
             thrive_x64_sub_rr(b, REG_RBX, REG_RAX);
             thrive_x64_mov_rr(b, REG_RAX, REG_RBX);
+            thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
             break;
         case THRIVE_TOKEN_KIND_MUL:
             thrive_x64_imul_rr(b, REG_RAX, REG_RBX);
             break;
         case THRIVE_TOKEN_KIND_DIV:
+        case THRIVE_TOKEN_KIND_MOD:
             thrive_x64_xor_rr(b, REG_RDX, REG_RDX);
             thrive_x64_mov_rr(b, REG_RCX, REG_RAX); /* RCX = right */
             thrive_x64_mov_rr(b, REG_RAX, REG_RBX); /* RAX = left */
-            thrive_x64_idiv_r(b, REG_RCX);
+            thrive_x64_div_r32(b, REG_RCX);         /* unsigned u32 like the folder */
+            if (node->data.binary.op == THRIVE_TOKEN_KIND_MOD)
+            {
+                thrive_x64_mov_rr(b, REG_RAX, REG_RDX);
+            }
             break;
         case THRIVE_TOKEN_KIND_LT:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_L);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_L);
             break;
         case THRIVE_TOKEN_KIND_GT:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_G);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_G);
             break;
         case THRIVE_TOKEN_KIND_LT_EQUALS:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_LE);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_LE);
             break;
         case THRIVE_TOKEN_KIND_GT_EQUALS:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_GE);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_GE);
             break;
         case THRIVE_TOKEN_KIND_EQUALS:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_E);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_E);
             break;
         case THRIVE_TOKEN_KIND_NOT_EQUALS:
             thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
-            thrive_x64_setcc(b, CC_NE);
-            thrive_x64_movzx_rax_al(b);
+            thrive_x64_codegen_bool(b, CC_NE);
             break;
         case THRIVE_TOKEN_KIND_AND_BITWISE:
             thrive_x64_and_rr(b, REG_RAX, REG_RBX);
+            thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
             break;
         case THRIVE_TOKEN_KIND_OR_BITWISE:
             thrive_x64_or_rr(b, REG_RAX, REG_RBX);
+            thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
+            break;
+        case THRIVE_TOKEN_KIND_XOR_BITWISE:
+            thrive_x64_xor_rr(b, REG_RAX, REG_RBX);
+            thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
             break;
         case THRIVE_TOKEN_KIND_AND_LOGICAL:
         {
@@ -2931,20 +10748,15 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
             i32 l_end = thrive_x64_codegen_new_label();
 
             thrive_x64_codegen_expression(b, node->data.binary.left);
-            thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-            thrive_buffer_write_u8(b, 0x0F);
-            thrive_buffer_write_u8(b, 0x80 | CC_E);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_false);
+            thrive_x64_codegen_test(b);
+            thrive_x64_codegen_jcc(b, CC_E, l_false);
             thrive_x64_codegen_expression(b, node->data.binary.right);
-            thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-            thrive_buffer_write_u8(b, 0x0F);
-            thrive_buffer_write_u8(b, 0x80 | CC_E);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_false);
-            thrive_x64_mov_ri64(b, REG_RAX, 1);
-            thrive_buffer_write_u8(b, 0xE9);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_end);
+            thrive_x64_codegen_test(b);
+            thrive_x64_codegen_jcc(b, CC_E, l_false);
+            thrive_x64_codegen_imm(b, REG_RAX, 1);
+            thrive_x64_codegen_jmp(b, l_end);
             thrive_x64_codegen_bind_label(b, l_false);
-            thrive_x64_mov_ri64(b, REG_RAX, 0);
+            thrive_x64_codegen_imm(b, REG_RAX, 0);
             thrive_x64_codegen_bind_label(b, l_end);
             break;
         }
@@ -2954,20 +10766,15 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
             i32 l_end = thrive_x64_codegen_new_label();
 
             thrive_x64_codegen_expression(b, node->data.binary.left);
-            thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-            thrive_buffer_write_u8(b, 0x0F);
-            thrive_buffer_write_u8(b, 0x80 | CC_NE);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_true);
+            thrive_x64_codegen_test(b);
+            thrive_x64_codegen_jcc(b, CC_NE, l_true);
             thrive_x64_codegen_expression(b, node->data.binary.right);
-            thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-            thrive_buffer_write_u8(b, 0x0F);
-            thrive_buffer_write_u8(b, 0x80 | CC_NE);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_true);
-            thrive_x64_mov_ri64(b, REG_RAX, 0);
-            thrive_buffer_write_u8(b, 0xE9);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_end);
+            thrive_x64_codegen_test(b);
+            thrive_x64_codegen_jcc(b, CC_NE, l_true);
+            thrive_x64_codegen_imm(b, REG_RAX, 0);
+            thrive_x64_codegen_jmp(b, l_end);
             thrive_x64_codegen_bind_label(b, l_true);
-            thrive_x64_mov_ri64(b, REG_RAX, 1);
+            thrive_x64_codegen_imm(b, REG_RAX, 1);
             thrive_x64_codegen_bind_label(b, l_end);
             break;
         }
@@ -2995,7 +10802,7 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
         if (node->data.unary.op == THRIVE_TOKEN_KIND_INC || node->data.unary.op == THRIVE_TOKEN_KIND_DEC)
         {
             thrive_var *v = thrive_x64_codegen_find_var(node->data.unary.expr->data.name.start, node->data.unary.expr->data.name.length);
-            thrive_x64_mov_r_mrbp(b, REG_RAX, v->offset);
+            thrive_x64_codegen_load(b, v->offset);
             if (node->data.unary.op == THRIVE_TOKEN_KIND_INC)
             {
                 thrive_x64_mov_ri32(b, REG_RBX, 1);
@@ -3006,7 +10813,7 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
                 thrive_x64_mov_ri32(b, REG_RBX, 1);
                 thrive_x64_sub_rr(b, REG_RAX, REG_RBX);
             }
-            thrive_x64_mov_mrbp_r(b, v->offset, REG_RAX);
+            thrive_x64_codegen_store(b, v->offset);
         }
         else
         {
@@ -3016,10 +10823,12 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
             case THRIVE_TOKEN_KIND_SUB:
                 thrive_x64_neg_r(b, REG_RAX);
                 break;
+            case THRIVE_TOKEN_KIND_NOT_BITWISE:
+                thrive_x64_not_r32(b, REG_RAX);
+                break;
             case THRIVE_TOKEN_KIND_NEGATE:
-                thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-                thrive_x64_setcc(b, CC_E);
-                thrive_x64_movzx_rax_al(b);
+                thrive_x64_codegen_test(b);
+                thrive_x64_codegen_bool(b, CC_E);
                 break;
             default:
                 break;
@@ -3029,17 +10838,23 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
     }
     case THRIVE_AST_TERNARY:
     {
-        i32 l_else = thrive_x64_codegen_new_label();
-        i32 l_end = thrive_x64_codegen_new_label();
+        i32 l_else;
+        i32 l_end;
+
+        if (node->data.ternary.select)
+        {
+            thrive_x64_codegen_select(b, node);
+            break;
+        }
+
+        l_else = thrive_x64_codegen_new_label();
+        l_end = thrive_x64_codegen_new_label();
 
         thrive_x64_codegen_expression(b, node->data.ternary.cond);
-        thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-        thrive_buffer_write_u8(b, 0x0F);
-        thrive_buffer_write_u8(b, 0x80 | CC_E);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_else);
+        thrive_x64_codegen_test(b);
+        thrive_x64_codegen_jcc(b, CC_E, l_else);
         thrive_x64_codegen_expression(b, node->data.ternary.then_expr);
-        thrive_buffer_write_u8(b, 0xE9);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_end);
+        thrive_x64_codegen_jmp(b, l_end);
         thrive_x64_codegen_bind_label(b, l_else);
         thrive_x64_codegen_expression(b, node->data.ternary.else_expr);
         thrive_x64_codegen_bind_label(b, l_end);
@@ -3053,24 +10868,36 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
         if (left->kind == THRIVE_AST_DEREF)
         {
             thrive_x64_codegen_expression(b, right);
-            thrive_x64_push_r(b, REG_RAX);
+            thrive_x64_codegen_push(b);
             thrive_x64_codegen_expression(b, left->data.unary.expr);
-            thrive_x64_pop_r(b, REG_RBX);
+            thrive_x64_codegen_pop(b, REG_RBX);
             thrive_x64_mov_mr_r(b, REG_RAX, REG_RBX);
         }
+        else if (left->kind == THRIVE_AST_ARRAY_ACCESS && thrive_x64_codegen_find_pointer(left))
+        {
+            thrive_x64_codegen_expression(b, right);
+            thrive_x64_mov_r_mrbp(b, REG_RBX, thrive_x64_codegen_find_pointer(left));
+            thrive_x64_mov_mr_r(b, REG_RBX, REG_RAX);
+        }
+        else if (left->kind == THRIVE_AST_ARRAY_ACCESS && thrive_x64_codegen_element_slot(left))
+        {
+            thrive_x64_codegen_expression(b, right);
+            thrive_x64_codegen_store(b, thrive_x64_codegen_element_slot(left));
+        }
         else if (left->kind == THRIVE_AST_ARRAY_ACCESS)
         {
             thrive_x64_codegen_expression(b, right);
-            thrive_x64_push_r(b, REG_RAX);
+            thrive_x64_codegen_push(b);
             thrive_x64_codegen_expression(b, left->data.array_access.index);
             thrive_x64_mov_ri32(b, REG_RBX, 8);
             thrive_x64_imul_rr(b, REG_RAX, REG_RBX);
-            thrive_x64_push_r(b, REG_RAX);
+            thrive_x64_codegen_push(b);
             thrive_x64_codegen_expression(b, left->data.array_access.left);
-            thrive_x64_pop_r(b, REG_RBX);
-            thrive_x64_add_rr(b, REG_RAX, REG_RBX);
-            thrive_x64_pop_r(b, REG_RBX);
-            thrive_x64_mov_mr_r(b, REG_RAX, REG_RBX);
+            thrive_x64_codegen_pop(b, REG_RBX);
+            thrive_x64_add_rr(b, REG_RBX, REG_RAX);
+            /* The stored value stays in rax like for a variable */
+            thrive_x64_codegen_pop(b, REG_RAX);
+            thrive_x64_mov_mr_r(b, REG_RBX, REG_RAX);
         }
         else
         {
@@ -3080,14 +10907,14 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
 
             v = thrive_x64_codegen_find_var(left->data.name.start, left->data.name.length);
 
-            thrive_x64_mov_mrbp_r(b, v->offset, REG_RAX);
+            thrive_x64_codegen_store(b, v->offset);
         }
         break;
     }
     case THRIVE_AST_ADDR_OF:
     {
         thrive_var *v = thrive_x64_codegen_find_var(node->data.unary.expr->data.name.start, node->data.unary.expr->data.name.length);
-        thrive_x64_lea_r_mrbp(b, REG_RAX, v->offset);
+        thrive_x64_codegen_address(b, v->offset);
         break;
     }
     case THRIVE_AST_DEREF:
@@ -3095,20 +10922,22 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
         thrive_x64_mov_r_mr(b, REG_RAX, REG_RAX);
         break;
     case THRIVE_AST_BREAK:
-        thrive_buffer_write_u8(b, 0xE9);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, current_break_label);
+        thrive_x64_codegen_jmp(b, current_break_label);
         break;
     case THRIVE_AST_CONTINUE:
-        thrive_buffer_write_u8(b, 0xE9);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, current_continue_label);
+        thrive_x64_codegen_jmp(b, current_continue_label);
         break;
     case THRIVE_AST_FUNC_CALL:
     {
         thrive_ast *curr = node->data.func_call.args;
-        thrive_x64_reg arg_regs[] = {REG_RCX, REG_RDX, REG_R8, REG_R9};
+        thrive_x64_reg win64_regs[] = {REG_RCX, REG_RDX, REG_R8, REG_R9};
         u32 arg_count = 0, i, extra_args;
         u32 stack_padding = 0, total_stack_alloc = 0;
         i32 f_idx = thrive_x64_codegen_find_or_add_func(node->data.func_call.name->data.name.start, node->data.func_call.name->data.name.length);
+        u8 is_external = funcs[f_idx].is_external;
+        thrive_x64_reg *arg_regs = is_external ? win64_regs : internal_arg_regs;
+        u32 num_regs = is_external ? THRIVE_WIN64_ARG_REGS : THRIVE_INTERNAL_ARG_REGS;
+        u32 shadow_space = is_external ? 32 : 0;
         u32 reg_args_to_process;
 
         while (curr)
@@ -3117,9 +10946,9 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
             curr = curr->next;
         }
 
-        extra_args = arg_count > 4 ? arg_count - 4 : 0;
+        extra_args = arg_count > num_regs ? arg_count - num_regs : 0;
         stack_padding = (extra_args % 2 != 0) ? 8 : 0;
-        total_stack_alloc = 32 + (extra_args * 8) + stack_padding;
+        total_stack_alloc = shadow_space + (extra_args * 8) + stack_padding;
 
         if (stack_padding > 0)
         {
@@ -3140,59 +10969,339 @@ THRIVE_API void thrive_x64_codegen_expression(thrive_buffer *b, thrive_ast *node
                 }
 
                 thrive_x64_codegen_expression(b, arg_node);
-                thrive_x64_push_r(b, REG_RAX);
+                thrive_x64_codegen_push(b);
             }
         }
 
-        reg_args_to_process = arg_count > 4 ? 4 : arg_count;
+        reg_args_to_process = arg_count > num_regs ? num_regs : arg_count;
         curr = node->data.func_call.args;
 
         for (i = 0; i < reg_args_to_process; ++i)
         {
             thrive_x64_codegen_expression(b, curr);
-            thrive_x64_push_r(b, REG_RAX);
+            thrive_x64_codegen_push(b);
             curr = curr->next;
         }
 
-        for (i = reg_args_to_process; i > 0; --i)
+        for (i = reg_args_to_process; i > 0; --i)
+        {
+            thrive_x64_codegen_pop(b, arg_regs[i - 1]);
+        }
+
+        if (is_external)
+        {
+            /* 32 bytes shadow space */
+            thrive_x64_sub_rsp_imm32(b, 32);
+            thrive_buffer_write_u8(b, 0xFF);
+            thrive_buffer_write_u8(b, 0x15);
+            thrive_x64_codegen_record_fixup(b, FIXUP_CALL_IAT, f_idx);
+        }
+        else
+        {
+            thrive_buffer_write_u8(b, 0xE8);
+            thrive_x64_codegen_record_fixup(b, FIXUP_CALL_REL, f_idx);
+            optimizer_stats.internal_calls++;
+        }
+
+        if (total_stack_alloc > 0)
+        {
+            thrive_x64_add_rsp_imm32(b, total_stack_alloc);
+        }
+        break;
+    }
+    case THRIVE_AST_INLINE:
+    {
+        thrive_ast *curr;
+        u32 saved_var_count = var_count;
+        i32 saved_stack_offset = stack_offset;
+        i32 saved_return_label = current_return_label;
+        u32 bound = 0;
+
+        current_return_label = thrive_x64_codegen_new_label();
+
+        /* Evaluate all arguments before the parameters can shadow caller variables */
+        for (curr = node->data.inline_call.args; curr; curr = curr->next)
+        {
+            thrive_x64_codegen_expression(b, curr);
+            thrive_x64_codegen_push(b);
+        }
+
+        for (curr = node->data.inline_call.params; curr; curr = curr->next)
+        {
+            thrive_x64_codegen_add_var(curr->data.name.start, curr->data.name.length, 0, 0);
+            bound++;
+        }
+
+        for (; bound > 0; --bound)
+        {
+            thrive_x64_codegen_pop(b, REG_RAX);
+            thrive_x64_codegen_store(b, vars[saved_var_count + bound - 1].offset);
+        }
+
+        thrive_x64_codegen_statement(b, node->data.inline_call.body);
+        thrive_x64_codegen_bind_label(b, current_return_label);
+
+        var_count = saved_var_count;
+        stack_offset = saved_stack_offset;
+        current_return_label = saved_return_label;
+        break;
+    }
+    case THRIVE_AST_STRING:
+    {
+        u32 id = thrive_x64_codegen_string(node->data.string_lit.start, node->data.string_lit.length);
+
+        thrive_x64_rex(b, 1, REG_RAX, 0);
+        thrive_buffer_write_u8(b, 0x8D); /* LEA RAX, [rel STR] */
+        thrive_buffer_write_u8(b, 0x05);
+        thrive_x64_codegen_record_fixup(b, FIXUP_STRING, (i32)id);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Evaluates cond and jumps to label if its truth value matches cc (CC_NE = true, CC_E = false) */
+THRIVE_API void thrive_x64_codegen_branch(thrive_buffer *b, thrive_ast *cond, thrive_x64_cc cc, i32 label)
+{
+    thrive_x64_codegen_expression(b, cond);
+    thrive_x64_codegen_test(b);
+    thrive_x64_codegen_jcc(b, cc, label);
+}
+
+/* Gives every reduction of the loop its extra accumulators, before the unrolled part */
+THRIVE_API void thrive_x64_codegen_accumulate_begin(thrive_buffer *b, thrive_ast *node)
+{
+    u32 i;
+    u32 k;
+
+    accumulate_width = node->data.for_loop.accumulate;
+    accumulate_count = accumulate_width > 1 ? thrive_accumulate_scan(node->data.for_loop.body, accumulate_reductions) : 0;
+
+    for (i = 0; i < accumulate_count; ++i)
+    {
+        thrive_ast *name = accumulate_reductions[i].name;
+        thrive_ast *right = accumulate_reductions[i].statement->data.assign.right;
+        thrive_var *v = thrive_x64_codegen_find_var(name->data.name.start, name->data.name.length);
+
+        accumulate_vars[i] = v;
+        accumulate_offsets[i][0] = v->offset;
+
+        /* 0 is neutral for + and ^, & | min and max may see s more than once */
+        if (right->kind == THRIVE_AST_BINARY && (right->data.binary.op == THRIVE_TOKEN_KIND_ADD || right->data.binary.op == THRIVE_TOKEN_KIND_XOR_BITWISE))
+        {
+            thrive_x64_codegen_imm(b, REG_RAX, 0);
+        }
+        else
+        {
+            thrive_x64_codegen_load(b, v->offset);
+        }
+
+        for (k = 1; k < accumulate_width; ++k)
+        {
+            accumulate_offsets[i][k] = thrive_x64_codegen_add_var((s8 *)"$a", 2, 0, 0)->offset;
+            thrive_x64_mov_mrbp_r(b, accumulate_offsets[i][k], REG_RAX);
+        }
+    }
+}
+
+/* Points the reduction variables at the accumulators of body copy */
+THRIVE_API void thrive_x64_codegen_accumulate_copy(u32 copy)
+{
+    u32 i;
+
+    for (i = 0; i < accumulate_count; ++i)
+    {
+        accumulate_vars[i]->offset = accumulate_offsets[i][copy % accumulate_width];
+    }
+}
+
+/* Folds the accumulators back into the reduction variables, behind the unrolled part */
+THRIVE_API void thrive_x64_codegen_accumulate_end(thrive_buffer *b)
+{
+    u32 i;
+    u32 k;
+
+    thrive_x64_codegen_accumulate_copy(0);
+
+    for (i = 0; i < accumulate_count; ++i)
+    {
+        thrive_ast *name = accumulate_reductions[i].name;
+        thrive_ast *right = accumulate_reductions[i].statement->data.assign.right;
+
+        for (k = 1; k < accumulate_width; ++k)
+        {
+            /* rax = s, rbx = accumulator k, then "s = s op accumulator" */
+            thrive_x64_codegen_load(b, accumulate_offsets[i][0]);
+            thrive_x64_mov_r_mrbp(b, REG_RBX, accumulate_offsets[i][k]);
+
+            if (right->kind == THRIVE_AST_BINARY)
+            {
+                switch (right->data.binary.op)
+                {
+                case THRIVE_TOKEN_KIND_ADD:
+                    thrive_x64_add_rr(b, REG_RAX, REG_RBX);
+                    break;
+                case THRIVE_TOKEN_KIND_XOR_BITWISE:
+                    thrive_x64_xor_rr(b, REG_RAX, REG_RBX);
+                    break;
+                case THRIVE_TOKEN_KIND_AND_BITWISE:
+                    thrive_x64_and_rr(b, REG_RAX, REG_RBX);
+                    break;
+                default:
+                    thrive_x64_or_rr(b, REG_RAX, REG_RBX);
+                    break;
+                }
+            }
+            else
+            {
+                thrive_ast *cond = right->data.ternary.cond;
+                thrive_x64_cc cc = thrive_x64_codegen_cc(cond->data.binary.op);
+
+                /* The same comparison with the other operand replaced by the accumulator */
+                if (thrive_inline_is_name(cond->data.binary.left, name))
+                {
+                    thrive_x64_cmp_rr(b, REG_RAX, REG_RBX);
+                }
+                else
+                {
+                    thrive_x64_cmp_rr(b, REG_RBX, REG_RAX);
+                }
+
+                /* rax keeps s where the statement picks s */
+                thrive_x64_cmovcc_rr(b, thrive_inline_is_name(right->data.ternary.then_expr, name) ? (thrive_x64_cc)(cc ^ 1) : cc, REG_RAX, REG_RBX);
+            }
+
+            thrive_x64_codegen_store(b, accumulate_offsets[i][0]);
+        }
+    }
+
+    accumulate_count = 0;
+}
+
+/*
+ * Leading part of a loop marked by thrive_ast_unroll, emitted after the init:
+ * while "i + (n - 1) * c < limit" run n copies of body and step (rotated like
+ * the plain loop), then fall through into it for the remaining iterations.
+ */
+THRIVE_API void thrive_x64_codegen_unrolled(thrive_buffer *b, thrive_ast *node, thrive_unroll_loop *loop)
+{
+    thrive_ast offset;
+    thrive_ast index;
+    thrive_ast guard;
+    i32 body_label = thrive_x64_codegen_new_label();
+    i32 rest_label = thrive_x64_codegen_new_label();
+    i32 old_continue = current_continue_label;
+    u32 i;
+
+    offset.kind = THRIVE_AST_INT;
+    offset.next = 0;
+    offset.data.int_value = (node->data.for_loop.unroll - 1) * loop->step;
+
+    index.kind = THRIVE_AST_BINARY;
+    index.next = 0;
+    index.data.binary.op = loop->down ? THRIVE_TOKEN_KIND_SUB : THRIVE_TOKEN_KIND_ADD;
+    index.data.binary.left = loop->var;
+    index.data.binary.right = &offset;
+
+    guard = *node->data.for_loop.cond;
+    guard.data.binary.left = &index;
+
+    thrive_x64_codegen_accumulate_begin(b, node);
+    thrive_x64_codegen_branch(b, &guard, CC_E, rest_label);
+    thrive_x64_codegen_bind_loop(b, body_label);
+
+    for (i = 0; i < node->data.for_loop.unroll; ++i)
+    {
+        i32 step_label = thrive_x64_codegen_new_label();
+        current_continue_label = step_label;
+
+        thrive_x64_codegen_accumulate_copy(i);
+        thrive_x64_codegen_statement(b, node->data.for_loop.body);
+
+        thrive_x64_codegen_bind_label(b, step_label);
+        thrive_x64_codegen_expression(b, node->data.for_loop.step);
+        thrive_x64_codegen_advance(b);
+    }
+
+    thrive_x64_codegen_branch(b, &guard, CC_NE, body_label);
+    thrive_x64_codegen_bind_label(b, rest_label);
+    thrive_x64_codegen_accumulate_end(b);
+
+    current_continue_label = old_continue;
+}
+
+/*
+ * Rest of a loop marked to count down by thrive_ast_reduce, emitted after
+ * the init and the pointers: the body never reads the counter, so it gets
+ * its final value up front and a hidden counter runs "limit - i" iterations,
+ * n body copies at a time first if the loop is marked for unrolling.
+ */
+THRIVE_API void thrive_x64_codegen_countdown(thrive_buffer *b, thrive_ast *node, thrive_unroll_loop *loop, i32 end_label)
+{
+    thrive_var *count = thrive_x64_codegen_add_var((s8 *)"$c", 2, 0, 0);
+    thrive_var *var = thrive_x64_codegen_find_var(loop->var->data.name.start, loop->var->data.name.length);
+    u32 unroll = node->data.for_loop.unroll;
+    i32 loop_label = thrive_x64_codegen_new_label();
+    i32 step_label;
+    u32 i;
+
+    thrive_x64_codegen_expression(b, loop->down ? loop->var : loop->limit);
+    thrive_x64_codegen_push(b);
+    thrive_x64_codegen_expression(b, loop->down ? loop->limit : loop->var);
+    thrive_x64_codegen_pop(b, REG_RBX);
+    thrive_x64_sub_rr(b, REG_RBX, REG_RAX);
+    thrive_x64_mov_mrbp_r(b, count->offset, REG_RBX);
+    thrive_x64_test_rr(b, REG_RBX, REG_RBX);
+    thrive_x64_codegen_jcc(b, CC_LE, end_label);
+
+    thrive_x64_codegen_expression(b, loop->limit);
+    thrive_x64_codegen_store(b, var->offset);
+
+    if (unroll > 1)
+    {
+        i32 body_label = thrive_x64_codegen_new_label();
+        i32 rest_label = thrive_x64_codegen_new_label();
+
+        thrive_x64_codegen_accumulate_begin(b, node);
+        thrive_x64_alu_mrbp_i32(b, OP_EXT_CMP, count->offset, unroll);
+        thrive_x64_codegen_jcc(b, CC_L, rest_label);
+        thrive_x64_codegen_bind_loop(b, body_label);
+
+        for (i = 0; i < unroll; ++i)
         {
-            thrive_x64_pop_r(b, arg_regs[i - 1]);
-        }
+            step_label = thrive_x64_codegen_new_label();
+            current_continue_label = step_label;
 
-        /* 32 bytes shadow space */
-        thrive_x64_sub_rsp_imm32(b, 32);
+            thrive_x64_codegen_accumulate_copy(i);
+            thrive_x64_codegen_statement(b, node->data.for_loop.body);
 
-        if (funcs[f_idx].is_external)
-        {
-            thrive_buffer_write_u8(b, 0xFF);
-            thrive_buffer_write_u8(b, 0x15);
-            thrive_x64_codegen_record_fixup(b, FIXUP_CALL_IAT, f_idx);
-        }
-        else
-        {
-            thrive_buffer_write_u8(b, 0xE8);
-            thrive_x64_codegen_record_fixup(b, FIXUP_CALL_REL, f_idx);
+            thrive_x64_codegen_bind_label(b, step_label);
+            thrive_x64_codegen_advance(b);
         }
 
-        thrive_x64_add_rsp_imm32(b, total_stack_alloc);
-        break;
+        /* Rotated, loops back while another n iterations remain */
+        thrive_x64_alu_mrbp_i32(b, OP_EXT_SUB, count->offset, unroll);
+        thrive_x64_alu_mrbp_i32(b, OP_EXT_CMP, count->offset, unroll);
+        thrive_x64_codegen_jcc(b, CC_GE, body_label);
+
+        thrive_x64_codegen_bind_label(b, rest_label);
+        thrive_x64_codegen_accumulate_end(b);
+        thrive_x64_alu_mrbp_i32(b, OP_EXT_CMP, count->offset, 0);
+        thrive_x64_codegen_jcc(b, CC_E, end_label);
     }
-    case THRIVE_AST_STRING:
-    {
-        u32 id = string_count++;
 
-        string_pool[id].start = node->data.string_lit.start;
-        string_pool[id].length = node->data.string_lit.length;
+    step_label = thrive_x64_codegen_new_label();
+    current_continue_label = step_label;
 
-        thrive_x64_rex(b, 1, REG_RAX, 0);
-        thrive_buffer_write_u8(b, 0x8D); /* LEA RAX, [rel STR] */
-        thrive_buffer_write_u8(b, 0x05);
-        thrive_x64_codegen_record_fixup(b, FIXUP_STRING, (i32)id);
-        break;
-    }
-    default:
-        break;
-    }
+    thrive_x64_codegen_bind_loop(b, loop_label);
+    thrive_x64_codegen_statement(b, node->data.for_loop.body);
+
+    /* The decrement sets the flags for the exit test */
+    thrive_x64_codegen_bind_label(b, step_label);
+    thrive_x64_codegen_advance(b);
+    thrive_x64_alu_mrbp_i32(b, OP_EXT_SUB, count->offset, 1);
+    thrive_x64_codegen_jcc(b, CC_NE, loop_label);
 }
 
 THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
@@ -3202,12 +11311,22 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
     case THRIVE_AST_DECL:
     {
         thrive_ast *name = node->data.decl.name;
-        thrive_var *v = thrive_x64_codegen_add_var(name->data.name.start, name->data.name.length, node->data.decl.is_array, node->data.decl.array_size);
+        thrive_var *v;
+
+        /* Declarations of the top-level code, not of a function body inlined into it, are globals */
+        if (!in_function && current_return_label < 0)
+        {
+            v = thrive_x64_codegen_add_global(name->data.name.start, name->data.name.length, node->data.decl.is_array, node->data.decl.array_size);
+        }
+        else
+        {
+            v = thrive_x64_codegen_add_var(name->data.name.start, name->data.name.length, node->data.decl.is_array, node->data.decl.array_size);
+        }
 
         if (node->data.decl.value)
         {
             thrive_x64_codegen_expression(b, node->data.decl.value);
-            thrive_x64_mov_mrbp_r(b, v->offset, REG_RAX);
+            thrive_x64_codegen_store(b, v->offset);
         }
         break;
     }
@@ -3217,18 +11336,15 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
         i32 l_end = thrive_x64_codegen_new_label();
 
         thrive_x64_codegen_expression(b, node->data.if_stmt.cond);
-        thrive_x64_test_rr(b, REG_RAX, REG_RAX);
+        thrive_x64_codegen_test(b);
 
-        thrive_buffer_write_u8(b, 0x0F);
-        thrive_buffer_write_u8(b, 0x80 | CC_E);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, node->data.if_stmt.else_branch ? l_else : l_end);
+        thrive_x64_codegen_jcc(b, CC_E, node->data.if_stmt.else_branch ? l_else : l_end);
 
         thrive_x64_codegen_statement(b, node->data.if_stmt.then_branch);
 
         if (node->data.if_stmt.else_branch)
         {
-            thrive_buffer_write_u8(b, 0xE9);
-            thrive_x64_codegen_record_fixup(b, FIXUP_JMP, l_end);
+            thrive_x64_codegen_jmp(b, l_end);
             thrive_x64_codegen_bind_label(b, l_else);
             thrive_x64_codegen_statement(b, node->data.if_stmt.else_branch);
         }
@@ -3241,24 +11357,49 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
         i32 step_label = thrive_x64_codegen_new_label();
         i32 end_label = thrive_x64_codegen_new_label();
         i32 old_break = current_break_label, old_continue = current_continue_label;
+        thrive_unroll_loop loop;
+        u8 reduced;
         current_break_label = end_label;
         current_continue_label = step_label;
 
-        thrive_x64_codegen_expression(b, node->data.for_loop.init);
-        thrive_x64_codegen_bind_label(b, start_label);
-        thrive_x64_codegen_expression(b, node->data.for_loop.cond);
-        thrive_x64_test_rr(b, REG_RAX, REG_RAX);
-        thrive_buffer_write_u8(b, 0x0F);
-        thrive_buffer_write_u8(b, 0x80 | CC_E);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, end_label);
+        if (node->data.for_loop.init)
+        {
+            thrive_x64_codegen_expression(b, node->data.for_loop.init);
+        }
+
+        /* Shapes checked again, passes after the unrolling may have rewritten the loop */
+        reduced = (u8)(node->data.for_loop.reduce && thrive_unroll_analyze(node, &loop));
 
-        thrive_x64_codegen_statement(b, node->data.for_loop.body);
+        if (reduced)
+        {
+            thrive_x64_codegen_pointers(b, node, &loop);
+        }
+
+        if (reduced && node->data.for_loop.reduce == 2)
+        {
+            thrive_x64_codegen_countdown(b, node, &loop, end_label);
+        }
+        else
+        {
+            if (node->data.for_loop.unroll > 1 && (reduced || thrive_unroll_analyze(node, &loop)))
+            {
+                thrive_x64_codegen_unrolled(b, node, &loop);
+            }
+
+            /* Rotated: one entry check, the exit test after the step branches back to the body */
+            thrive_x64_codegen_branch(b, node->data.for_loop.cond, CC_E, end_label);
+
+            thrive_x64_codegen_bind_loop(b, start_label);
+            thrive_x64_codegen_statement(b, node->data.for_loop.body);
+
+            thrive_x64_codegen_bind_label(b, step_label);
+            thrive_x64_codegen_expression(b, node->data.for_loop.step);
+            thrive_x64_codegen_advance(b);
+            thrive_x64_codegen_branch(b, node->data.for_loop.cond, CC_NE, start_label);
+        }
 
-        thrive_x64_codegen_bind_label(b, step_label);
-        thrive_x64_codegen_expression(b, node->data.for_loop.step);
-        thrive_buffer_write_u8(b, 0xE9);
-        thrive_x64_codegen_record_fixup(b, FIXUP_JMP, start_label);
         thrive_x64_codegen_bind_label(b, end_label);
+        reduced_count = 0;
 
         current_break_label = old_break;
         current_continue_label = old_continue;
@@ -3277,36 +11418,57 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
     case THRIVE_AST_FUNC_DECL:
     {
         thrive_ast *curr = node->data.func_decl.params;
-        thrive_x64_reg arg_regs[] = {REG_RCX, REG_RDX, REG_R8, REG_R9};
         u32 p_idx = 0;
 
         i32 f_idx = thrive_x64_codegen_find_or_add_func(node->data.func_decl.name->data.name.start, node->data.func_decl.name->data.name.length);
 
         u32 saved_var_count;
         i32 saved_stack_offset;
+        u32 unaligned = b->size;
+        u32 padding = align_functions ? thrive_x64_codegen_pad(b, align_functions) : 0;
+        u32 start = b->size;
+        u32 fixup_first = fixup_count;
 
+        optimizer_stats.aligned_functions += align_functions ? 1 : 0;
         funcs[f_idx].rva = 0x1000 + b->size;
 
-        thrive_x64_push_r(b, REG_RBP);
-        thrive_x64_mov_rr(b, REG_RBP, REG_RSP);
-        thrive_x64_sub_rsp_imm32(b, 256);
+        thrive_x64_codegen_frame_begin(b);
 
         saved_var_count = var_count;
         saved_stack_offset = stack_offset;
         stack_offset = 0;
         in_function = 1;
 
-        while (curr && p_idx < 4)
+        /* Parameters come in the internal convention, see internal_arg_regs */
+        for (; curr; curr = curr->next, ++p_idx)
         {
             thrive_var *v = thrive_x64_codegen_add_var(curr->data.name.start, curr->data.name.length, 0, 0);
-            thrive_x64_mov_mrbp_r(b, v->offset, arg_regs[p_idx++]);
-            curr = curr->next;
+
+            if (p_idx < THRIVE_INTERNAL_ARG_REGS)
+            {
+                thrive_x64_mov_mrbp_r(b, v->offset, internal_arg_regs[p_idx]);
+            }
+            else
+            {
+                thrive_x64_mov_r_mrbp(b, REG_RAX, 16 + 8 * (i32)(p_idx - THRIVE_INTERNAL_ARG_REGS));
+                thrive_x64_mov_mrbp_r(b, v->offset, REG_RAX);
+            }
         }
 
         thrive_x64_codegen_statement(b, node->data.func_decl.body);
 
         thrive_x64_leave(b);
         thrive_x64_ret(b);
+        thrive_x64_codegen_frame_end(b);
+        thrive_x64_codegen_icf_fold(b, f_idx, start, fixup_first);
+
+        /* A folded function gives its padding back */
+        if (b->size == start && align_functions)
+        {
+            b->size = unaligned;
+            optimizer_stats.align_padding -= padding;
+            optimizer_stats.aligned_functions--;
+        }
 
         var_count = saved_var_count;
         stack_offset = saved_stack_offset;
@@ -3316,7 +11478,11 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
     }
     case THRIVE_AST_RETURN:
         thrive_x64_codegen_expression(b, node->data.ret.expr);
-        if (in_function)
+        if (current_return_label >= 0)
+        {
+            thrive_x64_codegen_jmp(b, current_return_label);
+        }
+        else if (in_function)
         {
             thrive_x64_leave(b);
             thrive_x64_ret(b);
@@ -3342,62 +11508,128 @@ THRIVE_API void thrive_x64_codegen_statement(thrive_buffer *b, thrive_ast *node)
     }
 }
 
-void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_buffer *exe_out)
+/*
+ * Statement of the top-level list. It runs exactly once, so a declaration
+ * initialized with a constant needs no code: the value goes into .data, or
+ * the global stays in the zero-filled .bss for 0.
+ */
+THRIVE_API void thrive_x64_codegen_top_level(thrive_buffer *b, thrive_ast *node)
 {
-    thrive_ast *curr;
-    u32 i;
-    thrive_p32_plus_import imports[2];
-    u32 num_imports = 0;
+    thrive_ast *value = node->kind == THRIVE_AST_DECL ? node->data.decl.value : 0;
 
-    u32 text_rva;
+    /* A one element array is a scalar shared with functions (thrive_ast_share) */
+    if (value && value->kind == THRIVE_AST_INT && (!node->data.decl.is_array || node->data.decl.array_size == 1))
+    {
+        thrive_ast *name = node->data.decl.name;
+
+        thrive_x64_codegen_add_global(name->data.name.start, name->data.name.length, node->data.decl.is_array, node->data.decl.array_size);
+        globals[global_count - 1].value = value->data.int_value;
+        globals[global_count - 1].in_data = (u8)(value->data.int_value != 0);
+        return;
+    }
+
+    thrive_x64_codegen_statement(b, node);
+}
+
+THRIVE_API void thrive_x64_codegen_begin(thrive_buffer *code_b)
+{
+    u32 i;
 
     func_count = 0;
     fixup_count = 0;
-    string_count = 0;
-
-    /* Pass 1: Collect External Decl */
+    global_count = 0;
+    label_id = 0;
+    reduced_count = 0;
+    accumulate_count = 0;
+    stored_buffer = 0;
+    peephole_count = 0;
+    icf_count = 0;
+    u32_fc = 0;
+    k32_fc = 0;
     import_name_pool_offset = 0; /* Reset pool for fresh generations */
 
-    curr = node->data.block.body;
-    while (curr)
+    /* Top-level code is the entry point at the start of .text */
+    thrive_x64_codegen_reset_locals();
+    current_return_label = -1;
+    thrive_x64_codegen_frame_begin(code_b);
+
+    for (i = 0; string_count > 0 && i < THRIVE_STRING_HASH_SIZE; ++i)
     {
-        if (curr->kind == THRIVE_AST_EXT_DECL)
-        {
-            i32 f_idx = thrive_x64_codegen_find_or_add_func(curr->data.ext_decl.name->data.name.start, curr->data.ext_decl.name->data.name.length);
+        string_hash[i] = 0;
+    }
 
-            u32 len;
-            s8 *null_terminated_name;
-            u32 j;
+    string_count = 0;
+    string_b.size = 0;
+    rdata_string_b.size = 0;
+}
 
-            funcs[f_idx].is_external = 1;
+/* Registers an ext declaration for the import table, source_code locates the error of a late one */
+THRIVE_API void thrive_x64_codegen_ext_decl(thrive_ast *node, s8 *source_code)
+{
+    u32 known = func_count;
+    i32 f_idx = thrive_x64_codegen_find_or_add_func(node->data.ext_decl.name->data.name.start, node->data.ext_decl.name->data.name.length);
 
-            /* Extract and NULL-terminate the function name for the PE Importer */
-            len = funcs[f_idx].length;
-            null_terminated_name = &import_name_pool[import_name_pool_offset];
+    u32 len;
+    s8 *null_terminated_name;
+    u32 j;
 
-            for (j = 0; j < len; ++j)
-            {
-                null_terminated_name[j] = funcs[f_idx].start[j];
-            }
-            null_terminated_name[len] = '\0';
-            import_name_pool_offset += len + 1;
+    /* Only the pipelined codegen sees a call first, it already went out as an internal call */
+    if ((u32)f_idx < known && !funcs[f_idx].is_external)
+    {
+        thrive_status status = {0};
+        status.type = THRIVE_STATUS_ERROR_SYNTAX;
+        status.message = "ext declaration after the first call of the function";
+        status.token_start = node->data.ext_decl.name->data.name.start;
+        status.token_end = status.token_start + node->data.ext_decl.name->data.name.length;
+        thrive_status_position(&status, source_code, status.token_start);
+        thrive_panic(status);
+    }
 
-            /* Use the null-terminated version for the imports table */
-            if (null_terminated_name[0] == 'M' && null_terminated_name[1] == 'e' && null_terminated_name[2] == 's')
-            { /* MessageBoxA */
-                funcs[f_idx].ext_dll_index = 0;
-                funcs[f_idx].ext_func_index = u32_fc;
-                user32_funcs[u32_fc++] = (char *)null_terminated_name;
-            }
-            else
-            {
-                funcs[f_idx].ext_dll_index = 1;
-                funcs[f_idx].ext_func_index = k32_fc;
-                kernel32_funcs[k32_fc++] = (char *)null_terminated_name;
-            }
-        }
-        curr = curr->next;
+    funcs[f_idx].is_external = 1;
+
+    /* Extract and NULL-terminate the function name for the PE Importer */
+    len = funcs[f_idx].length;
+    null_terminated_name = &import_name_pool[import_name_pool_offset];
+
+    for (j = 0; j < len; ++j)
+    {
+        null_terminated_name[j] = funcs[f_idx].start[j];
+    }
+    null_terminated_name[len] = '\0';
+    import_name_pool_offset += len + 1;
+
+    /* Use the null-terminated version for the imports table */
+    if (null_terminated_name[0] == 'M' && null_terminated_name[1] == 'e' && null_terminated_name[2] == 's')
+    { /* MessageBoxA */
+        funcs[f_idx].ext_dll_index = 0;
+        funcs[f_idx].ext_func_index = u32_fc;
+        user32_funcs[u32_fc++] = (char *)null_terminated_name;
+    }
+    else
+    {
+        funcs[f_idx].ext_dll_index = 1;
+        funcs[f_idx].ext_func_index = k32_fc;
+        kernel32_funcs[k32_fc++] = (char *)null_terminated_name;
     }
+}
+
+/* Closes the top-level code, emits the function declarations found in the statement list and the executable */
+THRIVE_API void thrive_x64_codegen_end(thrive_buffer *code_b, thrive_ast *stmts, thrive_buffer *exe_out)
+{
+    thrive_ast *curr;
+    u32 i;
+    thrive_p32_plus_import imports[2];
+    u32 num_imports = 0;
+    thrive_buffer data_b = {0};
+    u32 bss_size = 0;
+    u32 strings_rva;
+    u32 data_rva;
+
+    u32 text_rva;
+
+    thrive_x64_leave(code_b);
+    thrive_x64_ret(code_b);
+    thrive_x64_codegen_frame_end(code_b);
 
     if (u32_fc > 0)
     {
@@ -3425,24 +11657,8 @@ void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_
         num_imports++;
     }
 
-    /* Pass 2: Main Logic */
-    thrive_x64_codegen_reset_locals();
-    thrive_x64_push_r(code_b, REG_RBP);
-    thrive_x64_mov_rr(code_b, REG_RBP, REG_RSP);
-    thrive_x64_sub_rsp_imm32(code_b, 256);
-
-    curr = node->data.block.body;
-    while (curr)
-    {
-        if (curr->kind != THRIVE_AST_FUNC_DECL && curr->kind != THRIVE_AST_EXT_DECL)
-            thrive_x64_codegen_statement(code_b, curr);
-        curr = curr->next;
-    }
-    thrive_x64_leave(code_b);
-    thrive_x64_ret(code_b);
-
     /* Pass 3: Internal Functions */
-    curr = node->data.block.body;
+    curr = stmts;
     while (curr)
     {
         if (curr->kind == THRIVE_AST_FUNC_DECL)
@@ -3450,53 +11666,38 @@ void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_
         curr = curr->next;
     }
 
-    /* Pass 4: Embed Strings into Text Section */
-    for (i = 0; i < string_count; ++i)
+    /* Recalculate IAT RVAs dynamically based on final text size */
+    for (i = 0; i < func_count; ++i)
     {
-        u32 j;
-        string_pool[i].offset = code_b->size;
-        for (j = 0; j < string_pool[i].length; ++j)
+        if (funcs[i].is_external)
         {
-            if (string_pool[i].start[j] == '\\' && j + 1 < string_pool[i].length)
-            {
-                j++;
-                switch (string_pool[i].start[j])
-                {
-                case 'n':
-                    thrive_buffer_write_u8(code_b, 10);
-                    break;
-                case 'r':
-                    thrive_buffer_write_u8(code_b, 13);
-                    break;
-                case 't':
-                    thrive_buffer_write_u8(code_b, 9);
-                    break;
-                case '0':
-                    thrive_buffer_write_u8(code_b, 0);
-                    break;
-                default:
-                    thrive_buffer_write_u8(code_b, (u8)string_pool[i].start[j]);
-                    break;
-                }
-            }
-            else
-            {
-                thrive_buffer_write_u8(code_b, (u8)string_pool[i].start[j]);
-            }
+            funcs[i].rva = thrive_pe32_plus_get_iat_rva(imports, num_imports, code_b->size, funcs[i].ext_dll_index, funcs[i].ext_func_index);
         }
-        thrive_buffer_write_u8(code_b, 0); /* Null Terminator */
     }
 
-    /* Recalculate IAT RVAs dynamically based on final text size */
-    for (i = 0; i < func_count; ++i)
+    /* Lay out the globals, initialized ones in .data and the rest in .bss */
+    data_b.data = global_data;
+    data_b.capacity = sizeof(global_data);
+
+    for (i = 0; i < global_count; ++i)
     {
-        if (funcs[i].is_external)
+        if (globals[i].in_data)
         {
-            funcs[i].rva = thrive_pe32_plus_get_iat_rva(imports, num_imports, code_b->size, funcs[i].ext_dll_index, funcs[i].ext_func_index);
+            globals[i].offset = data_b.size;
+            thrive_buffer_write_u64(&data_b, globals[i].value);
+        }
+        else
+        {
+            globals[i].offset = bss_size;
+            bss_size += globals[i].size;
         }
     }
 
-    /* Pass 5: Apply Fixups */
+    thrive_x64_codegen_strings();
+    strings_rva = thrive_pe32_plus_get_strings_rva(imports, num_imports, code_b->size);
+    data_rva = thrive_pe32_plus_get_data_rva(imports, num_imports, code_b->size, rdata_string_b.size);
+
+    /* Pass 4: Apply Fixups, string literals live in .rdata behind the imports */
     text_rva = 0x1000;
 
     for (i = 0; i < fixup_count; ++i)
@@ -3522,7 +11723,13 @@ void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_
         }
         else if (f->type == FIXUP_STRING)
         {
-            rel = (i32)string_pool[f->target_id].offset - (i32)f->instr_end_offset;
+            rel = (i32)(strings_rva + string_pool[f->target_id].offset) - (i32)(text_rva + f->instr_end_offset);
+        }
+        else if (f->type == FIXUP_DATA)
+        {
+            thrive_global *g = &globals[f->target_id];
+            u32 target_rva = g->in_data ? data_rva + g->offset : data_rva + thrive_align_up(data_b.size, 0x1000) + g->offset;
+            rel = (i32)target_rva - (i32)(text_rva + f->instr_end_offset);
         }
 
         patch_ptr = (u32 *)(code_b->data + f->buffer_offset);
@@ -3530,7 +11737,184 @@ void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_
     }
 
     /* Finally, emit executable via your PE32+ generator */
-    thrive_pe32_plus_generate(exe_out, code_b, imports, num_imports, code_b->size);
+    thrive_pe32_plus_generate(exe_out, code_b, &rdata_string_b, &data_b, bss_size, imports, num_imports, code_b->size);
+}
+
+void thrive_x64_codegen_program(thrive_buffer *code_b, thrive_ast *node, thrive_buffer *exe_out)
+{
+    thrive_ast *curr;
+
+    thrive_x64_codegen_begin(code_b);
+
+    /* Pass 1: Collect External Decl (before any call, so without the source for an error) */
+    curr = node->data.block.body;
+    while (curr)
+    {
+        if (curr->kind == THRIVE_AST_EXT_DECL)
+        {
+            thrive_x64_codegen_ext_decl(curr, 0);
+        }
+        curr = curr->next;
+    }
+
+    /* Pass 2: Main Logic */
+    curr = node->data.block.body;
+    while (curr)
+    {
+        if (curr->kind != THRIVE_AST_FUNC_DECL && curr->kind != THRIVE_AST_EXT_DECL)
+            thrive_x64_codegen_top_level(code_b, curr);
+        curr = curr->next;
+    }
+
+    thrive_x64_codegen_end(code_b, node->data.block.body, exe_out);
+}
+
+/* #############################################################################
+ * # [SECTION] Pipelined Compilation
+ * #############################################################################
+ *
+ * Runs lexing, parsing and folding/codegen concurrently. The platform layer
+ * calls each stage function on its own thread:
+ *
+ *   thrive_pipeline_lex     ; produces tokens into p->tokens
+ *   thrive_pipeline_parse   ; consumes tokens, produces top-level statements
+ *   thrive_pipeline_codegen ; folds and emits each statement as it arrives
+ *
+ * Top-level code is emitted while parsing is still in progress, functions are
+ * deferred to the end (Pass 3) like in the serial path. ext declarations are
+ * registered in stream order and therefore have to precede their first call,
+ * a later one panics.
+ */
+typedef struct thrive_pipeline
+{
+    thrive_state lexer;  /* owned by the lexer thread */
+    thrive_state parser; /* owned by the parser thread */
+
+    thrive_token_ring tokens;
+    thrive_ast_ring statements;
+
+    thrive_buffer *code;
+    thrive_buffer *exe;
+
+    s8 *source_code; /* start of the input, the lexer state moves on */
+
+} thrive_pipeline;
+
+THRIVE_API void thrive_pipeline_init(
+    thrive_pipeline *p,
+    s8 *source_code,
+    u32 source_code_size,
+    thrive_ast *ast_pool,
+    u32 ast_capacity,
+    thrive_buffer *code,
+    thrive_buffer *exe,
+    void (*yield)(void))
+{
+    thrive_state empty = {0};
+
+    p->lexer = empty;
+    p->lexer.line = 1;
+    p->lexer.column = 1;
+    p->lexer.source_code = source_code;
+    p->lexer.source_code_size = source_code_size;
+    p->lexer.line_start = source_code;
+
+    p->parser = p->lexer;
+    p->parser.ast_pool = ast_pool;
+    p->parser.ast_capacity = ast_capacity;
+    p->parser.token_ring = &p->tokens;
+
+    p->tokens.head = 0;
+    p->tokens.tail = 0;
+    p->tokens.yield = yield;
+
+    p->statements.head = 0;
+    p->statements.tail = 0;
+    p->statements.yield = yield;
+
+    p->code = code;
+    p->exe = exe;
+    p->source_code = source_code;
+}
+
+THRIVE_API void thrive_pipeline_lex(thrive_pipeline *p)
+{
+    do
+    {
+        thrive_token_lex(&p->lexer);
+        thrive_token_ring_push(&p->tokens, &p->lexer.current, p->lexer.line_start);
+
+    } while (p->lexer.current.kind != THRIVE_TOKEN_KIND_EOF);
+}
+
+THRIVE_API void thrive_pipeline_parse(thrive_pipeline *p)
+{
+    thrive_state *state = &p->parser;
+
+    state->ast_count = 0;
+
+    thrive_token_next(state);
+    thrive_token_skip_newlines(state);
+
+    while (state->current.kind != THRIVE_TOKEN_KIND_EOF)
+    {
+        thrive_ast *stmt;
+
+        thrive_token_skip_newlines(state);
+
+        stmt = thrive_ast_parse_statement(state);
+
+        if (!stmt)
+        {
+            break;
+        }
+
+        /* Statements are not linked, .next belongs to the codegen thread once published */
+        thrive_ast_ring_push(&p->statements, stmt);
+
+        thrive_token_skip_newlines(state);
+    }
+
+    thrive_ast_ring_push(&p->statements, 0); /* End of stream */
+}
+
+THRIVE_API void thrive_pipeline_codegen(thrive_pipeline *p)
+{
+    thrive_ast *func_decls = 0;
+    thrive_ast **func_tail = &func_decls;
+    thrive_ast *stmt;
+
+    thrive_x64_codegen_begin(p->code);
+
+    while ((stmt = thrive_ast_ring_pop(&p->statements)) != 0)
+    {
+        /* Folding a constant if can replace the statement by its branch (or nothing) */
+        stmt = thrive_ast_fold(stmt);
+
+        while (stmt)
+        {
+            thrive_ast *next = stmt->next;
+
+            if (stmt->kind == THRIVE_AST_EXT_DECL)
+            {
+                thrive_x64_codegen_ext_decl(stmt, p->source_code);
+            }
+            else if (stmt->kind == THRIVE_AST_FUNC_DECL)
+            {
+                stmt->next = 0;
+                *func_tail = stmt;
+                func_tail = &stmt->next;
+            }
+            else
+            {
+                thrive_x64_codegen_top_level(p->code, stmt);
+            }
+
+            stmt = next;
+        }
+    }
+
+    thrive_x64_codegen_end(p->code, func_decls, p->exe);
 }
 
 #endif /* THRIVE_H */
@@ -100,7 +100,7 @@ THRIVE_API void thrive_ast_print(thrive_ast *node, u32 depth)
     }
 
     case THRIVE_AST_TERNARY:
-        printf("TERNARY\n");
+        printf(node->data.ternary.select ? "TERNARY (select)\n" : "TERNARY\n");
 
         thrive_ast_print(node->data.ternary.cond, depth + 1);
         thrive_ast_print(node->data.ternary.then_expr, depth + 1);
@@ -131,7 +131,24 @@ THRIVE_API void thrive_ast_print(thrive_ast *node, u32 depth)
 
     case THRIVE_AST_FOR:
     {
-        printf("FOR\n");
+        printf("FOR");
+
+        if (node->data.for_loop.unroll > 1)
+        {
+            printf(" (unroll %u)", node->data.for_loop.unroll);
+        }
+
+        if (node->data.for_loop.accumulate > 1)
+        {
+            printf(" (accumulators %u)", node->data.for_loop.accumulate);
+        }
+
+        if (node->data.for_loop.reduce)
+        {
+            printf(node->data.for_loop.reduce == 2 ? " (pointers, count down)" : " (pointers)");
+        }
+
+        printf("\n");
 
         thrive_print_indent(depth + 1);
         printf("INIT\n");
@@ -292,6 +309,30 @@ THRIVE_API void thrive_ast_print(thrive_ast *node, u32 depth)
         break;
     }
 
+    case THRIVE_AST_INLINE:
+    {
+        thrive_ast *param = node->data.inline_call.params;
+        thrive_ast *arg = node->data.inline_call.args;
+
+        printf("INLINE %.*s\n",
+               node->data.inline_call.name->data.name.length,
+               node->data.inline_call.name->data.name.start);
+
+        while (param && arg)
+        {
+            thrive_print_indent(depth + 1);
+            printf("BIND %.*s:\n", param->data.name.length, param->data.name.start);
+            thrive_ast_print(arg, depth + 2);
+            param = param->next;
+            arg = arg->next;
+        }
+
+        thrive_print_indent(depth + 1);
+        printf("BODY:\n");
+        thrive_ast_print(node->data.inline_call.body, depth + 2);
+        break;
+    }
+
     default:
         printf("UNKNOWN AST\n");
         break;
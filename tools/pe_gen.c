@@ -68,6 +68,9 @@ i32 main(void)
     thrive_pe32_plus_generate(
         &pe_buf,
         &codebuf,
+        0,
+        0,
+        0,
         imports,
         imports_count,
         text_vsize);
@@ -0,0 +1,274 @@
+/* Times compute kernels compiled with the optimizer passes switched on step
+ * by step. Linux only (clock_gettime), the generated exe runs in place
+ * through thrive_exec.h, so the kernels must not call ext functions.
+ *
+ *   cc -O2 tools/thrive_bench.c -o thrive_bench
+ *   ./thrive_bench
+ *
+ * Columns: the levels of win32_thrive.c -O0, -O1 and -O2, run through
+ * thrive_ast_optimize so they follow thrive_passes, and aligned = -O2 with
+ * --align=32 (functions on 16 bytes, loop heads on 32).
+ */
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS, clock_gettime */
+
+#include "../thrive.h"
+#include "thrive_exec.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+/* #############################################################################
+ * # [SECTION] Benchmark
+ * #############################################################################
+ */
+THRIVE_API void thrive_panic(thrive_status status)
+{
+    printf("[error] %s (line %u)\n", status.message, status.line);
+    exit(1);
+}
+
+#define THRIVE_BENCH_LEVELS 4
+#define THRIVE_BENCH_RUNS 3
+
+typedef struct thrive_bench_kernel
+{
+    s8 *name;
+    s8 *source; /* top-level code ends with the result as an expression */
+
+} thrive_bench_kernel;
+
+static thrive_bench_kernel bench_kernels[] = {
+    {"sum",
+     "u32 sum(u32 *a : u32 n) {\n"
+     "  u32 i\n"
+     "  u32 s = 0\n"
+     "  for (i = 0 : i < n : ++i) { s += a[i] }\n"
+     "  ret s\n"
+     "}\n"
+     "u32 a[4096]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 4096 : ++i) { a[i] = i * 7 }\n"
+     "for (r = 0 : r < 20000 : ++r) { t += sum(a : 4096) }\n"
+     "t\n"},
+    {"dot",
+     "u32 dot(u32 *a : u32 *b : u32 n) {\n"
+     "  u32 i\n"
+     "  u32 s = 0\n"
+     "  for (i = 0 : i < n : ++i) { s += a[i] * b[i] }\n"
+     "  ret s\n"
+     "}\n"
+     "u32 a[4096]\n"
+     "u32 b[4096]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 4096 : ++i) { a[i] = i * 7  b[i] = 4096 - i }\n"
+     "for (r = 0 : r < 20000 : ++r) { t += dot(a : b : 4096) }\n"
+     "t\n"},
+    {"saxpy",
+     "u32 saxpy(u32 *y : u32 *x : u32 n : u32 k) {\n"
+     "  u32 i\n"
+     "  for (i = 0 : i < n : ++i) { y[i] = y[i] + x[i] * k }\n"
+     "  ret y[n - 1]\n"
+     "}\n"
+     "u32 x[4096]\n"
+     "u32 y[4096]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 4096 : ++i) { x[i] = i  y[i] = 1 }\n"
+     "for (r = 0 : r < 20000 : ++r) { t += saxpy(y : x : 4096 : r & 7) }\n"
+     "t\n"},
+    {"prefix",
+     "u32 prefix(u32 *a : u32 n) {\n"
+     "  u32 i\n"
+     "  u32 s = 0\n"
+     "  for (i = 0 : i < n : ++i) { s += a[i] & 255  a[i] = s }\n"
+     "  ret s\n"
+     "}\n"
+     "u32 a[4096]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 4096 : ++i) { a[i] = i }\n"
+     "for (r = 0 : r < 20000 : ++r) { t += prefix(a : 4096) }\n"
+     "t\n"},
+    /* Three arrays indexed per iteration, the address arithmetic is what the reduce pass removes */
+    {"vadd",
+     "u32 vadd(u32 *c : u32 *a : u32 *b : u32 n) {\n"
+     "  u32 i\n"
+     "  for (i = 0 : i < n : ++i) { c[i] = a[i] + b[i] }\n"
+     "  ret c[n - 1]\n"
+     "}\n"
+     "u32 a[4096]\n"
+     "u32 b[4096]\n"
+     "u32 c[4096]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 4096 : ++i) { a[i] = i  b[i] = i * 3 }\n"
+     "for (r = 0 : r < 20000 : ++r) { t += vadd(c : a : b : 4096) + c[r & 4095] }\n"
+     "t\n"},
+    /* Random input, the branches of min / max / clamp are unpredictable (64k elements, a 4k pattern is learned by the predictor) */
+    {"clamp",
+     "u32 clamp(u32 *a : u32 n) {\n"
+     "  u32 i\n"
+     "  u32 c\n"
+     "  u32 lo = 65535\n"
+     "  u32 hi = 0\n"
+     "  u32 s = 0\n"
+     "  for (i = 0 : i < n : ++i) {\n"
+     "    lo = a[i] < lo ? a[i] : lo\n"
+     "    if (a[i] > hi) { hi = a[i] }\n"
+     "    c = a[i] < 16384 ? 16384 : a[i]\n"
+     "    if (c > 49152) { c = 49152 }\n"
+     "    s += c\n"
+     "  }\n"
+     "  ret s + lo + hi\n"
+     "}\n"
+     "u32 a[65536]\n"
+     "u32 i\n"
+     "u32 r\n"
+     "u32 x = 12345\n"
+     "u32 t = 0\n"
+     "for (i = 0 : i < 65536 : ++i) { x = (x * 1103515245 + 12345) & 2147483647  a[i] = (x >> 8) & 65535 }\n"
+     "for (r = 0 : r < 1250 : ++r) { t += clamp(a : 65536) }\n"
+     "t\n"},
+    /* Call bound, five arguments per call between Thrive functions (recursive, so never inlined) */
+    {"calls",
+     "u32 fib(u32 n : u32 a : u32 b : u32 c : u32 d) {\n"
+     "  if (n < 2) { ret n + a - b + c - d }\n"
+     "  ret fib(n - 1 : a : b : c : d) + fib(n - 2 : b : a : d : c)\n"
+     "}\n"
+     "u32 r\n"
+     "u32 t = 0\n"
+     "for (r = 0 : r < 40 : ++r) { t += fib(27 : r : r : r + 1 : r + 1) }\n"
+     "t\n"},
+};
+
+static thrive_ast bench_pool[8192];
+static u8 bench_code_data[1 << 16];
+static u8 bench_exe_data[1 << 17];
+
+/* Compiles source like win32_thrive.c at level into bench_exe_data, the last column adds the alignment */
+void thrive_bench_compile(s8 *source, u32 column)
+{
+    thrive_opt_level level = column > THRIVE_OPT_O2 ? THRIVE_OPT_O2 : (thrive_opt_level)column;
+    thrive_pass_options options = thrive_pass_defaults(level);
+    thrive_state s = {0};
+    thrive_buffer code = {0};
+    thrive_buffer exe = {0};
+    thrive_ast *ast;
+
+    s.line = 1;
+    s.column = 1;
+    s.source_code = source;
+    s.line_start = source;
+    s.source_code_size = thrive_string_length(source);
+    /* The parser expects fresh nodes to be zeroed like the VirtualAlloc'd pool of win32_thrive.c */
+    memset(bench_pool, 0, sizeof(bench_pool));
+
+    s.ast_pool = bench_pool;
+    s.ast_capacity = sizeof(bench_pool) / sizeof(bench_pool[0]);
+
+    ast = thrive_ast_optimize(&s, thrive_ast_parse(&s), &options);
+
+    code.data = bench_code_data;
+    code.capacity = sizeof(bench_code_data);
+    exe.data = bench_exe_data;
+    exe.capacity = sizeof(bench_exe_data);
+
+    thrive_x64_codegen_peephole(level >= THRIVE_OPT_O2);
+    thrive_x64_codegen_icf(level >= THRIVE_OPT_O1);
+    thrive_x64_codegen_align(column > THRIVE_OPT_O2 ? 16 : 0, column > THRIVE_OPT_O2 ? 32 : 0);
+    thrive_x64_codegen_program(&code, ast, &exe);
+}
+
+/* Best wall time of a few runs in milliseconds */
+f64 thrive_bench_run(u64 *result)
+{
+    f64 best = 0.0;
+    u32 i;
+
+    for (i = 0; i < THRIVE_BENCH_RUNS; ++i)
+    {
+        struct timespec start;
+        struct timespec end;
+        f64 ms;
+
+        /* Top-level code is the entry point at the start of .text, a fresh image resets its globals */
+        thrive_exec_map(bench_exe_data);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        *result = thrive_exec_call();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ms = (f64)(end.tv_sec - start.tv_sec) * 1000.0 + (f64)(end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+        if (i == 0 || ms < best)
+        {
+            best = ms;
+        }
+    }
+
+    return best;
+}
+
+int main(void)
+{
+    static s8 *levels[THRIVE_BENCH_LEVELS] = {"O0", "O1", "O2", "aligned"};
+    u32 failures = 0;
+    u32 k;
+    u32 l;
+
+    if (!thrive_exec_init())
+    {
+        printf("[error] mmap failed\n");
+        return 1;
+    }
+
+    printf("[bench] %-8s", "kernel");
+
+    for (l = 0; l < THRIVE_BENCH_LEVELS; ++l)
+    {
+        printf(" %10s", levels[l]);
+    }
+
+    printf("  result\n");
+
+    for (k = 0; k < sizeof(bench_kernels) / sizeof(bench_kernels[0]); ++k)
+    {
+        u64 expected = 0;
+
+        printf("[bench] %-8s", bench_kernels[k].name);
+
+        for (l = 0; l < THRIVE_BENCH_LEVELS; ++l)
+        {
+            u64 result;
+            f64 ms;
+
+            thrive_bench_compile(bench_kernels[k].source, l);
+            ms = thrive_bench_run(&result);
+
+            printf(" %8.1fms", ms);
+
+            if (l == 0)
+            {
+                expected = result;
+            }
+            else if (result != expected)
+            {
+                printf(" MISMATCH %llu", (unsigned long long)result);
+                failures++;
+            }
+        }
+
+        printf("  %llu\n", (unsigned long long)expected);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+/* Runs an exe of thrive_x64_codegen_program in place: copies its sections to
+ * their rvas in one executable mapping and calls the top-level code through a
+ * trampoline, so the program must not call ext functions. The top-level code
+ * returns the value of its last expression.
+ *
+ * Needs _DEFAULT_SOURCE (MAP_ANONYMOUS) defined before the first include on
+ * Linux.
+ */
+#ifndef THRIVE_EXEC_H
+#define THRIVE_EXEC_H
+
+#include "../thrive.h"
+
+#include "string.h"
+
+#ifdef _WIN32
+__declspec(dllimport) void *__stdcall VirtualAlloc(void *lpAddress, u32 dwSize, u32 flAllocationType, u32 flProtect);
+#else
+#include "sys/mman.h"
+#endif
+
+#define THRIVE_EXEC_ENTRY 0x1000    /* rva of .text, the trampoline sits in the header page before it */
+#define THRIVE_EXEC_IMAGE (1 << 21) /* room for the .bss arrays of the programs */
+
+static u8 *thrive_exec_image; /* the image, section rvas are offsets into it */
+
+typedef u64 (*thrive_exec_fn)(void);
+
+static u32 thrive_exec_u32(u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/* Maps the image and writes the trampoline, 0 when there is no executable memory */
+u8 thrive_exec_init(void)
+{
+    thrive_buffer trampoline;
+
+#ifdef _WIN32
+    thrive_exec_image = (u8 *)VirtualAlloc(0, THRIVE_EXEC_IMAGE, 0x3000 /* MEM_RESERVE | MEM_COMMIT */, 0x40 /* PAGE_EXECUTE_READWRITE */);
+#else
+    thrive_exec_image = (u8 *)mmap(0, THRIVE_EXEC_IMAGE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (thrive_exec_image == MAP_FAILED)
+    {
+        thrive_exec_image = 0;
+    }
+#endif
+
+    if (!thrive_exec_image)
+    {
+        return 0;
+    }
+
+    /* The generated code uses rbx (and may use rsi / rdi) without saving them and expects the Win64 shadow space */
+    trampoline.data = thrive_exec_image;
+    trampoline.size = 0;
+    trampoline.capacity = THRIVE_EXEC_ENTRY;
+
+    thrive_x64_push_r(&trampoline, REG_RBX);
+    thrive_x64_push_r(&trampoline, REG_RSI);
+    thrive_x64_push_r(&trampoline, REG_RDI);
+    thrive_x64_sub_rsp_imm32(&trampoline, 32);
+    thrive_x64_call_rel32(&trampoline, trampoline.size, THRIVE_EXEC_ENTRY);
+    thrive_x64_add_rsp_imm32(&trampoline, 32);
+    thrive_x64_pop_r(&trampoline, REG_RDI);
+    thrive_x64_pop_r(&trampoline, REG_RSI);
+    thrive_x64_pop_r(&trampoline, REG_RBX);
+    thrive_x64_ret(&trampoline);
+
+    return 1;
+}
+
+/* Copies the raw data of every section of the exe to its rva, .bss stays zeroed */
+void thrive_exec_map(u8 *exe)
+{
+    u8 *nt = exe + thrive_exec_u32(exe + 0x3C);
+    u32 count = (u32)nt[6] | ((u32)nt[7] << 8);
+    u8 *section = nt + 24 + ((u32)nt[20] | ((u32)nt[21] << 8));
+    u32 i;
+
+    memset(thrive_exec_image + THRIVE_EXEC_ENTRY, 0, THRIVE_EXEC_IMAGE - THRIVE_EXEC_ENTRY);
+
+    for (i = 0; i < count; ++i, section += 40)
+    {
+        u32 virtual_size = thrive_exec_u32(section + 8);
+        u32 raw_size = thrive_exec_u32(section + 16);
+
+        memcpy(thrive_exec_image + thrive_exec_u32(section + 12), exe + thrive_exec_u32(section + 20), raw_size < virtual_size ? raw_size : virtual_size);
+    }
+}
+
+/* Runs the mapped top-level code, a fresh thrive_exec_map resets its globals */
+u64 thrive_exec_call(void)
+{
+    thrive_exec_fn run = (thrive_exec_fn)(void *)thrive_exec_image;
+
+    return run();
+}
+
+#endif /* THRIVE_EXEC_H */
@@ -0,0 +1,160 @@
+/* Exhaustive check of the constant division / modulo sequences emitted by the
+ * x64 codegen. Linux only (runs the generated code in place via mmap).
+ *
+ *   cc -O2 tools/thrive_magic_test.c -o thrive_magic_test
+ *   ./thrive_magic_test            all 2^32 numerators for a default set of divisors
+ *   ./thrive_magic_test 7 641      all 2^32 numerators for the given divisors
+ */
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include "../thrive.h"
+
+#include "stdio.h"
+#include "stdlib.h"
+#include "sys/mman.h"
+
+/* #############################################################################
+ * # [SECTION] Testing
+ * #############################################################################
+ */
+THRIVE_API void thrive_panic(thrive_status status)
+{
+    printf("[error] %s\n", status.message);
+    exit(1);
+}
+
+typedef unsigned long (*thrive_magic_fn)(unsigned long n);
+
+static u8 *magic_code;
+
+/* rax = rdi; rax = rax / d (or % d); ret */
+thrive_magic_fn thrive_magic_emit(u32 offset, u32 d, u8 remainder)
+{
+    thrive_buffer b;
+
+    b.data = magic_code + offset;
+    b.size = 0;
+    b.capacity = 64;
+
+    thrive_x64_mov_rr(&b, REG_RAX, REG_RDI);
+    thrive_x64_div_const(&b, d, remainder);
+    thrive_x64_ret(&b);
+
+    return (thrive_magic_fn)(void *)b.data;
+}
+
+/* Every 32-bit numerator for one divisor, returns the number of mismatches */
+u32 thrive_magic_test_exhaustive(u32 d)
+{
+    thrive_magic_fn div = thrive_magic_emit(0, d, 0);
+    thrive_magic_fn mod = thrive_magic_emit(64, d, 1);
+    u32 failures = 0;
+    u32 n = 0;
+
+    do
+    {
+        if (div(n) != n / d || mod(n) != n % d)
+        {
+            if (failures++ < 8)
+            {
+                printf("[magic] %u / %u: got %lu r %lu\n", n, d, div(n), mod(n));
+            }
+        }
+    } while (++n != 0);
+
+    printf("[magic] d = %-10u %s\n", d, failures ? "FAILED" : "ok");
+    return failures;
+}
+
+/* Numerators around multiples of d and the top of the range, for many divisors */
+u32 thrive_magic_test_boundaries(void)
+{
+    u32 failures = 0;
+    u32 i;
+
+    for (i = 1; i < 0x30000; ++i)
+    {
+        /* small divisors, divisors near 2^32 and divisors around each power of two */
+        u32 d = i < 0x10000 ? i : i < 0x20000 ? 0xFFFFFFFFu - (i - 0x10000) : (1u << (i & 31)) + ((i >> 5) & 7) - 4;
+        u32 q = 0xFFFFFFFFu / (d ? d : 1);
+        u32 k[10];
+        u32 j;
+
+        if (d == 0)
+        {
+            continue;
+        }
+
+        k[0] = 0;
+        k[1] = 1;
+        k[2] = d - 1;
+        k[3] = d;
+        k[4] = d + 1;
+        k[5] = 0xFFFFFFFFu;
+        k[6] = 0xFFFFFFFEu;
+        k[7] = q * d;
+        k[8] = q * d - 1;
+        k[9] = q / 2 * d + d - 1;
+
+        {
+            thrive_magic_fn div = thrive_magic_emit(0, d, 0);
+            thrive_magic_fn mod = thrive_magic_emit(64, d, 1);
+
+            for (j = 0; j < 10; ++j)
+            {
+                if (div(k[j]) != k[j] / d || mod(k[j]) != k[j] % d)
+                {
+                    if (failures++ < 8)
+                    {
+                        printf("[magic] %u / %u: got %lu r %lu\n", k[j], d, div(k[j]), mod(k[j]));
+                    }
+                }
+            }
+        }
+    }
+
+    printf("[magic] boundaries     %s\n", failures ? "FAILED" : "ok");
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    static u32 divisors[] = {3, 5, 6, 7, 10, 11, 25, 100, 641, 1000, 6700417, 65537, 0x7FFFFFFF, 0x80000001, 0xFFFFFFFF, 1, 2, 0x80000000};
+    u32 failures = 0;
+    int i;
+
+    magic_code = (u8 *)mmap(0, 4096, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (magic_code == MAP_FAILED)
+    {
+        printf("[error] mmap failed\n");
+        return 1;
+    }
+
+    failures += thrive_magic_test_boundaries();
+
+    if (argc > 1)
+    {
+        for (i = 1; i < argc; ++i)
+        {
+            u32 d = (u32)strtoul(argv[i], 0, 0);
+
+            if (d == 0)
+            {
+                printf("[magic] skipping divisor 0\n");
+                continue;
+            }
+
+            failures += thrive_magic_test_exhaustive(d);
+        }
+    }
+    else
+    {
+        for (i = 0; i < (int)(sizeof(divisors) / sizeof(divisors[0])); ++i)
+        {
+            failures += thrive_magic_test_exhaustive(divisors[i]);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -1,6 +1,9 @@
 
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
 #include "../thrive.h"
 #include "../thrive_ast_print.h"
+#include "thrive_exec.h"
 
 #include "stdio.h"
 #include "stdlib.h"
@@ -58,6 +61,913 @@ THRIVE_API void thrive_panic(thrive_status status)
     exit(1);
 }
 
+/* Parses a single expression from src into pool */
+thrive_ast *thrive_test_parse_expression(s8 *src, thrive_ast *pool, u32 capacity)
+{
+    thrive_state s = {0};
+    thrive_ast empty = {0};
+    u32 i;
+
+    /* The parser expects a zeroed pool */
+    for (i = 0; i < capacity; ++i)
+    {
+        pool[i] = empty;
+    }
+
+    s.line = 1;
+    s.column = 1;
+    s.source_code = src;
+    s.line_start = src;
+    s.source_code_size = thrive_string_length(src);
+    s.ast_pool = pool;
+    s.ast_capacity = capacity;
+
+    thrive_token_next(&s);
+
+    return thrive_ast_parse_expression(&s);
+}
+
+/* Every rewrite rule has to fire on its own test input and produce the expected tree */
+u32 thrive_test_rewrite_rules(void)
+{
+    thrive_ast pool[64];
+    u32 failures = 0;
+    u32 i;
+
+    printf("--------------------\n");
+
+    for (i = 0; i < THRIVE_REWRITE_RULE_COUNT; ++i)
+    {
+        thrive_rewrite_rule *rule = &thrive_rewrite_rules[i];
+        u32 hits = rule->hits;
+        thrive_ast *folded = thrive_ast_fold(thrive_test_parse_expression(rule->test, pool, 32));
+        thrive_ast *expected = thrive_ast_fold(thrive_test_parse_expression(rule->expected, pool + 32, 32));
+        u8 ok = (u8)(rule->hits > hits && thrive_ast_equals(folded, expected));
+
+        printf("[rewrite] %-16s -> %-10s %s\n", rule->test, rule->expected, ok ? "ok" : "FAILED");
+
+        failures += ok ? 0 : 1;
+    }
+
+    /* Operands with side effects are never dropped */
+    {
+        thrive_ast *folded = thrive_ast_fold(thrive_test_parse_expression("f(a) * 0", pool, 64));
+        u8 ok = (u8)(folded->kind == THRIVE_AST_BINARY);
+
+        printf("[rewrite] %-16s -> %-10s %s\n", "f(a) * 0", "f(a) * 0", ok ? "ok" : "FAILED");
+
+        failures += ok ? 0 : 1;
+    }
+
+    return failures;
+}
+
+/* Expected bytes of a peephole pattern with the rewrites on and off */
+typedef struct thrive_test_peephole_case
+{
+    s8 *name;
+    u8 on[16];
+    u32 on_size;
+    u8 off[24];
+    u32 off_size;
+
+} thrive_test_peephole_case;
+
+static thrive_test_peephole_case peephole_cases[] = {
+    {"push / pop", {0x48, 0x8B, 0xD8}, 3, {0x50, 0x5B}, 2},
+    {"push / imm / pop", {0x48, 0x8B, 0xD8, 0xB8, 0x05, 0x00, 0x00, 0x00}, 8, {0x50, 0x48, 0xB8, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5B}, 12},
+    {"push / pop rax", {0}, 0, {0x50, 0x58}, 2},
+    {"setl / test / je", {0x0F, 0x8D, 0x00, 0x00, 0x00, 0x00}, 6, {0x0F, 0x9C, 0xC0, 0x48, 0x0F, 0xB6, 0xC0, 0x48, 0x85, 0xC0, 0x0F, 0x84, 0x00, 0x00, 0x00, 0x00}, 16},
+    {"setl / test / sete", {0x0F, 0x9D, 0xC0, 0x48, 0x0F, 0xB6, 0xC0}, 7, {0x0F, 0x9C, 0xC0, 0x48, 0x0F, 0xB6, 0xC0, 0x48, 0x85, 0xC0, 0x0F, 0x94, 0xC0, 0x48, 0x0F, 0xB6, 0xC0}, 17},
+    {"add / test", {0x48, 0x01, 0xD8}, 3, {0x48, 0x01, 0xD8, 0x48, 0x85, 0xC0}, 6},
+    {"jmp next", {0}, 0, {0xE9, 0x00, 0x00, 0x00, 0x00}, 5},
+};
+
+/* Emits pattern i of peephole_cases through the codegen wrappers */
+void thrive_test_peephole_emit(thrive_buffer *b, u32 i)
+{
+    u32 start = b->size;
+    i32 label;
+
+    switch (i)
+    {
+    case 0:
+        thrive_x64_codegen_push(b);
+        thrive_x64_codegen_pop(b, REG_RBX);
+        break;
+    case 1:
+        thrive_x64_codegen_push(b);
+        thrive_x64_codegen_imm(b, REG_RAX, 5);
+        thrive_x64_codegen_pop(b, REG_RBX);
+        break;
+    case 2:
+        thrive_x64_codegen_push(b);
+        thrive_x64_codegen_pop(b, REG_RAX);
+        break;
+    case 3:
+        thrive_x64_codegen_bool(b, CC_L);
+        thrive_x64_codegen_test(b);
+        thrive_x64_codegen_jcc(b, CC_E, thrive_x64_codegen_new_label());
+        break;
+    case 4:
+        thrive_x64_codegen_bool(b, CC_L);
+        thrive_x64_codegen_test(b);
+        thrive_x64_codegen_bool(b, CC_E);
+        break;
+    case 5:
+        thrive_x64_add_rr(b, REG_RAX, REG_RBX);
+        thrive_x64_peephole_note(b, PEEP_FLAGS, CC_E, start);
+        thrive_x64_codegen_test(b);
+        break;
+    default:
+        label = thrive_x64_codegen_new_label();
+        thrive_x64_codegen_jmp(b, label);
+        thrive_x64_codegen_bind_label(b, label);
+        break;
+    }
+}
+
+/* Golden bytes of every peephole pattern, rewritten and as emitted without the peephole */
+u32 thrive_test_peephole(void)
+{
+    static u8 data[256];
+    thrive_buffer b;
+    u32 failures = 0;
+    u32 i;
+    u32 j;
+
+    printf("--------------------\n");
+
+    for (i = 0; i < sizeof(peephole_cases) / sizeof(peephole_cases[0]); ++i)
+    {
+        thrive_test_peephole_case *c = &peephole_cases[i];
+        u32 enabled;
+
+        for (enabled = 0; enabled < 2; ++enabled)
+        {
+            u8 *expected = enabled ? c->on : c->off;
+            u32 size = enabled ? c->on_size : c->off_size;
+            u32 start;
+            u8 ok;
+
+            b.data = data;
+            b.size = 0;
+            b.capacity = sizeof(data);
+
+            thrive_x64_codegen_peephole((u8)enabled);
+            thrive_x64_codegen_begin(&b);
+            start = b.size;
+            thrive_test_peephole_emit(&b, i);
+
+            ok = (u8)(b.size - start == size);
+
+            for (j = 0; ok && j < size; ++j)
+            {
+                ok = (u8)(data[start + j] == expected[j]);
+            }
+
+            printf("[peephole] %-18s %-3s %s\n", c->name, enabled ? "on" : "off", ok ? "ok" : "FAILED");
+
+            failures += ok ? 0 : 1;
+        }
+    }
+
+    thrive_x64_codegen_peephole(0);
+
+    return failures;
+}
+
+/* Code and exe of the last thrive_test_compile */
+static u8 thrive_test_code[4096];
+static u8 thrive_test_exe[8192];
+static u32 thrive_test_exe_size;
+
+/* Compiles src without the AST passes (icf = identical code folding on), returns the code size */
+u32 thrive_test_compile(s8 *src, u8 icf)
+{
+    static thrive_ast pool[2048];
+    thrive_state s = {0};
+    thrive_ast empty = {0};
+    thrive_buffer code = {0};
+    thrive_buffer exe = {0};
+    u32 i;
+
+    for (i = 0; i < 2048; ++i)
+    {
+        pool[i] = empty;
+    }
+
+    s.line = 1;
+    s.column = 1;
+    s.source_code = src;
+    s.line_start = src;
+    s.source_code_size = thrive_string_length(src);
+    s.ast_pool = pool;
+    s.ast_capacity = 2048;
+
+    code.data = thrive_test_code;
+    code.capacity = sizeof(thrive_test_code);
+    exe.data = thrive_test_exe;
+    exe.capacity = sizeof(thrive_test_exe);
+
+    thrive_x64_codegen_icf(icf);
+    thrive_x64_codegen_program(&code, thrive_ast_fold(thrive_ast_parse(&s)), &exe);
+    thrive_x64_codegen_icf(0);
+    thrive_test_exe_size = exe.size;
+
+    return code.size;
+}
+
+/* Tree, code and exe of the last thrive_test_run */
+static thrive_ast thrive_test_run_pool[8192];
+static u8 thrive_test_run_code[1 << 16];
+static u8 thrive_test_run_exe[1 << 17];
+static thrive_ast *thrive_test_run_ast;
+
+/* Compiles src at level like win32_thrive.c and runs it, returns the value of its last top-level expression */
+u64 thrive_test_run(s8 *src, thrive_opt_level level)
+{
+    thrive_pass_options options = thrive_pass_defaults(level);
+    thrive_state s = {0};
+    thrive_ast empty = {0};
+    thrive_buffer code = {0};
+    thrive_buffer exe = {0};
+    u32 i;
+
+    for (i = 0; i < 8192; ++i)
+    {
+        thrive_test_run_pool[i] = empty;
+    }
+
+    s.line = 1;
+    s.column = 1;
+    s.source_code = src;
+    s.line_start = src;
+    s.source_code_size = thrive_string_length(src);
+    s.ast_pool = thrive_test_run_pool;
+    s.ast_capacity = 8192;
+
+    thrive_test_run_ast = thrive_ast_optimize(&s, thrive_ast_parse(&s), &options);
+
+    code.data = thrive_test_run_code;
+    code.capacity = sizeof(thrive_test_run_code);
+    exe.data = thrive_test_run_exe;
+    exe.capacity = sizeof(thrive_test_run_exe);
+
+    thrive_x64_codegen_peephole(level >= THRIVE_OPT_O2);
+    thrive_x64_codegen_icf(level >= THRIVE_OPT_O1);
+    thrive_x64_codegen_program(&code, thrive_test_run_ast, &exe);
+    thrive_x64_codegen_peephole(0);
+    thrive_x64_codegen_icf(0);
+
+    thrive_exec_map(thrive_test_run_exe);
+
+    return thrive_exec_call();
+}
+
+/* Runs src at O0 and at O2, 0 unless both give expected. optimizer_stats and the tree are the ones of O2 */
+u8 thrive_test_levels(s8 *src, u64 expected)
+{
+    u64 result = thrive_test_run(src, THRIVE_OPT_O0);
+
+    thrive_optimizer_stats_reset();
+
+    return (u8)(result == expected && thrive_test_run(src, THRIVE_OPT_O2) == expected);
+}
+
+static thrive_ast_kind thrive_test_kind;
+static u32 thrive_test_kind_count;
+
+void thrive_test_count_visit(thrive_ast *node, void *user)
+{
+    (void)user;
+    thrive_test_kind_count += node->kind == thrive_test_kind ? 1 : 0;
+}
+
+/* Nodes of kind in the statements of the last thrive_test_run */
+u32 thrive_test_count(thrive_ast_kind kind)
+{
+    thrive_test_kind = kind;
+    thrive_test_kind_count = 0;
+    thrive_ast_walk(thrive_test_run_ast, thrive_test_count_visit, 0);
+
+    return thrive_test_kind_count;
+}
+
+/* Scalars are replaced by their constant or copy source, both arms of the if agree on a and the store through p keeps the facts */
+u32 thrive_test_propagate(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 x) { u32 a = 5  u32 b = x  u32 c = b + a  if (p[0] > 100) { a = 7 } else { a = 7 }  p[1] = c  ret c * a + b }\n"
+        "u32 q[2]\n"
+        "u32 r = 0\n"
+        "u32 i\n"
+        "u32 n = 3\n"
+        "for (i = 0 : i < n : ++i) { q[0] = i * 60  r += f(q : i) + q[1] }\n"
+        "r\n";
+    u8 ok = thrive_test_levels(src, 147);
+
+    ok = (u8)(ok && optimizer_stats.propagated_constants == 4 && optimizer_stats.propagated_copies == 2);
+
+    printf("--------------------\n");
+    printf("[propagate] %u constants, %u copies, O0 = O2 %s\n", optimizer_stats.propagated_constants, optimizer_stats.propagated_copies, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* The codegen computes in 64-bit registers, folding must not wrap what it would not */
+u32 thrive_test_wrap(void)
+{
+    static s8 *sources[] = {
+        "u32 a = 4000000000\n"
+        "a + a\n",
+        "u32 f(u32 x) { u32 a = 3  ret (a - 5) < 10 }\n"
+        "u32 in[1]\n"
+        "f(in[0])\n",
+        "u32 sq(u32 x) { ret x * x }\n"
+        "sq(100000)\n",
+        "u32 s = 0\n"
+        "u32 i\n"
+        "for (i = 0 : i < 4 : ++i) { s += 4000000000 }\n"
+        "s\n"};
+    static u64 expected[] = {(u64)4000000000u * 2, 1, (u64)100000 * 100000, (u64)4000000000u * 4};
+    u32 passed = 0;
+    u32 i;
+
+    for (i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i)
+    {
+        passed += thrive_test_levels(sources[i], expected[i]) && thrive_test_run(sources[i], THRIVE_OPT_O1) == expected[i] ? 1 : 0;
+    }
+
+    printf("--------------------\n");
+    printf("[wrap] %u of %u programs O0 = O1 = O2 %s\n", passed, i, passed == i ? "ok" : "FAILED");
+
+    return passed == i ? 0 : 1;
+}
+
+/* Functions differing only in their name share one body, everything else is kept */
+u32 thrive_test_icf(void)
+{
+    static s8 *src =
+        "u32 get_a(u32 *p : u32 i) { ret p[i] + 1 }\n"
+        "u32 get_b(u32 *p : u32 i) { ret p[i] + 1 }\n"
+        "u32 get_c(u32 *p : u32 i) { ret p[i] + 2 }\n"
+        "u32 fa(u32 n) { if (n < 2) { ret n } ret fa(n - 1) + 1 }\n"
+        "u32 fb(u32 n) { if (n < 2) { ret n } ret fb(n - 1) + 1 }\n"
+        "u32 arr[4]\n"
+        "get_a(arr : 1) + get_b(arr : 2) + get_c(arr : 3) + fa(3) + fb(4)\n";
+    u32 size = thrive_test_compile(src, 0);
+    u32 folded = optimizer_stats.folded_functions;
+    u32 bytes = optimizer_stats.folded_bytes;
+    u32 size_folded = thrive_test_compile(src, 1);
+    u8 ok = (u8)(optimizer_stats.folded_functions - folded == 2 && size - size_folded == optimizer_stats.folded_bytes - bytes);
+
+    printf("--------------------\n");
+    printf("[icf] %u -> %u bytes, %u functions folded %s\n", size, size_folded, optimizer_stats.folded_functions - folded, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* A zero array of 800 KB goes to .bss and costs no file size, an initialized scalar to .data */
+u32 thrive_test_globals(void)
+{
+    static s8 *src =
+        "u32 big[100000]\n"
+        "u32 g = 7\n"
+        "big[99999] = g\n"
+        "big[99999]\n";
+    static s8 many[260 * 16];
+    u32 sections = 0;
+    u32 length = 0;
+    u32 i;
+    u8 ok;
+
+    /* More globals than the 256 locals a frame holds, every one of them stays in .data */
+    for (i = 0; i < 260; ++i)
+    {
+        length += (u32)sprintf((char *)many + length, "u32 v%u = %u\n", i, i + 1);
+    }
+
+    thrive_test_compile(many, 0);
+    ok = (u8)(global_count == 260);
+
+    thrive_test_compile(src, 0);
+
+    /* Section names are 8 bytes, zero padded */
+    for (i = 0; i + 8 <= 0x200 && i + 8 <= thrive_test_exe_size; ++i)
+    {
+        sections += thrive_string_equals((s8 *)thrive_test_exe + i, ".data\0\0\0", 8) ? 1 : 0;
+        sections += thrive_string_equals((s8 *)thrive_test_exe + i, ".bss\0\0\0\0", 8) ? 1 : 0;
+    }
+
+    ok = (u8)(ok && sections == 2 && thrive_test_exe_size < 4096);
+
+    printf("--------------------\n");
+    printf("[globals] exe %u bytes, %u of 2 data sections %s\n", thrive_test_exe_size, sections, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Equal literals are stored once, a literal ending another one shares its bytes */
+u32 thrive_test_strings(void)
+{
+    static s8 *src =
+        "s8 *a = \"world\"\n"
+        "s8 *b = \"hello world\"\n"
+        "s8 *c = \"world\"\n"
+        "s8 *d = \"tab\\there\"\n"
+        "a + b + c + d\n";
+    u8 ok;
+
+    thrive_test_compile(src, 0);
+
+    /* "hello world\0" and "tab\there\0" */
+    ok = (u8)(string_count == 3 && rdata_string_b.size == 12 + 9);
+
+    printf("--------------------\n");
+    printf("[strings] %u literals in %u bytes of .rdata %s\n", string_count, rdata_string_b.size, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Function entries on 16 bytes and loop heads on 32, the nops are all the code grows by */
+u32 thrive_test_align(void)
+{
+    static s8 *src =
+        "u32 sum(u32 *p : u32 n) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { s += p[i] }  ret s }\n"
+        "u32 twice(u32 x) { ret x + x }\n"
+        "u32 arr[4]\n"
+        "u32 j\n"
+        "for (j = 0 : j < 4 : ++j) { arr[j] = twice(j) }\n"
+        "sum(arr : 4)\n";
+    u32 size = thrive_test_compile(src, 0);
+    u32 padding = optimizer_stats.align_padding;
+    u32 loops = optimizer_stats.aligned_loops;
+    u32 size_aligned;
+    u32 i;
+    u8 ok;
+
+    thrive_x64_codegen_align(16, 32);
+    size_aligned = thrive_test_compile(src, 0);
+    thrive_x64_codegen_align(0, 0);
+
+    ok = (u8)(optimizer_stats.aligned_loops - loops == 2 && size_aligned - size == optimizer_stats.align_padding - padding);
+
+    for (i = 0; i < func_count; ++i)
+    {
+        ok = (u8)(ok && (funcs[i].is_external || funcs[i].rva % 16 == 0));
+    }
+
+    for (i = 0; i < (u32)label_id; ++i)
+    {
+        /* Loop heads are the targets of the backward jumps */
+        u32 j;
+
+        for (j = 0; j < fixup_count; ++j)
+        {
+            if (fixups[j].type == FIXUP_JMP && fixups[j].target_id == (i32)i && label_offsets[i] < fixups[j].buffer_offset)
+            {
+                ok = (u8)(ok && label_offsets[i] % 32 == 0);
+            }
+        }
+    }
+
+    printf("--------------------\n");
+    printf("[align] %u -> %u bytes, %u loops aligned %s\n", size, size_aligned, optimizer_stats.aligned_loops - loops, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Calls between Thrive functions pass six arguments in registers and skip the shadow space, ext calls keep it */
+u32 thrive_test_internal_calls(void)
+{
+    static s8 *src =
+        "ext u32 Sleep(u32 ms)\n"
+        "u32 seven(u32 a : u32 b : u32 c : u32 d : u32 e : u32 f : u32 g) { Sleep(g)  ret a + b + c + d + e + f + g }\n"
+        "seven(1 : 2 : 3 : 4 : 5 : 6 : 7)\n";
+    static u8 add_rsp_16[] = {0x48, 0x81, 0xC4, 0x10, 0x00, 0x00, 0x00}; /* the seventh argument and its padding */
+    static u8 add_rsp_32[] = {0x48, 0x81, 0xC4, 0x20, 0x00, 0x00, 0x00};
+    u32 calls = optimizer_stats.internal_calls;
+    u32 i, j;
+    u8 ok = 1;
+
+    thrive_test_compile(src, 0);
+
+    for (i = 0; i < fixup_count; ++i)
+    {
+        u8 *expected = fixups[i].type == FIXUP_CALL_REL ? add_rsp_16 : add_rsp_32;
+
+        if (fixups[i].type != FIXUP_CALL_REL && fixups[i].type != FIXUP_CALL_IAT)
+        {
+            continue;
+        }
+
+        for (j = 0; j < sizeof(add_rsp_16); ++j)
+        {
+            ok = (u8)(ok && thrive_test_code[fixups[i].instr_end_offset + j] == expected[j]);
+        }
+    }
+
+    ok = (u8)(ok && optimizer_stats.internal_calls - calls == 1);
+
+    printf("--------------------\n");
+    printf("[internal calls] %u in registers without shadow space %s\n", optimizer_stats.internal_calls - calls, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* The stages run one after another on a source that fits both rings emit the serial bytes */
+u32 thrive_test_pipelined(void)
+{
+    static s8 *src =
+        "ext u32 Sleep(u32 ms)\n"
+        "u32 twice(u32 x) { ret x + x }\n"
+        "u32 arr[4]\n"
+        "u32 j\n"
+        "for (j = 0 : j < 4 : ++j) { arr[j] = twice(j) }\n"
+        "if (1) { Sleep(arr[3]) }\n"
+        "Sleep(twice(arr[2]))\n";
+    static thrive_ast pool[256];
+    static u8 serial[4096];
+    static u8 data[4096];
+    static u8 exe_data[8192];
+    static thrive_pipeline p;
+    thrive_ast empty = {0};
+    thrive_buffer code = {0};
+    thrive_buffer exe = {0};
+    u32 size = thrive_test_compile(src, 0);
+    u32 i;
+    u8 ok;
+
+    for (i = 0; i < size; ++i)
+    {
+        serial[i] = thrive_test_code[i];
+    }
+
+    for (i = 0; i < 256; ++i)
+    {
+        pool[i] = empty;
+    }
+
+    code.data = data;
+    code.capacity = sizeof(data);
+    exe.data = exe_data;
+    exe.capacity = sizeof(exe_data);
+
+    thrive_pipeline_init(&p, src, thrive_string_length(src), pool, 256, &code, &exe, 0);
+    thrive_pipeline_lex(&p);
+    thrive_pipeline_parse(&p);
+    thrive_pipeline_codegen(&p);
+
+    ok = (u8)(code.size == size);
+
+    for (i = 0; ok && i < size; ++i)
+    {
+        ok = (u8)(data[i] == serial[i]);
+    }
+
+    printf("--------------------\n");
+    printf("[pipelined] %u bytes, %u serial %s\n", code.size, size, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Uncalled functions, statements behind a ret and stores nobody reads go, a store a ret may skip the overwrite of stays */
+u32 thrive_test_eliminate(void)
+{
+    static s8 *src =
+        "u32 unused(u32 x) { ret x * 2 }\n"
+        "u32 f(u32 x) { u32 d = x * 3  u32 e = 1  if (x > 100) { ret f(x - 1) }  e = x + 1  ret e  x = 9 }\n"
+        "u32 in[1]\n"
+        "u32 *p = in\n"
+        "p[0] = 3\n"
+        "u32 r = 0\n"
+        "u32 i\n"
+        "for (i = 0 : i < p[0] : ++i) { r += f(i) }\n"
+        "r\n";
+    u8 ok = thrive_test_levels(src, 6);
+
+    ok = (u8)(ok && optimizer_stats.eliminated_functions == 1 && optimizer_stats.eliminated_statements == 1 && optimizer_stats.eliminated_stores == 1);
+    ok = (u8)(ok && optimizer_stats.overwritten_stores == 0 && thrive_test_count(THRIVE_AST_FUNC_DECL) == 1);
+
+    printf("--------------------\n");
+    printf("[eliminate] %u functions, %u statements, %u stores, O0 = O2 %s\n", optimizer_stats.eliminated_functions, optimizer_stats.eliminated_statements, optimizer_stats.eliminated_stores, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* The small add and mix with all six register parameters are inlined, the recursive fa keeps its calls */
+u32 thrive_test_inline(void)
+{
+    static s8 *src =
+        "u32 add(u32 a : u32 b) { ret a + b }\n"
+        "u32 mix(u32 a : u32 b : u32 c : u32 d : u32 e : u32 g) { ret a + b * c - d + e * g }\n"
+        "u32 fa(u32 n) { if (n == 0) { ret 0 } ret fa(n - 1) + 1 }\n"
+        "u32 in[1]\n"
+        "u32 *p = in\n"
+        "p[0] = 5\n"
+        "u32 r = add(p[0] : 2)\n"
+        "r + fa(p[0]) + mix(p[0] : 2 : 3 : 4 : r : 7) * 100\n";
+    u8 ok = thrive_test_levels(src, 5612);
+
+    ok = (u8)(ok && optimizer_stats.inlined_calls == 2 && thrive_test_count(THRIVE_AST_INLINE) == 2 && thrive_test_count(THRIVE_AST_FUNC_CALL) == 2);
+
+    printf("--------------------\n");
+    printf("[inline] %u calls inlined, %u kept, O0 = O2 %s\n", optimizer_stats.inlined_calls, thrive_test_count(THRIVE_AST_FUNC_CALL), ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Calls with constant arguments become their result, the function is dropped */
+u32 thrive_test_evaluate(void)
+{
+    static s8 *src =
+        "u32 sum(u32 n) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { s += i * i  if (s > 1000) { s = s - 1000 } }  ret s }\n"
+        "sum(30) + sum(7)\n";
+    u8 ok = thrive_test_levels(src, 646);
+
+    ok = (u8)(ok && optimizer_stats.evaluated_calls == 2 && thrive_test_count(THRIVE_AST_FUNC_CALL) == 0 && thrive_test_count(THRIVE_AST_FUNC_DECL) == 0);
+
+    printf("--------------------\n");
+    printf("[evaluate] %u calls evaluated, O0 = O2 %s\n", optimizer_stats.evaluated_calls, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* A constant trip count unrolls fully, the others run copies per iteration and a break still leaves the whole loop */
+u32 thrive_test_unroll(void)
+{
+    static s8 *src =
+        "u32 sum(u32 *a : u32 n) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { if (a[i] == 27) { break }  s += a[i] }  ret s }\n"
+        "u32 a[20]\n"
+        "u32 t = 0\n"
+        "u32 i\n"
+        "for (i = 0 : i < 20 : ++i) { a[i] = i * 3 }\n"
+        "for (i = 0 : i < 4 : ++i) { t += a[i * 5] }\n"
+        "sum(a : 13) + sum(a : 20) * 1000 + t * 1000000\n";
+    u8 ok = thrive_test_levels(src, 90108108);
+
+    ok = (u8)(ok && optimizer_stats.unrolled_loops == 1 && optimizer_stats.partially_unrolled == 2 && thrive_test_count(THRIVE_AST_FOR) == 2);
+
+    printf("--------------------\n");
+    printf("[unroll] %u loops unrolled, %u partially, O0 = O2 %s\n", optimizer_stats.unrolled_loops, optimizer_stats.partially_unrolled, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* p[k] * (n * w) is computed once before the loop, never for the loop that does not run (p[9] is out of bounds) */
+u32 thrive_test_hoist(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 n : u32 k : u32 w) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { s += p[k] * (n * w) }  ret s }\n"
+        "u32 a[4]\n"
+        "a[2] = 5\n"
+        "f(a : 6 : 2 : 3) + f(a : 0 : 9 : 3)\n";
+    u8 ok = thrive_test_levels(src, 540);
+
+    ok = (u8)(ok && optimizer_stats.hoisted_expressions == 1);
+
+    printf("--------------------\n");
+    printf("[hoist] %u expressions hoisted, O0 = O2 %s\n", optimizer_stats.hoisted_expressions, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+static u32 thrive_test_temp_decls;
+static u32 thrive_test_temp_stores;
+
+/* Temps declared without a value and the stores to temps */
+void thrive_test_temp_visit(thrive_ast *node, void *user)
+{
+    (void)user;
+    thrive_test_temp_decls += node->kind == THRIVE_AST_DECL && !node->data.decl.value && node->data.decl.name->data.name.start[0] == '$' ? 1 : 0;
+    thrive_test_temp_stores += node->kind == THRIVE_AST_ASSIGN && node->data.assign.left->kind == THRIVE_AST_NAME && node->data.assign.left->data.name.start[0] == '$' ? 1 : 0;
+}
+
+/* p[0] and a * b are evaluated once each, the p[0] behind the call to poke is loaded again. ga0[l0 & 7] += 0
+ * folds to an assignment whose both sides are one node, its index must get one rewrite and not a load of a
+ * temp that is never stored */
+u32 thrive_test_reuse(void)
+{
+    static s8 *src =
+        "u32 poke(u32 *q : u32 v) { if (v > 1000) { ret poke(q : v - 1) }  q[0] = v  ret 0 }\n"
+        "u32 f(u32 *p : u32 a : u32 b) { u32 s = 0  u32 t = 0  if (p[0] == 10 && p[0] > 0) { s += a * b  t = a * b }  u32 x = p[0] + poke(p : 3) + p[0]  ret s + t + x * 1000 }\n"
+        "u32 m[1]\n"
+        "m[0] = 10\n"
+        "f(m : 6 : 7)\n";
+    static s8 *shared =
+        "u32 ga0[8]\n"
+        "u32 f2(u32 a0 : u32 a1) { u32 l0 = ga0[a1 & 7]  ga0[l0 & 7] += 0  ret ga0[l0 & 7] + a0 }\n"
+        "u32 in[4]\n"
+        "u32 *p = in\n"
+        "in[2] = 5\n"
+        "ga0[0] = 9\n"
+        "ga0[1] = 4\n"
+        "f2(p[2] : p[3])\n";
+    u8 ok = thrive_test_levels(src, 13084);
+    u32 reused = optimizer_stats.common_subexpressions;
+
+    ok = (u8)(ok && reused == 2 && thrive_test_levels(shared, 9));
+
+    /* The walk meets the shared node twice */
+    thrive_test_temp_decls = 0;
+    thrive_test_temp_stores = 0;
+    thrive_ast_walk(thrive_test_run_ast, thrive_test_temp_visit, 0);
+
+    ok = (u8)(ok && thrive_test_temp_decls == 1 && thrive_test_temp_stores >= 1);
+
+    printf("--------------------\n");
+    printf("[reuse] %u subexpressions reused, O0 = O2 %s\n", reused, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Both loops index through pointers, the one whose counter is not read afterwards counts down. n = 0 runs no iteration */
+u32 thrive_test_reduce(void)
+{
+    static s8 *src =
+        "u32 sum(u32 *a : u32 n) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { s += a[i] }  ret s }\n"
+        "u32 scale(u32 *a : u32 *b : u32 n) { u32 i  for (i = 0 : i < n : ++i) { b[i] = a[i] * i }  ret i }\n"
+        "u32 a[16]\n"
+        "u32 b[16]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 16 : ++i) { a[i] = i + 1 }\n"
+        "sum(a : 16) + sum(a : 0) * 7 + scale(a : b : 11) * 1000 + sum(b : 11) * 100000\n";
+    u8 ok = thrive_test_levels(src, 44011136);
+
+    ok = (u8)(ok && optimizer_stats.reduced_loops == 2 && optimizer_stats.counted_down_loops == 1);
+
+    printf("--------------------\n");
+    printf("[reduce] %u loops through pointers, %u counting down, O0 = O2 %s\n", optimizer_stats.reduced_loops, optimizer_stats.counted_down_loops, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* k = 3 goes into mix, the two mode 1 calls share a clone. The recursive fa is never specialized (it crashed at O2) */
+u32 thrive_test_specialize(void)
+{
+    static s8 *recursive =
+        "u32 fa(u32 n) { if (n == 0) { ret 0 } ret fa(n - 1) + 1 }\n"
+        "fa(5)\n";
+    static s8 *src =
+        "u32 fa(u32 n) { if (n == 0) { ret 0 } ret fa(n - 1) + 1 }\n"
+        "u32 mix(u32 *p : u32 n : u32 mode : u32 k) { u32 s = 0  u32 i  for (i = 0 : i < n : ++i) { if (mode == 1) { s += p[i] * k } else { s = s ^ (p[i] + k) } }  ret s }\n"
+        "u32 a[8]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 8 : ++i) { a[i] = i * 5 + 1 }\n"
+        "fa(a[1]) + mix(a : 8 : 1 : 3) + mix(a : 5 : 1 : 3) * 1000 + mix(a : 8 : 2 : 3) * 1000000\n";
+    u8 ok = thrive_test_levels(recursive, 5);
+
+    ok = (u8)(ok && thrive_test_levels(src, 16165450));
+    ok = (u8)(ok && optimizer_stats.specialized_params == 1 && optimizer_stats.specialized_clones == 1 && thrive_test_count(THRIVE_AST_FUNC_DECL) == 3);
+
+    printf("--------------------\n");
+    printf("[specialize] %u parameters, %u clones, O0 = O2 %s\n", optimizer_stats.specialized_params, optimizer_stats.specialized_clones, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+static u32 thrive_test_array_count;
+
+void thrive_test_array_visit(thrive_ast *node, void *user)
+{
+    (void)user;
+    thrive_test_array_count += node->kind == THRIVE_AST_DECL && node->data.decl.is_array ? 1 : 0;
+}
+
+/* t only has constant indices once the loop is unrolled, so it becomes four scalars the propagation follows */
+u32 thrive_test_promote(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 x) { u32 t[4]  u32 i  for (i = 0 : i < 4 : ++i) { t[i] = p[i] * x }  ret t[0] + t[3] * 100 + t[1] * t[2] }\n"
+        "u32 a[4]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 4 : ++i) { a[i] = i + 2 }\n"
+        "f(a : a[0]) + f(a : a[3]) * 100000\n";
+    u8 ok = thrive_test_levels(src, 281001052);
+
+    thrive_test_array_count = 0;
+    thrive_ast_walk(thrive_test_run_ast, thrive_test_array_visit, 0);
+
+    ok = (u8)(ok && optimizer_stats.promoted_arrays == 1 && thrive_test_array_count == 1 && optimizer_stats.eliminated_stores == 4);
+
+    printf("--------------------\n");
+    printf("[promote] %u arrays promoted, %u dead element stores, O0 = O2 %s\n", optimizer_stats.promoted_arrays, optimizer_stats.eliminated_stores, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Branches that only pick a value for a variable become selects, the ternary of constants too */
+u32 thrive_test_select(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 n) { u32 s = 0  u32 m = 0  u32 i  u32 x  for (i = 0 : i < n : ++i) { if (p[i] > 20) { x = p[i] - 20 } else { x = 20 - p[i] }  if (p[i] > m) { m = p[i] }  s += x + (p[i] & 1 ? 3 : 5) }  ret s + m * 1000 }\n"
+        "u32 a[10]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 10 : ++i) { a[i] = (i * 17) % 41 }\n"
+        "f(a : 10)\n";
+    u8 ok = thrive_test_levels(src, 37145);
+
+    ok = (u8)(ok && optimizer_stats.if_conversions == 2 && thrive_test_count(THRIVE_AST_TERNARY) == 2);
+
+    printf("--------------------\n");
+    printf("[select] %u branches converted, O0 = O2 %s\n", optimizer_stats.if_conversions, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* Every jump back into a loop is its conditional exit test. continue, break and a loop that never runs keep their meaning */
+u32 thrive_test_rotate(void)
+{
+    static s8 *src =
+        "u32 in[1]\n"
+        "u32 *p = in\n"
+        "p[0] = 9\n"
+        "u32 s = 0\n"
+        "u32 i\n"
+        "for (i = 0 : i < p[0] : ++i) { if (i == 2) { continue }  if (i == 7) { break }  s += i }\n"
+        "for (i = p[0] : i < 3 : ++i) { s += 1000 }\n"
+        "s + i * 100\n";
+    u32 backward = 0;
+    u32 i;
+    u8 ok = thrive_test_levels(src, 919);
+
+    for (i = 0; i < fixup_count; ++i)
+    {
+        u32 at = fixups[i].buffer_offset;
+
+        if (fixups[i].type == FIXUP_JMP && label_offsets[fixups[i].target_id] <= at)
+        {
+            /* jcc rel32 is 0F 8x, jmp rel32 is E9 */
+            ok = (u8)(ok && thrive_test_run_code[at - 2] == 0x0F && (thrive_test_run_code[at - 1] & 0xF0) == 0x80);
+            backward++;
+        }
+    }
+
+    ok = (u8)(ok && backward >= 2);
+
+    printf("--------------------\n");
+    printf("[rotate] %u backward jumps, all conditional, O0 = O2 %s\n", backward, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* With i in [0, 9] the mask, the remainder and the bounds check go */
+u32 thrive_test_range(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 n) { u32 s = 0  u32 i  for (i = 0 : i < 10 : ++i) { s += (i & 255) + i % 16  if (i < 20) { s += p[i] } }  u32 k = 7  if (k > n + 100) { s += 1 }  ret s }\n"
+        "u32 a[10]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 10 : ++i) { a[i] = i * i }\n"
+        "f(a : 3)\n";
+    u8 ok = thrive_test_levels(src, 375);
+
+    ok = (u8)(ok && optimizer_stats.range_folds == 3);
+
+    printf("--------------------\n");
+    printf("[range] %u operations decided by ranges, O0 = O2 %s\n", optimizer_stats.range_folds, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* y = x * 3 is overwritten, and so is z = y once z = z + 1 reads y instead. The stored values feed the next statement without a reload */
+u32 thrive_test_dead_stores(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 x) { u32 y = x * 3  y = x + p[0]  u32 z = y  z = z + 1  p[1] = z  ret y + z }\n"
+        "u32 a[2]\n"
+        "a[0] = 4\n"
+        "f(a : 5) + a[1] * 100\n";
+    u8 ok = thrive_test_levels(src, 1019);
+
+    ok = (u8)(ok && optimizer_stats.overwritten_stores == 2 && optimizer_stats.forwarded_loads == 2);
+
+    printf("--------------------\n");
+    printf("[dead stores] %u overwritten stores, %u forwarded loads, O0 = O2 %s\n", optimizer_stats.overwritten_stores, optimizer_stats.forwarded_loads, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
+/* The sum, the xor and the min each get their own accumulators. n = 5 leaves the rest to the plain loop */
+u32 thrive_test_accumulate(void)
+{
+    static s8 *src =
+        "u32 f(u32 *p : u32 n) { u32 s = 0  u32 x = 0  u32 lo = 100000  u32 i  for (i = 0 : i < n : ++i) { s = s + p[i]  x = x ^ p[i]  lo = p[i] < lo ? p[i] : lo }  ret s + x * 1000 + lo * 1000000 }\n"
+        "u32 a[37]\n"
+        "u32 i\n"
+        "for (i = 0 : i < 37 : ++i) { a[i] = (i * 29) % 37 + 3 }\n"
+        "f(a : 37) + f(a : 5) * 7\n";
+    u8 ok = thrive_test_levels(src, 24249358);
+
+    ok = (u8)(ok && optimizer_stats.split_reductions == 3);
+
+    printf("--------------------\n");
+    printf("[accumulate] %u reductions split, O0 = O2 %s\n", optimizer_stats.split_reductions, ok ? "ok" : "FAILED");
+
+    return ok ? 0 : 1;
+}
+
 int main(void)
 {
     s8 *source_code =
@@ -104,6 +1014,12 @@ int main(void)
     state.ast_pool = malloc(sizeof(thrive_ast) * 1024);
     state.ast_capacity = 1024;
 
+    if (!thrive_exec_init())
+    {
+        printf("[error] no executable memory\n");
+        return 1;
+    }
+
     printf("--------------------\n");
     printf("%s", source_code);
     printf("--------------------\n");
@@ -130,6 +1046,7 @@ int main(void)
     printf("--------------------\n");
     {
         thrive_state s = {0};
+        thrive_pass_options options = thrive_pass_defaults(THRIVE_OPT_O2);
 
         thrive_ast *ast;
 
@@ -148,7 +1065,7 @@ int main(void)
         thrive_ast_print(ast, 0);
         */
 
-        ast = thrive_ast_fold(ast);
+        ast = thrive_ast_optimize(&s, ast, &options);
 
         printf("=== AFTER ===\n");
         thrive_ast_print(ast, 0);
@@ -166,6 +1083,7 @@ int main(void)
             exe_buffer.data = pe_data;
             exe_buffer.capacity = 16384;
 
+            thrive_x64_codegen_peephole(options.level >= THRIVE_OPT_O2);
             thrive_x64_codegen_program(&code_buffer, ast, &exe_buffer);
 
             /* Output Executable */
@@ -187,5 +1105,5 @@ int main(void)
         printf("---------------------------------------------\n");
     }
 
-    return 0;
+    return (thrive_test_rewrite_rules() + thrive_test_peephole() + thrive_test_icf() + thrive_test_globals() + thrive_test_strings() + thrive_test_align() + thrive_test_internal_calls() + thrive_test_pipelined() + thrive_test_propagate() + thrive_test_wrap() + thrive_test_eliminate() + thrive_test_inline() + thrive_test_evaluate() + thrive_test_unroll() + thrive_test_hoist() + thrive_test_reuse() + thrive_test_reduce() + thrive_test_specialize() + thrive_test_promote() + thrive_test_select() + thrive_test_rotate() + thrive_test_range() + thrive_test_dead_stores() + thrive_test_accumulate()) ? 1 : 0;
 }
@@ -87,6 +87,9 @@ void *memcpy(void *dest, void *src, u32 count)
 #define PAGE_READONLY 0x02
 #define FILE_MAP_READ 0x0004
 
+/* Threading */
+#define INFINITE 0xFFFFFFFF
+
 /* File IO */
 typedef struct FILETIME
 {
@@ -142,6 +145,11 @@ WIN32_API(i32)    WriteFile(void *hFile, void *lpBuffer, u32 nNumberOfBytesToWri
 WIN32_API(void *) CreateFileMappingA(void *hFile, void *lpFileMappingAttributes, u32 flProtect, u32 dwMaximumSizeHigh, u32 dwMaximumSizeLow, s8 *lpName);
 WIN32_API(void *) MapViewOfFile(void *hFileMappingObject, u32 dwDesiredAccess, u32 dwFileOffsetHigh, u32 dwFileOffsetLow, u32 dwNumberOfBytesToMap);
 
+/* Threading */
+WIN32_API(void *) CreateThread(void *lpThreadAttributes, u32 dwStackSize, u32 (__stdcall *lpStartAddress)(void *), void *lpParameter, u32 dwCreationFlags, u32 *lpThreadId);
+WIN32_API(u32)    WaitForSingleObject(void *hHandle, u32 dwMilliseconds);
+WIN32_API(i32)    SwitchToThread(void);
+
 /* Performance Metrics */
 WIN32_API(i32)    QueryPerformanceCounter(LARGE_INTEGER *lpPerformanceCount);
 WIN32_API(i32)    QueryPerformanceFrequency(LARGE_INTEGER *lpFrequency);
@@ -534,6 +542,56 @@ THRIVE_API void thrive_win32_print_u32(void *h_stdout, u32 val, u32 padding)
     WriteConsoleA(h_stdout, &buffer[i + 1], len, &written, 0);
 }
 
+THRIVE_API void win32_io_print_count(void *hConsole, s8 *name, u32 count)
+{
+    SetConsoleTextAttribute(hConsole, 9); /* blue */
+    thrive_win32_print(hConsole, "[thrive]");
+    SetConsoleTextAttribute(hConsole, 7); /* default */
+    thrive_win32_print(hConsole, " ");
+    thrive_win32_print(hConsole, name);
+    thrive_win32_print(hConsole, ": ");
+    thrive_win32_print_u32(hConsole, count, 0);
+    thrive_win32_print(hConsole, "\n");
+}
+
+/* Lists a function or ext declaration dropped by dead code elimination */
+THRIVE_API void win32_io_print_eliminated(void *hConsole, thrive_ast *decl)
+{
+    thrive_ast *name = decl->kind == THRIVE_AST_FUNC_DECL ? decl->data.func_decl.name : decl->data.ext_decl.name;
+    u32 written = 0;
+
+    SetConsoleTextAttribute(hConsole, 9); /* blue */
+    thrive_win32_print(hConsole, "[thrive]");
+    SetConsoleTextAttribute(hConsole, 7); /* default */
+    thrive_win32_print(hConsole, decl->kind == THRIVE_AST_FUNC_DECL ? "   removed function " : "   removed import   ");
+    WriteConsoleA(hConsole, name->data.name.start, name->data.name.length, &written, 0);
+    thrive_win32_print(hConsole, "\n");
+}
+
+/* Lists a variable range inferred by the value range analysis as "scope.name [lo, hi]" */
+THRIVE_API void win32_io_print_range(void *hConsole, thrive_range_var *v)
+{
+    u32 written = 0;
+
+    SetConsoleTextAttribute(hConsole, 9); /* blue */
+    thrive_win32_print(hConsole, "[thrive]");
+    SetConsoleTextAttribute(hConsole, 7); /* default */
+    thrive_win32_print(hConsole, "   range ");
+
+    if (v->scope)
+    {
+        WriteConsoleA(hConsole, v->scope->data.name.start, v->scope->data.name.length, &written, 0);
+        thrive_win32_print(hConsole, ".");
+    }
+
+    WriteConsoleA(hConsole, v->name->data.name.start, v->name->data.name.length, &written, 0);
+    thrive_win32_print(hConsole, v->range.lo < 0 ? " [-" : " [");
+    thrive_win32_print_u32(hConsole, (u32)(v->range.lo < 0 ? -v->range.lo : v->range.lo), 0);
+    thrive_win32_print(hConsole, v->range.hi < 0 ? ", -" : ", ");
+    thrive_win32_print_u32(hConsole, (u32)(v->range.hi < 0 ? -v->range.hi : v->range.hi), 0);
+    thrive_win32_print(hConsole, "]\n");
+}
+
 /* ############################################################################
  * # Performance Metrics
  * ############################################################################
@@ -542,8 +600,9 @@ typedef enum win32_thrive_metrics
 {
     METRIC_IO_FILE_READ = 0,
     METRIC_PARSING,
-    METRIC_FOLDING,
+    METRIC_OPTIMIZING,
     METRIC_CODEGEN,
+    METRIC_PIPELINE,
     METRIC_IO_FILE_WRITE,
     METRIC_COUNT
 
@@ -553,8 +612,9 @@ typedef enum win32_thrive_metrics
 static s8 *win32_thrive_metric_names[] = {
     "time_io_file_read ",
     "time_parsing      ",
-    "time_folding      ",
+    "time_optimizing   ",
     "time_codegen      ",
+    "time_pipeline     ",
     "time_io_file_write"};
 
 typedef struct win32_thrive_metric
@@ -633,14 +693,74 @@ THRIVE_API void thrive_panic(thrive_status status)
     }
 }
 
-THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq)
+/* ############################################################################
+ * # Pipelined Compilation Threads
+ * ############################################################################
+ */
+static thrive_pipeline win32_thrive_pipeline;
+
+THRIVE_API void win32_thrive_yield(void)
+{
+    SwitchToThread();
+}
+
+THRIVE_API u32 __stdcall win32_thrive_lexer_thread(void *param)
+{
+    thrive_pipeline_lex((thrive_pipeline *)param);
+    return 0;
+}
+
+THRIVE_API u32 __stdcall win32_thrive_codegen_thread(void *param)
+{
+    thrive_pipeline_codegen((thrive_pipeline *)param);
+    return 0;
+}
+
+/* Times every pass of thrive_ast_optimize, user is the metric per entry of thrive_passes */
+THRIVE_API void win32_thrive_pass_timer(void *user, u32 index, u8 done)
+{
+    win32_thrive_metric *metric = (win32_thrive_metric *)user + index;
+
+    QueryPerformanceCounter(done ? &metric->time_end : &metric->time_start);
+}
+
+/* count * size + extra bytes of zeroed memory, a size past 4 GB or a failed allocation panics */
+THRIVE_API void *win32_thrive_alloc(u32 count, u32 size, u32 extra)
+{
+    thrive_status status = {0};
+    void *memory;
+
+    status.type = THRIVE_STATUS_ERROR_MEMORY;
+    status.message = "Input too large";
+
+    if (count > (0xFFFFFFFF - extra) / size)
+    {
+        thrive_panic(status);
+    }
+
+    memory = VirtualAlloc((void *)0, count * size + extra, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+    if (!memory)
+    {
+        status.message = "Out of memory";
+        thrive_panic(status);
+    }
+
+    return memory;
+}
+
+THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq, u8 pipelined, thrive_pass_options *options, u8 dump_ranges)
 {
     u32 written = 0;
     win32_thrive_metric metrics[METRIC_COUNT] = {0};
+    win32_thrive_metric pass_metrics[THRIVE_PASS_COUNT] = {0};
 
     u32 source_code_size = 0;
     s8 *source_code;
 
+    u32 size_text = 0;
+    u32 size_image = 0;
+
     /* Read entire file */
     QueryPerformanceCounter(&metrics[METRIC_IO_FILE_READ].time_start);
     source_code = win32_io_file_read(file_name, &source_code_size);
@@ -664,33 +784,66 @@ THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq
         s.source_code = source_code;
         s.source_code_size = source_code_size;
         s.line_start = s.source_code;
-        s.ast_pool = VirtualAlloc((void *)0, sizeof(thrive_ast) * 1024, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-        s.ast_capacity = 1024;
-
-        QueryPerformanceCounter(&metrics[METRIC_PARSING].time_start);
-        ast = thrive_ast_parse(&s);
-        QueryPerformanceCounter(&metrics[METRIC_PARSING].time_end);
-
-        QueryPerformanceCounter(&metrics[METRIC_FOLDING].time_start);
-        ast = thrive_ast_fold(ast);
-        QueryPerformanceCounter(&metrics[METRIC_FOLDING].time_end);
+        /* Pools and buffers scale with the input so large sources fit */
+        s.ast_capacity = 1024 + source_code_size / 2;
+        s.ast_pool = win32_thrive_alloc(s.ast_capacity, (u32)sizeof(thrive_ast), 0);
 
         {
-            u8 x64_data[8192];
             thrive_buffer code_buffer = {0};
-
-            u8 pe_data[16384];
             thrive_buffer exe_buffer = {0};
+            u32 *labels;
+            thrive_fixup *fixup_entries;
 
-            code_buffer.data = x64_data;
-            code_buffer.capacity = 8192;
+            code_buffer.data = win32_thrive_alloc(source_code_size, 4, 8192);
+            code_buffer.capacity = 8192 + source_code_size * 4;
 
-            exe_buffer.data = pe_data;
-            exe_buffer.capacity = 16384;
+            exe_buffer.data = win32_thrive_alloc(code_buffer.capacity, 1, 0x10000);
+            exe_buffer.capacity = code_buffer.capacity + 0x10000;
 
-            QueryPerformanceCounter(&metrics[METRIC_CODEGEN].time_start);
-            thrive_x64_codegen_program(&code_buffer, ast, &exe_buffer);
-            QueryPerformanceCounter(&metrics[METRIC_CODEGEN].time_end);
+            /* About one jump target and one call, string or global access per AST node. Unrolled copies and
+             * rotated loop conditions can take more, the codegen panics instead of writing past the tables */
+            labels = win32_thrive_alloc(s.ast_capacity, (u32)sizeof(u32), 0);
+            fixup_entries = win32_thrive_alloc(s.ast_capacity, (u32)sizeof(thrive_fixup), 0);
+            thrive_x64_codegen_tables(labels, s.ast_capacity, fixup_entries, s.ast_capacity);
+
+            if (pipelined)
+            {
+                /* Lexer and codegen run on their own threads, parsing on this one */
+                thrive_pipeline *p = &win32_thrive_pipeline;
+                void *threads[2];
+
+                thrive_pipeline_init(p, s.source_code, s.source_code_size, s.ast_pool, s.ast_capacity, &code_buffer, &exe_buffer, win32_thrive_yield);
+
+                QueryPerformanceCounter(&metrics[METRIC_PIPELINE].time_start);
+                threads[0] = CreateThread(0, 0, win32_thrive_lexer_thread, p, 0, 0);
+                threads[1] = CreateThread(0, 0, win32_thrive_codegen_thread, p, 0, 0);
+
+                thrive_pipeline_parse(p);
+
+                WaitForSingleObject(threads[0], INFINITE);
+                WaitForSingleObject(threads[1], INFINITE);
+                QueryPerformanceCounter(&metrics[METRIC_PIPELINE].time_end);
+
+                CloseHandle(threads[0]);
+                CloseHandle(threads[1]);
+            }
+            else
+            {
+                QueryPerformanceCounter(&metrics[METRIC_PARSING].time_start);
+                ast = thrive_ast_parse(&s);
+                QueryPerformanceCounter(&metrics[METRIC_PARSING].time_end);
+
+                QueryPerformanceCounter(&metrics[METRIC_OPTIMIZING].time_start);
+                thrive_optimizer_stats_reset();
+                options->hook = win32_thrive_pass_timer;
+                options->hook_user = pass_metrics;
+                ast = thrive_ast_optimize(&s, ast, options);
+                QueryPerformanceCounter(&metrics[METRIC_OPTIMIZING].time_end);
+
+                QueryPerformanceCounter(&metrics[METRIC_CODEGEN].time_start);
+                thrive_x64_codegen_program(&code_buffer, ast, &exe_buffer);
+                QueryPerformanceCounter(&metrics[METRIC_CODEGEN].time_end);
+            }
 
             QueryPerformanceCounter(&metrics[METRIC_IO_FILE_WRITE].time_start);
             if (!win32_io_file_write("out.exe", exe_buffer.data, exe_buffer.size))
@@ -698,6 +851,15 @@ THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq
                 return 1;
             }
             QueryPerformanceCounter(&metrics[METRIC_IO_FILE_WRITE].time_end);
+
+            size_text = code_buffer.size;
+            size_image = exe_buffer.size;
+
+            thrive_x64_codegen_tables(0, 0, 0, 0);
+            VirtualFree(labels, 0, MEM_RELEASE);
+            VirtualFree(fixup_entries, 0, MEM_RELEASE);
+            VirtualFree(code_buffer.data, 0, MEM_RELEASE);
+            VirtualFree(exe_buffer.data, 0, MEM_RELEASE);
         }
 
         VirtualFree(s.ast_pool, 0, MEM_RELEASE);
@@ -706,6 +868,7 @@ THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq
     /* Gather metrics */
     {
         u32 i;
+        u32 j;
         f64 metric_times[METRIC_COUNT];
         f64 metric_times_total = 0.0;
 
@@ -717,20 +880,127 @@ THRIVE_API i32 thrive_compile(s8 *file_name, void *hConsole, LARGE_INTEGER *freq
             metric_times_total += elapsed_ms;
         }
 
-        /* Metric time */
+        /* Metric time (stages not run in this mode are skipped) */
         for (i = 0; i < METRIC_COUNT; ++i)
         {
             s8 *metric_name = win32_thrive_metric_names[i];
+
+            if (!metrics[i].time_start.LowPart && !metrics[i].time_start.HighPart)
+            {
+                continue;
+            }
+
             win32_io_print_ms(hConsole, metric_name, thrive_string_length(metric_name), metric_times[i], metric_times_total);
+
+            /* Passes of the optimizer level below its total, not counted again */
+            for (j = 0; i == METRIC_OPTIMIZING && j < THRIVE_PASS_COUNT; ++j)
+            {
+                s8 pass_name[18];
+                s8 *name = thrive_passes[j].name;
+                u32 k;
+
+                if (!pass_metrics[j].time_start.LowPart && !pass_metrics[j].time_start.HighPart)
+                {
+                    continue;
+                }
+
+                /* "  <name>" padded like the metric names */
+                for (k = 0; k < sizeof(pass_name); ++k)
+                {
+                    pass_name[k] = (k >= 2 && *name) ? *name++ : ' ';
+                }
+
+                win32_io_print_ms(hConsole, pass_name, sizeof(pass_name), win32_elapsed_ms(&pass_metrics[j].time_start, &pass_metrics[j].time_end, freq), metric_times_total);
+            }
         }
 
         /* Total time */
         win32_io_print_ms(hConsole, "time_total        ", 18, metric_times_total, metric_times_total);
     }
 
+    /* Optimizer report (the pipelined mode only folds, it never sees the whole program) */
+    if (!pipelined)
+    {
+        u32 i;
+
+        win32_io_print_count(hConsole, "opt_rewrites      ", optimizer_stats.rewrites);
+        win32_io_print_count(hConsole, "opt_const_loads   ", optimizer_stats.propagated_constants);
+        win32_io_print_count(hConsole, "opt_copy_loads    ", optimizer_stats.propagated_copies);
+        win32_io_print_count(hConsole, "opt_strength_red  ", optimizer_stats.strength_reductions);
+        win32_io_print_count(hConsole, "opt_shared        ", optimizer_stats.shared_globals);
+        win32_io_print_count(hConsole, "opt_inlined_calls ", optimizer_stats.inlined_calls);
+        win32_io_print_count(hConsole, "opt_const_params  ", optimizer_stats.specialized_params);
+        win32_io_print_count(hConsole, "opt_clones        ", optimizer_stats.specialized_clones);
+        win32_io_print_count(hConsole, "opt_evaluated     ", optimizer_stats.evaluated_calls);
+        win32_io_print_count(hConsole, "opt_unrolled      ", optimizer_stats.unrolled_loops);
+        win32_io_print_count(hConsole, "opt_unrolled_part ", optimizer_stats.partially_unrolled);
+        win32_io_print_count(hConsole, "opt_promoted      ", optimizer_stats.promoted_arrays);
+        win32_io_print_count(hConsole, "opt_ranges        ", optimizer_stats.range_folds);
+        win32_io_print_count(hConsole, "opt_hoisted       ", optimizer_stats.hoisted_expressions);
+        win32_io_print_count(hConsole, "opt_if_converted  ", optimizer_stats.if_conversions);
+        win32_io_print_count(hConsole, "opt_cse           ", optimizer_stats.common_subexpressions);
+        win32_io_print_count(hConsole, "opt_accumulators  ", optimizer_stats.split_reductions);
+        win32_io_print_count(hConsole, "opt_reduced       ", optimizer_stats.reduced_loops);
+        win32_io_print_count(hConsole, "opt_countdown     ", optimizer_stats.counted_down_loops);
+        win32_io_print_count(hConsole, "dce_statements    ", optimizer_stats.eliminated_statements);
+        win32_io_print_count(hConsole, "dce_stores        ", optimizer_stats.eliminated_stores);
+        win32_io_print_count(hConsole, "dce_overwritten   ", optimizer_stats.overwritten_stores);
+        win32_io_print_count(hConsole, "cg_forwarded_loads", optimizer_stats.forwarded_loads);
+        win32_io_print_count(hConsole, "cg_peephole       ", optimizer_stats.peephole_rewrites);
+        win32_io_print_count(hConsole, "cg_folded_funcs   ", optimizer_stats.folded_functions);
+        win32_io_print_count(hConsole, "cg_folded_bytes   ", optimizer_stats.folded_bytes);
+        win32_io_print_count(hConsole, "cg_aligned_funcs  ", optimizer_stats.aligned_functions);
+        win32_io_print_count(hConsole, "cg_aligned_loops  ", optimizer_stats.aligned_loops);
+        win32_io_print_count(hConsole, "cg_align_padding  ", optimizer_stats.align_padding);
+        win32_io_print_count(hConsole, "cg_internal_calls ", optimizer_stats.internal_calls);
+        win32_io_print_count(hConsole, "dce_functions     ", optimizer_stats.eliminated_functions);
+        win32_io_print_count(hConsole, "dce_imports       ", optimizer_stats.eliminated_imports);
+
+        for (i = 0; i < eliminated_decl_count; ++i)
+        {
+            win32_io_print_eliminated(hConsole, eliminated_decls[i]);
+        }
+
+        for (i = 0; dump_ranges && i < range_report_count; ++i)
+        {
+            win32_io_print_range(hConsole, &range_reports[i]);
+        }
+    }
+
+    /* Size report */
+    win32_io_print_count(hConsole, "size_text         ", size_text);
+    win32_io_print_count(hConsole, "size_image        ", size_image);
+
     return 0;
 }
 
+/* Decimal value of an option like --inline=<n>, 0 when digits is empty, has anything else in it or overflows */
+THRIVE_API u8 thrive_parse_u32(s8 *digits, u32 *value)
+{
+    u32 result = 0;
+
+    if (!*digits)
+    {
+        return 0;
+    }
+
+    for (; *digits; ++digits)
+    {
+        u32 digit = (u32)(*digits - '0');
+
+        if (*digits < '0' || *digits > '9' || result > (0xFFFFFFFF - digit) / 10)
+        {
+            return 0;
+        }
+
+        result = result * 10 + digit;
+    }
+
+    *value = result;
+
+    return 1;
+}
+
 /* ############################################################################
  * # C-Like main function
  * ############################################################################
@@ -747,9 +1017,16 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
     LARGE_INTEGER freq;
 
     u8 conf_enable_hot_reload = 0;
-    u8 conf_enable_optimized = 0;
+    thrive_opt_level conf_level = THRIVE_OPT_O1;
+    u8 conf_enable_pipelined = 0;
+    u32 conf_inline_budget = THRIVE_INLINE_BUDGET;
+    u32 conf_clone_budget = THRIVE_SPECIALIZE_BUDGET;
+    u32 conf_unroll_budget = THRIVE_UNROLL_BUDGET;
+    u32 conf_select_budget = THRIVE_SELECT_BUDGET;
+    u32 conf_align = 0;
+    u8 conf_dump_ranges = 0;
+    thrive_pass_options options;
 
-    (void)conf_enable_optimized;
     (void)win32_io_file_write;
 
     /* Pri32 usage */
@@ -760,7 +1037,15 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
         WriteConsoleA(hConsole, " code.thrive <options>\n", 23, &written, 0);
         WriteConsoleA(hConsole, "[thrive] options:\n", 18, &written, 0);
         WriteConsoleA(hConsole, "[thrive]   --hot-reload  ; Enable hot reloading of source file\n", 63, &written, 0);
-        WriteConsoleA(hConsole, "[thrive]   --optimized   ; Enable optimizations\n", 48, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --optimized   ; Enable all optimizations, same as -O2\n", 65, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   -O<n>         ; Optimization level: 0 none (fastest compile), 1 cheap passes (default), 2 all\n", 105, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --pipelined   ; Overlap lexing, parsing and codegen on threads\n", 74, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --inline=<n>  ; Inline functions of up to n AST nodes (0 disables)\n", 78, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --clone=<n>   ; Clone functions for constant arguments, up to n AST nodes in total (0 disables)\n", 107, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --unroll=<n>  ; Unroll loops into up to n AST nodes (0 disables)\n", 76, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --select=<n>  ; Use cmov for branches of up to n AST nodes (0 disables)\n", 83, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --ranges      ; List the value ranges inferred per variable\n", 71, &written, 0);
+        WriteConsoleA(hConsole, "[thrive]   --align=<n>   ; Pad loop heads to n bytes (a power of two up to 64) and functions to 16 with nops\n", 109, &written, 0);
         return 1;
     }
 
@@ -771,18 +1056,58 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
 
         for (i = 2; i < argc; ++i)
         {
+            u8 valid = 1;
+
             if (thrive_string_equals(argv[i], "--hot-reload", 12))
             {
                 conf_enable_hot_reload = 1;
             }
             else if (thrive_string_equals(argv[i], "--optimized", 11))
             {
-                conf_enable_optimized = 1;
+                conf_level = THRIVE_OPT_O2;
+            }
+            else if (thrive_string_equals(argv[i], "-O", 2) && argv[i][2] >= '0' && argv[i][2] <= '2' && !argv[i][3])
+            {
+                conf_level = (thrive_opt_level)(argv[i][2] - '0');
+            }
+            else if (thrive_string_equals(argv[i], "--pipelined", 11))
+            {
+                conf_enable_pipelined = 1;
+            }
+            else if (thrive_string_equals(argv[i], "--inline=", 9))
+            {
+                valid = thrive_parse_u32(argv[i] + 9, &conf_inline_budget);
+            }
+            else if (thrive_string_equals(argv[i], "--clone=", 8))
+            {
+                valid = thrive_parse_u32(argv[i] + 8, &conf_clone_budget);
+            }
+            else if (thrive_string_equals(argv[i], "--unroll=", 9))
+            {
+                valid = thrive_parse_u32(argv[i] + 9, &conf_unroll_budget);
+            }
+            else if (thrive_string_equals(argv[i], "--select=", 9))
+            {
+                valid = thrive_parse_u32(argv[i] + 9, &conf_select_budget);
+            }
+            else if (thrive_string_equals(argv[i], "--ranges", 8))
+            {
+                conf_dump_ranges = 1;
+            }
+            else if (thrive_string_equals(argv[i], "--align=", 8))
+            {
+                /* A power of two from 1 to 64, 1 pads nothing */
+                valid = (u8)(thrive_parse_u32(argv[i] + 8, &conf_align) && conf_align >= 1 && conf_align <= 64 && !(conf_align & (conf_align - 1)));
             }
             else
+            {
+                valid = 0;
+            }
+
+            if (!valid)
             {
                 SetConsoleTextAttribute(hConsole, 12); /* red */
-                WriteConsoleA(hConsole, "[thrive] Unrecognized option: ", 30, &written, 0);
+                WriteConsoleA(hConsole, "[thrive] Invalid option: ", 25, &written, 0);
                 WriteConsoleA(hConsole, argv[i], thrive_string_length(argv[i]), &written, 0);
                 WriteConsoleA(hConsole, "\n", 1, &written, 0);
                 SetConsoleTextAttribute(hConsole, 7);
@@ -796,6 +1121,21 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
 
     file_name = (s8 *)argv[1];
 
+    options = thrive_pass_defaults(conf_level);
+    options.inline_budget = conf_inline_budget;
+    options.clone_budget = conf_clone_budget;
+    options.unroll_budget = conf_unroll_budget;
+    options.select_budget = conf_select_budget;
+
+    /* Peephole rewrites of the emitted x64 */
+    thrive_x64_codegen_peephole(conf_level >= THRIVE_OPT_O2);
+
+    /* Functions with identical code share one body */
+    thrive_x64_codegen_icf(conf_level >= THRIVE_OPT_O1);
+
+    /* Loop heads on fetch boundaries, at the cost of the nops reported as cg_align_padding (--align=1 is off) */
+    thrive_x64_codegen_align(conf_align > 1 ? 16 : 0, conf_align > 1 ? conf_align : 0);
+
     /* Compile , ... every time the source file changes */
     if (conf_enable_hot_reload)
     {
@@ -809,7 +1149,7 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
             if (CompareFileTime(&file_time_current, &file_time_previous) != 0)
             {
                 WriteConsoleA(hConsole, "[thrive] recompile\n", 19, &written, 0);
-                thrive_compile(file_name, hConsole, &freq);
+                thrive_compile(file_name, hConsole, &freq, conf_enable_pipelined, &options, conf_dump_ranges);
             }
 
             Sleep(16);
@@ -818,7 +1158,7 @@ THRIVE_API i32 start(i32 argc, s8 **argv)
         }
     }
 
-    return thrive_compile(file_name, hConsole, &freq);
+    return thrive_compile(file_name, hConsole, &freq, conf_enable_pipelined, &options, conf_dump_ranges);
 }
 
 /* ############################################################################